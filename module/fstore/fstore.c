@@ -9,12 +9,24 @@
 #include <linux/cdev.h>
 #include <linux/device.h>
 #include <linux/kdev_t.h>
-#include <linux/hashtable.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/rhashtable.h>
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/jump_label.h>
+#include <linux/percpu.h>
+#include <linux/sched/clock.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
+#include <linux/string.h>
 #include <linux/types.h>
+#include <linux/workqueue.h>
 #include "fstore.h"
 
-atomic64_t number_maps;
-
 dev_t dev = 0;
 static struct class *dev_class;
 static struct cdev fstore_cdev;
@@ -22,9 +34,15 @@ static struct cdev fstore_cdev;
 static long fstore_ioctl(struct file *file,
 				unsigned int cmd,
 				unsigned long data);
+static int fstore_mmap(struct file* file, struct vm_area_struct* vma);
+static int fstore_open_file(struct inode* inode, struct file* file);
+static __poll_t fstore_poll(struct file* file, poll_table* wait);
+static int fstore_release(struct inode* inode, struct file* file);
 
 int fstore_register(u32 fd, u64 map_name);
 EXPORT_SYMBOL_GPL(fstore_register);
+int fstore_register_named(u32 fd, const char* name);
+EXPORT_SYMBOL_GPL(fstore_register_named);
 int fstore_unregister(u64 map_name);
 EXPORT_SYMBOL_GPL(fstore_unregister);
 int fstore_get(u64 map_name,
@@ -33,12 +51,58 @@ int fstore_get(u64 map_name,
 		void* value,
 		size_t value_size);
 EXPORT_SYMBOL_GPL(fstore_get);
+int fstore_get_rcu(u64 map_name,
+		void* key,
+		size_t key_size,
+		void* value,
+		size_t value_size);
+EXPORT_SYMBOL_GPL(fstore_get_rcu);
+int fstore_get_batch(u64 map_name,
+		void* keys,
+		size_t n,
+		void* values,
+		size_t stride);
+EXPORT_SYMBOL_GPL(fstore_get_batch);
+int fstore_get_this_cpu(u64 map_name,
+		void* key,
+		void* value,
+		size_t value_size);
+EXPORT_SYMBOL_GPL(fstore_get_this_cpu);
+int fstore_get_reduce(u64 map_name,
+		void* key,
+		enum fstore_reduce op,
+		u64* values,
+		size_t n);
+EXPORT_SYMBOL_GPL(fstore_get_reduce);
+int fstore_get_consistent(u64 map_name,
+		void* key,
+		void* value,
+		size_t value_size,
+		u32* retries);
+EXPORT_SYMBOL_GPL(fstore_get_consistent);
+int fstore_put(u64 map_name,
+		void* key,
+		size_t key_size,
+		void* value,
+		size_t value_size,
+		u64 flags);
+EXPORT_SYMBOL_GPL(fstore_put);
+int fstore_put_batch(u64 map_name,
+		void* keys,
+		size_t n,
+		void* values,
+		size_t stride,
+		u64 flags);
+EXPORT_SYMBOL_GPL(fstore_put_batch);
 int fstore_get_value_size(u64 map_name,
 		size_t* size);
 EXPORT_SYMBOL_GPL(fstore_get_value_size);
 int fstore_get_num_keys(u64 map_name,
 		size_t* size);
 EXPORT_SYMBOL_GPL(fstore_get_num_keys);
+int fstore_get_copy_size(u64 map_name,
+		size_t* size);
+EXPORT_SYMBOL_GPL(fstore_get_copy_size);
 
 int fstore_get_map_array_start(u64 map_name,
 				size_t key_size,
@@ -50,79 +114,371 @@ EXPORT_SYMBOL_GPL(fstore_get_map_array_start);
 int fstore_put_map_array(u64 map_name);
 EXPORT_SYMBOL_GPL(fstore_put_map_array);
 
+struct fstore_handle* fstore_open(u64 map_name);
+EXPORT_SYMBOL_GPL(fstore_open);
+int fstore_handle_get(struct fstore_handle* handle,
+		void* key,
+		void* value);
+EXPORT_SYMBOL_GPL(fstore_handle_get);
+size_t fstore_handle_value_size(struct fstore_handle* handle);
+EXPORT_SYMBOL_GPL(fstore_handle_value_size);
+size_t fstore_handle_num_keys(struct fstore_handle* handle);
+EXPORT_SYMBOL_GPL(fstore_handle_num_keys);
+void fstore_close(struct fstore_handle* handle);
+EXPORT_SYMBOL_GPL(fstore_close);
+
+/* called with the map name, its generation and whether it was unregistered */
+typedef void (*fstore_notify_t)(u64 map_name,
+		u64 generation,
+		bool expired,
+		void* data);
+
+struct fstore_subscription* fstore_subscribe(u64 map_name,
+		fstore_notify_t notify,
+		void* data);
+EXPORT_SYMBOL_GPL(fstore_subscribe);
+void fstore_unsubscribe(struct fstore_subscription* sub);
+EXPORT_SYMBOL_GPL(fstore_unsubscribe);
+
 struct file_operations fops = {
 	.owner = THIS_MODULE,
 	.read = NULL,
 	.write = NULL,
-	.open = NULL,
+	.open = fstore_open_file,
 	.unlocked_ioctl = fstore_ioctl,
-	.release = NULL,
+	.mmap = fstore_mmap,
+	.poll = fstore_poll,
+	.release = fstore_release,
 };
 
-#define FSTORE_LOGSIZE 8
-#define FSTORE_SIZE (1 << FSTORE_LOGSIZE)
-DEFINE_HASHTABLE(fstore_map, FSTORE_LOGSIZE);
+/* buckets are never grown past this, inserts fail past twice as many maps */
+#define FSTORE_MAX_BUCKETS (1 << 16)
 
 typedef struct register_input register_t;
+typedef struct register_named_input register_named_t;
+typedef struct load_input load_t;
+
+/*
+ * A handle caches everything a getter needs from the bpf_map so repeated
+ * reads skip the registry walk. The registry holds one reference for as long
+ * as the name is registered, every fstore_open holds another. The handle owns
+ * the bpf_map reference and is freed after an RCU grace period.
+ */
+struct fstore_handle {
+	struct bpf_map* map;
+	void* base;		/* bpf_array->value of mmapable arrays */
+	u32 key_size;
+	u32 value_size;
+	u32 elem_size;
+	u32 max_entries;
+	bool unregistered;
+	refcount_t refs;
+	u64 map_name;
+	atomic64_t puts;	/* in-kernel and LOAD_MAP writes */
+	u64 generation;		/* last sampled, see fstore_sample */
+#ifdef FSTORE_STATS
+	struct fstore_cpu_counts __percpu* stats;
+#endif
+	struct rcu_head rcu;
+};
+
+/*
+ * Statistics, see fstore.h. Every count is a single this_cpu_add on a line
+ * no other CPU writes, about a nanosecond and no shared cache line. Built
+ * without FSTORE_STATS all of it compiles to nothing.
+ */
+#ifdef FSTORE_STATS
+struct fstore_cpu_counts {
+	u64 count[FSTORE_STAT_NR];
+};
+
+struct fstore_cpu_stats {
+	u64 errors[FSTORE_ERR_NR];
+	u64 latency_ns[FSTORE_LAT_BUCKETS];
+	u32 calls;		/* picks the calls latency sampling times */
+};
+
+static DEFINE_PER_CPU(struct fstore_cpu_stats, fstore_cpu_stats);
+
+/* the untimed path costs one patched out jump */
+static DEFINE_STATIC_KEY_FALSE(fstore_lat_key);
+static int latency_sample_shift = -1;
+static u32 fstore_lat_mask;
+
+static int fstore_lat_set(const char* val, const struct kernel_param* kp)
+{
+	int shift;
+	int err = kstrtoint(val, 0, &shift);
+	if(err) return err;
+	if(shift < -1 || shift > 31) return -EINVAL;
+	WRITE_ONCE(fstore_lat_mask, shift < 0 ? 0 : (u32) ((1ULL << shift) - 1));
+	WRITE_ONCE(latency_sample_shift, shift);
+	if(shift < 0) static_branch_disable(&fstore_lat_key);
+	else static_branch_enable(&fstore_lat_key);
+	return 0;
+}
+
+static const struct kernel_param_ops fstore_lat_ops = {
+	.set = fstore_lat_set,
+	.get = param_get_int,
+};
+module_param_cb(latency_sample_shift, &fstore_lat_ops,
+		&latency_sample_shift, 0644);
+MODULE_PARM_DESC(latency_sample_shift,
+	"Time one in 2^shift gets on each CPU, -1 times none");
+
+static inline int fstore_stats_alloc(struct fstore_handle* handle)
+{
+	handle->stats = alloc_percpu(struct fstore_cpu_counts);
+	return handle->stats ? 0 : -ENOMEM;
+}
+
+static inline void fstore_stats_free(struct fstore_handle* handle)
+{
+	free_percpu(handle->stats);
+}
+
+static inline void fstore_count(struct fstore_handle* handle,
+		enum fstore_stat stat,
+		u64 n)
+{
+	this_cpu_add(handle->stats->count[stat], n);
+}
+
+static enum fstore_stat_err fstore_err_index(int err)
+{
+	switch(err) {
+	case -ENOKEY: return FSTORE_ERR_NOKEY;
+	case -EKEYEXPIRED: return FSTORE_ERR_KEYEXPIRED;
+	case -EINVAL: return FSTORE_ERR_INVAL;
+	case -ENOENT: return FSTORE_ERR_NOENT;
+	case -EBUSY: return FSTORE_ERR_BUSY;
+	default: return FSTORE_ERR_OTHER;
+	}
+}
+
+/* returns err so callers can return fstore_err(err) */
+static inline int fstore_err(int err)
+{
+	if(unlikely(err < 0))
+		this_cpu_inc(fstore_cpu_stats.errors[fstore_err_index(err)]);
+	return err;
+}
+
+/* a start time if this call is sampled, 0 otherwise */
+static inline u64 fstore_lat_start(void)
+{
+	if(!static_branch_unlikely(&fstore_lat_key)) return 0;
+	if(this_cpu_inc_return(fstore_cpu_stats.calls) & READ_ONCE(fstore_lat_mask))
+		return 0;
+	return local_clock();
+}
+
+static inline void fstore_lat_end(u64 start)
+{
+	if(likely(!start)) return;
+	/* a migration in between can make the clock step back */
+	s64 ns = local_clock() - start;
+	u32 bucket = ns > 1 ? ilog2((u64) ns) : 0;
+	this_cpu_inc(fstore_cpu_stats.latency_ns[min_t(u32, bucket, FSTORE_LAT_BUCKETS - 1)]);
+}
+#else
+static inline int fstore_stats_alloc(struct fstore_handle* handle) { return 0; }
+static inline void fstore_stats_free(struct fstore_handle* handle) {}
+static inline void fstore_count(struct fstore_handle* handle,
+		enum fstore_stat stat,
+		u64 n) {}
+static inline int fstore_err(int err) { return err; }
+static inline u64 fstore_lat_start(void) { return 0; }
+static inline void fstore_lat_end(u64 start) {}
+#endif // FSTORE_STATS
 
 typedef struct hash_node
 {
+	u64 map_name;
 	struct bpf_map* map;
-	struct hlist_node hnode;
+	struct fstore_handle* handle;
+	struct rhash_head hnode;
+	struct rcu_head rcu;
+	/* full name, read when a register hits an existing map_name and by stats */
+	char name[FSTORE_NAME_LEN];
 } hash_t;
 
-struct bpf_map* bpf_map_get(u32 ufd);
+/*
+ * The registry is an rhashtable keyed by the u64 name: lookups are RCU only,
+ * inserts and removes take a single bucket lock and the table is resized in
+ * the background as maps come and go.
+ */
+static struct rhashtable fstore_map;
 
-/**
- * register a map with the name given by a u64.
+static const struct rhashtable_params fstore_params = {
+	.key_len = sizeof(u64),
+	.key_offset = offsetof(hash_t, map_name),
+	.head_offset = offsetof(hash_t, hnode),
+	.max_size = FSTORE_MAX_BUCKETS,
+	.automatic_shrinking = true,
+};
+
+/* must hold rcu_read_lock, the node is only valid until it is dropped */
+static inline hash_t* fstore_find(u64 map_name)
+{
+	return rhashtable_lookup(&fstore_map, &map_name, fstore_params);
+}
+
+/*
+ * Take a reference on the map registered under map_name and count stat
+ * against it. The handle keeps its map reference until an RCU grace period
+ * after unregister, so the bpf_map_inc below cannot race with the final put.
  */
-int fstore_register(u32 fd, u64 map_name)
+static struct bpf_map* fstore_map_get(u64 map_name, enum fstore_stat stat)
 {
-	int err = 0;
-	/* acquire space to create map */
-	u64 index = atomic64_inc_return_acquire(&number_maps);
-	if(index >= FSTORE_SIZE) { err = -ENOSPC; goto cleanup_count; }
+	struct bpf_map* map = ERR_PTR(-ENOKEY);
+	rcu_read_lock();
+	hash_t* item = fstore_find(map_name);
+	if(item) {
+		map = item->map;
+		bpf_map_inc(map);
+		fstore_count(item->handle, stat, 1);
+	}
+	rcu_read_unlock();
+	return map;
+}
 
-	/* Check if value exists in map */
-	int i = 0;
-	hash_t* item = NULL;
-	hash_for_each_possible_rcu_notrace(fstore_map, item, hnode, map_name) {
-		i++;
+struct bpf_map* bpf_map_get(u32 ufd);
+
+static struct fstore_handle* fstore_handle_create(struct bpf_map* map,
+		u64 map_name)
+{
+	struct fstore_handle* handle = kzalloc(sizeof(*handle), GFP_KERNEL);
+	if(!handle) return NULL;
+
+	handle->map = map;
+	handle->map_name = map_name;
+	handle->key_size = map->key_size;
+	handle->value_size = map->value_size;
+	handle->max_entries = map->max_entries;
+	/* mmapable arrays cannot hold spin locks or timers, a memcpy is safe */
+	if(map->map_type == BPF_MAP_TYPE_ARRAY &&
+		(map->map_flags & BPF_F_MMAPABLE)) {
+		struct bpf_array* array = container_of(map, struct bpf_array, map);
+		handle->base = array->value;
+		handle->elem_size = array->elem_size;
 	}
-	if(i >= 1) { err = -EEXIST; goto cleanup_count;}
+	if(fstore_stats_alloc(handle)) {
+		kfree(handle);
+		return NULL;
+	}
+	refcount_set(&handle->refs, 1);
+	return handle;
+}
 
+static void fstore_handle_free(struct rcu_head* rcu)
+{
+	struct fstore_handle* handle =
+		container_of(rcu, struct fstore_handle, rcu);
+	bpf_map_put(handle->map);
+	fstore_stats_free(handle);
+	kfree(handle);
+}
+
+static void fstore_handle_put(struct fstore_handle* handle)
+{
+	if(refcount_dec_and_test(&handle->refs))
+		call_rcu(&handle->rcu, fstore_handle_free);
+}
+
+static int fstore_insert(u32 fd, u64 map_name, const char* name)
+{
+	int err = 0;
+	hash_t* item = NULL;
 	struct bpf_map* map;
 	map = bpf_map_get(fd);
-	if(IS_ERR(map)) {
-		err = -EBADF;
-		goto cleanup_count;
-	}
+	if(IS_ERR(map)) return -EBADF;
 
-	/* Check if name exists in map */
 	item = kmalloc(sizeof(hash_t), GFP_KERNEL);
 	if(!item) {
 		err = -ENOMEM;
 		goto cleanup_map;
 	}
 
+	item->handle = fstore_handle_create(map, map_name);
+	if(!item->handle) {
+		err = -ENOMEM;
+		goto cleanup_item;
+	}
+
 	item->map = map;
-	hash_add_rcu(fstore_map, &item->hnode, map_name);
-	return err;
+	item->map_name = map_name;
+	strscpy(item->name, name, FSTORE_NAME_LEN);
+	/* the duplicate check and the insert happen under one bucket lock */
+	err = rhashtable_lookup_insert_fast(&fstore_map, &item->hnode,
+			fstore_params);
+	if(err == -E2BIG) err = -ENOSPC;
+	if(err == -EEXIST) {
+		/* tell a real duplicate from two names sharing a hash */
+		rcu_read_lock();
+		hash_t* other = fstore_find(map_name);
+		if(other && strncmp(other->name, name, FSTORE_NAME_LEN))
+			err = -ENOTUNIQ;
+		rcu_read_unlock();
+	}
+	if(err) goto cleanup_handle;
+	return 0;
 
+cleanup_handle:
+	fstore_stats_free(item->handle);
+	kfree(item->handle);
+cleanup_item:
+	kfree(item);
 cleanup_map:
 	bpf_map_put(map);
-cleanup_count:
-	atomic64_dec_return_relaxed(&number_maps);
 	return err;
 }
 
+/**
+ * register a map with the name given by a u64.
+ */
+int fstore_register(u32 fd, u64 map_name)
+{
+	/* keep the packed bytes around as the name */
+	char name[sizeof(u64) + 1] = {0};
+	for(size_t i = 0; i < sizeof(u64); i++)
+		name[i] = (map_name >> (i * 8)) & 0xff;
+	return fstore_insert(fd, map_name, name);
+}
+
+/**
+ * fstore_register_named - register a map under a name of any length
+ * @fd: the bpf map fd
+ * @name: a NUL terminated name shorter than FSTORE_NAME_LEN
+ * @ret returns 0, -EEXIST if the name is taken, -ENOTUNIQ if another name
+ * already holds its hash or -ENAMETOOLONG
+ *
+ * Getters look the map up by fstore_name_hash(name).
+ */
+int fstore_register_named(u32 fd, const char* name)
+{
+	if(strnlen(name, FSTORE_NAME_LEN) >= FSTORE_NAME_LEN)
+		return -ENAMETOOLONG;
+	return fstore_insert(fd, fstore_name_hash(name), name);
+}
+
+/* the item must already be out of the table */
+static void fstore_notify_now(void);
+
 static void fstore_delete(hash_t* item)
 {
-	hash_del_rcu(&item->hnode);
-	atomic64_dec_return_release(&number_maps);
-	struct bpf_map* map = item->map;
-	if(!IS_ERR(map)) bpf_map_put(map);
-	kfree(item);
+	/* open handles keep the map alive but must stop serving it */
+	WRITE_ONCE(item->handle->unregistered, true);
+	fstore_handle_put(item->handle);
+	kfree_rcu(item, rcu);
+	/* subscribers hear about it without waiting out the interval */
+	fstore_notify_now();
+}
+
+static void fstore_free_item(void* ptr, void* arg)
+{
+	fstore_delete(ptr);
 }
 
 /**
@@ -132,12 +488,15 @@ static void fstore_delete(hash_t* item)
  */
 int fstore_unregister(u64 map_name) {
 	int i = 0;
-	hash_t* item = NULL;
-	struct hlist_node* tmp;
-	hash_for_each_possible_safe(fstore_map, item, tmp, hnode, map_name) {
+	rcu_read_lock();
+	hash_t* item = fstore_find(map_name);
+	/* only the caller whose remove succeeds may free the item */
+	if(item && !rhashtable_remove_fast(&fstore_map, &item->hnode,
+				fstore_params)) {
 		fstore_delete(item);
 		i++;
 	}
+	rcu_read_unlock();
 
 	return i;
 }
@@ -145,6 +504,24 @@ int fstore_unregister(u64 map_name) {
 int bpf_map_copy_value(struct bpf_map *map, void *key, void *value,
 			      __u64 flags);
 
+static bool fstore_map_is_percpu(struct bpf_map* map)
+{
+	return map->map_type == BPF_MAP_TYPE_PERCPU_ARRAY ||
+		map->map_type == BPF_MAP_TYPE_PERCPU_HASH ||
+		map->map_type == BPF_MAP_TYPE_LRU_PERCPU_HASH;
+}
+
+/*
+ * The number of bytes bpf_map_copy_value writes for one key. Per-CPU maps
+ * copy every possible CPU's value, each padded to 8 bytes.
+ */
+static size_t fstore_copy_size(struct bpf_map* map)
+{
+	if(fstore_map_is_percpu(map))
+		return round_up(map->value_size, 8) * num_possible_cpus();
+	return map->value_size;
+}
+
 int fstore_get(u64 map_name,
 		void* key,
 		size_t key_size,
@@ -152,29 +529,435 @@ int fstore_get(u64 map_name,
 		size_t value_size)
 {
 	int err = 0;
-	struct bpf_map* map;
-	int i = 0;
-	hash_t* item = NULL;
-	hash_for_each_possible_rcu_notrace(fstore_map, item, hnode, map_name) {
-		i++;
-		map = item->map;
-		if(IS_ERR(map)) err = -EKEYEXPIRED;
-		else bpf_map_inc(map);
-	}
-	// If either of these are hit we can safely exit
-	if(err == -EKEYEXPIRED) return -EKEYEXPIRED;
-	if(i == 0) return -ENOKEY;
+	u64 start = fstore_lat_start();
+	struct bpf_map* map = fstore_map_get(map_name, FSTORE_STAT_GET);
+	if(IS_ERR(map)) return fstore_err(PTR_ERR(map));
 
 	if(IS_ERR(key) ||
 		IS_ERR(value) ||
 		key_size < map->key_size ||
-		value_size < map->value_size) err = -EINVAL;
+		value_size < fstore_copy_size(map)) err = -EINVAL;
 	else err = bpf_map_copy_value(map, key, value, 0);
 
 	bpf_map_put(map);
+	fstore_lat_end(start);
+	return fstore_err(err);
+}
+
+/**
+ * fstore_get_rcu - fstore_get without a reference on the map
+ * @map_name: the name of the map u64ified
+ * @key: the key, key_size bytes long
+ * @key_size: the size of the key buffer, at least the map key_size
+ * @value: the output buffer
+ * @value_size: the size of the output buffer
+ * @ret returns 0, -ENOKEY for an unknown name or the copy's error
+ *
+ * The lookup and the copy share one RCU read section. The registry's map
+ * reference is only dropped a grace period after unregister, so the map
+ * cannot go away under the copy and no reference is taken. Readers on many
+ * CPUs then never write the map's refcount cache line.
+ */
+int fstore_get_rcu(u64 map_name,
+		void* key,
+		size_t key_size,
+		void* value,
+		size_t value_size)
+{
+	int err = -ENOKEY;
+	u64 start = fstore_lat_start();
+	rcu_read_lock();
+	hash_t* item = fstore_find(map_name);
+	if(item) {
+		struct bpf_map* map = item->map;
+		fstore_count(item->handle, FSTORE_STAT_GET, 1);
+		if(IS_ERR(key) ||
+			IS_ERR(value) ||
+			key_size < map->key_size ||
+			value_size < fstore_copy_size(map)) err = -EINVAL;
+		else err = bpf_map_copy_value(map, key, value, 0);
+	}
+	rcu_read_unlock();
+	fstore_lat_end(start);
+	return fstore_err(err);
+}
+
+/**
+ * fstore_get_this_cpu - copy the current CPU's value out of a per-CPU map
+ * @map_name: the name of the map u64ified
+ * @key: the key, key_size bytes long
+ * @value: the output buffer
+ * @value_size: the size of the output buffer, at least the map value_size
+ * @ret returns 0, -ENOENT for a missing key or -EINVAL if the map is not
+ * per-CPU
+ *
+ * Only the local slot is touched so no cache lines are pulled from other
+ * CPUs; the caller can migrate right after, so treat the result as a sample.
+ */
+int fstore_get_this_cpu(u64 map_name,
+		void* key,
+		void* value,
+		size_t value_size)
+{
+	int err = 0;
+	struct bpf_map* map = fstore_map_get(map_name, FSTORE_STAT_GET);
+	if(IS_ERR(map)) return fstore_err(PTR_ERR(map));
+
+	if(IS_ERR(key) ||
+		IS_ERR(value) ||
+		!fstore_map_is_percpu(map) ||
+		value_size < map->value_size) err = -EINVAL;
+	else {
+		rcu_read_lock();
+		preempt_disable();
+		/* per-CPU lookups return this_cpu_ptr of the element */
+		void* ptr = map->ops->map_lookup_elem(map, key);
+		if(ptr) copy_map_value(map, value, ptr);
+		else err = -ENOENT;
+		preempt_enable();
+		rcu_read_unlock();
+	}
+
+	bpf_map_put(map);
+	return fstore_err(err);
+}
+
+static inline u64 fstore_reduce_lane(enum fstore_reduce op, u64 acc, u64 v)
+{
+	switch(op) {
+	case FSTORE_REDUCE_MIN: return min(acc, v);
+	case FSTORE_REDUCE_MAX: return max(acc, v);
+	case FSTORE_REDUCE_SUM:
+	default: return acc + v;
+	}
+}
+
+/**
+ * fstore_get_reduce - fold a per-CPU value across every possible CPU
+ * @map_name: the name of the map u64ified
+ * @key: the key, key_size bytes long
+ * @op: FSTORE_REDUCE_SUM, FSTORE_REDUCE_MIN or FSTORE_REDUCE_MAX
+ * @values: output, one u64 per 8 bytes of value
+ * @n: the number of u64s in values, at least value_size / 8
+ * @ret returns 0, -ENOENT for a missing key or -EINVAL if the map is not
+ * per-CPU or its value is not made of u64s
+ *
+ * The value is treated as value_size / 8 independent u64 counters and each
+ * one is reduced separately.
+ */
+int fstore_get_reduce(u64 map_name,
+		void* key,
+		enum fstore_reduce op,
+		u64* values,
+		size_t n)
+{
+	int err = 0;
+	struct bpf_map* map = fstore_map_get(map_name, FSTORE_STAT_GET);
+	if(IS_ERR(map)) return fstore_err(PTR_ERR(map));
+
+	size_t lanes = map->value_size / sizeof(u64);
+	if(IS_ERR(key) ||
+		IS_ERR(values) ||
+		op > FSTORE_REDUCE_MAX ||
+		!fstore_map_is_percpu(map) ||
+		map->value_size % sizeof(u64) ||
+		n < lanes) { err = -EINVAL; goto cleanup; }
+	if(!map->ops->map_lookup_percpu_elem) { err = -EOPNOTSUPP; goto cleanup; }
+
+	bool first = true;
+	int cpu;
+	rcu_read_lock();
+	for_each_possible_cpu(cpu) {
+		u64* ptr = map->ops->map_lookup_percpu_elem(map, key, cpu);
+		if(!ptr) { err = -ENOENT; break; }
+		for(size_t l = 0; l < lanes; l++) {
+			u64 v = READ_ONCE(ptr[l]);
+			values[l] = first ? v : fstore_reduce_lane(op, values[l], v);
+		}
+		first = false;
+	}
+	rcu_read_unlock();
+
+cleanup:
+	bpf_map_put(map);
+	return fstore_err(err);
+}
+
+/**
+ * fstore_get_consistent - copy a versioned value without tearing it
+ * @map_name: the name of the map u64ified
+ * @key: the key, key_size bytes long
+ * @value: the output buffer, the sequence number is copied to its first u64
+ * @value_size: the size of the output buffer, at least the map value_size
+ * @retries: if not NULL, set to the number of torn copies thrown away
+ * @ret returns 0, -ENOENT for a missing key, -EINVAL if the map cannot hold a
+ * versioned value or -EBUSY when the writer kept it busy for
+ * FSTORE_SEQ_MAX_RETRIES copies
+ *
+ * The value must start with the sequence counter described in fstore.h.
+ * Writers make it odd while updating and even again after, so a copy is
+ * only kept if the counter was even and unchanged around it.
+ */
+int fstore_get_consistent(u64 map_name,
+		void* key,
+		void* value,
+		size_t value_size,
+		u32* retries)
+{
+	int err = 0;
+	u32 tries = 0;
+	struct bpf_map* map = fstore_map_get(map_name, FSTORE_STAT_GET);
+	if(IS_ERR(map)) return fstore_err(PTR_ERR(map));
+
+	if(IS_ERR(key) ||
+		IS_ERR(value) ||
+		fstore_map_is_percpu(map) ||
+		map->value_size < FSTORE_SEQ_SIZE ||
+		value_size < map->value_size) { err = -EINVAL; goto cleanup; }
+
+	rcu_read_lock();
+	void* ptr = map->ops->map_lookup_elem(map, key);
+	if(!ptr) err = -ENOENT;
+	else for(;;) {
+		u64 start = smp_load_acquire((u64*) ptr);
+		if(!(start & 1)) {
+			memcpy(value + FSTORE_SEQ_SIZE, ptr + FSTORE_SEQ_SIZE,
+				map->value_size - FSTORE_SEQ_SIZE);
+			/* order the payload loads before the recheck */
+			smp_rmb();
+			if(READ_ONCE(*(u64*) ptr) == start) {
+				*(u64*) value = start;
+				break;
+			}
+		}
+		if(++tries >= FSTORE_SEQ_MAX_RETRIES) { err = -EBUSY; break; }
+		cpu_relax();
+	}
+	rcu_read_unlock();
+
+cleanup:
+	if(retries) *retries = tries;
+	bpf_map_put(map);
+	return fstore_err(err);
+}
+
+/*
+ * Copy n values straight out of the bpf_array backing an array map,
+ * skipping the per key trip through bpf_map_copy_value.
+ */
+static int fstore_copy_array_batch(struct bpf_map* map,
+		u32* keys,
+		size_t n,
+		void* values,
+		size_t stride)
+{
+	struct bpf_array* array = container_of(map, struct bpf_array, map);
+	for(size_t i = 0; i < n; i++) {
+		u32 index = keys[i];
+		if(unlikely(index >= map->max_entries)) return -ENOENT;
+		copy_map_value(map, values + i * stride,
+			array->value +
+			(u64) array->elem_size * (index & array->index_mask));
+	}
+	return 0;
+}
+
+/**
+ * fstore_get_batch - copy the values of many keys from one registered map
+ * @map_name: the name of the map u64ified
+ * @keys: n keys packed back to back, each the map's key_size
+ * @n: the number of keys to look up
+ * @values: value i is copied to values + i * stride
+ * @stride: distance in bytes between two values, at least the value_size
+ * @ret returns 0 or the first error hit, values before it are filled
+ *
+ * The map is looked up and referenced once for the whole batch.
+ */
+int fstore_get_batch(u64 map_name,
+		void* keys,
+		size_t n,
+		void* values,
+		size_t stride)
+{
+	int err = 0;
+	struct fstore_handle* handle = fstore_open(map_name);
+	if(IS_ERR(handle)) return fstore_err(PTR_ERR(handle));
+	struct bpf_map* map = handle->map;
+	fstore_count(handle, FSTORE_STAT_BATCH, 1);
+	fstore_count(handle, FSTORE_STAT_BATCH_KEYS, n);
+
+	if(IS_ERR(keys) ||
+		IS_ERR(values) ||
+		stride < fstore_copy_size(map)) err = -EINVAL;
+	else if(map->map_type == BPF_MAP_TYPE_ARRAY)
+		err = fstore_copy_array_batch(map, keys, n, values, stride);
+	else {
+		for(size_t j = 0; j < n && err == 0; j++)
+			err = bpf_map_copy_value(map,
+					keys + j * map->key_size,
+					values + j * stride, 0);
+	}
+
+	fstore_close(handle);
+	return fstore_err(err);
+}
+
+/*
+ * Maps whose values are plain bytes. The rest hold fds, programs or sockets
+ * that only the bpf syscall knows how to translate.
+ */
+static bool fstore_map_is_writable(struct bpf_map* map)
+{
+	switch(map->map_type) {
+	case BPF_MAP_TYPE_ARRAY:
+	case BPF_MAP_TYPE_PERCPU_ARRAY:
+	case BPF_MAP_TYPE_HASH:
+	case BPF_MAP_TYPE_PERCPU_HASH:
+	case BPF_MAP_TYPE_LRU_HASH:
+	case BPF_MAP_TYPE_LRU_PERCPU_HASH:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* the update a BPF program's bpf_map_update_elem does */
+static int fstore_update(struct bpf_map* map, void* key, void* value,
+		u64 flags)
+{
+	int err;
+	migrate_disable();
+	rcu_read_lock();
+	err = map->ops->map_update_elem(map, key, value, flags);
+	rcu_read_unlock();
+	migrate_enable();
 	return err;
 }
 
+static int fstore_check_put(struct bpf_map* map, size_t value_size)
+{
+	if(!fstore_map_is_writable(map) ||
+		(map->map_flags & BPF_F_RDONLY_PROG) ||
+		value_size < map->value_size) return -EINVAL;
+	return 0;
+}
+
+/**
+ * fstore_put - publish one value into a registered map from the kernel
+ * @map_name: the name of the map u64ified
+ * @key: the key, key_size bytes long
+ * @key_size: the size of the key buffer, at least the map key_size
+ * @value: the value, value_size bytes long
+ * @value_size: the size of the value buffer, at least the map value_size
+ * @flags: BPF_ANY, BPF_NOEXIST, BPF_EXIST, optionally with BPF_F_LOCK
+ * @ret returns 0, -ENOKEY for an unknown name, -EINVAL for a map that holds
+ * fds or is read only to programs, or the update's error
+ *
+ * Same semantics as bpf_map_update_elem from a BPF program, so per-CPU maps
+ * only get the calling CPU's value. Must not be called with IRQs disabled.
+ * A successful put advances the map's generation.
+ */
+int fstore_put(u64 map_name,
+		void* key,
+		size_t key_size,
+		void* value,
+		size_t value_size,
+		u64 flags)
+{
+	int err = -ENOKEY;
+	rcu_read_lock();
+	hash_t* item = fstore_find(map_name);
+	if(item) {
+		struct bpf_map* map = item->map;
+		if(IS_ERR(key) || IS_ERR(value) || key_size < map->key_size)
+			err = -EINVAL;
+		else if(!(err = fstore_check_put(map, value_size)))
+			err = fstore_update(map, key, value, flags);
+		if(!err) atomic64_inc(&item->handle->puts);
+		fstore_count(item->handle, FSTORE_STAT_PUT, 1);
+	}
+	rcu_read_unlock();
+	return fstore_err(err);
+}
+
+/**
+ * fstore_put_batch - publish many values into one registered map
+ * @map_name: the name of the map u64ified
+ * @keys: n keys packed back to back, each the map's key_size
+ * @n: the number of values to write
+ * @values: value i is read from values + i * stride
+ * @stride: distance in bytes between two values, at least the value_size
+ * @flags: as for fstore_put, applied to every value
+ * @ret returns 0 or the first error hit, values before it are written
+ *
+ * The map is looked up and referenced once for the whole batch and its
+ * generation advances once. Large batches should come from process context,
+ * nothing reschedules in between.
+ */
+int fstore_put_batch(u64 map_name,
+		void* keys,
+		size_t n,
+		void* values,
+		size_t stride,
+		u64 flags)
+{
+	int err = 0;
+	size_t written = 0;
+	struct fstore_handle* handle = fstore_open(map_name);
+	if(IS_ERR(handle)) return fstore_err(PTR_ERR(handle));
+	struct bpf_map* map = handle->map;
+	fstore_count(handle, FSTORE_STAT_PUT, n);
+
+	if(IS_ERR(keys) || IS_ERR(values)) err = -EINVAL;
+	else err = fstore_check_put(map, stride);
+	for(; written < n && err == 0; written++) {
+		err = fstore_update(map, keys + written * map->key_size,
+				values + written * stride, flags);
+		if(err) break;
+	}
+	/* readers only need a new generation if a value changed */
+	if(written) atomic64_inc(&handle->puts);
+
+	fstore_close(handle);
+	return fstore_err(err);
+}
+
+/*
+ * Bulk load a registered map from user memory through the map's own
+ * map_update_batch, the path BPF_MAP_UPDATE_BATCH takes, in one ioctl.
+ */
+static int fstore_load(load_t __user* uptr)
+{
+	int err = 0;
+	load_t input;
+	if(copy_from_user(&input, uptr, sizeof(load_t))) return -EFAULT;
+
+	struct fstore_handle* handle = fstore_open(input.map_name);
+	if(IS_ERR(handle)) return fstore_err(PTR_ERR(handle));
+	struct bpf_map* map = handle->map;
+	fstore_count(handle, FSTORE_STAT_LOAD, 1);
+
+	/* user space writes obey the same rules as through the map fd */
+	if(!fstore_map_is_writable(map) ||
+		(map->map_flags & BPF_F_RDONLY)) err = -EINVAL;
+	else if(READ_ONCE(map->frozen)) err = -EPERM;
+	else if(!map->ops->map_update_batch) err = -EOPNOTSUPP;
+	/* the batch op writes back how many keys it wrote, except when it
+	 * fails before the first one, so start the user's count at zero */
+	else if(put_user(0, &uptr->attr.batch.count)) err = -EFAULT;
+	else {
+		err = map->ops->map_update_batch(map, NULL, &input.attr,
+				&uptr->attr);
+		/* a load that fails part way may still have written some */
+		u32 written = 0;
+		if(get_user(written, &uptr->attr.batch.count)) written = 0;
+		if(written) atomic64_inc(&handle->puts);
+	}
+
+	fstore_close(handle);
+	return fstore_err(err);
+}
+
 int fstore_get_map_array_start(u64 map_name,
 				size_t key_size,
 				size_t value_size,
@@ -182,88 +965,484 @@ int fstore_get_map_array_start(u64 map_name,
 				void** map_ptr) {
 	//Get the map
 	int err = 0;
-	struct bpf_map* map = NULL;
-	hash_t* item = NULL;
-	hash_for_each_possible_rcu_notrace(fstore_map, item, hnode, map_name) {
-		map = item->map;
-		if(IS_ERR(map)) return -EKEYEXPIRED;
-		else { bpf_map_inc(map); break; }
-	}
-	if(err) return err;
-	if(!map) return -ENOENT;
+	struct bpf_map* map = fstore_map_get(map_name, FSTORE_STAT_MMAP);
+	if(IS_ERR(map)) return -ENOENT;
 
 	//Check its type
-	if(map->map_type != BPF_MAP_TYPE_ARRAY) return -EINVAL;
+	if(map->map_type != BPF_MAP_TYPE_ARRAY) { err = -EINVAL; goto cleanup; }
 
 	//Shibboleth to verify if the module knows the limits.
-	if(map->key_size != key_size) return -EACCES;
-	if(map->value_size != value_size) return -EACCES;
-	if(map->max_entries != num_elements) return -EACCES;
-	if(!(map->map_flags & BPF_F_MMAPABLE)) return -EACCES;
+	if(map->key_size != key_size ||
+		map->value_size != value_size ||
+		map->max_entries != num_elements ||
+		!(map->map_flags & BPF_F_MMAPABLE)) { err = -EACCES; goto cleanup; }
 
 	//Get the starting pointer
 	struct bpf_array* array = container_of(map, struct bpf_array, map);
 	*map_ptr = array->value;
 
 	return 0;
+
+cleanup:
+	bpf_map_put(map);
+	return err;
 }
 
 int fstore_get_value_size(u64 map_name,
 			size_t* size) {
-	int err = 0;
-	struct bpf_map* map;
-	int i = 0;
-	hash_t* item = NULL;
-	hash_for_each_possible_rcu_notrace(fstore_map, item, hnode, map_name) {
-		i++;
-		map = item->map;
-		if(IS_ERR(map)) err = -EKEYEXPIRED;
-		else *size = map->value_size;
+	int err = -ENOKEY;
+	rcu_read_lock();
+	hash_t* item = fstore_find(map_name);
+	if(item) {
+		*size = item->map->value_size;
+		err = 0;
+	}
+	rcu_read_unlock();
+	return err;
+}
+
+/* the value_size fstore_get needs, every CPU's value for per-CPU maps */
+int fstore_get_copy_size(u64 map_name,
+			size_t* size) {
+	int err = -ENOKEY;
+	rcu_read_lock();
+	hash_t* item = fstore_find(map_name);
+	if(item) {
+		*size = fstore_copy_size(item->map);
+		err = 0;
 	}
-	// If either of these are hit we can safely exit
-	if(err == -EKEYEXPIRED) return -EKEYEXPIRED;
-	if(i == 0) return -ENOKEY;
+	rcu_read_unlock();
 	return err;
 }
 
 int fstore_get_num_keys(u64 map_name,
 			size_t* size) {
-	int err = 0;
-	struct bpf_map* map;
-	int i = 0;
-	hash_t* item = NULL;
-	hash_for_each_possible_rcu_notrace(fstore_map, item, hnode, map_name) {
-		i++;
-		map = item->map;
-		if(IS_ERR(map)) err = -EKEYEXPIRED;
-		else *size = map->max_entries;
+	int err = -ENOKEY;
+	rcu_read_lock();
+	hash_t* item = fstore_find(map_name);
+	if(item) {
+		*size = item->map->max_entries;
+		err = 0;
 	}
-	// If either of these are hit we can safely exit
-	if(err == -EKEYEXPIRED) return -EKEYEXPIRED;
-	if(i == 0) return -ENOKEY;
+	rcu_read_unlock();
 	return err;
 }
 
 int fstore_put_map_array(u64 map_name)
 {
-	struct bpf_map* map;
 	int i = 0;
-	hash_t* item = NULL;
-	hash_for_each_possible_rcu_notrace(fstore_map, item, hnode, map_name) {
+	rcu_read_lock();
+	hash_t* item = fstore_find(map_name);
+	if(item) {
+		bpf_map_put(item->map);
 		i++;
-		map = item->map;
-		if(IS_ERR(map)) i--;
-		else bpf_map_put(map);
 	}
+	rcu_read_unlock();
 	return i;
 }
 
+/**
+ * fstore_open - get a handle on a registered map for repeated reads
+ * @map_name: the name of the map u64ified
+ * @ret returns the handle or an ERR_PTR, release it with fstore_close
+ */
+struct fstore_handle* fstore_open(u64 map_name)
+{
+	struct fstore_handle* handle = ERR_PTR(-ENOKEY);
+	rcu_read_lock();
+	hash_t* item = fstore_find(map_name);
+	if(item) {
+		if(refcount_inc_not_zero(&item->handle->refs))
+			handle = item->handle;
+		else handle = ERR_PTR(-EKEYEXPIRED);
+	}
+	rcu_read_unlock();
+	return handle;
+}
+
+/* the read itself, fstore_handle_get counts around it */
+static inline int __fstore_handle_get(struct fstore_handle* handle,
+		void* key,
+		void* value)
+{
+	if(unlikely(READ_ONCE(handle->unregistered))) return -EKEYEXPIRED;
+	if(likely(handle->base)) {
+		u32 index = *(u32*) key;
+		if(unlikely(index >= handle->max_entries)) return -ENOENT;
+		memcpy(value,
+			handle->base + (u64) handle->elem_size * index,
+			handle->value_size);
+		return 0;
+	}
+	return bpf_map_copy_value(handle->map, key, value, 0);
+}
+
+/**
+ * fstore_handle_get - read one value through an open handle
+ * @handle: a handle returned by fstore_open
+ * @key: the key, key_size bytes long
+ * @value: the output buffer, at least value_size bytes long, or one 8 byte
+ * aligned value per possible CPU for per-CPU maps
+ * @ret returns 0, -ENOENT for a missing key or -EKEYEXPIRED once the map
+ * has been unregistered
+ */
+int fstore_handle_get(struct fstore_handle* handle,
+		void* key,
+		void* value)
+{
+	u64 start = fstore_lat_start();
+	int err = __fstore_handle_get(handle, key, value);
+	fstore_count(handle, FSTORE_STAT_GET, 1);
+	fstore_lat_end(start);
+	return fstore_err(err);
+}
+
+size_t fstore_handle_value_size(struct fstore_handle* handle)
+{
+	return handle->value_size;
+}
+
+size_t fstore_handle_num_keys(struct fstore_handle* handle)
+{
+	return handle->max_entries;
+}
+
+/**
+ * fstore_close - release a handle returned by fstore_open
+ */
+void fstore_close(struct fstore_handle* handle)
+{
+	if(!IS_ERR_OR_NULL(handle)) fstore_handle_put(handle);
+}
+
+/*
+ * Subscriptions. Writers never wake anyone themselves, fstore_notify_work
+ * samples the generation of every subscribed map each notify_interval_ms
+ * and calls the subscribers that saw an older one. However hot the writer,
+ * a subscriber runs at most once per interval with the latest generation.
+ */
+static unsigned int notify_interval_ms = 10;
+module_param(notify_interval_ms, uint, 0644);
+MODULE_PARM_DESC(notify_interval_ms,
+	"Minimum time between two notifications of a subscriber");
+
+struct fstore_subscription {
+	struct fstore_handle* handle;
+	fstore_notify_t notify;
+	void* data;
+	u64 notified;		/* the generation notify last got */
+	bool expired;
+	struct list_head node;
+};
+
+static LIST_HEAD(fstore_subscriptions);
+static DEFINE_MUTEX(fstore_sub_lock);
+
+static void fstore_notify_fn(struct work_struct* work);
+static DECLARE_DELAYED_WORK(fstore_notify_work, fstore_notify_fn);
+
+static unsigned long fstore_notify_delay(void)
+{
+	return msecs_to_jiffies(max(READ_ONCE(notify_interval_ms), 1U));
+}
+
+static void fstore_notify_now(void)
+{
+	if(!list_empty_careful(&fstore_subscriptions))
+		mod_delayed_work(system_wq, &fstore_notify_work, 0);
+}
+
+/* the generation map must map a u64 name to a shared u64 counter */
+static bool fstore_gen_map_ok(struct bpf_map* map)
+{
+	return map->key_size == sizeof(u64) &&
+		map->value_size >= sizeof(u64) &&
+		!fstore_map_is_percpu(map) &&
+		fstore_map_is_writable(map);
+}
+
+/*
+ * Refresh handle->generation, the map's count in the generation map plus its
+ * in-kernel writes. Must hold fstore_sub_lock.
+ */
+static void fstore_sample(struct fstore_handle* handle)
+{
+	u64 gen = atomic64_read(&handle->puts);
+	rcu_read_lock();
+	hash_t* item = fstore_find(fstore_name_hash(FSTORE_GEN_MAP));
+	if(item && fstore_gen_map_ok(item->map)) {
+		struct bpf_map* gen_map = item->map;
+		u64* count = gen_map->ops->map_lookup_elem(gen_map,
+				&handle->map_name);
+		if(count) gen += READ_ONCE(*count);
+	}
+	rcu_read_unlock();
+	WRITE_ONCE(handle->generation, gen);
+}
+
+static void fstore_notify_fn(struct work_struct* work)
+{
+	struct fstore_subscription* sub;
+	mutex_lock(&fstore_sub_lock);
+	/* one sample per subscription keeps every notify in a run consistent */
+	list_for_each_entry(sub, &fstore_subscriptions, node)
+		if(!READ_ONCE(sub->handle->unregistered))
+			fstore_sample(sub->handle);
+	list_for_each_entry(sub, &fstore_subscriptions, node) {
+		struct fstore_handle* handle = sub->handle;
+		bool expired = READ_ONCE(handle->unregistered);
+		u64 gen = READ_ONCE(handle->generation);
+		if(sub->expired || (!expired && gen == sub->notified)) continue;
+		WRITE_ONCE(sub->notified, gen);
+		sub->expired = expired;
+		sub->notify(handle->map_name, gen, expired, sub->data);
+	}
+	if(!list_empty(&fstore_subscriptions))
+		schedule_delayed_work(&fstore_notify_work, fstore_notify_delay());
+	mutex_unlock(&fstore_sub_lock);
+}
+
+/**
+ * fstore_subscribe - get called back when a registered map changes
+ * @map_name: the name of the map u64ified
+ * @notify: called from a workqueue with the new generation, may sleep but
+ * must not unsubscribe
+ * @data: passed to notify
+ * @ret returns the subscription or an ERR_PTR, release it with
+ * fstore_unsubscribe
+ *
+ * notify runs at most once per notify_interval_ms, whatever the number of
+ * bumps in between, and one last time with expired set once the map is
+ * unregistered. The subscription holds the map open until then.
+ */
+struct fstore_subscription* fstore_subscribe(u64 map_name,
+		fstore_notify_t notify,
+		void* data)
+{
+	struct fstore_handle* handle = fstore_open(map_name);
+	if(IS_ERR(handle)) return ERR_CAST(handle);
+
+	struct fstore_subscription* sub = kzalloc(sizeof(*sub), GFP_KERNEL);
+	if(!sub) {
+		fstore_close(handle);
+		return ERR_PTR(-ENOMEM);
+	}
+	sub->handle = handle;
+	sub->notify = notify;
+	sub->data = data;
+
+	mutex_lock(&fstore_sub_lock);
+	/* only changes after this point are reported */
+	fstore_sample(handle);
+	sub->notified = handle->generation;
+	if(list_empty(&fstore_subscriptions))
+		schedule_delayed_work(&fstore_notify_work, fstore_notify_delay());
+	list_add_tail(&sub->node, &fstore_subscriptions);
+	mutex_unlock(&fstore_sub_lock);
+	return sub;
+}
+
+/**
+ * fstore_unsubscribe - release a subscription, notify is not called after
+ */
+void fstore_unsubscribe(struct fstore_subscription* sub)
+{
+	if(IS_ERR_OR_NULL(sub)) return;
+	mutex_lock(&fstore_sub_lock);
+	list_del(&sub->node);
+	mutex_unlock(&fstore_sub_lock);
+	fstore_close(sub->handle);
+	kfree(sub);
+}
+
+/*
+ * Per open file: the map SELECT_MAP picked for mmap and the one WATCH_MAP
+ * picked for poll, with the generation MAP_GENERATION last handed out.
+ */
+struct fstore_file {
+	struct fstore_handle* selected;
+	struct mutex lock;	/* guards selected, watch and seen */
+	struct fstore_subscription* watch;
+	u64 seen;
+	wait_queue_head_t wait;
+};
+
+static int fstore_open_file(struct inode* inode, struct file* file)
+{
+	struct fstore_file* ff = kzalloc(sizeof(*ff), GFP_KERNEL);
+	if(!ff) return -ENOMEM;
+	mutex_init(&ff->lock);
+	init_waitqueue_head(&ff->wait);
+	file->private_data = ff;
+	return 0;
+}
+
+static void fstore_file_notify(u64 map_name,
+		u64 generation,
+		bool expired,
+		void* data)
+{
+	struct fstore_file* ff = data;
+	wake_up_interruptible_poll(&ff->wait,
+		expired ? EPOLLHUP : EPOLLIN | EPOLLRDNORM);
+}
+
+/* pick the map poll on this file waits for, replacing any earlier one */
+static int fstore_watch(struct file* file, u64 map_name)
+{
+	struct fstore_file* ff = file->private_data;
+	struct fstore_subscription* sub =
+		fstore_subscribe(map_name, fstore_file_notify, ff);
+	if(IS_ERR(sub)) return PTR_ERR(sub);
+
+	mutex_lock(&ff->lock);
+	struct fstore_subscription* old = ff->watch;
+	ff->watch = sub;
+	ff->seen = sub->notified;
+	mutex_unlock(&ff->lock);
+	fstore_unsubscribe(old);
+	return 0;
+}
+
+/* hand out the watched map's generation, poll is quiet until it changes */
+static int fstore_generation(struct file* file, u64 __user* uptr)
+{
+	struct fstore_file* ff = file->private_data;
+	u64 gen;
+	mutex_lock(&ff->lock);
+	if(!ff->watch) {
+		mutex_unlock(&ff->lock);
+		return -EBADF;
+	}
+	gen = ff->seen = READ_ONCE(ff->watch->notified);
+	mutex_unlock(&ff->lock);
+	return put_user(gen, uptr);
+}
+
+/**
+ * fstore_poll - wait for the map picked through WATCH_MAP to change
+ *
+ * EPOLLIN once a generation other than the one MAP_GENERATION last returned
+ * has been sampled, EPOLLHUP once the map is unregistered and EPOLLERR
+ * without a watched map.
+ */
+static __poll_t fstore_poll(struct file* file, poll_table* wait)
+{
+	struct fstore_file* ff = file->private_data;
+	__poll_t mask = 0;
+	poll_wait(file, &ff->wait, wait);
+	mutex_lock(&ff->lock);
+	if(!ff->watch) mask = EPOLLERR;
+	else if(READ_ONCE(ff->watch->handle->unregistered)) mask = EPOLLHUP;
+	else if(READ_ONCE(ff->watch->notified) != ff->seen)
+		mask = EPOLLIN | EPOLLRDNORM;
+	mutex_unlock(&ff->lock);
+	return mask;
+}
+
+/*
+ * Pick the map a later mmap of this file maps. Only mmapable arrays expose
+ * their values as one flat range; the file keeps the handle open.
+ */
+static int fstore_select(struct file* file, u64 map_name)
+{
+	struct fstore_handle* handle = fstore_open(map_name);
+	if(IS_ERR(handle)) return PTR_ERR(handle);
+	if(!handle->base || !handle->map->ops->map_mmap) {
+		fstore_close(handle);
+		return -EINVAL;
+	}
+	struct fstore_file* ff = file->private_data;
+	mutex_lock(&ff->lock);
+	struct fstore_handle* old = ff->selected;
+	ff->selected = handle;
+	mutex_unlock(&ff->lock);
+	fstore_close(old);
+	return 0;
+}
+
+static void fstore_vm_open(struct vm_area_struct* vma)
+{
+	struct fstore_handle* handle = vma->vm_private_data;
+	refcount_inc(&handle->refs);
+}
+
+static void fstore_vm_close(struct vm_area_struct* vma)
+{
+	fstore_handle_put(vma->vm_private_data);
+}
+
+static const struct vm_operations_struct fstore_vm_ops = {
+	.open = fstore_vm_open,
+	.close = fstore_vm_close,
+};
+
+/**
+ * fstore_mmap - map the values of the selected array read only, never exec
+ *
+ * Offset 0 is the value of key 0, values are elem_size apart just like
+ * mmapping the bpf map fd. Every vma holds a handle reference so the map
+ * outlives an unregister until the last munmap.
+ */
+static int fstore_mmap(struct file* file, struct vm_area_struct* vma)
+{
+	struct fstore_file* ff = file->private_data;
+	int err = 0;
+
+	/* a racing SELECT_MAP may close the file's reference, take our own */
+	mutex_lock(&ff->lock);
+	struct fstore_handle* handle = ff->selected;
+	if(handle) refcount_inc(&handle->refs);
+	mutex_unlock(&ff->lock);
+	if(!handle) return -EBADF;
+
+	if(READ_ONCE(handle->unregistered)) {
+		err = fstore_err(-EKEYEXPIRED);
+		goto cleanup;
+	}
+	/* BPF programs write these pages, never run them */
+	if(vma->vm_flags & (VM_WRITE | VM_EXEC)) {
+		err = -EACCES;
+		goto cleanup;
+	}
+
+	/* no mprotect to writable or executable later either */
+	vm_flags_clear(vma, VM_MAYWRITE | VM_MAYEXEC);
+	vm_flags_set(vma, VM_DONTDUMP | VM_DONTEXPAND);
+
+	err = handle->map->ops->map_mmap(handle->map, vma);
+	if(err) {
+		err = fstore_err(err);
+		goto cleanup;
+	}
+
+	fstore_count(handle, FSTORE_STAT_MMAP, 1);
+	/* the reference taken above is now the vma's */
+	vma->vm_ops = &fstore_vm_ops;
+	vma->vm_private_data = handle;
+	return 0;
+
+cleanup:
+	fstore_handle_put(handle);
+	return err;
+}
+
+static int fstore_release(struct inode* inode, struct file* file)
+{
+	struct fstore_file* ff = file->private_data;
+	fstore_unsubscribe(ff->watch);
+	fstore_close(ff->selected);
+	kfree(ff);
+	return 0;
+}
+
 static long fstore_ioctl(struct file *file,
 				unsigned int cmd,
 				unsigned long data)
 {
 	int err = 0;
 	register_t input;
+	register_named_t named;
 	switch(cmd) {
 	case REGISTER_MAP:
 		if( copy_from_user(&input,
@@ -277,10 +1456,39 @@ static long fstore_ioctl(struct file *file,
 		err = fstore_register(input.fd, input.map_name);
 		break;
 
+	case REGISTER_MAP_NAMED:
+		if( copy_from_user(&named,
+			(register_named_t*) data,
+			sizeof(register_named_t)) )
+		{
+			pr_err("Getting initial struct impossible\n");
+			err = -EINVAL;
+			break;
+		}
+		/* an unterminated name is caught by the length check */
+		err = fstore_register_named(named.fd, named.name);
+		break;
+
 	case UNREGISTER_MAP:
 		err = fstore_unregister((u64) data);
 		break;
 
+	case SELECT_MAP:
+		err = fstore_select(file, (u64) data);
+		break;
+
+	case LOAD_MAP:
+		err = fstore_load((load_t __user*) data);
+		break;
+
+	case WATCH_MAP:
+		err = fstore_watch(file, (u64) data);
+		break;
+
+	case MAP_GENERATION:
+		err = fstore_generation(file, (u64 __user*) data);
+		break;
+
 	default:
 		pr_info("Default case");
 	}
@@ -299,14 +1507,196 @@ static int convertString2u64(const char* s, u64* ret) {
 }
 */
 
+#ifdef FSTORE_STATS
+static struct dentry* fstore_debugfs;
+
+static const char* const fstore_stat_names[FSTORE_STAT_NR] = {
+	[FSTORE_STAT_GET] = "get",
+	[FSTORE_STAT_BATCH] = "batch",
+	[FSTORE_STAT_BATCH_KEYS] = "batch_keys",
+	[FSTORE_STAT_PUT] = "put",
+	[FSTORE_STAT_LOAD] = "load",
+	[FSTORE_STAT_MMAP] = "mmap",
+};
+
+static const char* const fstore_err_names[FSTORE_ERR_NR] = {
+	[FSTORE_ERR_NOKEY] = "ENOKEY",
+	[FSTORE_ERR_KEYEXPIRED] = "EKEYEXPIRED",
+	[FSTORE_ERR_INVAL] = "EINVAL",
+	[FSTORE_ERR_NOENT] = "ENOENT",
+	[FSTORE_ERR_BUSY] = "EBUSY",
+	[FSTORE_ERR_OTHER] = "other",
+};
+
+/* the module wide counters summed over every possible CPU */
+static void fstore_stats_header_fill(struct fstore_stats_header* header)
+{
+	int cpu;
+	memset(header, 0, sizeof(*header));
+	header->magic = FSTORE_STATS_MAGIC;
+	header->version = FSTORE_STATS_VERSION;
+	header->latency_sample_shift = READ_ONCE(latency_sample_shift);
+	for_each_possible_cpu(cpu) {
+		struct fstore_cpu_stats* stats = per_cpu_ptr(&fstore_cpu_stats, cpu);
+		for(int i = 0; i < FSTORE_ERR_NR; i++)
+			header->errors[i] += READ_ONCE(stats->errors[i]);
+		for(int i = 0; i < FSTORE_LAT_BUCKETS; i++)
+			header->latency_ns[i] += READ_ONCE(stats->latency_ns[i]);
+	}
+}
+
+static void fstore_map_stats_fill(hash_t* item, struct fstore_map_stats* out)
+{
+	int cpu;
+	memset(out, 0, sizeof(*out));
+	out->map_name = item->map_name;
+	strscpy(out->name, item->name, FSTORE_NAME_LEN);
+	for_each_possible_cpu(cpu) {
+		struct fstore_cpu_counts* counts = per_cpu_ptr(item->handle->stats, cpu);
+		for(int i = 0; i < FSTORE_STAT_NR; i++)
+			out->count[i] += READ_ONCE(counts->count[i]);
+	}
+}
+
+/*
+ * Call fn on every registered map, under RCU so fn must not sleep. Writers
+ * are never held off, a resize during the walk can show a map twice.
+ */
+static void fstore_stats_walk(void (*fn)(hash_t* item, void* arg), void* arg)
+{
+	struct rhashtable_iter iter;
+	hash_t* item;
+	rhashtable_walk_enter(&fstore_map, &iter);
+	rhashtable_walk_start(&iter);
+	while((item = rhashtable_walk_next(&iter))) {
+		if(IS_ERR(item)) {
+			if(PTR_ERR(item) == -EAGAIN) continue;
+			break;
+		}
+		fn(item, arg);
+	}
+	rhashtable_walk_stop(&iter);
+	rhashtable_walk_exit(&iter);
+}
+
+static void fstore_stats_show_map(hash_t* item, void* arg)
+{
+	struct seq_file* m = arg;
+	struct fstore_map_stats stats;
+	fstore_map_stats_fill(item, &stats);
+	seq_printf(m, "%-32s %#018llx", stats.name, stats.map_name);
+	for(int i = 0; i < FSTORE_STAT_NR; i++)
+		seq_printf(m, " %llu", stats.count[i]);
+	seq_putc(m, '\n');
+}
+
+static int fstore_stats_show(struct seq_file* m, void* v)
+{
+	struct fstore_stats_header header;
+	fstore_stats_header_fill(&header);
+
+	seq_puts(m, "errors");
+	for(int i = 0; i < FSTORE_ERR_NR; i++)
+		seq_printf(m, " %s=%llu", fstore_err_names[i], header.errors[i]);
+	seq_printf(m, "\nlatency_sample_shift %d\nlatency_ns",
+		header.latency_sample_shift);
+	for(int i = 0; i < FSTORE_LAT_BUCKETS; i++)
+		seq_printf(m, " %llu", header.latency_ns[i]);
+	seq_printf(m, "\n%-32s %-18s", "name", "map_name");
+	for(int i = 0; i < FSTORE_STAT_NR; i++)
+		seq_printf(m, " %s", fstore_stat_names[i]);
+	seq_putc(m, '\n');
+	fstore_stats_walk(fstore_stats_show_map, m);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(fstore_stats);
+
+struct fstore_snapshot {
+	size_t capacity;	/* maps the buffer has room for */
+	struct fstore_stats_header* header;
+};
+
+static void fstore_snapshot_map(hash_t* item, void* arg)
+{
+	struct fstore_snapshot* snap = arg;
+	struct fstore_map_stats* maps = (void*) (snap->header + 1);
+	/* maps registered since the buffer was sized are left out */
+	if(snap->header->num_maps >= snap->capacity) return;
+	fstore_map_stats_fill(item, &maps[snap->header->num_maps++]);
+}
+
+/* the snapshot is taken once at open so every read of it agrees */
+static int fstore_stats_bin_open(struct inode* inode, struct file* file)
+{
+	struct fstore_snapshot snap;
+	/* room for maps registered while allocating */
+	snap.capacity = atomic_read(&fstore_map.nelems) + 16;
+	snap.header = kvzalloc(sizeof(*snap.header) +
+			snap.capacity * sizeof(struct fstore_map_stats), GFP_KERNEL);
+	if(!snap.header) return -ENOMEM;
+
+	fstore_stats_header_fill(snap.header);
+	fstore_stats_walk(fstore_snapshot_map, &snap);
+	file->private_data = snap.header;
+	return 0;
+}
+
+static ssize_t fstore_stats_bin_read(struct file* file,
+		char __user* buf,
+		size_t count,
+		loff_t* ppos)
+{
+	struct fstore_stats_header* header = file->private_data;
+	size_t size = sizeof(*header) +
+		header->num_maps * sizeof(struct fstore_map_stats);
+	return simple_read_from_buffer(buf, count, ppos, header, size);
+}
+
+static int fstore_stats_bin_release(struct inode* inode, struct file* file)
+{
+	kvfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations fstore_stats_bin_fops = {
+	.owner = THIS_MODULE,
+	.open = fstore_stats_bin_open,
+	.read = fstore_stats_bin_read,
+	.release = fstore_stats_bin_release,
+	.llseek = default_llseek,
+};
+
+/* debugfs failures only cost the files, never the module */
+static void fstore_debugfs_init(void)
+{
+	fstore_debugfs = debugfs_create_dir("fstore", NULL);
+	debugfs_create_file("stats", 0444, fstore_debugfs, NULL,
+		&fstore_stats_fops);
+	debugfs_create_file("stats.bin", 0444, fstore_debugfs, NULL,
+		&fstore_stats_bin_fops);
+}
+
+static void fstore_debugfs_exit(void)
+{
+	debugfs_remove_recursive(fstore_debugfs);
+}
+#else
+static void fstore_debugfs_init(void) {}
+static void fstore_debugfs_exit(void) {}
+#endif // FSTORE_STATS
+
 int __init init_module(void)
 {
-	atomic64_set(&number_maps, 0);
+	/* the table must exist before the device can take an ioctl */
+	if(rhashtable_init(&fstore_map, &fstore_params)) {
+		pr_err("Cannot allocate the map registry\n");
+		return -1;
+	}
 
 	/*Allocating Major number*/
 	if((alloc_chrdev_region(&dev, 0, 1, "fstore_dev")) <0){
 					pr_err("Cannot allocate major number\n");
-					return -1;
+					goto r_table;
 	}
 
 	pr_info("Major = %d Minor = %d \n",MAJOR(dev), MINOR(dev));
@@ -332,7 +1722,7 @@ int __init init_module(void)
 		goto r_device;
 	}
 
-	hash_init(fstore_map);
+	fstore_debugfs_init();
 
 	pr_info("Fstore Driver Insert...Done!!!\n");
 	return 0;
@@ -341,18 +1731,24 @@ r_device:
 	class_destroy(dev_class);
 r_class:
 	unregister_chrdev_region(dev,1);
+r_table:
+	rhashtable_destroy(&fstore_map);
 	return -1;
 }
 
 void	__exit cleanup_module(void)
 {
+	/* no stats reader may walk the table while it is torn down */
+	fstore_debugfs_exit();
+
 	/* Clean up fstore_map*/
-	int i;
-	struct hlist_node* nodeptr;
-	hash_t* ptr;
-	hash_for_each_safe(fstore_map, i, nodeptr, ptr, hnode) {
-		fstore_delete(ptr);
-	}
+	rhashtable_free_and_destroy(&fstore_map, fstore_free_item, NULL);
+
+	/* no subscribers are left, only a kick from the deletes above */
+	cancel_delayed_work_sync(&fstore_notify_work);
+
+	/* wait for the handles freed above */
+	rcu_barrier();
 
 	/* release device*/
 	device_destroy(dev_class,dev);
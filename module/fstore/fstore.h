@@ -1,19 +1,191 @@
 #ifndef _FSTORE_H_
 #define _FSTORE_H_
 #include <asm-generic/int-ll64.h>
+#include <linux/bpf.h>
 
 enum fstore_cmd {
 	REGISTER_MAP = 0x0,
 	UNREGISTER_MAP = 0x1,
+	REGISTER_MAP_NAMED = 0x2,
+	SELECT_MAP = 0x3,
+	LOAD_MAP = 0x4,
+	WATCH_MAP = 0x5,
+	MAP_GENERATION = 0x6,
 };
 
+/* longest name REGISTER_MAP_NAMED accepts, including the terminator */
+#define FSTORE_NAME_LEN 64
+
+/*
+ * Named maps are keyed by a 64 bit FNV-1a hash of the full name with the top
+ * bit set. 8 byte packed ASCII names never have that bit so the two schemes
+ * cannot collide with each other.
+ */
+#define FSTORE_NAME_HASHED (1ULL << 63)
+#define FSTORE_FNV_OFFSET 0xcbf29ce484222325ULL
+#define FSTORE_FNV_PRIME 0x100000001b3ULL
+
+/* how fstore_get_reduce folds a per-CPU value across CPUs */
+enum fstore_reduce {
+	FSTORE_REDUCE_SUM = 0x0,
+	FSTORE_REDUCE_MIN = 0x1,
+	FSTORE_REDUCE_MAX = 0x2,
+};
+
+/*
+ * Versioned value layout for fstore_get_consistent. The value starts with a
+ * u64 sequence counter that a writer makes odd before touching the payload
+ * and even again once done, e.g. from BPF:
+ *
+ *	FSTORE_SEQ_WRITE_BEGIN(&v->seq);
+ *	v->feature[0] = ...;
+ *	FSTORE_SEQ_WRITE_END(&v->seq);
+ *
+ * Writers of one value must be serialized, e.g. by keying on the CPU.
+ *
+ * The bumps must be ordered with the payload stores around them. clang only
+ * emits the fully ordered BPF_ADD | BPF_FETCH when the old value is used, an
+ * add whose result is dropped becomes the unordered BPF_ADD, a relaxed STADD
+ * on arm64. The macros hand the old value to an empty asm so the fetch stays,
+ * which needs BPF_FETCH atomics: clang -mcpu=v3 and Linux 5.12.
+ * bench_kernel_get -e runs the same instructions against
+ * fstore_get_consistent.
+ */
+struct fstore_versioned {
+	__u64 seq;
+	/* payload follows */
+};
+
+#define FSTORE_SEQ_SIZE sizeof(__u64)
+#define FSTORE_SEQ_MAX_RETRIES 64
+#define FSTORE_SEQ_BUMP(seqp) ({					\
+	__u64 __fstore_seq = __sync_fetch_and_add((seqp), 1);		\
+	__asm__ __volatile__("" : "+r"(__fstore_seq));			\
+	__fstore_seq;							\
+})
+#define FSTORE_SEQ_WRITE_BEGIN(seqp) FSTORE_SEQ_BUMP(seqp)
+#define FSTORE_SEQ_WRITE_END(seqp) FSTORE_SEQ_BUMP(seqp)
+
+/*
+ * Change notification. Every registered map has a generation, the sum of
+ * its entry in the generation map and the number of fstore_put,
+ * fstore_put_batch and LOAD_MAP calls that wrote to it. The generation map is a hash
+ * from u64 map name to u64 counter registered with REGISTER_MAP_NAMED as
+ * FSTORE_GEN_MAP, BPF writers bump their map's entry once done:
+ *
+ *	u64* gen = fstore_gen.lookup(&name);
+ *	if(gen) FSTORE_GEN_BUMP(gen);
+ *
+ * The module samples generations at most every notify_interval_ms, so any
+ * number of bumps in between wake a watcher once. A file watches one map
+ * through WATCH_MAP, poll() reports EPOLLIN until MAP_GENERATION, which
+ * takes a __u64* to write the generation to, acknowledges it.
+ */
+#define FSTORE_GEN_MAP "fstore_gen"
+#define FSTORE_GEN_BUMP(genp) __sync_fetch_and_add((genp), 1)
+
 struct register_input {
 	__u64 map_name;
 	__u32 fd;
 };
 
+struct register_named_input {
+	__u32 fd;
+	char name[FSTORE_NAME_LEN];
+};
+
+/*
+ * LOAD_MAP writes attr.batch.count keys and values into a registered map
+ * exactly like BPF_MAP_UPDATE_BATCH on its fd: keys and values are packed
+ * arrays, per-CPU values hold one 8 byte aligned value per possible CPU and
+ * elem_flags may only be BPF_F_LOCK. attr.batch.count is set to the number
+ * of entries written, also when the load fails part way.
+ */
+struct load_input {
+	__u64 map_name;
+	union bpf_attr attr;
+};
+
+/*
+ * Statistics, kept when the module is built with FSTORE_STATS=y (the
+ * default, see fstore/Makefile). Counters are per CPU and summed on read of
+ * /sys/kernel/debug/fstore/stats, as text, or stats.bin, a
+ * struct fstore_stats_header followed by num_maps struct fstore_map_stats.
+ *
+ * Every registered map counts its fstore_get* and fstore_handle_get calls,
+ * fstore_get_batch calls and the keys they asked for, values passed to
+ * fstore_put*, LOAD_MAP calls and mmaps of its values, including in-kernel
+ * fstore_get_map_array_start. A call counts once its name is found, whether
+ * it then succeeds or not. Failures are counted by errno across all maps.
+ *
+ * With latency_sample_shift >= 0 one in 2^shift fstore_get, fstore_get_rcu
+ * and fstore_handle_get calls per CPU is timed, bucket i of latency_ns
+ * counts calls that took [2^i, 2^(i+1)) ns, bucket 0 also those under 1 ns.
+ */
+enum fstore_stat {
+	FSTORE_STAT_GET,
+	FSTORE_STAT_BATCH,
+	FSTORE_STAT_BATCH_KEYS,
+	FSTORE_STAT_PUT,
+	FSTORE_STAT_LOAD,
+	FSTORE_STAT_MMAP,
+	FSTORE_STAT_NR,
+};
+
+enum fstore_stat_err {
+	FSTORE_ERR_NOKEY,	/* no map under the name */
+	FSTORE_ERR_KEYEXPIRED,	/* the handle's map was unregistered */
+	FSTORE_ERR_INVAL,
+	FSTORE_ERR_NOENT,	/* no such key in the map */
+	FSTORE_ERR_BUSY,	/* fstore_get_consistent kept tearing */
+	FSTORE_ERR_OTHER,
+	FSTORE_ERR_NR,
+};
+
+#define FSTORE_LAT_BUCKETS 32
+#define FSTORE_STATS_MAGIC 0x66737461U	/* "fsta" */
+#define FSTORE_STATS_VERSION 1
+
+struct fstore_stats_header {
+	__u32 magic;
+	__u32 version;
+	__u32 num_maps;
+	__s32 latency_sample_shift;	/* -1 while latency sampling is off */
+	__u64 errors[FSTORE_ERR_NR];
+	__u64 latency_ns[FSTORE_LAT_BUCKETS];
+};
+
+struct fstore_map_stats {
+	__u64 map_name;
+	__u64 count[FSTORE_STAT_NR];
+	char name[FSTORE_NAME_LEN];	/* as registered, the packed u64 for REGISTER_MAP */
+};
+
+#ifndef __cplusplus
+static inline __u64 fstore_name_hash(const char* name)
+{
+	__u64 hash = FSTORE_FNV_OFFSET;
+	for(; *name != '\0'; name++) {
+		hash ^= (__u8) *name;
+		hash *= FSTORE_FNV_PRIME;
+	}
+	return hash | FSTORE_NAME_HASHED;
+}
+#endif // __cplusplus
+
 #ifdef __cplusplus
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
 #include <optional>
+#include <span>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
 
 std::optional<__u64> convert8byteStringHash(char* string) {
 	__u64 hash = 0;
@@ -34,6 +206,168 @@ consteval __u64 unsafeHashConvert(const char* string) {
   	return hash;
 }
 
+constexpr __u64 fnv1aHash(const char* string) {
+	__u64 hash = FSTORE_FNV_OFFSET;
+	for (; *string != '\0'; string++) {
+		hash ^= (__u8)*string;
+		hash *= FSTORE_FNV_PRIME;
+	}
+	return hash | FSTORE_NAME_HASHED;
+}
+
+// The u64 a name registered through REGISTER_MAP_NAMED is looked up by
+consteval __u64 fnv1aHashConvert(const char* string) {
+	return fnv1aHash(string);
+}
+
+namespace fstore {
+
+// A string literal usable as a template argument
+template <size_t N>
+struct FixedString {
+	char chars[N];
+	consteval FixedString(const char (&string)[N]) { std::copy_n(string, N, chars); }
+};
+
+/*
+ * A map name checked and hashed at compile time, fstore::Name<"fault_regions">.
+ * hash is the u64 REGISTER_MAP_NAMED registers it under, packed() the
+ * REGISTER_MAP form of names of up to 8 bytes.
+ */
+template <FixedString S>
+struct Name {
+	static constexpr const char* string = S.chars;
+	static constexpr size_t length = sizeof(S.chars) - 1;
+	static_assert(length > 0 && length < FSTORE_NAME_LEN, "REGISTER_MAP_NAMED takes names shorter than FSTORE_NAME_LEN");
+	static constexpr __u64 hash = fnv1aHash(S.chars);
+
+	static consteval __u64 packed() {
+		static_assert(length <= sizeof(__u64), "only names of up to 8 bytes pack into a u64");
+		return unsafeHashConvert(S.chars);
+	}
+
+	static register_named_input named(__u32 fd) {
+		register_named_input input = {.fd = fd};
+		std::copy_n(S.chars, length + 1, input.name);
+		return input;
+	}
+};
+
+/*
+ * The mmapped values of a BPF array map as Values, key i at i * stride just
+ * like the map's own mmap. The layout is checked once when the view is made,
+ * after that every size is a constant so reads inline to fixed size copies
+ * and contiguous values() loops can be vectorized. operator[] checks bounds
+ * with assert only. N may be std::dynamic_extent when the number of entries
+ * is only known at run time.
+ *
+ * Nothing orders these reads against BPF writers, a value can be torn, see
+ * fstore_get_consistent for values that must not be.
+ */
+template <typename Key, typename Value, size_t N = std::dynamic_extent>
+class ArrayView {
+	static_assert(std::is_same_v<Key, __u32>, "array maps have u32 keys");
+	static_assert(std::is_trivially_copyable_v<Value>, "values are copied as bytes");
+
+	std::byte* base_;
+	size_t entries_;
+
+	ArrayView(std::byte* base, size_t entries) : base_(base), entries_(entries) {}
+
+public:
+	// array maps round each value up to 8 bytes
+	static constexpr size_t stride = (sizeof(Value) + 7) / 8 * 8;
+	static constexpr bool contiguous = stride == sizeof(Value);
+
+	/*
+	 * Map entries values of fd, a map fd, fstore after SELECT_MAP or any
+	 * device laid out the same. errno is set when it returns nullopt.
+	 */
+	static std::optional<ArrayView> map(int fd,
+			size_t entries = N,
+			int prot = PROT_READ,
+			int flags = MAP_SHARED) {
+		if (entries == std::dynamic_extent || (N != std::dynamic_extent && entries != N)) {
+			errno = EINVAL;
+			return std::nullopt;
+		}
+		void* base = mmap(NULL, entries * stride, prot, flags, fd, 0);
+		if (base == MAP_FAILED) return std::nullopt;
+		return ArrayView(static_cast<std::byte*>(base), entries);
+	}
+
+	/*
+	 * Map the values of map_fd read only once it is known to be an mmapable
+	 * array of Key, Value and entries, else nullopt with errno EINVAL.
+	 * A dynamic view takes the map's own max_entries by default.
+	 */
+	static std::optional<ArrayView> attach(int map_fd, size_t entries = N) {
+		struct bpf_map_info info = {};
+		union bpf_attr attr = {};
+		attr.info.bpf_fd = map_fd;
+		attr.info.info_len = sizeof(info);
+		attr.info.info = (__u64) &info;
+		if (syscall(SYS_bpf, BPF_OBJ_GET_INFO_BY_FD, &attr, sizeof(attr)) != 0) return std::nullopt;
+		if (entries == std::dynamic_extent) entries = info.max_entries;
+		if (info.type != BPF_MAP_TYPE_ARRAY ||
+			!(info.map_flags & BPF_F_MMAPABLE) ||
+			info.key_size != sizeof(Key) ||
+			info.value_size != sizeof(Value) ||
+			info.max_entries != entries) {
+			errno = EINVAL;
+			return std::nullopt;
+		}
+		return map(map_fd, entries);
+	}
+
+	/*
+	 * Map the values of a registered map through fstore. The device holds no
+	 * layout to check against, the kernel only refuses views larger than the
+	 * map, so prefer attach when the map fd is at hand.
+	 */
+	static std::optional<ArrayView> select(int fstore_fd, __u64 map_name, size_t entries = N) {
+		if (ioctl(fstore_fd, SELECT_MAP, map_name) != 0) return std::nullopt;
+		return map(fstore_fd, entries);
+	}
+
+	ArrayView(ArrayView&& other) : base_(std::exchange(other.base_, nullptr)), entries_(other.entries_) {}
+	ArrayView& operator=(ArrayView&& other) {
+		std::swap(base_, other.base_);
+		std::swap(entries_, other.entries_);
+		return *this;
+	}
+	ArrayView(const ArrayView&) = delete;
+	ArrayView& operator=(const ArrayView&) = delete;
+	~ArrayView() {
+		if (base_) munmap(base_, entries_ * stride);
+	}
+
+	constexpr size_t size() const {
+		if constexpr (N != std::dynamic_extent) return N;
+		else return entries_;
+	}
+
+	const Value& operator[](Key key) const {
+		assert(key < size());
+		return *reinterpret_cast<const Value*>(base_ + (size_t) key * stride);
+	}
+
+	// only for views mapped writable, e.g. a device
+	Value& operator[](Key key) {
+		assert(key < size());
+		return *reinterpret_cast<Value*>(base_ + (size_t) key * stride);
+	}
+
+	std::span<const Value, N> values() const requires contiguous {
+		return std::span<const Value, N>(reinterpret_cast<const Value*>(base_), size());
+	}
+
+	auto begin() const requires contiguous { return values().begin(); }
+	auto end() const requires contiguous { return values().end(); }
+};
+
+} // namespace fstore
+
 #endif // __cplusplus
 
 #endif // _FSTORE_H_
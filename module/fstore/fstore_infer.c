@@ -0,0 +1,428 @@
+/*
+ * fstore_infer.c - Kernel module evaluating small models over fstore maps
+ */
+
+#include <linux/module.h>	/* Needed by all modules */
+#include <linux/bottom_half.h>
+#include <linux/printk.h>	/* Needed for pr_info() */
+#include <linux/minmax.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/rhashtable.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/types.h>
+#include "fstore.h"
+#include "fstore_infer.h"
+
+int fstore_get_rcu(u64 map_name,
+		void* key,
+		size_t key_size,
+		void* value,
+		size_t value_size);
+int fstore_get_value_size(u64 map_name,
+		size_t* size);
+int fstore_get_copy_size(u64 map_name,
+		size_t* size);
+
+int fstore_infer_register(u64 model_name,
+		const struct fstore_model* desc);
+EXPORT_SYMBOL_GPL(fstore_infer_register);
+int fstore_infer_unregister(u64 model_name);
+EXPORT_SYMBOL_GPL(fstore_infer_unregister);
+int fstore_infer_eval(u64 model_name,
+		void* key,
+		size_t key_size,
+		s64* out);
+EXPORT_SYMBOL_GPL(fstore_infer_eval);
+int fstore_infer_run(u64 model_name,
+		const s32* features,
+		s64* out);
+EXPORT_SYMBOL_GPL(fstore_infer_run);
+
+/* per CPU, the MLP activations of one layer's input and output */
+struct infer_scratch {
+	s8 act[2][FSTORE_MLP_MAX_WIDTH];
+	s32 features[];		/* the fetched map value */
+};
+
+/*
+ * A registered model. The descriptor's arrays are copied into data so the
+ * whole model is one allocation, walked front to back by an evaluation.
+ * Each CPU gets a scratch area for the fetched features and activations,
+ * evaluations never allocate.
+ */
+typedef struct infer_model
+{
+	u64 model_name;
+	struct rhash_head hnode;
+	struct rcu_head rcu;
+	u32 type;
+	u32 n_features;
+	u64 feature_map;
+	u32 value_size;		/* of the feature map at register time */
+	struct infer_scratch __percpu* scratch;
+	s64 bias;		/* linear bias or GBDT base */
+	const s32* weights;
+	u32 n_trees;
+	const u32* roots;
+	const struct fstore_tree_node* nodes;
+	u32 input_shift;
+	u32 n_layers;
+	struct fstore_mlp_layer layers[FSTORE_MLP_MAX_LAYERS];
+	u8 data[] __aligned(8);
+} model_t;
+
+static struct rhashtable infer_models;
+
+static const struct rhashtable_params infer_params = {
+	.key_len = sizeof(u64),
+	.key_offset = offsetof(model_t, model_name),
+	.head_offset = offsetof(model_t, hnode),
+	.automatic_shrinking = true,
+};
+
+static int infer_check_gbdt(const struct fstore_model* desc)
+{
+	const struct fstore_gbdt_model* gbdt = &desc->gbdt;
+	if(!gbdt->n_trees || !gbdt->n_nodes ||
+		!gbdt->roots || !gbdt->nodes) return -EINVAL;
+	for(u32 t = 0; t < gbdt->n_trees; t++)
+		if(gbdt->roots[t] >= gbdt->n_nodes) return -EINVAL;
+	/* children after their parent and in bounds, so every walk ends */
+	for(u32 i = 0; i < gbdt->n_nodes; i++) {
+		const struct fstore_tree_node* node = &gbdt->nodes[i];
+		if(node->feature == FSTORE_TREE_LEAF) continue;
+		if(node->feature >= desc->n_features ||
+			node->right < 2 ||
+			(u64) i + node->right >= gbdt->n_nodes) return -EINVAL;
+	}
+	return 0;
+}
+
+static int infer_check_mlp(const struct fstore_model* desc)
+{
+	const struct fstore_mlp_model* mlp = &desc->mlp;
+	if(!mlp->n_layers || mlp->n_layers > FSTORE_MLP_MAX_LAYERS ||
+		!mlp->layers || mlp->input_shift >= 32) return -EINVAL;
+	/* the quantized features are the first layer's activations */
+	if(desc->n_features > FSTORE_MLP_MAX_WIDTH) return -EINVAL;
+	u32 in = desc->n_features;
+	for(u32 l = 0; l < mlp->n_layers; l++) {
+		const struct fstore_mlp_layer* layer = &mlp->layers[l];
+		if(layer->in != in ||
+			!layer->out || layer->out > FSTORE_MLP_MAX_WIDTH ||
+			!layer->weights || !layer->bias ||
+			layer->shift >= 63) return -EINVAL;
+		in = layer->out;
+	}
+	return in == 1 ? 0 : -EINVAL;
+}
+
+/* bytes of data the copied arrays take, or 0 for a bad descriptor */
+static size_t infer_data_size(const struct fstore_model* desc)
+{
+	size_t size = 0;
+	if(!desc->n_features ||
+		desc->n_features > FSTORE_INFER_MAX_FEATURES) return 0;
+	switch(desc->type) {
+	case FSTORE_MODEL_LINEAR:
+	case FSTORE_MODEL_LOGISTIC:
+		if(!desc->linear.weights) return 0;
+		return round_up(sizeof(s32) * desc->n_features, 8);
+	case FSTORE_MODEL_GBDT:
+		if(infer_check_gbdt(desc)) return 0;
+		return round_up(sizeof(u32) * desc->gbdt.n_trees, 8) +
+			sizeof(struct fstore_tree_node) * desc->gbdt.n_nodes;
+	case FSTORE_MODEL_MLP:
+		if(infer_check_mlp(desc)) return 0;
+		for(u32 l = 0; l < desc->mlp.n_layers; l++) {
+			const struct fstore_mlp_layer* layer = &desc->mlp.layers[l];
+			size += round_up(sizeof(s32) * layer->out, 8) +
+				round_up((size_t) layer->in * layer->out, 8);
+		}
+		return size;
+	default:
+		return 0;
+	}
+}
+
+static const void* infer_copy(u8** cursor, const void* src, size_t bytes)
+{
+	void* dst = *cursor;
+	memcpy(dst, src, bytes);
+	*cursor += round_up(bytes, 8);
+	return dst;
+}
+
+static void infer_fill(model_t* model, const struct fstore_model* desc)
+{
+	u8* cursor = model->data;
+	switch(desc->type) {
+	case FSTORE_MODEL_LINEAR:
+	case FSTORE_MODEL_LOGISTIC:
+		model->bias = desc->linear.bias;
+		model->weights = infer_copy(&cursor, desc->linear.weights,
+				sizeof(s32) * desc->n_features);
+		break;
+	case FSTORE_MODEL_GBDT:
+		model->bias = desc->gbdt.base;
+		model->n_trees = desc->gbdt.n_trees;
+		model->roots = infer_copy(&cursor, desc->gbdt.roots,
+				sizeof(u32) * desc->gbdt.n_trees);
+		model->nodes = infer_copy(&cursor, desc->gbdt.nodes,
+				sizeof(struct fstore_tree_node) * desc->gbdt.n_nodes);
+		break;
+	case FSTORE_MODEL_MLP:
+		model->input_shift = desc->mlp.input_shift;
+		model->n_layers = desc->mlp.n_layers;
+		for(u32 l = 0; l < desc->mlp.n_layers; l++) {
+			const struct fstore_mlp_layer* layer = &desc->mlp.layers[l];
+			model->layers[l] = *layer;
+			model->layers[l].bias = infer_copy(&cursor, layer->bias,
+					sizeof(s32) * layer->out);
+			model->layers[l].weights = infer_copy(&cursor,
+					layer->weights, (size_t) layer->in * layer->out);
+		}
+		break;
+	}
+}
+
+static void infer_free(model_t* model)
+{
+	free_percpu(model->scratch);
+	kvfree(model);
+}
+
+static void infer_free_rcu(struct rcu_head* rcu)
+{
+	infer_free(container_of(rcu, model_t, rcu));
+}
+
+/**
+ * fstore_infer_register - register a model over a registered feature map
+ * @model_name: the name to evaluate the model by u64ified
+ * @desc: the model, its arrays are copied
+ * @ret returns 0, -EINVAL for a malformed model or a per-CPU feature map,
+ * -ENOKEY if the feature map is not registered, -EMSGSIZE if its values
+ * cannot hold n_features or -EEXIST if the name is taken
+ */
+int fstore_infer_register(u64 model_name,
+		const struct fstore_model* desc)
+{
+	int err = 0;
+	size_t value_size = 0;
+	size_t copy_size = 0;
+	size_t data_size = infer_data_size(desc);
+	if(!data_size) return -EINVAL;
+	if(( err = fstore_get_value_size(desc->feature_map, &value_size) ) ||
+		( err = fstore_get_copy_size(desc->feature_map, &copy_size) ))
+		return err;
+	/* a per-CPU map holds a vector per CPU, not one to evaluate */
+	if(copy_size != value_size) return -EINVAL;
+	if(value_size < sizeof(s32) * desc->n_features) return -EMSGSIZE;
+
+	model_t* model = kvzalloc(struct_size(model, data, data_size),
+			GFP_KERNEL);
+	if(!model) return -ENOMEM;
+	model->scratch = __alloc_percpu(sizeof(struct infer_scratch) +
+			round_up(value_size, 8), SMP_CACHE_BYTES);
+	if(!model->scratch) {
+		kvfree(model);
+		return -ENOMEM;
+	}
+
+	model->model_name = model_name;
+	model->type = desc->type;
+	model->n_features = desc->n_features;
+	model->feature_map = desc->feature_map;
+	model->value_size = value_size;
+	infer_fill(model, desc);
+
+	err = rhashtable_lookup_insert_fast(&infer_models, &model->hnode,
+			infer_params);
+	if(err) infer_free(model);
+	return err;
+}
+
+/**
+ * fstore_infer_unregister - drop a model, evaluations in flight finish first
+ * @model_name: the name of the model u64ified
+ * @ret returns the number of models removed
+ */
+int fstore_infer_unregister(u64 model_name)
+{
+	int i = 0;
+	rcu_read_lock();
+	model_t* model = rhashtable_lookup(&infer_models, &model_name,
+			infer_params);
+	if(model && !rhashtable_remove_fast(&infer_models, &model->hnode,
+				infer_params)) {
+		call_rcu(&model->rcu, infer_free_rcu);
+		i++;
+	}
+	rcu_read_unlock();
+	return i;
+}
+
+/* Amin, Curtis and Hayes-Gill's PLAN approximation, within 2% everywhere */
+static s64 infer_sigmoid(s64 x)
+{
+	const s64 one = FSTORE_INFER_ONE;
+	s64 ax = x < 0 ? -x : x;
+	s64 y;
+	if(ax >= 5 * one) y = one;
+	else if(ax >= 19 * one / 8) y = (ax >> 5) + 27 * one / 32;
+	else if(ax >= one) y = (ax >> 3) + 5 * one / 8;
+	else y = (ax >> 2) + one / 2;
+	return x < 0 ? one - y : y;
+}
+
+static s64 infer_linear(const model_t* model, const s32* x)
+{
+	s64 acc = 0;
+	for(u32 i = 0; i < model->n_features; i++)
+		acc += (s64) model->weights[i] * x[i];
+	return model->bias + (acc >> FSTORE_INFER_FRAC_BITS);
+}
+
+static s64 infer_gbdt(const model_t* model, const s32* x)
+{
+	s64 sum = model->bias;
+	for(u32 t = 0; t < model->n_trees; t++) {
+		const struct fstore_tree_node* node = model->nodes + model->roots[t];
+		while(node->feature != FSTORE_TREE_LEAF)
+			node += x[node->feature] <= node->value ? 1 : node->right;
+		sum += node->value;
+	}
+	return sum;
+}
+
+static s64 infer_mlp(const model_t* model, const s32* x,
+		struct infer_scratch* scratch)
+{
+	s8* in = scratch->act[0];
+	s8* out = scratch->act[1];
+	for(u32 i = 0; i < model->n_features; i++)
+		in[i] = clamp_t(s32, x[i] >> model->input_shift, S8_MIN, S8_MAX);
+
+	for(u32 l = 0;; l++) {
+		const struct fstore_mlp_layer* layer = &model->layers[l];
+		bool last = l + 1 == model->n_layers;
+		for(u32 o = 0; o < layer->out; o++) {
+			const s8* w = layer->weights + (size_t) o * layer->in;
+			s32 acc = layer->bias[o];
+			for(u32 i = 0; i < layer->in; i++)
+				acc += w[i] * in[i];
+			s64 scaled = ((s64) acc * layer->multiplier) >> layer->shift;
+			/* checked at register, the last layer has one output */
+			if(last) return scaled;
+			out[o] = clamp_t(s64, scaled, 0, S8_MAX);
+		}
+		swap(in, out);
+	}
+}
+
+static s64 infer_model(const model_t* model, const s32* x,
+		struct infer_scratch* scratch)
+{
+	switch(model->type) {
+	case FSTORE_MODEL_LINEAR: return infer_linear(model, x);
+	case FSTORE_MODEL_LOGISTIC: return infer_sigmoid(infer_linear(model, x));
+	case FSTORE_MODEL_GBDT: return infer_gbdt(model, x);
+	case FSTORE_MODEL_MLP:
+	default: return infer_mlp(model, x, scratch);
+	}
+}
+
+/**
+ * fstore_infer_eval - evaluate a model on the feature vector of a key
+ * @model_name: the name of the model u64ified
+ * @key: the key into the model's feature map
+ * @key_size: the size of the key buffer, at least the map key_size
+ * @out: the model's Q16.16 output
+ * @ret returns 0, -ENOKEY for an unknown model or feature map, or the
+ * error of fetching the features
+ *
+ * The features are copied to this CPU's scratch area with fstore_get_rcu
+ * and evaluated in integer arithmetic with bottom halves off, so a softirq
+ * on this CPU cannot evaluate into the same scratch midway. Nothing is
+ * allocated. Must not be called from hard IRQ context or with interrupts
+ * disabled.
+ */
+int fstore_infer_eval(u64 model_name,
+		void* key,
+		size_t key_size,
+		s64* out)
+{
+	int err = -ENOKEY;
+	rcu_read_lock();
+	model_t* model = rhashtable_lookup(&infer_models, &model_name,
+			infer_params);
+	if(model) {
+		local_bh_disable();
+		struct infer_scratch* scratch = this_cpu_ptr(model->scratch);
+		err = fstore_get_rcu(model->feature_map, key, key_size,
+				scratch->features, model->value_size);
+		if(!err) *out = infer_model(model, scratch->features, scratch);
+		local_bh_enable();
+	}
+	rcu_read_unlock();
+	return err;
+}
+
+/**
+ * fstore_infer_run - evaluate a model on features the caller already has
+ * @model_name: the name of the model u64ified
+ * @features: n_features Q16.16 values
+ * @out: the model's Q16.16 output
+ * @ret returns 0 or -ENOKEY for an unknown model
+ *
+ * Uses the scratch area under the same rules as fstore_infer_eval.
+ */
+int fstore_infer_run(u64 model_name,
+		const s32* features,
+		s64* out)
+{
+	int err = -ENOKEY;
+	rcu_read_lock();
+	model_t* model = rhashtable_lookup(&infer_models, &model_name,
+			infer_params);
+	if(model) {
+		local_bh_disable();
+		*out = infer_model(model, features, this_cpu_ptr(model->scratch));
+		local_bh_enable();
+		err = 0;
+	}
+	rcu_read_unlock();
+	return err;
+}
+
+static void infer_free_item(void* ptr, void* arg)
+{
+	infer_free(ptr);
+}
+
+int __init init_module(void)
+{
+	if(rhashtable_init(&infer_models, &infer_params)) {
+		pr_err("Cannot allocate the model registry\n");
+		return -1;
+	}
+	pr_info("Fstore infer Insert...Done!!!\n");
+	return 0;
+}
+
+void __exit cleanup_module(void)
+{
+	/* users of the exports are gone, nothing evaluates any more */
+	rhashtable_free_and_destroy(&infer_models, infer_free_item, NULL);
+	/* and the models unregistered before */
+	rcu_barrier();
+	pr_info("Fstore infer exit.\n");
+}
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Aditya Tewari <adityaatewari@gmail.com>");
+MODULE_DESCRIPTION("Fixed point model evaluation over the feature store");
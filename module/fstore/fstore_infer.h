@@ -0,0 +1,93 @@
+#ifndef _FSTORE_INFER_H_
+#define _FSTORE_INFER_H_
+#include <asm-generic/int-ll64.h>
+
+/*
+ * Models evaluated by fstore_infer over the feature vectors of a registered
+ * fstore map. A feature vector is n_features signed Q16.16 values at the
+ * start of the map value, outputs are Q16.16 as well.
+ */
+#define FSTORE_INFER_FRAC_BITS 16
+#define FSTORE_INFER_ONE (1 << FSTORE_INFER_FRAC_BITS)
+#define FSTORE_INFER_MAX_FEATURES 1024
+
+enum fstore_model_type {
+	FSTORE_MODEL_LINEAR = 0x0,
+	FSTORE_MODEL_LOGISTIC = 0x1,
+	FSTORE_MODEL_GBDT = 0x2,
+	FSTORE_MODEL_MLP = 0x3,
+};
+
+/*
+ * bias + sum(weights[i] * x[i]), weights and bias in Q16.16. Logistic
+ * models squash that through a piecewise linear sigmoid into [0, ONE].
+ */
+struct fstore_linear_model {
+	__s64 bias;
+	const __s32* weights;	/* n_features */
+};
+
+/*
+ * Trees are stored depth first, 8 bytes a node so a cache line holds 8. The
+ * left child of a split is the next node and the right child is `right`
+ * nodes further on, so a walk only ever moves forward.
+ */
+#define FSTORE_TREE_LEAF 0xffff
+
+struct fstore_tree_node {
+	__s32 value;		/* go left if x[feature] <= value, or the leaf's output */
+	__u16 feature;		/* FSTORE_TREE_LEAF for leaves */
+	__u16 right;
+};
+
+/* base + the sum of one leaf per tree */
+struct fstore_gbdt_model {
+	__s64 base;
+	__u32 n_trees;
+	__u32 n_nodes;
+	const __u32* roots;	/* n_trees indices into nodes */
+	const struct fstore_tree_node* nodes;
+};
+
+/*
+ * Quantized MLP. Features are quantized to int8 as x >> input_shift, each
+ * layer computes the int32 sums bias[o] + sum(weights[o * in + i] * a[i])
+ * and rescales them by (sum * multiplier) >> shift. Hidden layers clamp the
+ * result to [0, 127], a ReLU back to int8, the last layer has a single
+ * output that is the Q16.16 result. The quantized features are the first
+ * layer's input, so n_features is at most FSTORE_MLP_MAX_WIDTH too.
+ */
+#define FSTORE_MLP_MAX_WIDTH 256
+#define FSTORE_MLP_MAX_LAYERS 8
+
+struct fstore_mlp_layer {
+	__u32 in;
+	__u32 out;
+	const __s8* weights;	/* out rows of in */
+	const __s32* bias;	/* out */
+	__s32 multiplier;
+	__u32 shift;
+};
+
+struct fstore_mlp_model {
+	__u32 input_shift;
+	__u32 n_layers;
+	const struct fstore_mlp_layer* layers;
+};
+
+/*
+ * What fstore_infer_register takes. Every array is copied, the caller may
+ * free them once it returns.
+ */
+struct fstore_model {
+	__u32 type;
+	__u32 n_features;
+	__u64 feature_map;	/* fstore name of the feature vectors */
+	union {
+		struct fstore_linear_model linear;
+		struct fstore_gbdt_model gbdt;
+		struct fstore_mlp_model mlp;
+	};
+};
+
+#endif // _FSTORE_INFER_H_
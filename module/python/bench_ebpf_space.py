@@ -1,16 +1,22 @@
 import argparse
+import json
 import os
 import time
 from ctypes import c_int, c_uint32
 
 from bcc import BPF
 
+
+def parse_list(arg: str) -> list[int]:
+    return [int(value) for value in arg.split(',')]
+
 parser = argparse.ArgumentParser()
 parser.add_argument('-n', action='store', type=int, dest='number', help="Number of iterations", default=1000)
-parser.add_argument('-s', action='store', type=int, dest='size', help="Size of Map", default=10)
-parser.add_argument('-d', action='store', type=int, dest='data_size', help="Data Size", default=8)
+parser.add_argument('-s', action='store', type=parse_list, dest='sizes', help="Sizes of Map, comma separated", default=[10])
+parser.add_argument('-d', action='store', type=parse_list, dest='data_sizes', help="Data Sizes, comma separated", default=[8])
+parser.add_argument('-t', action='store', type=int, dest='trials', help="Timed trials per point", default=1)
+parser.add_argument('-w', action='store', type=int, dest='warmup', help="Untimed trials per point", default=1)
 parser.add_argument('-v', action='store', type=int, dest='debug', help="Debug Level", default=0)
-parser.add_argument('-w', action='store_true', dest='hang', help="Keep probe alive", default=False)
 
 FIX= 1<< 32
 
@@ -35,9 +41,46 @@ def write(data, fd=3):
     except OSError:
         return -1
 
+def percentile(values: list[float], p: float) -> float:
+    # nearest rank, as bench::Histogram
+    ordered = sorted(values)
+    rank = max(int(p * len(ordered) + 0.5), 1)
+    return ordered[min(rank, len(ordered)) - 1]
+
+def report(args, map_size: int, data_size: int, trial_ns: list[int]):
+    """One line in the JSON format of test/bench.h, time_trials style."""
+    ns_per_op = [ns / args.number for ns in trial_ns]
+    line = {
+        "bench": "bench_ebpf_space",
+        "mode": "ebpf",
+        "iterations": args.number,
+        "map_size": map_size,
+        "value_size": data_size,
+        "trials": args.trials,
+        "warmup": args.warmup,
+        "batch": args.number,
+        "cpu": -1,
+        "trial_ns": trial_ns,
+        "ns_per_op_mean": sum(ns_per_op) / len(ns_per_op),
+        "ns_per_op_min": min(ns_per_op),
+        "ns_per_op_p50": percentile(ns_per_op, 0.5),
+        "ns_per_op_p99": percentile(ns_per_op, 0.99),
+        "ns_per_op_p999": percentile(ns_per_op, 0.999),
+        "ns_per_op_max": max(ns_per_op),
+        "cycles": None,
+        "llc_misses": None,
+        "dtlb_misses": None,
+    }
+    write(json.dumps(line, separators=(',', ':')) + "\n")
+
 args = parser.parse_args()
+args.data_sizes = [max(data_size, 8) // 8 * 8 for data_size in args.data_sizes]
+args.trials = max(args.trials, 1)
 
-txt = f"""
+# The array holds the largest map of the sweep and the probe reads the first
+# map_size entries. Only the data size needs its own program.
+def program(data_size: int, max_size: int) -> str:
+    return f"""
 #include <linux/sched.h>
 
 struct data_ts {{
@@ -64,13 +107,14 @@ static u32 simplerand(struct ShiftXor* rand) {{
 }}
 
 struct data_sizer {{
-    u32 size[{args.data_size}/4];
+    u32 size[{data_size}/4];
 }};
 
 BPF_PERF_OUTPUT(events);
 BPF_PERF_OUTPUT(useless);
 
-BPF_ARRAY(array, struct data_sizer, {args.size});
+BPF_ARRAY(array, struct data_sizer, {max_size});
+BPF_ARRAY(map_size, u32, 1);
 
 BPF_ARRAY(on, struct data_ts, 1);
 BPF_PERCPU_ARRAY(temp_buffer, struct data_sizer, 1);
@@ -85,7 +129,11 @@ int probe(struct pt_regs *ctx) {{
     struct data_ts data;
     struct ShiftXor rand = {{1, 4, 7, 13}};
     u32 returner = 0;
-    const u32 data_size = {args.data_size};
+    const u32 data_size = {data_size};
+
+    u32* size_ptr = map_size.lookup(&zero_key);
+    if(!size_ptr || *size_ptr == 0) return -1;
+    const u32 size = *size_ptr;
 
     struct data_sizer* ptr = NULL;
     struct data_sizer* tmp = temp_buffer.lookup(&zero_key);
@@ -93,7 +141,7 @@ int probe(struct pt_regs *ctx) {{
 
     u64 start = bpf_ktime_get_ns();
     for(u64 i = 0; i < {args.number}; i++) {{
-        u32 key = simplerand(&rand) % {args.size};
+        u32 key = simplerand(&rand) % size;
         ptr = array.lookup(&key);
         if(!ptr) return -1;
         memcpy(tmp, ptr, sizeof(struct data_sizer));
@@ -110,35 +158,44 @@ int probe(struct pt_regs *ctx) {{
 }}
 """
 
-bpf_ctx = BPF(text=txt, debug=args.debug)
+max_size = max(args.sizes)
+for data_size in args.data_sizes:
+    bpf_ctx = BPF(text=program(data_size, max_size), debug=args.debug)
+
+    on = bpf_ctx["on"]
+    on[c_int(0)] = on.Leaf(1)
+
+    rand = [1, 4, 7, 13]
+    array = bpf_ctx["array"]
+    array_size = data_size // 4
+    for i in range(0, max_size):
+        arr = (c_uint32 * array_size)()
+        for j in range(0, array_size):
+            val, rand = simplerand(rand)
+            arr[j] = val
+        array[c_uint32(i)] = arr
 
-on = bpf_ctx["on"]
-on[c_int(0)]=c_int(1)
+    bpf_ctx.attach_kprobe(event='do_nanosleep', fn_name="probe")
 
-rand = [1, 4, 7, 13]
-array = bpf_ctx["array"]
-array_size = args.data_size // 4
-for i in range(0, args.size):
-    arr = (c_uint32 * array_size)()
-    for j in range(0, array_size):
-        val, rand = simplerand(rand)
-        arr[j] = val
-    array[c_uint32(i)] = arr
+    results = list[int]()
 
-bpf_ctx.attach_kprobe(event='do_nanosleep', fn_name="probe")
+    def print_event(cpu, data, size):
+        results.append(bpf_ctx["events"].event(data).ts)
 
-ready = True
+    bpf_ctx["events"].open_perf_buffer(print_event)
 
-def print_event(cpu, data, size):
-    output = bpf_ctx["events"].event(data)
-    time.sleep(0.001)
-    write("get_iterations %ld\tmap_size %ld\tvalue_size %d\tTime(ns) %ld\n" % (args.number, args.size, args.data_size, output.ts))
-    return -1
+    def trial() -> int:
+        results.clear()
+        # The next nanosleep on any CPU runs the loop once
+        on[c_int(0)] = on.Leaf(0)
+        while not results:
+            time.sleep(0.001)
+            bpf_ctx.perf_buffer_poll(timeout=10)
+        return results[0]
 
-bpf_ctx["events"].open_perf_buffer(print_event)
+    for size in args.sizes:
+        bpf_ctx["map_size"][c_int(0)] = c_uint32(size)
+        trial_ns = [trial() for i in range(0, args.warmup + args.trials)][args.warmup:]
+        report(args, size, data_size, trial_ns)
 
-on[c_int(0)]=c_int(0)
-while ready:
-    bpf_ctx.perf_buffer_poll()
-    if not args.hang:
-        ready = False
+    bpf_ctx.cleanup()
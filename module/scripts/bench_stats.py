@@ -0,0 +1,54 @@
+#!/usr/bin/python3
+"""Summarizes the JSON lines test/bench.h benchmarks write to STAT_FD.
+
+Prints one CSV row per file: trial count-weighted mean and variance of the
+trial times in ns, plus the median p50 and p99 ns per operation over runs.
+"""
+
+import argparse
+import json
+import statistics
+import sys
+from pathlib import Path
+
+parser = argparse.ArgumentParser()
+parser.add_argument('files', nargs='+', type=Path, help="Stats files of bench.h benchmarks")
+parser.add_argument('-m', action='store', dest="mode", help="Only rows of this mode", default=None)
+parser.add_argument('--no-header', action='store_false', dest="header")
+
+
+def read_runs(path: Path, mode: str | None) -> list[dict]:
+  runs = []
+  with open(path) as f:
+    for line in f:
+      if not line.strip():
+        continue
+      run = json.loads(line)
+      if mode is None or run["mode"] == mode:
+        runs.append(run)
+  return runs
+
+
+def summarize(runs: list[dict]) -> list:
+  trial_ns = [ns for run in runs for ns in run["trial_ns"]]
+  return [
+    runs[0]["iterations"],
+    runs[0]["value_size"],
+    runs[0]["map_size"],
+    statistics.fmean(trial_ns),
+    statistics.pvariance(trial_ns),
+    statistics.median(run["ns_per_op_p50"] for run in runs),
+    statistics.median(run["ns_per_op_p99"] for run in runs),
+  ]
+
+
+if __name__ == "__main__":
+  args = parser.parse_args()
+  if args.header:
+    print("Count, DataSize, MapSize, AverageTime, Variance, P50, P99")
+  for path in args.files:
+    runs = read_runs(path, args.mode)
+    if not runs:
+      print(f"{path}: no runs", file=sys.stderr)
+      continue
+    print(", ".join(str(value) for value in summarize(runs)))
@@ -1,6 +1,7 @@
 #!/usr/bin/python3
 
 import argparse
+import csv
 import re
 import sys
 from enum import Enum
@@ -38,6 +39,9 @@ parser.add_argument('-o', action='store', dest="ouputf", help="Output FileN", re
 parser.add_argument('-i', action='store', dest="inputf", help="Input FileN", default="")
 parser.add_argument('-p', dest='gtype', help="Graph Type", type=lambda val: GraphType[val], choices=list(GraphType), default = "bar")
 parser.add_argument('-l', dest='log', help="Data Access Log Scale", action='store_true')
+parser.add_argument('--tidy', dest='tidy', help="Input is the CSV of sweep.py, one group per path", action='store_true')
+parser.add_argument('--x-column', action='store', dest="xcolumn", help="Tidy column on the X axis", default="data_size")
+parser.add_argument('--where', action='append', dest="where", help="Tidy rows to keep, e.g. map_size=256", default=[])
 
 new_color_cycle = cycler(color=['cyan', 'green', 'orange', 'purple', 'magenta'])
 
@@ -81,6 +85,22 @@ def parse_bar_input(inputf, groups: int):
     xaxis.append(broken_line[groups])
     return (xaxis, yaxis, eaxis, group_label)
 
+def parse_tidy_input(inputf, xcolumn: str, where: list[str]):
+    rows = list(csv.DictReader(inputf))
+    for condition in where:
+        column, value = condition.split('=', 1)
+        rows = [row for row in rows if row[column] == value]
+    group_label = list(dict.fromkeys(row["path"] for row in rows))
+    xaxis = sorted({row[xcolumn] for row in rows}, key=float)
+    # Without a --where for every other column the last matching row wins
+    cells = {(row["path"], row[xcolumn]): row for row in rows}
+    yaxis = []
+    eaxis = []
+    for path in group_label:
+        yaxis.append([float(cells[(path, x)]["ns_per_op"]) if (path, x) in cells else 0 for x in xaxis])
+        eaxis.append([float(cells[(path, x)]["ns_per_op_std"]) if (path, x) in cells else 0 for x in xaxis])
+    return (xaxis, yaxis, eaxis, group_label)
+
 def open_data_file(valFile: Path) -> [float]:
     data = []
     with open(valFile) as f:
@@ -129,8 +149,12 @@ box type graphs:
     g_name0 g_name1 g_name2
     pathG0Y0s pathG1Y0s pathG2Y0s
     pathG0Y1s pathG1Y1s pathG2Y1s
+
+tidy, a bar graph of the sweep.py CSV with one group per path, the x axis
+column given by tidy and the rows kept by where
 """
-def graph(gtitle, xlabel, ylabel, inputf, ouputf, groups, horizon, gtype: GraphType, log: bool):
+def graph(gtitle, xlabel, ylabel, inputf, ouputf, groups, horizon, gtype: GraphType, log: bool,
+          tidy: str | None = None, where: list[str] = []):
     _ = plt.figure(figsize=(10,7))
     #ax = fig.add_axes([0,0,1,1])
     xaxis, yaxis, eaxis, group_label = ([], [], [], [])
@@ -138,7 +162,11 @@ def graph(gtitle, xlabel, ylabel, inputf, ouputf, groups, horizon, gtype: GraphT
     if verbose:
         print(gtype)
 
-    if gtype is GraphType.bar:
+    if tidy is not None:
+        xaxis, yaxis, eaxis, group_label = parse_tidy_input(inputf, tidy, where)
+        groups = len(group_label)
+        gtype = GraphType.bar
+    elif gtype is GraphType.bar:
         xaxis, yaxis, eaxis, group_label = parse_bar_input(inputf, groups)
     elif gtype is GraphType.box:
         xaxis, yaxis, eaxis, group_label = parse_box_input(inputf, groups)
@@ -191,4 +219,5 @@ if __name__ == "__main__":
   verbose = args.verbose
   if args.inputf != "" or args.inputf is None:
     inputf = open(args.inputf)
-  graph(args.gtitle,args.xlabel,args.ylabel,inputf,args.ouputf,args.groups,args.horizon,args.gtype, args.log)
+  graph(args.gtitle,args.xlabel,args.ylabel,inputf,args.ouputf,args.groups,args.horizon,args.gtype, args.log,
+        args.xcolumn if args.tidy else None, args.where)
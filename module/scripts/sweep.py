@@ -0,0 +1,130 @@
+#!/usr/bin/python3
+"""Runs the data size x map size matrix over every access path.
+
+Each path is one process that gets the whole -d and -s lists and sweeps them
+itself, see Options::points() in test/bench.h and python/bench_ebpf_space.py.
+The kmod paths hand the sizes to bench_kernel_get through the ioctl args, so
+one loaded module covers the matrix too.
+
+The JSON lines of the benchmarks are appended to the -r file as they come.
+The -o file is the tidy CSV of them: one row per path and point, with the mean
+and standard deviation of the per trial ns/op, for graph.py --tidy.
+"""
+
+import argparse
+import csv
+import json
+import os
+import statistics
+import sys
+from pathlib import Path
+
+MODULE = Path(__file__).resolve().parent.parent
+
+# argv of each path, {build} is the -b directory
+PATHS = {
+  "kmod-array": ["{build}/test/e2e/bench_kernel_get/bench_kernel_get", "-a"],
+  "kmod-map": ["{build}/test/e2e/bench_kernel_get/bench_kernel_get", "-f"],
+  "kmod-batch": ["{build}/test/e2e/bench_kernel_get/bench_kernel_get", "-b"],
+  "kmod-handle": ["{build}/test/e2e/bench_kernel_get/bench_kernel_get", "-o"],
+  "kmod-this-cpu": ["{build}/test/e2e/bench_kernel_get/bench_kernel_get", "-p"],
+  "kmod-reduce": ["{build}/test/e2e/bench_kernel_get/bench_kernel_get", "-r"],
+  "kmod-consistent": ["{build}/test/e2e/bench_kernel_get/bench_kernel_get", "-c"],
+  "kmod-consistent-bpf": ["{build}/test/e2e/bench_kernel_get/bench_kernel_get", "-e"],
+  "user-mmap": ["{build}/test/kdev/bpf_map_bench"],
+  "user-view": ["{build}/test/kdev/bpf_map_bench", "-v"],
+  "fstore-mmap": ["{build}/test/unit/fstore_mmap_bench"],
+  "ebpf-map": ["python3", "python/bench_ebpf_space.py"],
+  "user-ksched": ["test/user-ksched/user_ksched"],
+  "user-ksched-view": ["test/user-ksched/user_ksched", "-v"],
+}
+
+DEFAULT_PATHS = "kmod-array,kmod-map,user-mmap,user-view,fstore-mmap,ebpf-map,user-ksched"
+
+COLUMNS = [
+  "path", "bench", "mode", "data_size", "map_size", "iterations", "trials",
+  "ns_per_op", "ns_per_op_std", "ns_per_op_p50", "ns_per_op_p99",
+]
+
+parser = argparse.ArgumentParser()
+parser.add_argument('-d', action='store', dest="data_sizes", help="Data sizes, comma separated",
+                    default="8,16,32,64,128,256,512")
+parser.add_argument('-s', action='store', dest="sizes", help="Map sizes, comma separated",
+                    default="32,64,128,256,512,1024,2048")
+parser.add_argument('-n', action='store', dest="number", help="Gets per trial", default="100000")
+parser.add_argument('-t', action='store', dest="trials", help="Timed trials per point", default="30")
+parser.add_argument('-w', action='store', dest="warmup", help="Untimed trials per point", default="1")
+parser.add_argument('-p', action='store', dest="paths", default=DEFAULT_PATHS,
+                    help=f"Paths to run, comma separated, of {','.join(PATHS)}")
+parser.add_argument('-b', action='store', dest="build", help="Build directory", default="build")
+parser.add_argument('-o', action='store', dest="output", type=Path, help="Tidy CSV",
+                    default=Path("sweep.csv"))
+parser.add_argument('-r', action='store', dest="raw", type=Path, default=None,
+                    help="JSON lines of the benchmarks, the -o path with .jsonl by default")
+
+
+def run(argv: list[str], raw: Path) -> tuple[int, list[dict]]:
+  """Runs one path with its stats fd 3 appended to raw, returns its status and lines."""
+  with open(raw, "ab") as stats:
+    start = stats.tell()
+    try:
+      pid = os.posix_spawnp(argv[0], argv, os.environ,
+                            file_actions=[(os.POSIX_SPAWN_DUP2, stats.fileno(), 3)])
+    except OSError as e:
+      print(f"{argv[0]}: {e}", file=sys.stderr)
+      return (-1, [])
+    _, status = os.waitpid(pid, 0)
+  with open(raw, "rb") as stats:
+    stats.seek(start)
+    runs = [json.loads(line) for line in stats if line.strip()]
+  return (os.waitstatus_to_exitcode(status), runs)
+
+
+def tidy(path: str, line: dict) -> dict:
+  ns_per_op = [ns / line["iterations"] for ns in line["trial_ns"]] if line["iterations"] else [0]
+  return {
+    "path": path,
+    "bench": line["bench"],
+    "mode": line["mode"],
+    "data_size": line["value_size"],
+    "map_size": line["map_size"],
+    "iterations": line["iterations"],
+    "trials": line["trials"],
+    "ns_per_op": statistics.fmean(ns_per_op),
+    "ns_per_op_std": statistics.pstdev(ns_per_op),
+    "ns_per_op_p50": line["ns_per_op_p50"],
+    "ns_per_op_p99": line["ns_per_op_p99"],
+  }
+
+
+if __name__ == "__main__":
+  args = parser.parse_args()
+  paths = args.paths.split(",")
+  unknown = [path for path in paths if path not in PATHS]
+  if unknown:
+    parser.error(f"unknown paths {','.join(unknown)}")
+  output = args.output.resolve()
+  raw = (args.raw or output.with_suffix(".jsonl")).resolve()
+  os.chdir(MODULE)
+
+  failed = []
+  with open(output, "w", newline="") as f:
+    writer = csv.DictWriter(f, fieldnames=COLUMNS)
+    writer.writeheader()
+    for path in paths:
+      argv = [arg.format(build=args.build) for arg in PATHS[path]]
+      argv += ["-n", args.number, "-s", args.sizes, "-d", args.data_sizes,
+               "-t", args.trials, "-w", args.warmup]
+      print(f"{path}: {' '.join(argv)}", file=sys.stderr)
+      # a path that is not built or has no device here should not cost the others
+      status, runs = run(argv, raw)
+      if status != 0:
+        print(f"{path}: exit {status} after {len(runs)} points", file=sys.stderr)
+        failed.append(path)
+      for line in runs:
+        writer.writerow(tidy(path, line))
+      f.flush()
+
+  if failed:
+    print(f"failed: {','.join(failed)}", file=sys.stderr)
+    sys.exit(1)
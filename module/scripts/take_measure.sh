@@ -1,19 +1,9 @@
-for ds in 8 16 32 64 128 256 512; do
-    for ms in 32 64 128 256 512 1024 2048; do
-        echo MAP_SIZE: ${ms} DATA_SIZE: ${ds}
-        #export BENCH_CFLAGS="-DBENCH_GET_DATA_SIZE=${ds} -DBENCH_GET_ARRAY_SIZE=${ms}"
-        #export BENCH_ARGS="-s${ms} -d ${ds}"
-        #export KBUILD=/var/local/adityat/kbuild
-        #export REPSRC=/var/local/adityat/LDOS/KernMLOps/module
-        #export KHEADS=/usr/src/linux-headers-6.12.0-g0a2d0d569a5b
-        #export MODULE=/
-        #export SUDO="sudo"
-        #make -s undeploy
-        #make -s test
-        #for i in $(seq 1 30); do python3 python/bench_ebpf_space.py -s ${ms} -d ${ds} 3>>ebpf-map-${ds}-${ms}.stats; done
-        for i in $(seq 1 30); do ./build/test/kdev/bpf_map_bench -n 100000 -s ${ms} -d ${ds} 3>>user-mmap-${ds}-${ms}.stats; done
-        #for i in `seq 1 30`; do ./build/test/e2e/bench_kernel_get/bench_kernel_get -f -n 100000 -s ${ms} -d ${ds} 3>> kmod-map-${ds}-${ms}.stats; done
-        #for i in `seq 1 30`; do ./build/test/e2e/bench_kernel_get/bench_kernel_get -a -n 100000 -s ${ms} -d ${ds} 3>> kmod-array-${ds}-${ms}.stats; done
-        #for i in `seq 1 30`; do ./test/user-ksched/user_ksched -a -n 100000 -s ${ms} -d ${ds} 3>> user-ksched-${ds}-${ms}.stats 4>> returner; done
-    done
-done
+# The data size x map size matrix over every access path, each path sweeping
+# it in one process, see sweep.py. The kmod paths need bench_kernel_get loaded
+# once, at any BENCH_CFLAGS.
+python3 $(dirname $0)/sweep.py -d 8,16,32,64,128,256,512 -s 32,64,128,256,512,1024,2048 \
+    -t 30 -n 100000 -o measure.csv "$@"
+#python3 $(dirname $0)/sweep.py -p kmod-batch,kmod-handle,kmod-this-cpu,kmod-reduce,kmod-consistent,user-ksched-view \
+#    -d 8,16,32,64,128,256,512 -s 32,64,128,256,512,1024,2048 -t 30 -n 100000 -o measure-extra.csv
+#./build/test/e2e/bench_kernel_get/bench_kernel_get -t 30 -k $(nproc) -n 100000 -s 2048 -d 256 3>> kmod-scale.stats
+#./test/user-ksched/ksched_ring_bench -t 30 -n 100000 -s 2048 -d 256 -p 0 -C 1 3>> ksched-ring.stats
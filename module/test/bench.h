@@ -0,0 +1,457 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+// Shared microbenchmark harness for the test/ benchmarks.
+//
+// A benchmark parses its flags with bench::Options::parse, pins itself with
+// bench::pin_cpu and times its loop with bench::time_ops (operations issued
+// from user space) or bench::time_trials (loops timed elsewhere, e.g. in the
+// kernel). Both run untimed warmup trials, then the timed ones, and return a
+// bench::Result that bench::Report writes as one JSON line to STAT_FD. -s and
+// -d take comma separated lists, a benchmark sweeps Options::points() so one
+// process covers a whole map size x data size matrix.
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <getopt.h>
+#include <linux/perf_event.h>
+#include <linux/types.h>
+#include <optional>
+#include <sched.h>
+#include <string>
+#include <string_view>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace bench {
+
+constexpr int STAT_FD = 3;
+constexpr __u64 DEFAULT_NUMBER = 10;
+constexpr __u32 DEFAULT_SIZE = 10;
+constexpr __u32 DEFAULT_DATA_SIZE = 8;
+
+// "32,64,128" as {32, 64, 128}
+inline std::vector<__u32> parse_list(const char* arg) {
+  std::vector<__u32> values;
+  char* end = (char*)arg;
+  do {
+    values.push_back(strtoul(end, &end, 10));
+  } while (*end++ == ',');
+  return values;
+}
+
+struct Options {
+  __u64 number = DEFAULT_NUMBER;
+  // The first of sizes and data_sizes
+  __u32 size = DEFAULT_SIZE;
+  __u32 data_size = DEFAULT_DATA_SIZE;
+  std::vector<__u32> sizes{DEFAULT_SIZE};
+  std::vector<__u32> data_sizes{DEFAULT_DATA_SIZE};
+  __u32 trials = 1;
+  __u32 warmup = 1;
+  // Operations per latency sample, 1 reads the clock around every operation
+  __u64 batch = 100;
+  int cpu = -1;
+  bool perf = false;
+
+  // Parses -n -s -d -t -w -B -C -P, handing any flag of `extra` to `on_extra`
+  static Options parse(int argc, char** argv, const char* extra = "",
+                       std::function<void(int, const char*)> on_extra = {},
+                       const char* extra_usage = "") {
+    Options opts;
+    std::string optstring = std::string("n:s:d:t:w:B:C:P") + extra;
+    int c;
+    while ((c = getopt(argc, argv, optstring.c_str())) != -1) {
+      switch (c) {
+        case 'n':
+          opts.number = strtoull(optarg, NULL, 10);
+          break;
+        case 's':
+          opts.sizes = parse_list(optarg);
+          break;
+        case 'd':
+          opts.data_sizes = parse_list(optarg);
+          break;
+        case 't':
+          opts.trials = strtoul(optarg, NULL, 10);
+          break;
+        case 'w':
+          opts.warmup = strtoul(optarg, NULL, 10);
+          break;
+        case 'B':
+          opts.batch = strtoull(optarg, NULL, 10);
+          break;
+        case 'C':
+          opts.cpu = strtol(optarg, NULL, 10);
+          break;
+        case 'P':
+          opts.perf = true;
+          break;
+        default:
+          if (c != '?' && on_extra) {
+            on_extra(c, optarg);
+            break;
+          }
+          fprintf(stderr,
+                  "%s [-n <number>] [-s <map-size>,...] [-d <data-size>,...] [-t <trials>]"
+                  " [-w <warmup>] [-B <batch>] [-C <cpu>] [-P] %s\n",
+                  argv[0], extra_usage);
+          exit(-1);
+          break;
+      }
+    }
+    // Resize
+    for (__u32& data_size : opts.data_sizes) {
+      data_size = data_size < DEFAULT_DATA_SIZE ? DEFAULT_DATA_SIZE : data_size;
+      data_size = data_size / DEFAULT_DATA_SIZE * DEFAULT_DATA_SIZE;
+    }
+    opts.size = opts.sizes[0];
+    opts.data_size = opts.data_sizes[0];
+    opts.trials = std::max(opts.trials, 1u);
+    opts.batch = std::max(opts.batch, (__u64)1);
+    return opts;
+  }
+
+  // One Options per data size and map size pair, every map size of a data
+  // size before the next data size
+  std::vector<Options> points() const {
+    std::vector<Options> all;
+    for (__u32 d : data_sizes) {
+      for (__u32 s : sizes) {
+        Options point = *this;
+        point.size = s;
+        point.data_size = d;
+        point.sizes = {s};
+        point.data_sizes = {d};
+        all.push_back(point);
+      }
+    }
+    return all;
+  }
+};
+
+// Pins the calling thread, a negative cpu leaves it where it is
+inline void pin_cpu(int cpu) {
+  if (cpu < 0) return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+    fprintf(stderr, "pin to cpu %d: %s\n", cpu, strerror(errno));
+    exit(-errno);
+  }
+}
+
+// A value of Bytes bytes read as 32 bit words
+template <__u32 Bytes>
+struct Words {
+  static_assert(Bytes % sizeof(__u32) == 0);
+  __u32 words[Bytes / sizeof(__u32)];
+};
+
+// The data sizes a benchmark compiles a statically sized loop for
+template <__u32... Sizes>
+struct DataSizes {};
+using StaticDataSizes = DataSizes<8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096>;
+
+// Calls f(std::integral_constant<__u32, data_size>{}) if data_size is one of
+// Sizes, returns whether it was
+template <typename F, __u32... Sizes>
+bool with_data_size(__u32 data_size, F&& f, DataSizes<Sizes...>) {
+  return ((data_size == Sizes && (f(std::integral_constant<__u32, Sizes>{}), true)) || ...);
+}
+
+template <typename F>
+bool with_data_size(__u32 data_size, F&& f) {
+  return with_data_size(data_size, std::forward<F>(f), StaticDataSizes{});
+}
+
+// Keeps the compiler from dropping a result it cannot see used
+template <typename T>
+inline void do_not_optimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Log-linear histogram, values land in one of 2^SUB_BITS buckets per power of
+// two so percentiles are within about 3% of the recorded value
+class Histogram {
+  static constexpr int SUB_BITS = 5;
+  static constexpr __u64 SUB_COUNT = 1 << SUB_BITS;
+  static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+  std::array<__u64, BUCKETS> counts_{};
+  __u64 count_ = 0;
+  __u64 sum_ = 0;
+  __u64 min_ = ~0ull;
+  __u64 max_ = 0;
+
+  static size_t index(__u64 value) {
+    if (value < SUB_COUNT) return value;
+    int msb = 63 - __builtin_clzll(value);
+    return (msb - SUB_BITS + 1) * SUB_COUNT + ((value >> (msb - SUB_BITS)) & (SUB_COUNT - 1));
+  }
+
+  static __u64 midpoint(size_t idx) {
+    if (idx < SUB_COUNT) return idx;
+    int shift = idx / SUB_COUNT - 1;
+    __u64 lower = (SUB_COUNT + idx % SUB_COUNT) << shift;
+    return lower + ((1ull << shift) >> 1);
+  }
+
+ public:
+  void record(__u64 value) {
+    counts_[index(value)]++;
+    count_++;
+    sum_ += value;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+
+  __u64 count() const { return count_; }
+  __u64 min() const { return count_ ? min_ : 0; }
+  __u64 max() const { return max_; }
+  double mean() const { return count_ ? (double)sum_ / count_ : 0; }
+
+  // p in [0, 1]
+  __u64 percentile(double p) const {
+    if (count_ == 0) return 0;
+    __u64 rank = std::max((__u64)(p * count_ + 0.5), (__u64)1);
+    __u64 seen = 0;
+    for (size_t idx = 0; idx < BUCKETS; idx++) {
+      seen += counts_[idx];
+      if (seen >= rank) return std::clamp(midpoint(idx), min_, max_);
+    }
+    return max_;
+  }
+};
+
+enum Counter { CYCLES, LLC_MISSES, DTLB_MISSES, COUNTERS };
+constexpr std::array<const char*, COUNTERS> COUNTER_NAMES = {"cycles", "llc_misses",
+                                                             "dtlb_misses"};
+
+// Hardware counters of the calling thread, kernel time included where
+// perf_event_paranoid allows it. Counters the machine lacks read as nullopt.
+class PerfCounters {
+  std::array<int, COUNTERS> fds_;
+
+  static int open_counter(__u32 type, __u64 config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+      attr.exclude_kernel = 1;
+      fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    return fd;
+  }
+
+  static constexpr __u64 cache_miss(__u64 cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  }
+
+  void each(unsigned long request) {
+    for (int fd : fds_)
+      if (fd >= 0) ioctl(fd, request, 0);
+  }
+
+ public:
+  explicit PerfCounters(bool enabled) {
+    fds_.fill(-1);
+    if (!enabled) return;
+    fds_[CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds_[LLC_MISSES] = open_counter(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL));
+    fds_[DTLB_MISSES] = open_counter(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_DTLB));
+  }
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+  ~PerfCounters() {
+    for (int fd : fds_)
+      if (fd >= 0) close(fd);
+  }
+
+  void start() { each(PERF_EVENT_IOC_ENABLE); }
+  void stop() { each(PERF_EVENT_IOC_DISABLE); }
+
+  // Totals over every start/stop, scaled up if the counter was multiplexed
+  std::array<std::optional<__u64>, COUNTERS> read() const {
+    std::array<std::optional<__u64>, COUNTERS> values;
+    for (int i = 0; i < COUNTERS; i++) {
+      __u64 buf[3];
+      if (fds_[i] < 0 || ::read(fds_[i], buf, sizeof(buf)) != sizeof(buf)) continue;
+      values[i] = buf[2] ? (__u64)((double)buf[0] * buf[1] / buf[2]) : buf[0];
+    }
+    return values;
+  }
+};
+
+struct Result {
+  // Wall time of each timed trial
+  std::vector<__u64> trial_ns;
+  // Per operation latency in picoseconds
+  Histogram op_ps;
+  std::array<std::optional<__u64>, COUNTERS> counters;
+};
+
+using Clock = std::chrono::steady_clock;
+
+inline __u64 elapsed_ns(Clock::time_point start, Clock::time_point stop) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+}
+
+// Calls op(i) opts.number times per trial, sampling latency every opts.batch
+// operations. Trial times include those clock reads.
+template <typename Op>
+Result time_ops(const Options& opts, Op&& op) {
+  Result result;
+  PerfCounters counters(opts.perf);
+  for (__u32 trial = 0; trial < opts.warmup + opts.trials; trial++) {
+    bool timed = trial >= opts.warmup;
+    if (timed) counters.start();
+    const auto start = Clock::now();
+    auto batch_start = start;
+    __u64 in_batch = 0;
+    for (__u64 i = 0; i < opts.number; i++) {
+      op(i);
+      if (++in_batch == opts.batch || i + 1 == opts.number) {
+        const auto now = Clock::now();
+        if (timed) result.op_ps.record(elapsed_ns(batch_start, now) * 1000 / in_batch);
+        batch_start = now;
+        in_batch = 0;
+      }
+    }
+    const auto stop = Clock::now();
+    if (timed) {
+      counters.stop();
+      result.trial_ns.push_back(elapsed_ns(start, stop));
+    }
+  }
+  result.counters = counters.read();
+  return result;
+}
+
+// Calls trial() once per trial, it runs opts.number operations and returns
+// the nanoseconds they took, so only the mean latency of each trial is known
+template <typename Trial>
+Result time_trials(const Options& opts, Trial&& trial) {
+  Result result;
+  PerfCounters counters(opts.perf);
+  for (__u32 i = 0; i < opts.warmup + opts.trials; i++) {
+    bool timed = i >= opts.warmup;
+    if (timed) counters.start();
+    __u64 ns = trial();
+    if (timed) {
+      counters.stop();
+      result.trial_ns.push_back(ns);
+      result.op_ps.record(opts.number ? ns * 1000 / opts.number : 0);
+    }
+  }
+  result.counters = counters.read();
+  return result;
+}
+
+// One JSON object per line, scripts/bench_stats.py turns them into tables
+class Report {
+  std::string fields_;
+
+  void key(std::string_view name) {
+    fields_ += ",\"";
+    fields_ += name;
+    fields_ += "\":";
+  }
+
+ public:
+  Report(std::string_view bench_name, std::string_view mode, const Options& opts) {
+    fields_ += "{\"bench\":\"";
+    fields_ += bench_name;
+    fields_ += "\"";
+    field("mode", mode);
+    field("iterations", opts.number);
+    field("map_size", (__u64)opts.size);
+    field("value_size", (__u64)opts.data_size);
+    field("trials", (__u64)opts.trials);
+    field("warmup", (__u64)opts.warmup);
+    field("batch", opts.batch);
+    field("cpu", (__s64)opts.cpu);
+  }
+
+  Report& field(std::string_view name, std::string_view value) {
+    key(name);
+    fields_ += "\"";
+    fields_ += value;
+    fields_ += "\"";
+    return *this;
+  }
+  Report& field(std::string_view name, const char* value) {
+    return field(name, std::string_view(value));
+  }
+  Report& field(std::string_view name, __u64 value) {
+    key(name);
+    fields_ += std::to_string(value);
+    return *this;
+  }
+  Report& field(std::string_view name, __s64 value) {
+    key(name);
+    fields_ += std::to_string(value);
+    return *this;
+  }
+  Report& field(std::string_view name, double value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3f", value);
+    key(name);
+    fields_ += buf;
+    return *this;
+  }
+
+  std::string json(const Result& result) const {
+    Report report = *this;
+    std::string trials = "[";
+    for (size_t i = 0; i < result.trial_ns.size(); i++) {
+      if (i) trials += ",";
+      trials += std::to_string(result.trial_ns[i]);
+    }
+    report.key("trial_ns");
+    report.fields_ += trials + "]";
+    const Histogram& ps = result.op_ps;
+    report.field("ns_per_op_mean", ps.mean() / 1000)
+        .field("ns_per_op_min", ps.min() / 1000.0)
+        .field("ns_per_op_p50", ps.percentile(0.5) / 1000.0)
+        .field("ns_per_op_p99", ps.percentile(0.99) / 1000.0)
+        .field("ns_per_op_p999", ps.percentile(0.999) / 1000.0)
+        .field("ns_per_op_max", ps.max() / 1000.0);
+    for (int i = 0; i < COUNTERS; i++) {
+      if (result.counters[i]) {
+        report.field(COUNTER_NAMES[i], *result.counters[i]);
+      } else {
+        report.key(COUNTER_NAMES[i]);
+        report.fields_ += "null";
+      }
+    }
+    return report.fields_ + "}\n";
+  }
+
+  // Writes to STAT_FD when the caller opened it, returns whether it did
+  bool write(const Result& result, int fd = STAT_FD) const {
+    if (fcntl(fd, F_GETFD) == -1) return false;
+    std::string line = json(result);
+    return ::write(fd, line.data(), line.size()) == (ssize_t)line.size();
+  }
+};
+
+}  // namespace bench
+
+#endif  //_BENCH_H_
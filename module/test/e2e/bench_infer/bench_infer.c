@@ -0,0 +1,341 @@
+/*
+ * bench_infer.c - Kernel module for timing fstore_infer models
+ */
+
+#include <linux/module.h>	/* Needed by all modules */
+#include <linux/printk.h>	/* Needed for pr_info() */
+#include <linux/fs.h> 		/* Needed for ioctl api */
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/kdev_t.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include "../../../fstore/fstore.h"
+#include "../../../fstore/fstore_infer.h"
+#include "bench_infer.h"
+
+#ifndef BENCH_INFER_TREE_DEPTH
+#define BENCH_INFER_TREE_DEPTH 6
+#endif
+
+/* feature vectors BENCH_INFER_RUN copies out before timing */
+#ifndef BENCH_INFER_ROWS
+#define BENCH_INFER_ROWS 64
+#endif
+
+/* the MLP is n_features -> size -> size -> 1 */
+#define BENCH_INFER_MLP_LAYERS 3
+
+/* "bnchinfr" packed into a u64 */
+#define BENCH_INFER_MODEL 0x72666e6968636e62ULL
+
+dev_t dev = 0;
+static struct class *dev_class;
+static struct cdev bench_infer_cdev;
+
+int fstore_get(u64 map_name,
+		void* key,
+		size_t key_size,
+		void* value,
+		size_t value_size);
+
+int fstore_get_value_size(u64 map_name,
+		size_t* size);
+
+int fstore_infer_register(u64 model_name,
+		const struct fstore_model* desc);
+
+int fstore_infer_unregister(u64 model_name);
+
+int fstore_infer_eval(u64 model_name,
+		void* key,
+		size_t key_size,
+		s64* out);
+
+int fstore_infer_run(u64 model_name,
+		const s32* features,
+		s64* out);
+
+static long bench_infer_ioctl(struct file *file,
+				unsigned int cmd,
+				unsigned long data);
+
+static struct file_operations fops = {
+	.owner = THIS_MODULE,
+	.read = NULL,
+	.write = NULL,
+	.open = NULL,
+	.unlocked_ioctl = bench_infer_ioctl,
+	.release = NULL,
+};
+
+typedef struct bench_infer_args bia_t;
+
+typedef struct ShiftXor shift_xor;
+
+const shift_xor START_RANDOM = {1, 4, 7, 13};
+
+/* a Q16.16 value in [-range, range) */
+static inline s32 bench_fixed(shift_xor* rand, s32 range) {
+	return (s32) (simplerand(rand) % (2 * (u64) range)) - range;
+}
+
+/* a complete tree of the given depth depth first from nodes[at] on */
+static u32 bench_build_tree(struct fstore_tree_node* nodes, u32 at,
+		u32 depth, u32 n_features, shift_xor* rand) {
+	if(depth == 0) {
+		nodes[at].feature = FSTORE_TREE_LEAF;
+		nodes[at].value = bench_fixed(rand, FSTORE_INFER_ONE / 16);
+		nodes[at].right = 0;
+		return at + 1;
+	}
+	nodes[at].feature = simplerand(rand) % n_features;
+	nodes[at].value = bench_fixed(rand, FSTORE_INFER_ONE);
+	u32 right = bench_build_tree(nodes, at + 1, depth - 1, n_features, rand);
+	nodes[at].right = right - at;
+	return bench_build_tree(nodes, right, depth - 1, n_features, rand);
+}
+
+/*
+ * Register a random model of the benchmarked type. The arrays are scratch,
+ * fstore_infer_register keeps its own copy.
+ */
+static int bench_register_model(bia_t* bia) {
+	int err = 0;
+	shift_xor rand = START_RANDOM;
+	struct fstore_model desc = {
+		.type = bia->type,
+		.n_features = bia->n_features,
+		.feature_map = bia->map_name,
+	};
+	s32* weights = NULL;
+	u32* roots = NULL;
+	struct fstore_tree_node* nodes = NULL;
+	struct fstore_mlp_layer layers[BENCH_INFER_MLP_LAYERS];
+	void* mlp_arrays[2 * BENCH_INFER_MLP_LAYERS] = {NULL};
+
+	if(!bia->n_features || bia->n_features > FSTORE_INFER_MAX_FEATURES)
+		return -EINVAL;
+
+	switch(bia->type) {
+	case FSTORE_MODEL_LINEAR:
+	case FSTORE_MODEL_LOGISTIC:
+		weights = kvmalloc_array(bia->n_features, sizeof(s32), GFP_KERNEL);
+		if(!weights) return -ENOMEM;
+		for(u32 i = 0; i < bia->n_features; i++)
+			weights[i] = bench_fixed(&rand, FSTORE_INFER_ONE);
+		desc.linear.weights = weights;
+		break;
+
+	case FSTORE_MODEL_GBDT: {
+		const u32 per_tree = (2 << BENCH_INFER_TREE_DEPTH) - 1;
+		if(!bia->size) return -EINVAL;
+		roots = kvmalloc_array(bia->size, sizeof(u32), GFP_KERNEL);
+		nodes = kvmalloc_array((size_t) bia->size * per_tree,
+				sizeof(*nodes), GFP_KERNEL);
+		if(!roots || !nodes) { err = -ENOMEM; goto cleanup; }
+		for(u32 t = 0; t < bia->size; t++) {
+			roots[t] = t * per_tree;
+			bench_build_tree(nodes, roots[t], BENCH_INFER_TREE_DEPTH,
+					bia->n_features, &rand);
+		}
+		desc.gbdt.n_trees = bia->size;
+		desc.gbdt.n_nodes = bia->size * per_tree;
+		desc.gbdt.roots = roots;
+		desc.gbdt.nodes = nodes;
+		break;
+	}
+
+	case FSTORE_MODEL_MLP: {
+		const u32 widths[BENCH_INFER_MLP_LAYERS + 1] = {
+			bia->n_features, bia->size, bia->size, 1,
+		};
+		if(!bia->size || bia->size > FSTORE_MLP_MAX_WIDTH ||
+			bia->n_features > FSTORE_MLP_MAX_WIDTH) return -EINVAL;
+		for(u32 l = 0; l < BENCH_INFER_MLP_LAYERS; l++) {
+			u32 in = widths[l], out = widths[l + 1];
+			s8* w = kvmalloc_array(in, out, GFP_KERNEL);
+			s32* b = kvmalloc_array(out, sizeof(s32), GFP_KERNEL);
+			mlp_arrays[2 * l] = w;
+			mlp_arrays[2 * l + 1] = b;
+			if(!w || !b) { err = -ENOMEM; goto cleanup; }
+			for(size_t i = 0; i < (size_t) in * out; i++)
+				w[i] = (s8) simplerand(&rand);
+			for(u32 o = 0; o < out; o++)
+				b[o] = (s32) (simplerand(&rand) % 256) - 128;
+			/* sums of in products of two int8s back to about int8 */
+			layers[l] = (struct fstore_mlp_layer) {
+				.in = in,
+				.out = out,
+				.weights = w,
+				.bias = b,
+				.multiplier = 1,
+				.shift = ilog2(in) + 7,
+			};
+		}
+		/* Q16.16 in [-1, 1) to int8 */
+		desc.mlp.input_shift = FSTORE_INFER_FRAC_BITS - 7;
+		desc.mlp.n_layers = BENCH_INFER_MLP_LAYERS;
+		desc.mlp.layers = layers;
+		break;
+	}
+
+	default:
+		return -EINVAL;
+	}
+
+	err = fstore_infer_register(BENCH_INFER_MODEL, &desc);
+	if(err) pr_err("%s:%d Registering the model failed %d\n",
+			__FILE__, __LINE__, err);
+
+cleanup:
+	for(u32 i = 0; i < 2 * BENCH_INFER_MLP_LAYERS; i++) kvfree(mlp_arrays[i]);
+	kvfree(nodes);
+	kvfree(roots);
+	kvfree(weights);
+	return err;
+}
+
+static int bench_infer_eval(bia_t* bia, __u64* nanos) {
+	int err = 0;
+	shift_xor rand = START_RANDOM;
+	s64 out = 0;
+	s64 checksum = 0;
+	__u64 start = ktime_get_raw_fast_ns();
+	for(__u64 i = 0; i < bia->number; i++) {
+		__u32 key = simplerand(&rand) % bia->keys;
+		if(( err = fstore_infer_eval(BENCH_INFER_MODEL, &key, 4, &out) )) {
+			pr_err("%s:%d Huge error occurred fstore_infer_eval",
+					__FILE__, __LINE__);
+			return err;
+		}
+		checksum += out;
+	}
+	__u64 stop = ktime_get_raw_fast_ns();
+	*nanos = stop - start;
+	bia->checksum = checksum;
+	return 0;
+}
+
+static int bench_infer_run(bia_t* bia, __u64* nanos) {
+	int err = 0;
+	size_t value_size;
+	if(( err = fstore_get_value_size(bia->map_name, &value_size) )) return err;
+	const u32 rows = min_t(u32, bia->keys, BENCH_INFER_ROWS);
+	u8* features = kvmalloc_array(rows, value_size, GFP_KERNEL);
+	if(!features) return -ENOMEM;
+	for(u32 key = 0; key < rows && !err; key++)
+		err = fstore_get(bia->map_name, &key, 4,
+				features + key * value_size, value_size);
+	if(err) goto cleanup;
+
+	shift_xor rand = START_RANDOM;
+	s64 out = 0;
+	s64 checksum = 0;
+	__u64 start = ktime_get_raw_fast_ns();
+	for(__u64 i = 0; i < bia->number; i++) {
+		u32 row = simplerand(&rand) % rows;
+		if(( err = fstore_infer_run(BENCH_INFER_MODEL,
+				(s32*) (features + row * value_size), &out) )) {
+			pr_err("%s:%d Huge error occurred fstore_infer_run",
+					__FILE__, __LINE__);
+			goto cleanup;
+		}
+		checksum += out;
+	}
+	__u64 stop = ktime_get_raw_fast_ns();
+	*nanos = stop - start;
+	bia->checksum = checksum;
+cleanup:
+	kvfree(features);
+	return err;
+}
+
+static long bench_infer_ioctl(struct file* file,
+				unsigned int cmd,
+				unsigned long data)
+{
+	int err = -EINVAL;
+	bia_t* uptr = (bia_t*) data;
+	bia_t bia;
+	__u64 nanos = 0;
+	if( copy_from_user(&bia, uptr, sizeof(bia_t)) )
+	{
+		pr_err("Getting initial struct impossible\n");
+		return -EINVAL;
+	}
+	if(bia.keys == 0) return -EINVAL;
+	if(cmd != BENCH_INFER_EVAL && cmd != BENCH_INFER_RUN) {
+		pr_info("%s:%d Invalid Command arrived %u\n",
+				__FILE__, __LINE__, cmd);
+		return -EINVAL;
+	}
+
+	if(( err = bench_register_model(&bia) )) return err;
+	if(cmd == BENCH_INFER_EVAL) err = bench_infer_eval(&bia, &nanos);
+	else err = bench_infer_run(&bia, &nanos);
+	fstore_infer_unregister(BENCH_INFER_MODEL);
+
+	bia.number = nanos;
+	if( err == 0 && copy_to_user(uptr, &bia, sizeof(bia_t)) ) {
+		pr_err("Copy to User was thwarted\n");
+		err = -EINVAL;
+	}
+	return err;
+}
+
+int __init init_module(void)
+{
+	/*Allocating Major number*/
+	if((alloc_chrdev_region(&dev, 0, 1, NAME"_dev")) < 0){
+		pr_err("Cannot allocate major number\n");
+		return -1;
+	}
+
+	pr_info("Major = %d Minor = %d \n",MAJOR(dev), MINOR(dev));
+
+	/*Creating cdev structure*/
+	cdev_init(&bench_infer_cdev, &fops);
+
+	/*Adding character device to the system*/
+	if((cdev_add(&bench_infer_cdev, dev, 1)) < 0){
+		pr_err("Cannot add the device to the system\n");
+		goto r_class;
+	}
+
+	/*Creating struct class*/
+	if(IS_ERR(dev_class = class_create(NAME "_class"))){
+		pr_err("Cannot create the struct class\n");
+		goto r_class;
+	}
+
+	/*Creating device*/
+	if(IS_ERR(device_create(dev_class, NULL, dev, NULL, NAME "_device"))){
+		pr_err("Cannot create the Device 1\n");
+		goto r_device;
+	}
+
+	pr_info(NAME " Driver Insert...Done!!!\n");
+	return 0;
+
+r_device:
+	class_destroy(dev_class);
+r_class:
+	unregister_chrdev_region(dev,1);
+	return -1;
+}
+
+void __exit cleanup_module(void)
+{
+	/* release device*/
+	device_destroy(dev_class,dev);
+	class_destroy(dev_class);
+	cdev_del(&bench_infer_cdev);
+	unregister_chrdev_region(dev, 1);
+
+	pr_info(NAME " exit\n");
+}
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Aditya Tewari <adityaatewari@gmail.com>");
+MODULE_DESCRIPTION("benchmark fixed point models over the feature store");
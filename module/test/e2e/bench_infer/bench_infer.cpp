@@ -0,0 +1,154 @@
+#include "bench_infer.h"
+#include "../../../fstore/fstore.h"
+#include "../../../fstore/fstore_infer.h"
+#include "../../bench.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <initializer_list>
+#include <iostream>
+#include <linux/bpf.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#define ASSERT_ERRNO(x)                                                            \
+  if (!(x)) {                                                                      \
+    int err_errno = errno;                                                         \
+    fprintf(stderr, "%s:%d: errno:%s\n", __FILE__, __LINE__, strerror(err_errno)); \
+    std::exit(-err_errno);                                                         \
+  }
+
+constexpr __u64 MAP_NAME = unsafeHashConvert("benchinf");
+
+// Trees of a GBDT and hidden widths of an MLP to sweep
+constexpr std::initializer_list<__u32> GBDT_SIZES = {1, 10, 100, 500};
+constexpr std::initializer_list<__u32> MLP_SIZES = {16, 64, 256};
+
+// An array map of `size` feature vectors of data_size bytes, Q16.16 in [-1, 1)
+int create_features(int fd, __u32 data_size, __u32 size) {
+  union bpf_attr attr = {
+      .map_type = BPF_MAP_TYPE_ARRAY,
+      .key_size = 4,
+      .value_size = data_size,
+      .max_entries = size,
+  };
+  int ebpf_fd = syscall(SYS_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
+  if (ebpf_fd < 0) {
+    auto err = errno;
+    std::cerr << "Failed to create map: " << err << ", " << std::strerror(err) << std::endl;
+    std::exit(ebpf_fd);
+  }
+
+  register_input reg = {.map_name = MAP_NAME, .fd = (__u32)ebpf_fd};
+  int err = ioctl(fd, REGISTER_MAP, (unsigned long)&reg);
+  ASSERT_ERRNO(err == 0);
+
+  ShiftXor rand{1, 4, 7, 13};
+  std::vector<__u32> keys(size);
+  std::vector<__s32> features((size_t)size * data_size / 4);
+  for (__u32 i = 0; i < size; i++) keys[i] = i;
+  for (auto& feature : features) {
+    feature = (__s32)(simplerand(&rand) % (2 * FSTORE_INFER_ONE)) - FSTORE_INFER_ONE;
+  }
+  load_input load = {.map_name = MAP_NAME};
+  load.attr.batch.keys = (__u64)keys.data();
+  load.attr.batch.values = (__u64)features.data();
+  load.attr.batch.count = size;
+  err = ioctl(fd, LOAD_MAP, (unsigned long)&load);
+  ASSERT_ERRNO(err == 0 && load.attr.batch.count == size);
+  return ebpf_fd;
+}
+
+enum Command : __u32 {
+  NONE = 0x0,
+  LINEAR = 0x1,
+  GBDT = (0x1 << 1),
+  MLP = (0x1 << 2),
+};
+
+int main(int argc, char** argv) {
+  enum Command cmd = NONE;
+  bool cached = false;
+  const auto opts = bench::Options::parse(
+      argc, argv, "lgmc",
+      [&](int c, const char*) {
+        switch (c) {
+          case 'l':
+            cmd = (Command)(cmd | LINEAR);
+            break;
+          case 'g':
+            cmd = (Command)(cmd | GBDT);
+            break;
+          case 'm':
+            cmd = (Command)(cmd | MLP);
+            break;
+          case 'c':
+            cached = true;
+            break;
+        }
+      },
+      "[-l | -g | -m] [-c]");
+  // -d is the feature vector, every model reads all of it
+  const __u32 n_features = opts.data_size / 4;
+  bench::pin_cpu(opts.cpu);
+
+  int fd = open("/dev/fstore_device", O_RDWR);
+  ASSERT_ERRNO(fd >= 0);
+  int ebpf_fd = create_features(fd, opts.data_size, opts.size);
+
+  int bifd = open("/dev/" NAME "_device", O_RDWR);
+  ASSERT_ERRNO(bifd >= 0);
+
+  // Each model type and size gets its own trials and stats line
+  auto run_one = [&](const char* model, __u32 type, __u32 size, bool run_cached) {
+    __s64 checksum = 0;
+    const auto result = bench::time_trials(opts, [&] {
+      bench_infer_args bia = {
+          .map_name = MAP_NAME,
+          .number = opts.number,
+          .type = type,
+          .size = size,
+          .n_features = n_features,
+          .keys = opts.size,
+      };
+      int err = ioctl(bifd, run_cached ? BENCH_INFER_RUN : BENCH_INFER_EVAL, (unsigned long)&bia);
+      ASSERT_ERRNO(err == 0);
+      checksum = bia.checksum;
+      return bia.number;
+    });
+    const std::string mode = std::string(run_cached ? "run_" : "eval_") + model;
+    bench::Report report(NAME, mode, opts);
+    report.field("model_size", (__u64)size)
+        .field("features", (__u64)n_features)
+        .field("checksum", (__s64)checksum);
+    if (report.write(result)) std::cerr << "Output to stats" << std::endl;
+  };
+  // -c adds the same models evaluated on features already fetched
+  auto run = [&](const char* model, __u32 type, __u32 size) {
+    run_one(model, type, size, false);
+    if (cached) run_one(model, type, size, true);
+  };
+
+  if (cmd & LINEAR) {
+    run("linear", FSTORE_MODEL_LINEAR, n_features);
+    run("logistic", FSTORE_MODEL_LOGISTIC, n_features);
+  }
+  if (cmd & GBDT) {
+    for (__u32 trees : GBDT_SIZES) run("gbdt", FSTORE_MODEL_GBDT, trees);
+  }
+  if (cmd & MLP) {
+    for (__u32 width : MLP_SIZES) run("mlp", FSTORE_MODEL_MLP, width);
+  }
+
+  close(bifd);
+  int err = ioctl(fd, UNREGISTER_MAP, MAP_NAME);
+  ASSERT_ERRNO(err == 1);
+  close(fd);
+  close(ebpf_fd);
+  return 0;
+}
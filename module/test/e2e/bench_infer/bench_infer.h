@@ -0,0 +1,49 @@
+#ifndef _BENCH_INFER_H_
+#define _BENCH_INFER_H_
+#include <linux/types.h>
+
+#define NAME "bench_infer"
+
+enum BENCH_INFER_COMMAND {
+	/* features fetched from the map with fstore_infer_eval */
+	BENCH_INFER_EVAL = 0x1,
+	/* features already at hand, fstore_infer_run */
+	BENCH_INFER_RUN = 0x2,
+};
+
+struct bench_infer_args {
+	__u64 map_name;
+	/* evaluations in, nanoseconds out */
+	__u64 number;
+	/* enum fstore_model_type */
+	__u32 type;
+	/* trees of a GBDT or hidden width of an MLP, unused by linear models */
+	__u32 size;
+	/* Q16.16 features at the start of each map value */
+	__u32 n_features;
+	/* keys of the feature map, evaluated in random order */
+	__u32 keys;
+	/* sum of every output, so runs can be compared */
+	__s64 checksum;
+};
+
+struct ShiftXor {
+	__u64 w;
+	__u64 x;
+	__u64 y;
+	__u64 z;
+};
+
+inline __u64 simplerand(struct ShiftXor* rand) {
+	__u64 t = rand->x;
+	t ^= t << 11;
+	t ^= t >> 8;
+	rand->x = rand->y;
+	rand->y = rand->z;
+	rand->z = rand->w;
+	rand->w ^= rand->w >> 19;
+	rand->w ^= t;
+	return rand->w;
+}
+
+#endif //_BENCH_INFER_H_
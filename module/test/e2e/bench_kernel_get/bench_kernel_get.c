@@ -9,6 +9,10 @@
 #include <linux/device.h>
 #include <linux/kdev_t.h>
 #include <linux/hashtable.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include "../../../fstore/fstore.h"
 #include "bench_kernel_get.h"
@@ -23,6 +27,14 @@
 #define BENCH_GET_ARRAY_SIZE 10
 #endif
 
+#ifndef BENCH_GET_MAX_DATA_SIZE
+#define BENCH_GET_MAX_DATA_SIZE 4096
+#endif
+
+#ifndef BENCH_GET_BATCH_SIZE
+#define BENCH_GET_BATCH_SIZE 32
+#endif
+
 dev_t dev = 0;
 static struct class *dev_class;
 static struct cdev bench_get_many_cdev;
@@ -33,6 +45,57 @@ int fstore_get(u64 map_name,
 		void* value,
 		size_t value_size);
 
+int fstore_get_rcu(u64 map_name,
+		void* key,
+		size_t key_size,
+		void* value,
+		size_t value_size);
+
+int fstore_get_batch(u64 map_name,
+		void* keys,
+		size_t n,
+		void* values,
+		size_t stride);
+
+int fstore_get_this_cpu(u64 map_name,
+		void* key,
+		void* value,
+		size_t value_size);
+
+int fstore_get_reduce(u64 map_name,
+		void* key,
+		enum fstore_reduce op,
+		u64* values,
+		size_t n);
+
+int fstore_get_consistent(u64 map_name,
+		void* key,
+		void* value,
+		size_t value_size,
+		u32* retries);
+
+int fstore_get_map_array_start(u64 map_name,
+		size_t key_size,
+		size_t value_size,
+		size_t num_elements,
+		void** map_ptr);
+
+int fstore_put_map_array(u64 map_name);
+
+struct fstore_handle;
+
+struct fstore_handle* fstore_open(u64 map_name);
+
+int fstore_handle_get(struct fstore_handle* handle,
+		void* key,
+		void* value);
+
+size_t fstore_handle_value_size(struct fstore_handle* handle);
+
+size_t fstore_handle_num_keys(struct fstore_handle* handle);
+
+void fstore_close(struct fstore_handle* handle);
+
 int fstore_get_value_size(u64 map_name,
 		size_t* size);
 
@@ -60,9 +123,27 @@ __u32 returner;
 
 const shift_xor START_RANDOM = {1, 4, 7, 13};
 
-typedef struct data {
-	__u32 size[BENCH_GET_DATA_SIZE/4];
-} data_t;
+/*
+ * The map a command reads. Both sizes come from the ioctl args, so one
+ * loaded module covers a whole map size x data size sweep.
+ */
+struct bench_shape {
+	size_t map_size;
+	size_t data_size;
+};
+
+static int bench_shape_get(const gsa_t* gsa, struct bench_shape* shape) {
+	shape->map_size = gsa->map_size ? gsa->map_size : BENCH_GET_ARRAY_SIZE;
+	shape->data_size = gsa->data_size ? gsa->data_size : BENCH_GET_DATA_SIZE;
+	/* values are read as u64 by FSTORE_REDUCE_SUM and the seq writer */
+	if(shape->data_size % sizeof(u64) ||
+		shape->data_size > BENCH_GET_MAX_DATA_SIZE) {
+		pr_err("%s:%d: Data size %zu not supported\n",
+			__FILE__, __LINE__, shape->data_size);
+		return -EINVAL;
+	}
+	return 0;
+}
 
 inline void inline_memcpy(void* dest, const void* src, size_t count) {
 	char* tmp = dest;
@@ -70,25 +151,28 @@ inline void inline_memcpy(void* dest, const void* src, size_t count) {
 	while(count--) *tmp++ = *s++;
 }
 
-data_t temp_buffer;
+__u32 temp_buffer[BENCH_GET_MAX_DATA_SIZE/4];
 
-static int bench_get_many_array(data_t* buffer, __u64 times, __u64* nanos) {
+__u32 batch_keys[BENCH_GET_BATCH_SIZE];
+
+static int bench_get_many_array(__u32* buffer,
+		const struct bench_shape* shape, __u64 times, __u64* nanos) {
 	shift_xor rand = START_RANDOM;
-	const size_t map_size = BENCH_GET_ARRAY_SIZE;
-	const size_t data_size = BENCH_GET_DATA_SIZE;
-	for(__u64 i = 0; i < map_size; i++)
-		for(__u64 j = 0; j < data_size/sizeof(__u32); j++)
-			buffer[i].size[j] = simplerand(&rand);
+	const size_t map_size = shape->map_size;
+	const size_t data_size = shape->data_size;
+	const size_t words = data_size/sizeof(__u32);
+	for(__u64 i = 0; i < map_size * words; i++)
+		buffer[i] = simplerand(&rand);
 
 	rand = START_RANDOM;
 	__u32 accumulator = 0;
 	__u64 start = ktime_get_raw_fast_ns();
 	for(__u64 i = 0; i < times; i++) {
 		__u32 key = simplerand(&rand) % map_size;
-		inline_memcpy(&temp_buffer, &buffer[key], data_size);
-		for(__u32 j = 0; j < data_size/sizeof(__u32); j++)
+		inline_memcpy(temp_buffer, &buffer[key * words], data_size);
+		for(__u32 j = 0; j < words; j++)
 		{
-			accumulator ^= temp_buffer.size[j];
+			accumulator ^= temp_buffer[j];
 		}
 	}
 	__u64 stop = ktime_get_raw_fast_ns();
@@ -97,44 +181,379 @@ static int bench_get_many_array(data_t* buffer, __u64 times, __u64* nanos) {
 	return 0;
 }
 
-static int bench_get_many_map(__u64 map_name, __u64 times, __u64* nanos) {
+static int bench_check_map(__u64 map_name, const struct bench_shape* shape) {
 	int err = 0;
 	size_t size;
 	err = fstore_get_value_size(map_name, &size);
-	if(err != 0 || size != BENCH_GET_DATA_SIZE) {
+	if(err != 0 || size != shape->data_size) {
 		pr_err("%s:%d: Getting value size not working\n",
 			__FILE__, __LINE__);
-		return err;
+		return err ? err : -EINVAL;
 	}
 	err = fstore_get_num_keys(map_name, &size);
-	if(err != 0 || size != BENCH_GET_ARRAY_SIZE) {
+	if(err != 0 || size != shape->map_size) {
 		pr_err("%s:%d: Getting value size not working\n",
 			__FILE__, __LINE__);
-		return err;
+		return err ? err : -EINVAL;
 	}
+	return 0;
+}
+
+static int bench_get_many_map(__u64 map_name,
+		const struct bench_shape* shape, __u64 times, __u64* nanos) {
+	int err = 0;
+	if(( err = bench_check_map(map_name, shape) )) return err;
 	shift_xor rand = START_RANDOM;
-	const size_t map_size = BENCH_GET_ARRAY_SIZE;
-	const size_t data_size = BENCH_GET_DATA_SIZE;
+	const size_t map_size = shape->map_size;
+	const size_t data_size = shape->data_size;
 	__u32 accumulator = 0;
 	__u64 start = ktime_get_raw_fast_ns();
 	for(__u64 i = 0; i < times; i++) {
 		__u32 key = simplerand(&rand) % map_size;
 		if(( err =
 			fstore_get(map_name,
-				&key, 4, &temp_buffer, data_size) )) {
+				&key, 4, temp_buffer, data_size) )) {
 			pr_err("%s:%d Huge error occurred fstore_get",
 					__FILE__, __LINE__);
 			goto cleanup;
 		}
-		for(__u32 j = 0; j < size/4; j++)
+		for(__u32 j = 0; j < data_size/4; j++)
+		{
+			accumulator ^= temp_buffer[j];
+		}
+	}
+	__u64 stop = ktime_get_raw_fast_ns();
+	*nanos = stop - start;
+	returner ^= accumulator;
+cleanup:
+	return err;
+}
+
+static int bench_get_batch_map(__u64 map_name,
+		const struct bench_shape* shape, __u64 times, __u64* nanos) {
+	int err = 0;
+	if(( err = bench_check_map(map_name, shape) )) return err;
+	shift_xor rand = START_RANDOM;
+	const size_t map_size = shape->map_size;
+	const size_t data_size = shape->data_size;
+	const size_t words = data_size/sizeof(__u32);
+	__u32* batch_buffer = kvmalloc_array(BENCH_GET_BATCH_SIZE, data_size,
+			GFP_KERNEL);
+	if(!batch_buffer) return -ENOMEM;
+	__u32 accumulator = 0;
+	__u64 start = ktime_get_raw_fast_ns();
+	for(__u64 i = 0; i < times; i += BENCH_GET_BATCH_SIZE) {
+		size_t n = min_t(__u64, times - i, BENCH_GET_BATCH_SIZE);
+		for(size_t j = 0; j < n; j++)
+			batch_keys[j] = simplerand(&rand) % map_size;
+		if(( err =
+			fstore_get_batch(map_name,
+				batch_keys, n, batch_buffer, data_size) )) {
+			pr_err("%s:%d Huge error occurred fstore_get_batch",
+					__FILE__, __LINE__);
+			goto cleanup;
+		}
+		for(size_t j = 0; j < n * words; j++)
+		{
+			accumulator ^= batch_buffer[j];
+		}
+	}
+	__u64 stop = ktime_get_raw_fast_ns();
+	*nanos = stop - start;
+	returner ^= accumulator;
+cleanup:
+	kvfree(batch_buffer);
+	return err;
+}
+
+static int bench_get_percpu_map(__u64 map_name,
+		const struct bench_shape* shape, __u64 times, __u64* nanos,
+		bool reduce) {
+	int err = 0;
+	if(( err = bench_check_map(map_name, shape) )) return err;
+	shift_xor rand = START_RANDOM;
+	const size_t map_size = shape->map_size;
+	const size_t data_size = shape->data_size;
+	__u32 accumulator = 0;
+	__u64 start = ktime_get_raw_fast_ns();
+	for(__u64 i = 0; i < times; i++) {
+		__u32 key = simplerand(&rand) % map_size;
+		if(reduce) err = fstore_get_reduce(map_name, &key,
+				FSTORE_REDUCE_SUM, (u64*) temp_buffer,
+				data_size/sizeof(u64));
+		else err = fstore_get_this_cpu(map_name,
+				&key, temp_buffer, data_size);
+		if(err) {
+			pr_err("%s:%d Huge error occurred %s",
+					__FILE__, __LINE__,
+					reduce ? "fstore_get_reduce" : "fstore_get_this_cpu");
+			goto cleanup;
+		}
+		for(__u32 j = 0; j < data_size/4; j++)
+		{
+			accumulator ^= temp_buffer[j];
+		}
+	}
+	__u64 stop = ktime_get_raw_fast_ns();
+	*nanos = stop - start;
+	returner ^= accumulator;
+cleanup:
+	return err;
+}
+
+struct bench_seq_args {
+	__u32* values;
+	struct bench_shape shape;
+};
+
+/*
+ * Stands in for a BPF program updating versioned feature vectors: bump the
+ * sequence to odd, rewrite the payload, bump it back to even.
+ */
+static int bench_seq_writer(void* data) {
+	struct bench_seq_args* args = data;
+	const size_t words = args->shape.data_size/4;
+	shift_xor rand = {2, 5, 8, 14};
+	while(!kthread_should_stop()) {
+		__u64 key = simplerand(&rand) % args->shape.map_size;
+		__u32* slot = &args->values[key * words];
+		u64* seq = (u64*) slot;
+		u64 start = READ_ONCE(*seq);
+		WRITE_ONCE(*seq, start + 1);
+		smp_wmb();
+		for(__u32 j = FSTORE_SEQ_SIZE/4; j < words; j++)
+			WRITE_ONCE(slot[j], simplerand(&rand));
+		smp_store_release(seq, start + 2);
+		cond_resched();
+	}
+	return 0;
+}
+
+static int bench_get_consistent_map(__u64 map_name,
+		const struct bench_shape* shape, __u64 times, __u32 flags,
+		__u64* nanos, __u64* retries) {
+	int err = 0;
+	struct bench_seq_args args = {.shape = *shape};
+	err = fstore_get_map_array_start(map_name, 4, shape->data_size,
+			shape->map_size, (void**) &args.values);
+	if(err) return err;
+	struct task_struct* writer = NULL;
+	if(!(flags & BENCH_CONSISTENT_BPF)) {
+		writer = kthread_run(bench_seq_writer, &args, NAME "_writer");
+		if(IS_ERR(writer)) {
+			err = PTR_ERR(writer);
+			goto cleanup_map;
+		}
+	}
+
+	shift_xor rand = START_RANDOM;
+	const size_t map_size = shape->map_size;
+	const size_t data_size = shape->data_size;
+	__u32 accumulator = 0;
+	__u32 tries = 0;
+	*retries = 0;
+	__u64 start = ktime_get_raw_fast_ns();
+	for(__u64 i = 0; i < times; i++) {
+		__u32 key = simplerand(&rand) % map_size;
+		err = fstore_get_consistent(map_name,
+				&key, temp_buffer, data_size, &tries);
+		*retries += tries;
+		if(err) {
+			pr_err("%s:%d Huge error occurred fstore_get_consistent",
+					__FILE__, __LINE__);
+			goto cleanup;
+		}
+		/* a torn copy mixes payloads of two writes */
+		u32 seq = (u32) *(u64*) temp_buffer;
+		for(__u32 j = FSTORE_SEQ_SIZE/4;
+				(flags & BENCH_CONSISTENT_BPF) && j < data_size/4; j++) {
+			if(temp_buffer[j] + 2 != seq) {
+				pr_err("%s:%d Torn copy of key %u: seq %u word %u\n",
+						__FILE__, __LINE__, key, seq,
+						temp_buffer[j]);
+				err = -EILSEQ;
+				goto cleanup;
+			}
+		}
+		for(__u32 j = 0; j < data_size/4; j++)
+		{
+			accumulator ^= temp_buffer[j];
+		}
+	}
+	__u64 stop = ktime_get_raw_fast_ns();
+	*nanos = stop - start;
+	returner ^= accumulator;
+cleanup:
+	if(writer) kthread_stop(writer);
+cleanup_map:
+	fstore_put_map_array(map_name);
+	return err;
+}
+
+static int bench_get_handle_map(__u64 map_name,
+		const struct bench_shape* shape, __u64 times, __u64* nanos) {
+	int err = 0;
+	struct fstore_handle* handle = fstore_open(map_name);
+	if(IS_ERR(handle)) return PTR_ERR(handle);
+	if(fstore_handle_value_size(handle) != shape->data_size ||
+		fstore_handle_num_keys(handle) != shape->map_size) {
+		pr_err("%s:%d: Handle sizes do not match\n",
+			__FILE__, __LINE__);
+		err = -EINVAL;
+		goto cleanup;
+	}
+	shift_xor rand = START_RANDOM;
+	const size_t map_size = shape->map_size;
+	const size_t data_size = shape->data_size;
+	__u32 accumulator = 0;
+	__u64 start = ktime_get_raw_fast_ns();
+	for(__u64 i = 0; i < times; i++) {
+		__u32 key = simplerand(&rand) % map_size;
+		if(( err = fstore_handle_get(handle, &key, temp_buffer) )) {
+			pr_err("%s:%d Huge error occurred fstore_handle_get",
+					__FILE__, __LINE__);
+			goto cleanup;
+		}
+		for(__u32 j = 0; j < data_size/4; j++)
 		{
-			accumulator ^= temp_buffer.size[j];
+			accumulator ^= temp_buffer[j];
 		}
 	}
 	__u64 stop = ktime_get_raw_fast_ns();
 	*nanos = stop - start;
 	returner ^= accumulator;
 cleanup:
+	fstore_close(handle);
+	return err;
+}
+
+/*
+ * One reader of the scaling benchmark. Workers sit on separate CPUs and do
+ * not start timing until every one of them is up, so they all hit the map at
+ * once.
+ */
+struct bench_scale_worker {
+	__u32 buffer[BENCH_GET_MAX_DATA_SIZE/4];
+	struct bench_shape shape;
+	__u64 map_name;
+	__u64 times;
+	__u64 nanos;
+	__u32 accumulator;
+	bool rcu;
+	int err;
+	atomic_t* ready;
+	__u32 threads;
+	struct completion done;
+} ____cacheline_aligned;
+
+static int bench_scale_reader(void* data) {
+	struct bench_scale_worker* w = data;
+	const size_t map_size = w->shape.map_size;
+	const size_t data_size = w->shape.data_size;
+	shift_xor rand = START_RANDOM;
+	int err = 0;
+
+	atomic_inc(w->ready);
+	while(atomic_read(w->ready) < w->threads) {
+		cpu_relax();
+		cond_resched();
+	}
+
+	__u64 start = ktime_get_raw_fast_ns();
+	for(__u64 i = 0; i < w->times; i++) {
+		__u32 key = simplerand(&rand) % map_size;
+		if(w->rcu) err = fstore_get_rcu(w->map_name,
+				&key, 4, w->buffer, data_size);
+		else err = fstore_get(w->map_name,
+				&key, 4, w->buffer, data_size);
+		if(err) break;
+		for(__u32 j = 0; j < data_size/4; j++)
+		{
+			w->accumulator ^= w->buffer[j];
+		}
+	}
+	w->nanos = ktime_get_raw_fast_ns() - start;
+	w->err = err;
+	complete(&w->done);
+
+	/* exit only through kthread_stop so the task outlives the wait */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while(!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+/*
+ * Read one map from `threads` kthreads bound to the first online CPUs,
+ * through fstore_get or, with BENCH_SCALE_RCU, fstore_get_rcu. nanos is the
+ * mean time a reader took for its `times` gets.
+ */
+static int bench_get_scale_map(__u64 map_name,
+		const struct bench_shape* shape, __u64 times, __u32 threads,
+		__u32 flags, __u64* nanos) {
+	int err = 0;
+	if(( err = bench_check_map(map_name, shape) )) return err;
+	if(threads == 0 || threads > num_online_cpus()) return -EINVAL;
+
+	struct bench_scale_worker* workers = kcalloc(threads, sizeof(*workers),
+			GFP_KERNEL);
+	struct task_struct** tasks = kcalloc(threads, sizeof(*tasks), GFP_KERNEL);
+	if(!workers || !tasks) {
+		err = -ENOMEM;
+		goto cleanup;
+	}
+
+	atomic_t ready = ATOMIC_INIT(0);
+	__u32 created = 0;
+	int cpu;
+	for_each_online_cpu(cpu) {
+		if(created == threads) break;
+		struct bench_scale_worker* w = &workers[created];
+		w->shape = *shape;
+		w->map_name = map_name;
+		w->times = times;
+		w->rcu = flags & BENCH_SCALE_RCU;
+		w->ready = &ready;
+		w->threads = threads;
+		init_completion(&w->done);
+		tasks[created] = kthread_create_on_node(bench_scale_reader, w,
+				cpu_to_node(cpu), NAME "_reader/%d", cpu);
+		if(IS_ERR(tasks[created])) {
+			err = PTR_ERR(tasks[created]);
+			break;
+		}
+		kthread_bind(tasks[created], cpu);
+		created++;
+	}
+	if(err || created < threads) {
+		/* never woken, so the readers exit without running */
+		for(__u32 i = 0; i < created; i++) kthread_stop(tasks[i]);
+		err = err ? err : -EINVAL;
+		goto cleanup;
+	}
+
+	for(__u32 i = 0; i < threads; i++) wake_up_process(tasks[i]);
+	__u64 total = 0;
+	for(__u32 i = 0; i < threads; i++) {
+		wait_for_completion(&workers[i].done);
+		kthread_stop(tasks[i]);
+		total += workers[i].nanos;
+		returner ^= workers[i].accumulator;
+		if(workers[i].err && !err) {
+			pr_err("%s:%d Huge error occurred %s",
+					__FILE__, __LINE__,
+					workers[i].rcu ? "fstore_get_rcu" : "fstore_get");
+			err = workers[i].err;
+		}
+	}
+	*nanos = total / threads;
+
+cleanup:
+	kfree(tasks);
+	kfree(workers);
 	return err;
 }
 
@@ -145,7 +564,8 @@ static long get_set_ioctl(struct file* file,
 	int err = -EINVAL;
 	gsa_t* uptr = (gsa_t*) data;
 	gsa_t gsa;
-	data_t* array = NULL;
+	struct bench_shape shape;
+	__u32* array = NULL;
 	size_t alloc_size;
 	if( copy_from_user(&gsa, (gsa_t*) data, sizeof(gsa_t)) )
 	{
@@ -153,12 +573,45 @@ static long get_set_ioctl(struct file* file,
 		err = -EINVAL;
 		return err;
 	}
+	if(( err = bench_shape_get(&gsa, &shape) )) return err;
 	switch (cmd) {
 	case BENCH_GET_MANY:
-		err = bench_get_many_map(gsa.map_name, gsa.number, &gsa.number);
+		err = bench_get_many_map(gsa.map_name, &shape,
+				gsa.number, &gsa.number);
+		break;
+	case BENCH_GET_BATCH:
+		err = bench_get_batch_map(gsa.map_name, &shape,
+				gsa.number, &gsa.number);
+		break;
+	case BENCH_GET_HANDLE:
+		err = bench_get_handle_map(gsa.map_name, &shape,
+				gsa.number, &gsa.number);
+		break;
+	case BENCH_GET_THIS_CPU:
+		err = bench_get_percpu_map(gsa.map_name, &shape, gsa.number,
+				&gsa.number, false);
+		break;
+	case BENCH_GET_REDUCE:
+		err = bench_get_percpu_map(gsa.map_name, &shape, gsa.number,
+				&gsa.number, true);
+		break;
+	case BENCH_GET_SCALE:
+		err = bench_get_scale_map(gsa.map_name, &shape, gsa.number,
+				gsa.threads, gsa.flags, &gsa.number);
+		break;
+	case BENCH_GET_CONSISTENT:
+		err = bench_get_consistent_map(gsa.map_name, &shape, gsa.number,
+				gsa.flags, &gsa.number, &gsa.retries);
+		/* the retry count is the point of this mode, return it */
+		if( copy_to_user(&uptr->retries,
+					&(gsa.retries),
+					sizeof(__u64)) ) {
+			pr_err("Copy to User was thwarted\n");
+			err = err ? err : -EINVAL;
+		}
 		break;
 	case BENCH_GET_ARRAY:
-		alloc_size = BENCH_GET_ARRAY_SIZE * BENCH_GET_DATA_SIZE;
+		alloc_size = array_size(shape.map_size, shape.data_size);
 		array = vmalloc(alloc_size);
 		if( array == NULL ) {
 			pr_info("%s:%d Out of memory for: %lu\n",
@@ -166,7 +619,8 @@ static long get_set_ioctl(struct file* file,
 			err = -ENOMEM;
 			break;
 		}
-		err = bench_get_many_array(array, gsa.number, &gsa.number);
+		err = bench_get_many_array(array, &shape, gsa.number,
+				&gsa.number);
 		break;
 	default:
 		pr_info("%s:%d Invalid Command arrived %u\n",
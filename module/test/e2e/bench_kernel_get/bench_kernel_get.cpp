@@ -1,16 +1,22 @@
 #include "bench_kernel_get.h"
 #include "../../../fstore/fstore.h"
+#include "../../bench.h"
 #include <cassert>
 #include <cerrno>
 #include <cstdio>
 #include <cstring>
 #include <fcntl.h>
-#include <getopt.h>
+#include <fstream>
 #include <iostream>
+#include <atomic>
 #include <linux/bpf.h>
+#include <sched.h>
 #include <sys/ioctl.h>
 #include <sys/syscall.h>
+#include <thread>
+#include <tuple>
 #include <unistd.h>
+#include <vector>
 
 #define ASSERT_ERRNO(x)                                                            \
   if (!(x)) {                                                                      \
@@ -19,11 +25,6 @@
     std::exit(-err_errno);                                                         \
   }
 
-constexpr __u64 SAMPLE_VALUE = 0xDEADBEEF;
-constexpr __u64 DEFAULT_NUMBER = 10;
-constexpr __u32 DEFAULT_SIZE = 10;
-constexpr __u32 DEFAULT_DATA_SIZE = 8;
-constexpr int STAT_FD = 3;
 
 int bpf_create_map(union bpf_attr& attr) {
   int ebpf_fd = syscall(SYS_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
@@ -35,12 +36,103 @@ int bpf_create_map(union bpf_attr& attr) {
   return ebpf_fd;
 }
 
-__u64 benchmark_fstore(int benchmark_fd, __u32 data_size, __u32 size, __u64 number) {
+// Parses /sys/devices/system/cpu/possible, e.g. "0-3,8-11"
+__u32 num_possible_cpus() {
+  std::ifstream possible("/sys/devices/system/cpu/possible");
+  __u32 cpus = 0;
+  unsigned first, last;
+  char sep;
+  while (possible >> first) {
+    last = first;
+    if (possible.peek() == '-') possible >> sep >> last;
+    cpus += last - first + 1;
+    if (possible.peek() == ',') possible >> sep;
+  }
+  ASSERT_ERRNO(cpus > 0);
+  return cpus;
+}
+
+constexpr bpf_insn insn(__u8 code, __u8 dst, __u8 src, __s16 off, __s32 imm) {
+  return {.code = code, .dst_reg = dst, .src_reg = src, .off = off, .imm = imm};
+}
+
+// A BPF writer of versioned values, rewriting one random key per run with
+// the fetching atomic adds FSTORE_SEQ_WRITE_BEGIN/END compile to around the
+// payload stores. Every payload word gets the low half of the old, even,
+// sequence, see BENCH_CONSISTENT_BPF.
+int load_seq_writer(int map_fd, __u32 size, __u32 data_size) {
+  const __u32 payload_words = (data_size - FSTORE_SEQ_SIZE) / 4;
+  std::vector<bpf_insn> insns = {
+      // key = bpf_get_prandom_u32() % size on the stack
+      insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_get_prandom_u32),
+      insn(BPF_ALU | BPF_MOD | BPF_K, BPF_REG_0, 0, 0, (__s32)size),
+      insn(BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_0, -4, 0),
+      insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd),
+      insn(0, 0, 0, 0, 0),
+      insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0),
+      insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -4),
+      insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+      insn(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, (__s16)(4 + payload_words), 0),
+      // r1 = FSTORE_SEQ_WRITE_BEGIN(&value->seq)
+      insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_1, 0, 0, 1),
+      insn(BPF_STX | BPF_ATOMIC | BPF_DW, BPF_REG_0, BPF_REG_1, 0, BPF_ADD | BPF_FETCH),
+  };
+  for (__u32 j = 0; j < payload_words; j++) {
+    insns.push_back(
+        insn(BPF_STX | BPF_MEM | BPF_W, BPF_REG_0, BPF_REG_1, (__s16)(FSTORE_SEQ_SIZE + 4 * j), 0));
+  }
+  // FSTORE_SEQ_WRITE_END(&value->seq)
+  insns.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_1, 0, 0, 1));
+  insns.push_back(insn(BPF_STX | BPF_ATOMIC | BPF_DW, BPF_REG_0, BPF_REG_1, 0, BPF_ADD | BPF_FETCH));
+  insns.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, 0));
+  insns.push_back(insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+  union bpf_attr attr = {};
+  attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+  attr.insns = (__u64)insns.data();
+  attr.insn_cnt = insns.size();
+  attr.license = (__u64) "GPL";
+  int prog_fd = syscall(SYS_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
+  ASSERT_ERRNO(prog_fd >= 0);
+  return prog_fd;
+}
+
+// Runs the writer until stop, off the benchmark's CPU when it is pinned to one
+void run_seq_writer(int prog_fd, const std::atomic<bool>& stop) {
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) == 1) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t others;
+    CPU_ZERO(&others);
+    for (long cpu = 0; cpu < cpus; cpu++) {
+      if (!CPU_ISSET(cpu, &set)) CPU_SET(cpu, &others);
+    }
+    if (CPU_COUNT(&others) > 0) sched_setaffinity(0, sizeof(others), &others);
+  }
+  // socket filters only test run on at least an Ethernet header
+  char packet[64] = {};
+  union bpf_attr attr = {};
+  attr.test.prog_fd = prog_fd;
+  attr.test.data_in = (__u64)packet;
+  attr.test.data_size_in = sizeof(packet);
+  attr.test.repeat = 1000;
+  while (!stop.load(std::memory_order_relaxed)) {
+    int err = syscall(SYS_bpf, BPF_PROG_TEST_RUN, &attr, sizeof(attr));
+    ASSERT_ERRNO(err == 0);
+  }
+}
+
+__u64 benchmark_fstore(int benchmark_fd, __u32 data_size, __u32 size, __u64 number,
+                       unsigned long bench_cmd, __u32 map_flags = 0,
+                       __u32 map_type = BPF_MAP_TYPE_ARRAY, __u64* retries = nullptr,
+                       __u32 threads = 0, __u32 flags = 0) {
+  const bool bpf_writer = bench_cmd == BENCH_GET_CONSISTENT && (flags & BENCH_CONSISTENT_BPF);
   union bpf_attr attr = {
-      .map_type = BPF_MAP_TYPE_ARRAY,
+      .map_type = map_type,
       .key_size = 4,
       .value_size = data_size,
       .max_entries = size,
+      .map_flags = map_flags,
   };
 
   int ebpf_fd = bpf_create_map(attr);
@@ -56,44 +148,71 @@ __u64 benchmark_fstore(int benchmark_fd, __u32 data_size, __u32 size, __u64 numb
   int err = ioctl(fd, REGISTER_MAP, (unsigned long)&reg);
   ASSERT_ERRNO(err == 0);
 
-  bzero(&attr, sizeof(attr));
-
-  __u32 key = 0;
-  __u64 sample_value = SAMPLE_VALUE;
-  __u64* sample_buffer = (__u64*)malloc(sizeof(char) * data_size);
-
-  attr.map_fd = ebpf_fd;
-  attr.key = (__u64)&key;
-  attr.value = (__u64)sample_buffer;
-  attr.flags = BPF_EXIST;
+  // Per-CPU maps are written one value per possible CPU
+  __u32 copies = map_type == BPF_MAP_TYPE_PERCPU_ARRAY ? num_possible_cpus() : 1;
+  std::vector<__u32> keys(size);
+  std::vector<__u64> sample_buffer((size_t)size * data_size * copies / 8);
 
   ShiftXor rand{1, 4, 7, 13};
 
   for (__u64 i = 0; i < size; i++) {
-    key = i;
-    for (size_t i = 0; i < data_size / 8; i++) {
-      sample_buffer[i] = simplerand(&rand);
+    keys[i] = i;
+    __u64* value = &sample_buffer[i * data_size * copies / 8];
+    for (size_t i = 0; i < data_size * copies / 8; i++) {
+      value[i] = simplerand(&rand);
+    }
+    // Versioned values start with an even, idle, sequence number
+    if (bench_cmd == BENCH_GET_CONSISTENT) value[0] = 0;
+    // and, for the BPF writer, a payload that checks out against it
+    for (size_t i = 1; bpf_writer && i < data_size / 8; i++) {
+      value[i] = 0xfffffffefffffffe;
     }
-    err = syscall(SYS_bpf, BPF_MAP_UPDATE_ELEM, &attr, sizeof(attr));
-    ASSERT_ERRNO(err == 0);
   }
 
+  // The whole map in one call
+  load_input load = {.map_name = unsafeHashConvert("benchget")};
+  load.attr.batch.keys = (__u64)keys.data();
+  load.attr.batch.values = (__u64)sample_buffer.data();
+  load.attr.batch.count = size;
+  err = ioctl(fd, LOAD_MAP, (unsigned long)&load);
+  ASSERT_ERRNO(err == 0 && load.attr.batch.count == size);
+
   bench_get_args gsa = {
       .map_name = unsafeHashConvert("benchget"),
       .number = number,
+      .threads = threads,
+      .flags = flags,
+      .map_size = size,
+      .data_size = data_size,
   };
-  err = ioctl(benchmark_fd, BENCH_GET_MANY, (unsigned long)&gsa);
+  int prog_fd = -1;
+  std::atomic<bool> stop = false;
+  std::thread writer;
+  if (bpf_writer) {
+    prog_fd = load_seq_writer(ebpf_fd, size, data_size);
+    writer = std::thread(run_seq_writer, prog_fd, std::cref(stop));
+  }
+  err = ioctl(benchmark_fd, bench_cmd, (unsigned long)&gsa);
   ASSERT_ERRNO(err == 0);
+  if (retries) *retries = gsa.retries;
+  if (bpf_writer) {
+    stop = true;
+    writer.join();
+    close(prog_fd);
+  }
 
   err = ioctl(fd, UNREGISTER_MAP, unsafeHashConvert("benchget"));
   ASSERT_ERRNO(err == 1);
+  close(fd);
+  close(ebpf_fd);
   return gsa.number;
 }
 
 __u64 benchmark_array(int benchmark_fd, __u32 data_size, __u32 size, __u64 number) {
   bench_get_args gsa = {
-      .map_name = size,
       .number = number,
+      .map_size = size,
+      .data_size = data_size,
   };
   int err = ioctl(benchmark_fd, BENCH_GET_ARRAY, (unsigned long)&gsa);
   ASSERT_ERRNO(err == 0);
@@ -104,67 +223,139 @@ enum Command : __u32 {
   NONE = 0x0,
   FSTORE = 0x1,
   ARRAY = (0x1 << 1),
+  BATCH = (0x1 << 2),
+  HANDLE = (0x1 << 3),
+  THIS_CPU = (0x1 << 4),
+  REDUCE = (0x1 << 5),
+  CONSISTENT = (0x1 << 6),
+  SCALE = (0x1 << 7),
+  CONSISTENT_BPF = (0x1 << 8),
 };
 
 int main(int argc, char** argv) {
-  __u64 number = DEFAULT_NUMBER;
-  __u32 size = DEFAULT_SIZE;
-  __u32 data_size = 0;
   enum Command cmd = NONE;
-  int array = false;
-  int test = false;
-  int err = 0;
-
-  int stats_print = fcntl(STAT_FD, F_GETFD);
-
-  int c;
-  while ((c = getopt(argc, argv, "n:s:d:af")) != -1) {
-    switch (c) {
-      case 'n':
-        number = strtoull(optarg, NULL, 10);
-        break;
-      case 's':
-        size = strtoul(optarg, NULL, 10);
-        break;
-      case 'd':
-        data_size = strtoul(optarg, NULL, 10);
-        break;
-      case 'a':
-        cmd = (Command)(cmd | ARRAY);
-        break;
-      case 'f':
-        cmd = (Command)(cmd | FSTORE);
-        break;
-      default:
-        fprintf(stderr, "%s [-n <number>] [-s <map-size>] [-d <data-size> ] [-a | -f]\n", argv[0]);
-        exit(-1);
-        break;
-    }
-  }
-
-  // Resize
-  data_size = data_size < DEFAULT_DATA_SIZE ? DEFAULT_DATA_SIZE : data_size;
-  data_size = data_size / DEFAULT_DATA_SIZE * DEFAULT_DATA_SIZE;
-
-  __u64 time_ns = 0;
+  __u32 max_threads = 0;
+  const auto sweep = bench::Options::parse(
+      argc, argv, "afboprcek:",
+      [&](int c, const char* arg) {
+        switch (c) {
+          case 'a':
+            cmd = (Command)(cmd | ARRAY);
+            break;
+          case 'f':
+            cmd = (Command)(cmd | FSTORE);
+            break;
+          case 'b':
+            cmd = (Command)(cmd | BATCH);
+            break;
+          case 'o':
+            cmd = (Command)(cmd | HANDLE);
+            break;
+          case 'p':
+            cmd = (Command)(cmd | THIS_CPU);
+            break;
+          case 'r':
+            cmd = (Command)(cmd | REDUCE);
+            break;
+          case 'c':
+            cmd = (Command)(cmd | CONSISTENT);
+            break;
+          case 'e':
+            cmd = (Command)(cmd | CONSISTENT_BPF);
+            break;
+          case 'k':
+            cmd = (Command)(cmd | SCALE);
+            max_threads = strtoul(arg, NULL, 10);
+            break;
+        }
+      },
+      "[-a | -f | -b | -o | -p | -r | -c | -e | -k <max-threads>]");
+  bench::pin_cpu(sweep.cpu);
 
   int gsfd = open("/dev/" NAME "_device", O_RDWR);
   ASSERT_ERRNO(gsfd >= 0);
 
-  if (cmd & ARRAY) {
-    time_ns = benchmark_array(gsfd, data_size, size, number);
-  }
-  if (cmd & FSTORE) {
-    time_ns = benchmark_fstore(gsfd, data_size, size, number);
-  }
+  // The module takes the sizes with every ioctl, one load covers the sweep
+  for (const auto& opts : sweep.points()) {
+    const __u64 number = opts.number;
+    const __u32 size = opts.size;
+    const __u32 data_size = opts.data_size;
+
+    // Each selected mode gets its own trials and stats line
+    auto run = [&](const char* mode, auto&& trial, __u64* retries = nullptr) {
+      const auto result = bench::time_trials(opts, trial);
+      bench::Report report(NAME, mode, opts);
+      if (retries) report.field("retries", *retries);
+      if (report.write(result)) std::cerr << "Output to stats" << std::endl;
+    };
 
-  // Important this comes after the free
-  if (stats_print >= 0) {
-    std::cerr << "Output to stats" << std::endl;
-    err = dprintf(STAT_FD, "get_iterations %lld\tmap_size %d\tvalue_size %d\tTime(ns) %lld\n",
-                  number, size, data_size, time_ns);
-    assert(err > 0);
+    if (cmd & ARRAY) {
+      run("array", [&] { return benchmark_array(gsfd, data_size, size, number); });
+    }
+    if (cmd & FSTORE) {
+      run("fstore",
+          [&] { return benchmark_fstore(gsfd, data_size, size, number, BENCH_GET_MANY); });
+    }
+    if (cmd & BATCH) {
+      run("batch",
+          [&] { return benchmark_fstore(gsfd, data_size, size, number, BENCH_GET_BATCH); });
+    }
+    if (cmd & HANDLE) {
+      run("handle", [&] {
+        return benchmark_fstore(gsfd, data_size, size, number, BENCH_GET_HANDLE, BPF_F_MMAPABLE);
+      });
+    }
+    if (cmd & THIS_CPU) {
+      run("this_cpu", [&] {
+        return benchmark_fstore(gsfd, data_size, size, number, BENCH_GET_THIS_CPU, 0,
+                                BPF_MAP_TYPE_PERCPU_ARRAY);
+      });
+    }
+    if (cmd & REDUCE) {
+      run("reduce", [&] {
+        return benchmark_fstore(gsfd, data_size, size, number, BENCH_GET_REDUCE, 0,
+                                BPF_MAP_TYPE_PERCPU_ARRAY);
+      });
+    }
+    // -c writes from a kthread, -e from a BPF program and checks every copy
+    for (auto [bit, mode, flags] : {std::tuple{CONSISTENT, "consistent", 0u},
+                                    std::tuple{CONSISTENT_BPF, "consistent_bpf",
+                                               (__u32)BENCH_CONSISTENT_BPF}}) {
+      if (!(cmd & bit)) continue;
+      // Summed over the timed trials
+      __u64 retries = 0;
+      __u32 calls = 0;
+      run(
+          mode,
+          [&] {
+            __u64 trial_retries = 0;
+            __u64 ns = benchmark_fstore(gsfd, data_size, size, number, BENCH_GET_CONSISTENT,
+                                        BPF_F_MMAPABLE, BPF_MAP_TYPE_ARRAY, &trial_retries, 0,
+                                        flags);
+            if (++calls > opts.warmup) retries += trial_retries;
+            return ns;
+          },
+          &retries);
+    }
+
+    if (cmd & SCALE) {
+      // ns/get of one reader as 1..max_threads CPUs read the same map, with and without refcounts
+      __u32 cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      for (__u32 threads = 1; threads <= std::min(max_threads, cpus); threads++) {
+        for (__u32 scale_flags : {0, BENCH_SCALE_RCU}) {
+          const auto result = bench::time_trials(opts, [&] {
+            return benchmark_fstore(gsfd, data_size, size, number, BENCH_GET_SCALE, 0,
+                                    BPF_MAP_TYPE_ARRAY, nullptr, threads, scale_flags);
+          });
+          bench::Report report(NAME, scale_flags & BENCH_SCALE_RCU ? "scale_rcu" : "scale_ref",
+                               opts);
+          report.field("threads", (__u64)threads);
+          if (report.write(result)) std::cerr << "Output to stats" << std::endl;
+        }
+      }
+    }
   }
 
+  close(gsfd);
   return 0;
 }
@@ -8,11 +8,34 @@ enum GET_SET_COMMAND {
 	BENCH_GET_MANY = 0x100,
 	BENCH_GET_ARRAY = 0x10,
 	BENCH_GET_MAPPED = 0x1000,
+	BENCH_GET_BATCH = 0x10000,
+	BENCH_GET_HANDLE = 0x100000,
+	BENCH_GET_THIS_CPU = 0x1000000,
+	BENCH_GET_REDUCE = 0x10000000,
+	BENCH_GET_CONSISTENT = 0x1,
+	BENCH_GET_SCALE = 0x2,
 };
 
+/* BENCH_GET_SCALE flags */
+#define BENCH_SCALE_RCU 0x1
+/*
+ * BENCH_GET_CONSISTENT flags: user space runs the BPF writer instead of the
+ * module's kthread. It stores the low half of the even sequence it started
+ * from in every payload word, so a good copy has payload + 2 == seq.
+ */
+#define BENCH_CONSISTENT_BPF 0x1
+
 struct bench_get_args {
 	__u64 map_name;
 	__u64 number;
+	__u64 retries;
+	/* BENCH_GET_SCALE: kthreads reading at once, one per online CPU */
+	__u32 threads;
+	/* BENCH_GET_SCALE or BENCH_GET_CONSISTENT flags */
+	__u32 flags;
+	/* the map read, 0 keeps the BENCH_GET_ARRAY_SIZE/DATA_SIZE defaults */
+	__u32 map_size;
+	__u32 data_size;
 };
 
 struct ShiftXor {
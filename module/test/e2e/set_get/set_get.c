@@ -40,6 +40,13 @@ int fstore_get(u64 map_name,
 		void* value,
 		size_t value_size);
 
+int fstore_put(u64 map_name,
+		void* key,
+		size_t key_size,
+		void* value,
+		size_t value_size,
+		u64 flags);
+
 int fstore_get_value_size(u64 map_name,
 			size_t* size);
 
@@ -54,8 +61,23 @@ int fstore_get_map_array_start(u64 map_name,
 
 int fstore_put_map_array(u64 map_name);
 
+struct fstore_handle;
+
+struct fstore_handle* fstore_open(u64 map_name);
+
+int fstore_handle_get(struct fstore_handle* handle,
+		void* key,
+		void* value);
+
+size_t fstore_handle_value_size(struct fstore_handle* handle);
+
+void fstore_close(struct fstore_handle* handle);
+
 typedef struct get_set_args gsa_t;
 
+/* held across ioctls to check that unregister invalidates open handles */
+static struct fstore_handle* held_handle = NULL;
+
 static long get_set_ioctl(struct file* file,
 				unsigned int cmd,
 				unsigned long data)
@@ -117,6 +139,62 @@ static long get_set_ioctl(struct file* file,
 			fstore_put_map_array(gsa.map_name);
 		}
 		break;
+	case HOLD_HANDLE:
+		if( copy_from_user(&gsa, (gsa_t*) data, sizeof(gsa_t)) )
+		{
+			pr_err("Getting initial struct impossible\n");
+			err = -EINVAL;
+			break;
+		}
+		if( held_handle != NULL ) {
+			err = -EBUSY;
+			break;
+		}
+		held_handle = fstore_open(gsa.map_name);
+		if( IS_ERR(held_handle) ) {
+			err = PTR_ERR(held_handle);
+			held_handle = NULL;
+			break;
+		}
+		err = fstore_handle_value_size(held_handle) == 8 ? 0 : -EMSGSIZE;
+		break;
+	case GET_HANDLE:
+		if( copy_from_user(&gsa, (gsa_t*) data, sizeof(gsa_t)) )
+		{
+			pr_err("Getting initial struct impossible\n");
+			err = -EINVAL;
+			break;
+		}
+		if( held_handle == NULL ) {
+			err = -EBADF;
+			break;
+		}
+		err = fstore_handle_get(held_handle, &gsa.key, &gsa.value);
+		if(err == 0) {
+			if( copy_to_user(&uptr->value,
+					&(gsa.value),
+					sizeof(gsa.value)) ) {
+				pr_err("Returning was thwarted\n");
+				err = -EINVAL;
+			}
+		}
+		break;
+	case PUT_ONE:
+		if( copy_from_user(&gsa, (gsa_t*) data, sizeof(gsa_t)) )
+		{
+			pr_err("Getting initial struct impossible\n");
+			err = -EINVAL;
+			break;
+		}
+		err = fstore_put(gsa.map_name,
+				&gsa.key, sizeof(gsa.key),
+				&gsa.value, sizeof(gsa.value), BPF_EXIST);
+		break;
+	case RELEASE_HANDLE:
+		fstore_close(held_handle);
+		held_handle = NULL;
+		err = 0;
+		break;
 
 	default:
 		break;
@@ -168,6 +246,8 @@ r_class:
 
 void __exit cleanup_module(void)
 {
+	fstore_close(held_handle);
+
 	/* release device*/
 	device_destroy(dev_class,dev);
 	class_destroy(dev_class);
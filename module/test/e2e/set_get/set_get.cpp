@@ -83,6 +83,29 @@ int main() {
   }
   assert(gsa.value == SAMPLE_VALUE);
 
+  // Written from the kernel, read back through the map fd
+  gsa = {.key = 3, .value = ~SAMPLE_VALUE, .map_name = unsafeHashConvert(NAME)};
+  err = ioctl(gsfd, PUT_ONE, (unsigned long)&gsa);
+  if (err != 0) {
+    auto err = errno;
+    std::cerr << "Something failed while putting: " << err << ", " << std::strerror(err)
+              << std::endl;
+    return err;
+  }
+  __u32 put_key = 3;
+  __u64 put_value = 0;
+  attr.key = (__u64)&put_key;
+  attr.value = (__u64)&put_value;
+  attr.flags = 0;
+  err = syscall(SYS_bpf, BPF_MAP_LOOKUP_ELEM, &attr, sizeof(attr));
+  assert(err == 0);
+  assert(put_value == ~SAMPLE_VALUE);
+
+  // Past max_entries of an array
+  gsa = {.key = 100, .value = 0, .map_name = unsafeHashConvert(NAME)};
+  err = ioctl(gsfd, PUT_ONE, (unsigned long)&gsa);
+  assert(err != 0);
+
   gsa = {.key = 0, .value = 0, .map_name = unsafeHashConvert(NAME)};
 
   err = ioctl(gsfd, GET_MAPPED, (unsigned long)&gsa);
@@ -93,8 +116,35 @@ int main() {
     return err;
   }
 
+  gsa = {.key = 0, .value = 0, .map_name = unsafeHashConvert(NAME)};
+
+  err = ioctl(gsfd, HOLD_HANDLE, (unsigned long)&gsa);
+  if (err != 0) {
+    auto err = errno;
+    std::cerr << "Something failed while opening handle: " << err << ", " << std::strerror(err)
+              << std::endl;
+    return err;
+  }
+
+  err = ioctl(gsfd, GET_HANDLE, (unsigned long)&gsa);
+  if (err != 0) {
+    auto err = errno;
+    std::cerr << "Something failed while getting handle: " << err << ", " << std::strerror(err)
+              << std::endl;
+    return err;
+  }
+  assert(gsa.value == SAMPLE_VALUE);
+
   err = ioctl(fd, UNREGISTER_MAP, unsafeHashConvert(NAME));
   assert(err == 1);
 
+  // A handle held over unregister must stop serving the map
+  err = ioctl(gsfd, GET_HANDLE, (unsigned long)&gsa);
+  assert(err != 0);
+  assert(errno == EKEYEXPIRED);
+
+  err = ioctl(gsfd, RELEASE_HANDLE, (unsigned long)&gsa);
+  assert(err == 0);
+
   return 0;
 }
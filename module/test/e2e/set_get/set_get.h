@@ -7,6 +7,10 @@
 enum GET_SET_COMMAND {
 	GET_ONE = 0x10,
 	GET_MAPPED = 0x100,
+	HOLD_HANDLE = 0x1000,
+	GET_HANDLE = 0x10000,
+	RELEASE_HANDLE = 0x100000,
+	PUT_ONE = 0x1000000,
 };
 
 struct get_set_args {
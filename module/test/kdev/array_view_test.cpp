@@ -0,0 +1,109 @@
+#include "../../fstore/fstore.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/bpf.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+constexpr __u32 ENTRIES = 1024;
+
+using Regions = fstore::Name<"fault_regions">;
+static_assert(Regions::hash == fnv1aHashConvert("fault_regions"));
+static_assert(Regions::length == 13);
+static_assert(fstore::Name<"bulkload">::packed() == unsafeHashConvert("bulkload"));
+
+struct Pair {
+  __u64 count;
+  __u64 sum;
+};
+
+// Padded to 8 bytes in the map, so not contiguous
+struct Odd {
+  __u32 words[3];
+};
+
+static_assert(fstore::ArrayView<__u32, Pair, ENTRIES>::contiguous);
+static_assert(fstore::ArrayView<__u32, Odd>::stride == 16);
+static_assert(!fstore::ArrayView<__u32, Odd>::contiguous);
+
+static int create_array(__u32 value_size, __u32 flags) {
+  union bpf_attr attr = {
+      .map_type = BPF_MAP_TYPE_ARRAY,
+      .key_size = 4,
+      .value_size = value_size,
+      .max_entries = ENTRIES,
+      .map_flags = flags,
+  };
+  int fd = syscall(SYS_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
+  if (fd < 0) {
+    auto err = errno;
+    std::cerr << "Failed to create map: " << err << ", " << std::strerror(err) << std::endl;
+    exit(fd);
+  }
+  return fd;
+}
+
+static void update(int fd, __u32 key, const void* value) {
+  union bpf_attr attr = {};
+  attr.map_fd = fd;
+  attr.key = (__u64)&key;
+  attr.value = (__u64)value;
+  int err = syscall(SYS_bpf, BPF_MAP_UPDATE_ELEM, &attr, sizeof(attr));
+  assert(err == 0);
+}
+
+int main() {
+  int pairs_fd = create_array(sizeof(Pair), BPF_F_MMAPABLE);
+  for (__u32 i = 0; i < ENTRIES; i++) {
+    Pair pair = {.count = i, .sum = (__u64)i * 3};
+    update(pairs_fd, i, &pair);
+  }
+
+  auto pairs = fstore::ArrayView<__u32, Pair, ENTRIES>::attach(pairs_fd);
+  assert(pairs);
+  assert(pairs->size() == ENTRIES);
+  assert((*pairs)[7].sum == 21);
+
+  // values() is one span over the whole array
+  __u64 sum = 0;
+  for (const Pair& pair : *pairs) {
+    sum += pair.count;
+  }
+  assert(sum == (__u64)ENTRIES * (ENTRIES - 1) / 2);
+
+  // A dynamic view takes the map's size
+  auto dynamic = fstore::ArrayView<__u32, Pair>::attach(pairs_fd);
+  assert(dynamic && dynamic->size() == ENTRIES);
+
+  // Any other layout is refused before mapping
+  auto wrong_size = fstore::ArrayView<__u32, Pair, ENTRIES / 2>::attach(pairs_fd);
+  assert(!wrong_size && errno == EINVAL);
+  auto wrong_value = fstore::ArrayView<__u32, __u64, ENTRIES>::attach(pairs_fd);
+  assert(!wrong_value && errno == EINVAL);
+
+  int unmappable_fd = create_array(sizeof(Pair), 0);
+  auto unmappable = fstore::ArrayView<__u32, Pair, ENTRIES>::attach(unmappable_fd);
+  assert(!unmappable && errno == EINVAL);
+
+  // Padded values land on the map's 8 byte stride
+  int odd_fd = create_array(sizeof(Odd), BPF_F_MMAPABLE);
+  Odd odd = {.words = {1, 2, 3}};
+  update(odd_fd, ENTRIES - 1, &odd);
+  auto odds = fstore::ArrayView<__u32, Odd>::attach(odd_fd);
+  assert(odds);
+  assert((*odds)[ENTRIES - 1].words[2] == 3);
+  assert((*odds)[ENTRIES - 2].words[2] == 0);
+
+  // Moving hands over the mapping
+  auto moved = std::move(*pairs);
+  assert(moved[ENTRIES - 1].count == ENTRIES - 1);
+
+  close(odd_fd);
+  close(unmappable_fd);
+  close(pairs_fd);
+  return 0;
+}
@@ -1,8 +1,8 @@
 #include "../../fstore/fstore.h"
+#include "../bench.h"
 #include "../e2e/bench_kernel_get/bench_kernel_get.h"
 #include <cassert>
 #include <cerrno>
-#include <chrono>
 #include <cstdio>
 #include <cstring>
 #include <fcntl.h>
@@ -20,11 +20,6 @@
     exit(-err_errno);                                                              \
   }
 
-constexpr __u64 SAMPLE_VALUE = 0xDEADBEEF;
-constexpr __u64 DEFAULT_NUMBER = 10;
-constexpr __u32 DEFAULT_SIZE = 10;
-constexpr __u32 DEFAULT_DATA_SIZE = 8;
-constexpr int STAT_FD = 3;
 constexpr int RET_FD = 4;
 constexpr __u32 MAX = 16384;
 
@@ -34,33 +29,11 @@ struct data_t {
 
 data_t temp_buffer;
 
-int main(int argc, char** argv) {
-  __u64 number = DEFAULT_NUMBER;
-  __u32 size = DEFAULT_SIZE;
-  __u32 data_size = 0;
-
-  int c;
-  while ((c = getopt(argc, argv, "n:s:d:")) != -1) {
-    switch (c) {
-      case 'n':
-        number = strtoll(optarg, NULL, 10);
-        break;
-      case 's':
-        size = strtol(optarg, NULL, 10);
-        break;
-      case 'd':
-        data_size = strtol(optarg, NULL, 10);
-        break;
-      default:
-        fprintf(stderr, "%s [-n <number>] [-s <map-size>] [-d <data-size> ]\n", argv[0]);
-        exit(-1);
-        break;
-    }
-  }
-
-  // Resize
-  data_size = data_size < DEFAULT_DATA_SIZE ? DEFAULT_DATA_SIZE : data_size;
-  data_size = data_size / DEFAULT_DATA_SIZE * DEFAULT_DATA_SIZE;
+// One point of the sweep, a fresh map of opts.size values of opts.data_size
+static int run(const bench::Options& opts, bool view, __u32& returner) {
+  const __u32 size = opts.size;
+  const __u32 data_size = opts.data_size;
+  ASSERT_ERRNO(data_size <= MAX);
 
   union bpf_attr attr = {
       .map_type = BPF_MAP_TYPE_ARRAY,
@@ -99,40 +72,78 @@ int main(int argc, char** argv) {
     ASSERT_ERRNO(err == 0);
   }
 
-  std::byte* map_ptr =
-      (std::byte*)mmap(NULL, size * data_size, PROT_READ, MAP_SHARED | MAP_POPULATE, ebpf_fd, 0);
-  ASSERT_ERRNO(map_ptr != MAP_FAILED);
-
   rand = {1, 4, 7, 13};
 
-  __u32 returner = 0;
-  const auto start = std::chrono::steady_clock::now();
-  for (__u64 i = 0; i < number; i++) {
-    key = simplerand(&rand) % size;
-    memcpy(&temp_buffer, map_ptr + (data_size * size), data_size);
-    for (__u32 j = 0; j < data_size / 4; j++) {
-      returner ^= temp_buffer.size[j];
+  bench::Result result;
+  if (view) {
+    // The value size is a constant, the read below unrolls and vectorizes
+    bool sized = bench::with_data_size(data_size, [&](auto bytes) {
+      using Value = bench::Words<decltype(bytes)::value>;
+      auto values = fstore::ArrayView<__u32, Value>::attach(ebpf_fd);
+      ASSERT_ERRNO(values);
+      result = bench::time_ops(opts, [&](__u64) {
+        key = simplerand(&rand) % size;
+        const Value& value = (*values)[key];
+        // a local the reads cannot alias keeps the loop vectorized
+        __u32 folded = 0;
+        for (__u32 word : value.words) {
+          folded ^= word;
+        }
+        returner ^= folded;
+      });
+    });
+    if (!sized) {
+      std::cerr << "-v has no view of " << data_size << " byte values" << std::endl;
+      close(ebpf_fd);
+      free(sample_buffer);
+      return -EINVAL;
     }
+  } else {
+    std::byte* map_ptr =
+        (std::byte*)mmap(NULL, size * data_size, PROT_READ, MAP_SHARED | MAP_POPULATE, ebpf_fd, 0);
+    ASSERT_ERRNO(map_ptr != MAP_FAILED);
+
+    result = bench::time_ops(opts, [&](__u64) {
+      key = simplerand(&rand) % size;
+      memcpy(&temp_buffer, map_ptr + (size_t)data_size * key, data_size);
+      for (__u32 j = 0; j < data_size / 4; j++) {
+        returner ^= temp_buffer.size[j];
+      }
+    });
+
+    munmap(map_ptr, size * data_size);
   }
-  const auto stop = std::chrono::steady_clock::now();
-  auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
-
-  munmap(map_ptr, size * data_size);
 
   close(ebpf_fd);
+  free(sample_buffer);
 
-  err = fcntl(STAT_FD, F_GETFD);
-  if (err != -1) {
+  if (bench::Report("bpf_map_bench", view ? "view" : "mmap", opts).write(result)) {
     std::cerr << "Output to stats" << std::endl;
-    err = dprintf(STAT_FD, "get_iterations %lld\tmap_size %d\tvalue_size %d\tTime(ns) %ld\n",
-                  number, size, data_size, time);
-    assert(err > 0);
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  // -v reads through a statically sized fstore::ArrayView instead
+  bool view = false;
+  const auto opts = bench::Options::parse(
+      argc, argv, "v",
+      [&](int, const char*) {
+        view = true;
+      },
+      "[-v]");
+  bench::pin_cpu(opts.cpu);
+
+  __u32 returner = 0;
+  for (const auto& point : opts.points()) {
+    int err = run(point, view, returner);
+    if (err) return err;
   }
 
-  err = fcntl(RET_FD, F_GETFD);
+  int err = fcntl(RET_FD, F_GETFD);
   if (err != -1) {
     std::cerr << "Output to returner" << std::endl;
-    err = dprintf(STAT_FD, "returner %d", returner);
+    err = dprintf(RET_FD, "returner %d", returner);
     assert(err > 0);
   }
 }
@@ -0,0 +1,52 @@
+#include "../bench.h"
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+int main() {
+  bench::Histogram histogram;
+  for (__u64 value = 1; value <= 10000; value++) {
+    histogram.record(value);
+  }
+  assert(histogram.count() == 10000);
+  assert(histogram.min() == 1 && histogram.max() == 10000);
+  // Buckets are within 1/32 of their values
+  auto near = [](__u64 got, __u64 want) { return got >= want - want / 32 && got <= want + want / 32; };
+  assert(near(histogram.percentile(0.5), 5000));
+  assert(near(histogram.percentile(0.99), 9900));
+  assert(near(histogram.percentile(0.999), 9990));
+  assert(histogram.percentile(1.0) == 10000);
+
+  char* argv[] = {(char*)"bench_harness", (char*)"-n", (char*)"64", (char*)"-d", (char*)"12",
+                  (char*)"-t", (char*)"3", (char*)"-B", (char*)"8", nullptr};
+  const auto opts = bench::Options::parse(9, argv);
+  assert(opts.number == 64 && opts.data_size == 8 && opts.trials == 3 && opts.batch == 8);
+
+  // -s and -d lists sweep every pair, sizes rounded down to 8 bytes as before
+  char* sweep_argv[] = {(char*)"bench_harness", (char*)"-s", (char*)"32,64", (char*)"-d",
+                        (char*)"8,20,512", nullptr};
+  optind = 1;
+  const auto sweep = bench::Options::parse(5, sweep_argv);
+  assert(sweep.size == 32 && sweep.data_size == 8);
+  const auto points = sweep.points();
+  assert(points.size() == 6);
+  assert(points[1].size == 64 && points[1].data_size == 8);
+  assert(points[2].size == 32 && points[2].data_size == 16);
+  assert(points[5].size == 64 && points[5].data_size == 512);
+
+  __u64 calls = 0;
+  const auto result = bench::time_ops(opts, [&](__u64) { bench::do_not_optimize(++calls); });
+  // Warmup trials run the loop but are not reported
+  assert(calls == (opts.warmup + opts.trials) * opts.number);
+  assert(result.trial_ns.size() == opts.trials);
+  assert(result.op_ps.count() == opts.trials * opts.number / opts.batch);
+
+  const std::string json = bench::Report("bench_harness", "loop", opts).json(result);
+  assert(json.starts_with("{\"bench\":\"bench_harness\",\"mode\":\"loop\",\"iterations\":64"));
+  assert(json.find("\"trial_ns\":[") != std::string::npos);
+  assert(json.find("\"cycles\":null") != std::string::npos);
+  assert(json.ends_with("}\n"));
+  std::cerr << json;
+  return 0;
+}
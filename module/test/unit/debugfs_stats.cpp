@@ -0,0 +1,133 @@
+#include "../../fstore/fstore.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <linux/bpf.h>
+#include <optional>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+constexpr char NAME[] = "debugfs_stats_test";
+constexpr __u64 MAP_NAME = fnv1aHashConvert(NAME);
+constexpr __u64 MISSING_NAME = fnv1aHashConvert("debugfs_stats_missing");
+constexpr __u32 ENTRIES = 512;
+constexpr char STATS_PATH[] = "/sys/kernel/debug/fstore/stats.bin";
+
+struct Snapshot {
+  fstore_stats_header header;
+  std::vector<fstore_map_stats> maps;
+
+  std::optional<fstore_map_stats> find(__u64 map_name) const {
+    for (const auto& map : maps) {
+      if (map.map_name == map_name) return map;
+    }
+    return std::nullopt;
+  }
+};
+
+static Snapshot snapshot() {
+  std::ifstream file(STATS_PATH, std::ios::binary);
+  assert(file.good());
+  std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  assert(bytes.size() >= sizeof(fstore_stats_header));
+
+  Snapshot snap;
+  std::memcpy(&snap.header, bytes.data(), sizeof(snap.header));
+  assert(snap.header.magic == FSTORE_STATS_MAGIC);
+  assert(snap.header.version == FSTORE_STATS_VERSION);
+  assert(bytes.size() == sizeof(fstore_stats_header) + snap.header.num_maps * sizeof(fstore_map_stats));
+  snap.maps.resize(snap.header.num_maps);
+  std::memcpy(snap.maps.data(), bytes.data() + sizeof(snap.header),
+              snap.maps.size() * sizeof(fstore_map_stats));
+  return snap;
+}
+
+int main() {
+  // A module built with FSTORE_STATS=n or without debugfs has nothing to check
+  if (access(STATS_PATH, R_OK) != 0) {
+    std::cerr << "No " << STATS_PATH << ", skipping" << std::endl;
+    return 0;
+  }
+
+  union bpf_attr attr = {
+      .map_type = BPF_MAP_TYPE_ARRAY,
+      .key_size = 4,
+      .value_size = 8,
+      .max_entries = ENTRIES,
+      .map_flags = BPF_F_MMAPABLE,
+  };
+
+  int ebpf_fd = syscall(SYS_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
+  if (ebpf_fd < 0) {
+    auto err = errno;
+    std::cerr << "Failed to create map: " << err << ", " << std::strerror(err) << std::endl;
+    return ebpf_fd;
+  }
+
+  int fd = open("/dev/fstore_device", O_RDWR);
+  if (fd < 0) {
+    auto err = errno;
+    std::cerr << "Failed to open module: " << err << ", " << std::strerror(err) << std::endl;
+    return -EBADF;
+  }
+
+  register_named_input named = {.fd = (__u32)ebpf_fd};
+  std::strcpy(named.name, NAME);
+  int err = ioctl(fd, REGISTER_MAP_NAMED, (unsigned long)&named);
+  assert(err == 0);
+
+  Snapshot before = snapshot();
+  auto registered = before.find(MAP_NAME);
+  assert(registered);
+  assert(std::strcmp(registered->name, NAME) == 0);
+  for (__u32 i = 0; i < FSTORE_STAT_NR; i++) {
+    assert(registered->count[i] == 0);
+  }
+
+  std::vector<__u32> keys(ENTRIES);
+  std::vector<__u64> values(ENTRIES);
+  for (__u32 i = 0; i < ENTRIES; i++) {
+    keys[i] = i;
+    values[i] = i;
+  }
+  load_input load = {.map_name = MAP_NAME};
+  load.attr.batch.keys = (__u64)keys.data();
+  load.attr.batch.values = (__u64)values.data();
+  load.attr.batch.count = ENTRIES;
+  err = ioctl(fd, LOAD_MAP, (unsigned long)&load);
+  assert(err == 0);
+
+  // Unknown names are only counted by errno
+  load.map_name = MISSING_NAME;
+  err = ioctl(fd, LOAD_MAP, (unsigned long)&load);
+  assert(err != 0 && errno == ENOKEY);
+
+  err = ioctl(fd, SELECT_MAP, MAP_NAME);
+  assert(err == 0);
+  size_t size = (size_t)ENTRIES * sizeof(__u64);
+  void* values_ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  assert(values_ptr != MAP_FAILED);
+
+  Snapshot after = snapshot();
+  auto counted = after.find(MAP_NAME);
+  assert(counted);
+  assert(counted->count[FSTORE_STAT_LOAD] == 1);
+  assert(counted->count[FSTORE_STAT_MMAP] == 1);
+  assert(counted->count[FSTORE_STAT_GET] == 0);
+  // Other users of the module may fail lookups in between
+  assert(after.header.errors[FSTORE_ERR_NOKEY] >= before.header.errors[FSTORE_ERR_NOKEY] + 1);
+
+  munmap(values_ptr, size);
+  err = ioctl(fd, UNREGISTER_MAP, MAP_NAME);
+  assert(err == 1);
+  assert(!snapshot().find(MAP_NAME));
+  return 0;
+}
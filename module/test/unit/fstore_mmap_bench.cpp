@@ -0,0 +1,148 @@
+#include "../../fstore/fstore.h"
+#include "../bench.h"
+#include "../e2e/bench_kernel_get/bench_kernel_get.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/bpf.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define ASSERT_ERRNO(x)                                                            \
+  if (!(x)) {                                                                      \
+    int err_errno = errno;                                                         \
+    fprintf(stderr, "%s:%d: errno:%s\n", __FILE__, __LINE__, strerror(err_errno)); \
+    exit(-err_errno);                                                              \
+  }
+
+constexpr int RET_FD = 4;
+constexpr __u32 MAX = 16384;
+constexpr __u64 MAP_NAME = unsafeHashConvert("fsmmap");
+
+struct data_t {
+  __u32 size[MAX / sizeof(__u32)];
+};
+
+data_t temp_buffer;
+
+// One point of the sweep, a fresh map of opts.size values of opts.data_size
+static int run(const bench::Options& opts, __u32& returner) {
+  const __u32 size = opts.size;
+  const __u32 data_size = opts.data_size;
+  ASSERT_ERRNO(data_size <= MAX);
+
+  union bpf_attr attr = {
+      .map_type = BPF_MAP_TYPE_ARRAY,
+      .key_size = 4,
+      .value_size = data_size,
+      .max_entries = size,
+      .map_flags = BPF_F_MMAPABLE,
+  };
+
+  int ebpf_fd = syscall(SYS_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
+  if (ebpf_fd < 0) {
+    auto err = errno;
+    std::cerr << "Failed to create map: " << err << ", " << std::strerror(err) << std::endl;
+    return ebpf_fd;
+  }
+
+  bzero(&attr, sizeof(attr));
+
+  int err = 0;
+  __u32 key = 0;
+  __u64* sample_buffer = (__u64*)malloc(sizeof(char) * data_size);
+
+  attr.map_fd = ebpf_fd;
+  attr.key = (__u64)&key;
+  attr.value = (__u64)sample_buffer;
+  attr.flags = BPF_EXIST;
+
+  ShiftXor rand{1, 4, 7, 13};
+
+  for (__u64 i = 0; i < size; i++) {
+    key = i;
+    for (size_t i = 0; i < data_size / 8; i++) {
+      sample_buffer[i] = simplerand(&rand);
+    }
+    err = syscall(SYS_bpf, BPF_MAP_UPDATE_ELEM, &attr, sizeof(attr));
+    ASSERT_ERRNO(err == 0);
+  }
+
+  int fd = open("/dev/fstore_device", O_RDWR);
+  ASSERT_ERRNO(fd >= 0);
+
+  register_input reg = {
+      .map_name = MAP_NAME,
+      .fd = (__u32)ebpf_fd,
+  };
+  err = ioctl(fd, REGISTER_MAP, (unsigned long)&reg);
+  ASSERT_ERRNO(err == 0);
+
+  err = ioctl(fd, SELECT_MAP, MAP_NAME);
+  ASSERT_ERRNO(err == 0);
+
+  // The device only hands out read only views
+  void* writable = mmap(NULL, size * data_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ASSERT_ERRNO(writable == MAP_FAILED && errno == EACCES);
+  void* executable = mmap(NULL, size * data_size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+  ASSERT_ERRNO(executable == MAP_FAILED && errno == EACCES);
+
+  std::byte* map_ptr =
+      (std::byte*)mmap(NULL, size * data_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+  ASSERT_ERRNO(map_ptr != MAP_FAILED);
+  // Nor can a read only view be made writable or executable afterwards
+  err = mprotect(map_ptr, size * data_size, PROT_READ | PROT_WRITE);
+  ASSERT_ERRNO(err == -1 && errno == EACCES);
+  err = mprotect(map_ptr, size * data_size, PROT_READ | PROT_EXEC);
+  ASSERT_ERRNO(err == -1 && errno == EACCES);
+
+  // Same bytes as the value we last wrote through the bpf syscall
+  ASSERT_ERRNO(memcmp(map_ptr + (size_t)data_size * (size - 1), sample_buffer, data_size) == 0);
+
+  rand = {1, 4, 7, 13};
+
+  const auto result = bench::time_ops(opts, [&](__u64) {
+    key = simplerand(&rand) % size;
+    memcpy(&temp_buffer, map_ptr + (size_t)data_size * key, data_size);
+    for (__u32 j = 0; j < data_size / 4; j++) {
+      returner ^= temp_buffer.size[j];
+    }
+  });
+
+  munmap(map_ptr, size * data_size);
+
+  err = ioctl(fd, UNREGISTER_MAP, MAP_NAME);
+  ASSERT_ERRNO(err == 1);
+
+  close(fd);
+  close(ebpf_fd);
+  free(sample_buffer);
+
+  if (bench::Report("fstore_mmap_bench", "mmap", opts).write(result)) {
+    std::cerr << "Output to stats" << std::endl;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const auto opts = bench::Options::parse(argc, argv);
+  bench::pin_cpu(opts.cpu);
+
+  __u32 returner = 0;
+  for (const auto& point : opts.points()) {
+    int err = run(point, returner);
+    if (err) return err;
+  }
+
+  int err = fcntl(RET_FD, F_GETFD);
+  if (err != -1) {
+    std::cerr << "Output to returner" << std::endl;
+    err = dprintf(RET_FD, "returner %d", returner);
+    assert(err > 0);
+  }
+}
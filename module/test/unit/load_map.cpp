@@ -0,0 +1,99 @@
+#include "../../fstore/fstore.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/bpf.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+constexpr __u32 ENTRIES = 1 << 16;
+constexpr __u64 MAP_NAME = unsafeHashConvert("bulkload");
+
+int main() {
+  union bpf_attr attr = {
+      .map_type = BPF_MAP_TYPE_HASH,
+      .key_size = 4,
+      .value_size = 8,
+      .max_entries = ENTRIES,
+  };
+
+  int ebpf_fd = syscall(SYS_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
+  if (ebpf_fd < 0) {
+    auto err = errno;
+    std::cerr << "Failed to create map: " << err << ", " << std::strerror(err) << std::endl;
+    return ebpf_fd;
+  }
+
+  int fd = open("/dev/fstore_device", O_RDWR);
+  if (fd < 0) {
+    auto err = errno;
+    std::cerr << "Failed to open module: " << err << ", " << std::strerror(err) << std::endl;
+    return -EBADF;
+  }
+
+  std::vector<__u32> keys(ENTRIES);
+  std::vector<__u64> values(ENTRIES);
+  for (__u32 i = 0; i < ENTRIES; i++) {
+    keys[i] = i * 7 + 1;
+    values[i] = (__u64)i << 32 | 0xfeed;
+  }
+
+  load_input load = {.map_name = MAP_NAME};
+  load.attr.batch.keys = (__u64)keys.data();
+  load.attr.batch.values = (__u64)values.data();
+  load.attr.batch.count = ENTRIES;
+
+  // Nothing is registered under the name yet
+  int err = ioctl(fd, LOAD_MAP, (unsigned long)&load);
+  assert(err != 0 && errno == ENOKEY);
+
+  register_input reg = {.map_name = MAP_NAME, .fd = (__u32)ebpf_fd};
+  err = ioctl(fd, REGISTER_MAP, (unsigned long)&reg);
+  assert(err == 0);
+
+  // The whole table in one call
+  err = ioctl(fd, LOAD_MAP, (unsigned long)&load);
+  assert(err == 0);
+  assert(load.attr.batch.count == ENTRIES);
+
+  __u32 key = 0;
+  __u64 value = 0;
+  bzero(&attr, sizeof(attr));
+  attr.map_fd = ebpf_fd;
+  attr.key = (__u64)&key;
+  attr.value = (__u64)&value;
+  for (__u32 i = 0; i < ENTRIES; i += 997) {
+    key = keys[i];
+    err = syscall(SYS_bpf, BPF_MAP_LOOKUP_ELEM, &attr, sizeof(attr));
+    assert(err == 0);
+    assert(value == values[i]);
+  }
+
+  // Only BPF_F_LOCK is a valid element flag, as for BPF_MAP_UPDATE_BATCH
+  load.attr.batch.count = 1;
+  load.attr.batch.elem_flags = BPF_NOEXIST;
+  err = ioctl(fd, LOAD_MAP, (unsigned long)&load);
+  assert(err != 0 && errno == EINVAL);
+
+  // A full map stops the load part way and reports how far it got
+  keys.push_back(0);
+  values.push_back(0);
+  load.attr.batch.keys = (__u64)(keys.data() + ENTRIES);
+  load.attr.batch.values = (__u64)(values.data() + ENTRIES);
+  load.attr.batch.elem_flags = 0;
+  err = ioctl(fd, LOAD_MAP, (unsigned long)&load);
+  assert(err != 0 && errno == E2BIG);
+  assert(load.attr.batch.count == 0);
+
+  err = ioctl(fd, UNREGISTER_MAP, MAP_NAME);
+  assert(err == 1);
+
+  close(fd);
+  close(ebpf_fd);
+  return 0;
+}
@@ -0,0 +1,134 @@
+#include "../../fstore/fstore.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/bpf.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+constexpr __u64 MAP_NAME = unsafeHashConvert("notify");
+// Well past the default notify_interval_ms of 10
+constexpr int POLL_TIMEOUT_MS = 1000;
+
+static int create_map(__u32 type, __u32 key_size, __u32 value_size, __u32 max_entries) {
+  union bpf_attr attr = {
+      .map_type = type,
+      .key_size = key_size,
+      .value_size = value_size,
+      .max_entries = max_entries,
+  };
+  return syscall(SYS_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
+}
+
+static short poll_events(int fd, int timeout_ms) {
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  int err = poll(&pfd, 1, timeout_ms);
+  assert(err >= 0);
+  return err ? pfd.revents : 0;
+}
+
+// What a BPF writer does with FSTORE_GEN_BUMP, from user space
+static void bump(int gen_fd, __u64 count) {
+  __u64 name = MAP_NAME;
+  __u64 value = count;
+  union bpf_attr attr = {};
+  attr.map_fd = gen_fd;
+  attr.key = (__u64)&name;
+  attr.value = (__u64)&value;
+  int err = syscall(SYS_bpf, BPF_MAP_UPDATE_ELEM, &attr, sizeof(attr));
+  assert(err == 0);
+}
+
+int main() {
+  int ebpf_fd = create_map(BPF_MAP_TYPE_HASH, 4, 8, 64);
+  int gen_fd = create_map(BPF_MAP_TYPE_HASH, 8, 8, 64);
+  if (ebpf_fd < 0 || gen_fd < 0) {
+    auto err = errno;
+    std::cerr << "Failed to create map: " << err << ", " << std::strerror(err) << std::endl;
+    return -1;
+  }
+
+  int fd = open("/dev/fstore_device", O_RDWR);
+  int watch_fd = open("/dev/fstore_device", O_RDWR);
+  if (fd < 0 || watch_fd < 0) {
+    auto err = errno;
+    std::cerr << "Failed to open module: " << err << ", " << std::strerror(err) << std::endl;
+    return -EBADF;
+  }
+
+  // Nothing to wait for yet
+  assert(poll_events(watch_fd, 0) == POLLERR);
+  __u64 generation = 0;
+  int err = ioctl(watch_fd, MAP_GENERATION, (unsigned long)&generation);
+  assert(err != 0 && errno == EBADF);
+  err = ioctl(watch_fd, WATCH_MAP, MAP_NAME);
+  assert(err != 0 && errno == ENOKEY);
+
+  register_named_input named = {.fd = (__u32)gen_fd};
+  std::strcpy(named.name, FSTORE_GEN_MAP);
+  err = ioctl(fd, REGISTER_MAP_NAMED, (unsigned long)&named);
+  assert(err == 0);
+  register_input reg = {.map_name = MAP_NAME, .fd = (__u32)ebpf_fd};
+  err = ioctl(fd, REGISTER_MAP, (unsigned long)&reg);
+  assert(err == 0);
+
+  err = ioctl(watch_fd, WATCH_MAP, MAP_NAME);
+  assert(err == 0);
+  assert(poll_events(watch_fd, 0) == 0);
+
+  bump(gen_fd, 1);
+  assert(poll_events(watch_fd, POLL_TIMEOUT_MS) & POLLIN);
+  err = ioctl(watch_fd, MAP_GENERATION, (unsigned long)&generation);
+  assert(err == 0 && generation == 1);
+  assert(poll_events(watch_fd, 0) == 0);
+
+  // A burst of bumps is one wakeup with the last generation
+  for (__u64 count = 2; count <= 1000; count++) {
+    bump(gen_fd, count);
+  }
+  assert(poll_events(watch_fd, POLL_TIMEOUT_MS) & POLLIN);
+  usleep(50 * 1000);
+  err = ioctl(watch_fd, MAP_GENERATION, (unsigned long)&generation);
+  assert(err == 0 && generation == 1000);
+  assert(poll_events(watch_fd, 0) == 0);
+
+  // Writes through fstore count as well
+  __u32 key = 7;
+  __u64 value = 42;
+  load_input load = {.map_name = MAP_NAME};
+  load.attr.batch.keys = (__u64)&key;
+  load.attr.batch.values = (__u64)&value;
+  load.attr.batch.count = 1;
+  err = ioctl(fd, LOAD_MAP, (unsigned long)&load);
+  assert(err == 0);
+  assert(poll_events(watch_fd, POLL_TIMEOUT_MS) & POLLIN);
+  err = ioctl(watch_fd, MAP_GENERATION, (unsigned long)&generation);
+  assert(err == 0 && generation == 1001);
+
+  // Failed ones that wrote nothing do not
+  load.attr.batch.elem_flags = BPF_NOEXIST;
+  err = ioctl(fd, LOAD_MAP, (unsigned long)&load);
+  assert(err != 0 && errno == EINVAL);
+  assert(load.attr.batch.count == 0);
+  assert(poll_events(watch_fd, POLL_TIMEOUT_MS) == 0);
+  err = ioctl(watch_fd, MAP_GENERATION, (unsigned long)&generation);
+  assert(err == 0 && generation == 1001);
+
+  err = ioctl(fd, UNREGISTER_MAP, MAP_NAME);
+  assert(err == 1);
+  assert(poll_events(watch_fd, POLL_TIMEOUT_MS) & POLLHUP);
+
+  err = ioctl(fd, UNREGISTER_MAP, fnv1aHashConvert(FSTORE_GEN_MAP));
+  assert(err == 1);
+
+  close(watch_fd);
+  close(fd);
+  close(gen_fd);
+  close(ebpf_fd);
+  return 0;
+}
@@ -0,0 +1,70 @@
+#include "../../fstore/fstore.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/bpf.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+constexpr char LONG_NAME[] = "tcp_v4_rcv_branches";
+constexpr __u64 LONG_HASH = fnv1aHashConvert(LONG_NAME);
+
+// Hashed names can never land on a packed 8 byte name
+static_assert(LONG_HASH & FSTORE_NAME_HASHED);
+static_assert(!(unsafeHashConvert("tcp_v4_r") & FSTORE_NAME_HASHED));
+
+int main() {
+  union bpf_attr attr = {
+      .map_type = BPF_MAP_TYPE_ARRAY,
+      .key_size = 4,
+      .value_size = 8,
+      .max_entries = 100,
+  };
+
+  int ebpf_fd = syscall(SYS_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
+  if (ebpf_fd < 0) {
+    auto err = errno;
+    std::cerr << "Failed to create map: " << err << ", " << std::strerror(err) << std::endl;
+    return ebpf_fd;
+  }
+
+  int fd = open("/dev/fstore_device", O_RDWR);
+  if (fd < 0) {
+    auto err = errno;
+    std::cerr << "Failed to open module: " << err << ", " << std::strerror(err) << std::endl;
+    return -EBADF;
+  }
+
+  register_named_input named = {.fd = (__u32)ebpf_fd};
+  std::strcpy(named.name, LONG_NAME);
+  int err = ioctl(fd, REGISTER_MAP_NAMED, (unsigned long)&named);
+  assert(err == 0);
+
+  err = ioctl(fd, REGISTER_MAP_NAMED, (unsigned long)&named);
+  assert(err != 0);
+  assert(errno == EEXIST);
+
+  // The packed name with the same first 8 bytes is a different map
+  register_input reg = {
+      .map_name = unsafeHashConvert(LONG_NAME),
+      .fd = (__u32)ebpf_fd,
+  };
+  err = ioctl(fd, REGISTER_MAP, (unsigned long)&reg);
+  assert(err == 0);
+
+  std::memset(named.name, 'a', FSTORE_NAME_LEN);
+  err = ioctl(fd, REGISTER_MAP_NAMED, (unsigned long)&named);
+  assert(err != 0);
+  assert(errno == ENAMETOOLONG);
+
+  err = ioctl(fd, UNREGISTER_MAP, LONG_HASH);
+  assert(err == 1);
+
+  err = ioctl(fd, UNREGISTER_MAP, reg.map_name);
+  assert(err == 1);
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include "../../fstore/fstore.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/bpf.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Enough names to be well past the old 256 entry registry
+constexpr __u32 NAMES_PER_THREAD = 1024;
+constexpr __u32 CHURN_ITERATIONS = 4096;
+constexpr __u64 CONTENDED_NAME = unsafeHashConvert("contend");
+
+static __u64 thread_name(__u32 thread, __u32 i) {
+  return (__u64)'s' << 56 | (__u64)thread << 32 | i;
+}
+
+int main() {
+  union bpf_attr attr = {
+      .map_type = BPF_MAP_TYPE_ARRAY,
+      .key_size = 4,
+      .value_size = 8,
+      .max_entries = 100,
+  };
+
+  int ebpf_fd = syscall(SYS_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
+  if (ebpf_fd < 0) {
+    auto err = errno;
+    std::cerr << "Failed to create map: " << err << ", " << std::strerror(err) << std::endl;
+    return ebpf_fd;
+  }
+
+  int fd = open("/dev/fstore_device", O_RDWR);
+  if (fd < 0) {
+    auto err = errno;
+    std::cerr << "Failed to open module: " << err << ", " << std::strerror(err) << std::endl;
+    return -EBADF;
+  }
+
+  const __u32 threads = std::clamp(std::thread::hardware_concurrency(), 2u, 16u);
+  std::vector<std::thread> workers;
+
+  // Everyone races on one name, exactly one register may win
+  std::atomic<__u32> won = 0;
+  std::atomic<__u32> lost = 0;
+  for (__u32 t = 0; t < threads; t++) {
+    workers.emplace_back([&]() {
+      register_input reg = {.map_name = CONTENDED_NAME, .fd = (__u32)ebpf_fd};
+      int err = ioctl(fd, REGISTER_MAP, (unsigned long)&reg);
+      if (err == 0) {
+        won++;
+      } else if (errno == EEXIST) {
+        lost++;
+      }
+    });
+  }
+  for (auto& w : workers) w.join();
+  workers.clear();
+  assert(won == 1);
+  assert(lost == threads - 1);
+  int err = ioctl(fd, UNREGISTER_MAP, CONTENDED_NAME);
+  assert(err == 1);
+
+  // Fill the registry from every thread at once, then drain it
+  std::atomic<__u32> failures = 0;
+  for (__u32 t = 0; t < threads; t++) {
+    workers.emplace_back([&, t]() {
+      for (__u32 i = 0; i < NAMES_PER_THREAD; i++) {
+        register_input reg = {.map_name = thread_name(t, i), .fd = (__u32)ebpf_fd};
+        if (ioctl(fd, REGISTER_MAP, (unsigned long)&reg) != 0) failures++;
+      }
+      for (__u32 i = 0; i < NAMES_PER_THREAD; i++) {
+        if (ioctl(fd, UNREGISTER_MAP, thread_name(t, i)) != 1) failures++;
+      }
+    });
+  }
+  for (auto& w : workers) w.join();
+  workers.clear();
+  assert(failures == 0);
+
+  // Register and unregister concurrently so the table grows and shrinks
+  for (__u32 t = 0; t < threads; t++) {
+    workers.emplace_back([&, t]() {
+      for (__u32 i = 0; i < CHURN_ITERATIONS; i++) {
+        __u64 name = thread_name(t, i % NAMES_PER_THREAD);
+        register_input reg = {.map_name = name, .fd = (__u32)ebpf_fd};
+        if (ioctl(fd, REGISTER_MAP, (unsigned long)&reg) != 0) failures++;
+        if (ioctl(fd, UNREGISTER_MAP, name) != 1) failures++;
+      }
+    });
+  }
+  for (auto& w : workers) w.join();
+  assert(failures == 0);
+
+  close(fd);
+  close(ebpf_fd);
+  return 0;
+}
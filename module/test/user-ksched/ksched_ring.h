@@ -0,0 +1,201 @@
+#ifndef _KSCHED_RING_H_
+#define _KSCHED_RING_H_
+#include <linux/types.h>
+
+/*
+ * Single producer, single consumer ring in the /dev/ksched shared region,
+ * the channel a user space policy feeds decisions to the kernel scheduler
+ * through. head and tail are free running counters on cache lines of their
+ * own, each written by one side only, so the two sides never write the same
+ * line. Both sides work in batches: a producer fills any number of slots and
+ * publishes them with one head store, a consumer reads every slot up to head
+ * and hands them back with one tail store.
+ */
+#define KSCHED_RING_CACHELINE 64
+#define KSCHED_RING_MAGIC 0x31676e69726b73ULL	/* "skring1" */
+/* past the per-CPU area and the pages user_ksched reads */
+#define KSCHED_RING_OFFSET (1UL << 20)
+
+struct ksched_ring {
+	/* set once by ksched_ring_init */
+	__u64 magic;
+	__u32 slots;		/* a power of two */
+	__u32 slot_size;	/* a multiple of KSCHED_RING_CACHELINE */
+	__u8 pad0[KSCHED_RING_CACHELINE - 16];
+	/* next slot the producer publishes */
+	__u64 head;
+	__u8 pad1[KSCHED_RING_CACHELINE - 8];
+	/* next slot the consumer reads */
+	__u64 tail;
+	__u8 pad2[KSCHED_RING_CACHELINE - 8];
+	/* slots follow */
+} __attribute__((aligned(KSCHED_RING_CACHELINE)));
+
+/* slots are padded to whole cache lines */
+static inline __u32 ksched_ring_slot_size(__u32 size)
+{
+	return (size + KSCHED_RING_CACHELINE - 1) /
+		KSCHED_RING_CACHELINE * KSCHED_RING_CACHELINE;
+}
+
+/* bytes of shared memory a ring needs */
+static inline __u64 ksched_ring_bytes(__u32 slots, __u32 slot_size)
+{
+	return sizeof(struct ksched_ring) +
+		(__u64) slots * ksched_ring_slot_size(slot_size);
+}
+
+static inline void* ksched_ring_slot(struct ksched_ring* ring, __u64 index)
+{
+	return (char*) (ring + 1) +
+		(index & (ring->slots - 1)) * (__u64) ring->slot_size;
+}
+
+#ifdef __KERNEL__
+#include <linux/log2.h>
+#include <linux/minmax.h>
+
+/*
+ * Consumer side for ksched.c. The ring was set up by user space, which can
+ * rewrite any of it at any time, so the geometry is checked once and kept in
+ * a private copy, and so is tail. Slots are only ever located through that
+ * copy and head is clamped to it, whatever user space writes afterwards.
+ */
+struct ksched_ring_reader {
+	struct ksched_ring* ring;
+	__u64 tail;
+	__u32 slots;
+	__u32 slot_size;
+};
+
+/* false if the ring in the size bytes at ring is malformed */
+static inline bool ksched_ring_reader_init(struct ksched_ring_reader* reader,
+		struct ksched_ring* ring, __u64 size)
+{
+	__u32 slots = READ_ONCE(ring->slots);
+	__u32 slot_size = READ_ONCE(ring->slot_size);
+	if(size < sizeof(*ring) ||
+		READ_ONCE(ring->magic) != KSCHED_RING_MAGIC ||
+		!slots || !is_power_of_2(slots) ||
+		!slot_size || slot_size % KSCHED_RING_CACHELINE ||
+		ksched_ring_bytes(slots, slot_size) > size) return false;
+	reader->ring = ring;
+	reader->tail = READ_ONCE(ring->tail);
+	reader->slots = slots;
+	reader->slot_size = slot_size;
+	return true;
+}
+
+/* the number of slots ready from the reader's tail on, at most max */
+static inline __u32 ksched_ring_peek(struct ksched_ring_reader* reader,
+		__u32 max)
+{
+	__u64 head = smp_load_acquire(&reader->ring->head);
+	/* a producer can never be more than slots ahead */
+	return min3(head - reader->tail, (__u64) reader->slots, (__u64) max);
+}
+
+/* slot i of the ones peek returned */
+static inline void* ksched_ring_reader_slot(struct ksched_ring_reader* reader,
+		__u32 i)
+{
+	return (char*) (reader->ring + 1) +
+		((reader->tail + i) & (reader->slots - 1)) *
+		(__u64) reader->slot_size;
+}
+
+/* give the n slots peek returned back to the producer */
+static inline void ksched_ring_consume(struct ksched_ring_reader* reader,
+		__u32 n)
+{
+	reader->tail += n;
+	smp_store_release(&reader->ring->tail, reader->tail);
+}
+#endif // __KERNEL__
+
+#ifdef __cplusplus
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+// Sets up an empty ring at mem, which must be cache line aligned and hold
+// ksched_ring_bytes(slots, slot_size). The consumer must not run yet.
+inline ksched_ring* ksched_ring_init(void* mem, __u32 slots, __u32 slot_size) {
+	if (slots == 0 || (slots & (slots - 1))) return nullptr;
+	if ((__u64)mem % KSCHED_RING_CACHELINE) return nullptr;
+	auto* ring = static_cast<ksched_ring*>(mem);
+	std::memset(ring, 0, sizeof(*ring));
+	ring->slots = slots;
+	ring->slot_size = ksched_ring_slot_size(slot_size);
+	std::atomic_ref<__u64>(ring->magic).store(KSCHED_RING_MAGIC, std::memory_order_release);
+	return ring;
+}
+
+// The user side producer, only one may exist per ring. Reserved slots stay
+// invisible to the consumer until publish.
+class KschedRingProducer {
+	ksched_ring* ring_;
+	__u64 head_;
+	// The consumer's tail as last read, only refreshed when the ring looks full
+	__u64 tail_;
+
+public:
+	explicit KschedRingProducer(ksched_ring* ring)
+		: ring_(ring),
+		  head_(std::atomic_ref<__u64>(ring->head).load(std::memory_order_relaxed)),
+		  tail_(std::atomic_ref<__u64>(ring->tail).load(std::memory_order_acquire)) {}
+
+	// The next slot to fill, nullptr while the ring is full
+	void* reserve() {
+		if (head_ - tail_ == ring_->slots) {
+			tail_ = std::atomic_ref<__u64>(ring_->tail).load(std::memory_order_acquire);
+			if (head_ - tail_ == ring_->slots) return nullptr;
+		}
+		return ksched_ring_slot(ring_, head_++);
+	}
+
+	// Makes every reserved slot visible with one store
+	void publish() {
+		std::atomic_ref<__u64>(ring_->head).store(head_, std::memory_order_release);
+	}
+
+	// Whether the consumer has taken everything published
+	bool drained() {
+		tail_ = std::atomic_ref<__u64>(ring_->tail).load(std::memory_order_acquire);
+		return tail_ == head_;
+	}
+};
+
+// The user side consumer, the counterpart of the kernel's ksched_ring_reader
+class KschedRingConsumer {
+	ksched_ring* ring_;
+	__u64 tail_;
+	// The producer's head as last read, only refreshed once caught up
+	__u64 head_;
+
+public:
+	explicit KschedRingConsumer(ksched_ring* ring)
+		: ring_(ring),
+		  tail_(std::atomic_ref<__u64>(ring->tail).load(std::memory_order_relaxed)),
+		  head_(std::atomic_ref<__u64>(ring->head).load(std::memory_order_acquire)) {}
+
+	// The number of slots ready to read, at most max
+	__u32 peek(__u32 max) {
+		if (tail_ == head_)
+			head_ = std::atomic_ref<__u64>(ring_->head).load(std::memory_order_acquire);
+		return std::min<__u64>(head_ - tail_, max);
+	}
+
+	// Slot i of the ones peek returned
+	const void* slot(__u32 i) const { return ksched_ring_slot(ring_, tail_ + i); }
+
+	// Hands n slots back to the producer with one store
+	void consume(__u32 n) {
+		tail_ += n;
+		std::atomic_ref<__u64>(ring_->tail).store(tail_, std::memory_order_release);
+	}
+};
+
+#endif // __cplusplus
+
+#endif // _KSCHED_RING_H_
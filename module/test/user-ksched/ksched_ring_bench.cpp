@@ -0,0 +1,148 @@
+#include "../bench.h"
+#include "ksched_ring.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <immintrin.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+
+#define ASSERT_ERRNO(x)                                                            \
+  if (!(x)) {                                                                      \
+    int err_errno = errno;                                                         \
+    fprintf(stderr, "%s:%d: errno:%s\n", __FILE__, __LINE__, strerror(err_errno)); \
+    exit(-err_errno);                                                              \
+  }
+
+// The head of every slot, the rest of the -d bytes is payload
+struct message {
+  __u64 seq;
+  __u64 sent_ns;
+};
+
+static __u64 now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             bench::Clock::now().time_since_epoch())
+      .count();
+}
+
+int main(int argc, char** argv) {
+  bool anonymous = false;
+  bool stream = false;
+  int producer_cpu = -1;
+  __u32 publish_batch = 1;
+  __u64 offset = KSCHED_RING_OFFSET;
+  auto opts = bench::Options::parse(
+      argc, argv, "ap:b:fo:",
+      [&](int c, const char* arg) {
+        switch (c) {
+          case 'a':
+            anonymous = true;
+            break;
+          case 'p':
+            producer_cpu = strtol(arg, NULL, 10);
+            break;
+          case 'b':
+            publish_batch = strtoul(arg, NULL, 10);
+            break;
+          case 'f':
+            stream = true;
+            break;
+          case 'o':
+            offset = strtoull(arg, NULL, 10);
+            break;
+        }
+      },
+      "[-a] [-p <producer-cpu>] [-b <publish-batch>] [-f] [-o <offset>]");
+  // -s is the number of slots, -C the consumer's cpu
+  __u32 slots = 1;
+  while (slots < opts.size) slots <<= 1;
+  opts.size = slots;
+  publish_batch = std::clamp(publish_batch, 1u, slots);
+  const __u32 slot_size = std::max<__u32>(opts.data_size, sizeof(message));
+  ASSERT_ERRNO(offset % KSCHED_RING_CACHELINE == 0);
+
+  // The ring lives in the ksched region, -a runs it in plain shared memory
+  const __u64 shm_size = offset + ksched_ring_bytes(slots, slot_size);
+  int fd = -1;
+  int flags = MAP_SHARED | MAP_POPULATE | MAP_LOCKED;
+  if (anonymous) {
+    flags |= MAP_ANONYMOUS;
+  } else {
+    fd = open("/dev/ksched", O_RDWR);
+    if (fd == -1) {
+      perror("Failed to open device");
+      return -1;
+    }
+  }
+  void* shm = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, flags, fd, 0);
+  if (shm == MAP_FAILED) {
+    perror("mmap failed");
+    if (fd != -1) close(fd);
+    return -1;
+  }
+
+  bench::Result result;
+  for (__u32 trial = 0; trial < opts.warmup + opts.trials; trial++) {
+    const bool timed = trial >= opts.warmup;
+    ksched_ring* ring = ksched_ring_init((char*)shm + offset, slots, slot_size);
+    assert(ring != nullptr);
+
+    const auto start = bench::Clock::now();
+    std::thread consumer([&] {
+      bench::pin_cpu(opts.cpu);
+      KschedRingConsumer queue(ring);
+      for (__u64 received = 0; received < opts.number;) {
+        __u32 ready = queue.peek(publish_batch);
+        if (ready == 0) {
+          _mm_pause();
+          continue;
+        }
+        const __u64 now = now_ns();
+        for (__u32 i = 0; i < ready; i++) {
+          const auto* msg = static_cast<const message*>(queue.slot(i));
+          assert(msg->seq == received + i);
+          if (timed) result.op_ps.record((now - msg->sent_ns) * 1000);
+        }
+        queue.consume(ready);
+        received += ready;
+      }
+    });
+
+    bench::pin_cpu(producer_cpu);
+    KschedRingProducer queue(ring);
+    for (__u64 i = 0; i < opts.number;) {
+      for (__u32 in_batch = 0; in_batch < publish_batch && i < opts.number; in_batch++, i++) {
+        void* slot;
+        while (!(slot = queue.reserve())) {
+          // Full, let the consumer see what is reserved so far
+          queue.publish();
+          _mm_pause();
+        }
+        auto* msg = static_cast<message*>(slot);
+        msg->seq = i;
+        msg->sent_ns = now_ns();
+      }
+      queue.publish();
+      // Bursts time an idle consumer, -f streams and keeps the ring busy
+      while (!stream && !queue.drained()) _mm_pause();
+    }
+    consumer.join();
+    if (timed) result.trial_ns.push_back(bench::elapsed_ns(start, bench::Clock::now()));
+  }
+
+  if (bench::Report("ksched_ring", stream ? "stream" : "burst", opts)
+          .field("producer_cpu", (__s64)producer_cpu)
+          .field("publish_batch", (__u64)publish_batch)
+          .field("slot_size", (__u64)ksched_ring_slot_size(slot_size))
+          .write(result)) {
+    std::cerr << "Output to stats" << std::endl;
+  }
+
+  munmap(shm, shm_size);
+  if (fd != -1) close(fd);
+}
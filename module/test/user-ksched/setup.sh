@@ -56,5 +56,7 @@ sudo ./scripts/setup_machine.sh && lsmod | grep ksched
 
 # Compile and test the benchmark script
 cd ..
-g++ -Wall -Werror -O3 -o user_ksched user_ksched.cpp
+g++ -Wall -Werror -O3 -std=gnu++2b -o user_ksched user_ksched.cpp
 sudo bash -c './user_ksched -n 100000 -s 32 -d 8 3>> ksched-user-8-32.stats 4>> returner'
+g++ -Wall -Werror -O3 -std=gnu++2b -pthread -o ksched_ring_bench ksched_ring_bench.cpp
+sudo bash -c './ksched_ring_bench -n 100000 -s 256 -d 64 -p 0 -C 1 3>> ksched-ring-64-256.stats'
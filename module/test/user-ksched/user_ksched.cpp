@@ -1,7 +1,8 @@
+#include "../../fstore/fstore.h"
+#include "../bench.h"
 #include "../e2e/bench_kernel_get/bench_kernel_get.h"
 #include <cassert>
 #include <cerrno>
-#include <chrono>
 #include <cstdio>
 #include <cstring>
 #include <fcntl.h>
@@ -19,11 +20,6 @@
     exit(-err_errno);                                                              \
   }
 
-// constexpr __u64 SAMPLE_VALUE = 0xDEADBEEF;
-constexpr __u64 DEFAULT_NUMBER = 10;
-constexpr __u32 DEFAULT_SIZE = 10;
-constexpr __u32 DEFAULT_DATA_SIZE = 8;
-constexpr int STAT_FD = 3;
 constexpr int RET_FD = 4;
 constexpr __u32 MAX = 16384;
 
@@ -33,40 +29,60 @@ struct data_t {
 
 data_t temp_buffer;
 
-int main(int argc, char** argv) {
-  __u64 number = DEFAULT_NUMBER;
-  __u32 size = DEFAULT_SIZE;
-  __u32 data_size = 0;
-
-  int c;
-  while ((c = getopt(argc, argv, "n:s:d:")) != -1) {
-    switch (c) {
-      case 'n':
-        number = strtoll(optarg, NULL, 10);
-        break;
-      case 's':
-        size = strtol(optarg, NULL, 10);
-        break;
-      case 'd':
-        data_size = strtol(optarg, NULL, 10);
-        break;
-      default:
-        fprintf(stderr, "%s [-n <number>] [-s <map-size>] [-d <data-size> ]\n", argv[0]);
-        exit(-1);
-        break;
-    }
+static int write_returner(__u32 returner) {
+  int err = fcntl(RET_FD, F_GETFD);
+  if (err != -1) {
+    std::cerr << "Output to returner" << std::endl;
+    err = dprintf(RET_FD, "returner %d", returner);
+    assert(err > 0);
   }
+  return 0;
+}
 
-  // Resize
-  data_size = data_size < DEFAULT_DATA_SIZE ? DEFAULT_DATA_SIZE : data_size;
-  data_size = data_size / DEFAULT_DATA_SIZE * DEFAULT_DATA_SIZE;
+// One point of the sweep over the first opts.size values of the device
+static int run(int fd, const bench::Options& opts, bool view, __u32& returner) {
+  const __u32 size = opts.size;
+  const __u32 data_size = opts.data_size;
+  ASSERT_ERRNO(data_size <= MAX);
 
-  // Open the device
-  const char* dev_name = "/dev/ksched";
-  int fd = open(dev_name, O_RDWR);
-  if (fd == -1) {
-    perror("Failed to open device");
-    return -1;
+  ShiftXor rand{1, 4, 7, 13};
+
+  if (view) {
+    bool sized = bench::with_data_size(data_size, [&](auto bytes) {
+      using Value = bench::Words<decltype(bytes)::value>;
+      auto values = fstore::ArrayView<__u32, Value>::map(
+          fd, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE | MAP_LOCKED);
+      ASSERT_ERRNO(values);
+
+      Value sample;
+      for (__u32 i = 0; i < size; i++) {
+        for (size_t j = 0; j < sizeof(Value) / 8; j++) {
+          __u64 random = simplerand(&rand);
+          memcpy(&sample.words[j * 2], &random, sizeof(random));
+        }
+        (*values)[i] = sample;
+      }
+
+      rand = {1, 4, 7, 13};
+
+      const auto result = bench::time_ops(opts, [&](__u64) {
+        const Value& value = (*values)[simplerand(&rand) % size];
+        // a local the reads cannot alias keeps the loop vectorized
+        __u32 folded = 0;
+        for (__u32 word : value.words) {
+          folded ^= word;
+        }
+        returner ^= folded;
+      });
+      if (bench::Report("user_ksched", "view", opts).write(result)) {
+        std::cerr << "Output to stats" << std::endl;
+      }
+    });
+    if (!sized) {
+      std::cerr << "-v has no view of " << data_size << " byte values" << std::endl;
+      return -EINVAL;
+    }
+    return 0;
   }
 
   // Map the memory region
@@ -75,12 +91,9 @@ int main(int argc, char** argv) {
       mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE | MAP_LOCKED, fd, 0);
   if (ksched_shm == MAP_FAILED) {
     perror("mmap failed");
-    close(fd);
     return -1;
   }
 
-  ShiftXor rand{1, 4, 7, 13};
-
   // Write random data into memory region
   __u32 key = 0;
   __u64* sample_buffer = (__u64*)malloc(sizeof(char) * data_size);
@@ -95,31 +108,51 @@ int main(int argc, char** argv) {
   rand = {1, 4, 7, 13};
 
   // Read random data from memory region and time it
-  __u32 returner = 0;
-  const auto start = std::chrono::steady_clock::now();
-  for (__u64 i = 0; i < number; i++) {
+  const auto result = bench::time_ops(opts, [&](__u64) {
     key = simplerand(&rand) % size;
     memcpy(&temp_buffer, ((char*)ksched_shm) + (key * data_size), data_size);
     for (__u32 j = 0; j < data_size / 4; j++) {
       returner ^= temp_buffer.size[j];
     }
-  }
-  const auto stop = std::chrono::steady_clock::now();
-  auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+  });
 
-  // Write the file
-  int err = fcntl(STAT_FD, F_GETFD);
-  if (err != -1) {
+  munmap(ksched_shm, shm_size);
+  free(sample_buffer);
+
+  if (bench::Report("user_ksched", "mmap", opts).write(result)) {
     std::cerr << "Output to stats" << std::endl;
-    err = dprintf(STAT_FD, "get_iterations %lld\tmap_size %d\tvalue_size %d\tTime(ns) %ld\n",
-                  number, size, data_size, time);
-    assert(err > 0);
   }
+  return 0;
+}
 
-  err = fcntl(RET_FD, F_GETFD);
-  if (err != -1) {
-    std::cerr << "Output to returner" << std::endl;
-    err = dprintf(RET_FD, "returner %d", returner);
-    assert(err > 0);
+int main(int argc, char** argv) {
+  // -v reads through a statically sized fstore::ArrayView instead
+  bool view = false;
+  const auto opts = bench::Options::parse(
+      argc, argv, "v",
+      [&](int, const char*) {
+        view = true;
+      },
+      "[-v]");
+  bench::pin_cpu(opts.cpu);
+
+  // Open the device
+  const char* dev_name = "/dev/ksched";
+  int fd = open(dev_name, O_RDWR);
+  if (fd == -1) {
+    perror("Failed to open device");
+    return -1;
   }
+
+  __u32 returner = 0;
+  for (const auto& point : opts.points()) {
+    int err = run(fd, point, view, returner);
+    if (err) {
+      close(fd);
+      return err;
+    }
+  }
+  close(fd);
+
+  return write_returner(returner);
 }
@@ -17,7 +17,7 @@ echo:
 ${OUT_DIR}:
 	mkdir -p $@
 
-${FULL_OUT}: ${OUT_DIR}/% : %.cpp ../../fstore/fstore.h | ${OUT_DIR}
+${FULL_OUT}: ${OUT_DIR}/% : %.cpp ../../fstore/fstore.h ../bench.h | ${OUT_DIR}
 	${CXX} -O3 -I/usr/src/linux-headers-$(shell uname -r)/include/ \
 		-std=gnu++2b $< -o $@
 
@@ -69,6 +69,61 @@ def cli_collect_data(
     )
 
 
+@cli_collect.command("overhead")
+@click.option(
+    "-c",
+    "--config-file",
+    "config_file",
+    default=DEFAULT_CONFIG_FILE,
+    required=True,
+    type=click.Path(exists=True, dir_okay=False, path_type=Path),
+)
+@click.option(
+    "-b",
+    "--benchmark",
+    "benchmark_name",
+    default=None,
+    type=click.Choice(list(benchmarks.keys())),
+    help="Used to override benchmark from config file.",
+)
+@click.option("-n", "--repeat", "repeat", default=3, type=int, help="Runs of each variant.")
+@click.option(
+    "--hook",
+    "hook_names",
+    multiple=True,
+    type=click.Choice(data_collection.bpf.hook_names()),
+    help="Hooks to measure, default is the hooks of the config file.",
+)
+@click.option(
+    "-o",
+    "--output",
+    "report",
+    default=Path("data/overhead/overhead"),
+    type=click.Path(dir_okay=False, path_type=Path),
+    help="Report prefix, .runs and .summary Parquet and CSV files are written next to it.",
+)
+def cli_collect_overhead(
+    config_file: Path,
+    benchmark_name: str | None,
+    repeat: int,
+    hook_names: tuple[str, ...],
+    report: Path,
+):
+    """Measure collector overhead against a run without hooks."""
+    from cli import overhead
+
+    config_overrides = yaml.safe_load(config_file.read_text())
+    config = KernmlopsConfig().merge(config_overrides)
+    name = benchmark_name if benchmark_name else str(config.benchmark_config.generic.benchmark)
+    runs = overhead.run_overhead(
+        config=asdict(config),
+        benchmark_name=name,
+        hooks=list(hook_names) if hook_names else list(config.collector_config.generic.hooks),
+        repeat=repeat,
+    )
+    print(overhead.write_overhead_report(runs, report))
+
+
 @cli_collect.command("dump")
 @click.option(
     "-d",
@@ -153,6 +208,58 @@ def cli_collect_perf():
         print(data.dump())
 
 
+@cli_collect.command("control")
+@click.option(
+    "--hook",
+    "hook_names",
+    multiple=True,
+    required=True,
+    type=click.Choice(data_collection.bpf.hook_names()),
+)
+@click.option("--disable", "disable", default=False, is_flag=True, type=bool)
+@click.option("--sample-every", "sample_every", default=1, type=int, help="Emit 1 in N events per CPU.")
+@click.option("--sample-period-us", "sample_period_us", default=0, type=int, help="Emit at most one event per CPU per period.")
+@click.option("--tgid", "tgids", multiple=True, type=int, help="Only emit events of these tgids.")
+@click.option("--cgroup", "cgroups", multiple=True, type=str, help="Only emit events of these cgroup paths.")
+def cli_collect_control(
+    hook_names: tuple[str, ...],
+    disable: bool,
+    sample_every: int,
+    sample_period_us: int,
+    tgids: tuple[int, ...],
+    cgroups: tuple[str, ...],
+):
+    """Change sampling and filtering of running hooks through the pinned control map."""
+    from data_collection.bpf_instrumentation.control import (
+        CONTROLLED_HOOKS,
+        HookControl,
+        SamplingControl,
+    )
+
+    # other hooks never read their entry, setting it would silently do nothing
+    unsupported = [hook_name for hook_name in hook_names if hook_name not in CONTROLLED_HOOKS]
+    if unsupported:
+        raise click.BadParameter(
+            f"{', '.join(unsupported)} do not support sampling control, only {', '.join(CONTROLLED_HOOKS)} do",
+            param_hint="--hook",
+        )
+
+    control = HookControl()
+    if tgids:
+        control.allow_tgids(tgids, replace=True)
+    if cgroups:
+        control.allow_cgroups(cgroups, replace=True)
+    for hook_name in hook_names:
+        control.set(hook_name, SamplingControl(
+            enabled=not disable,
+            sample_every=sample_every,
+            sample_period_us=sample_period_us,
+            filter_tgids=bool(tgids),
+            filter_cgroups=bool(cgroups),
+        ))
+        print(f"{hook_name}: {control.get(hook_name)}")
+
+
 @cli_collect.command("defaults")
 def cli_collect_defaults():
     """Output default collection config into yaml file defaults.yaml."""
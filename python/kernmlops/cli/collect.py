@@ -1,4 +1,5 @@
 import os
+import resource
 import signal
 import sys
 from datetime import datetime
@@ -11,7 +12,13 @@ from typing import cast
 import data_collection
 import data_schema
 import polars as pl
+from cli.parquet_sink import ParquetSink, PartitionedSink
 from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.loader import load_hooks
+from data_collection.bpf_instrumentation.numa import NodePoller
+from data_collection.bpf_instrumentation.poller import HookPoller
+from data_collection.feature_pipeline import FeaturePipeline
+from data_collection.system_info import format_cpulist, numa_topology
 from data_schema import get_user_group_ids
 from kernmlops_benchmark import (
     Benchmark,
@@ -33,15 +40,44 @@ def poll_instrumentation(
   queue: Queue,
   run_event: Event,
   poll_rate: float = .5,
+  poll_engine: str = "epoll",
+  poller_threads: int = 0,
+  poller_cpus: list[int] | None = None,
+  numa_drain: bool = False,
+  collector_cpus: list[int] | None = None,
 ) -> int:
 
+    # node pollers take the per-CPU perf buffers before the other pollers collect descriptors
+    node_pollers = list[NodePoller]()
+    if numa_drain:
+        node_pollers = NodePoller.per_node(bpf_programs, collector_cpus or [])
+        for node_poller in node_pollers:
+            node_poller.start()
+
+    # "sleep" keeps the fixed interval loop, "epoll" wakes as soon as a hook buffer has data
+    pollers = list[HookPoller]()
+    if poll_engine == "epoll":
+        if poller_threads > 0:
+            pollers = HookPoller.split(bpf_programs, poll_rate, poller_threads, poller_cpus or [])
+            for poller in pollers:
+                poller.start()
+        else:
+            pollers = [HookPoller(bpf_programs, poll_rate)]
+
     return_code = None
     while return_code is None and run_event.is_set():
         try:
-            for bpf_program in bpf_programs:
-                bpf_program.poll()
-            if poll_rate > 0:
+            if poller_threads > 0 and pollers:
+                # the poller threads own the hooks, only watch the benchmark here
                 sleep(poll_rate)
+            elif pollers:
+                if not pollers[0].poll_once():
+                    continue
+            else:
+                for bpf_program in bpf_programs:
+                    bpf_program.poll()
+                if poll_rate > 0:
+                    sleep(poll_rate)
             return_code = benchmark.poll()
             # clean data when missed samples - or detect?
         except BenchmarkNotRunningError:
@@ -51,6 +87,11 @@ def poll_instrumentation(
         benchmark.kill()
         return_code = 0 if benchmark.name() == "faux" else 1
 
+    for poller in pollers:
+        poller.close()
+    for node_poller in node_pollers:
+        node_poller.close()
+
     # Poll again to clean out all buffers
     for bpf_program in bpf_programs:
         try:
@@ -65,13 +106,20 @@ def signal_handler_factory(event: Event):
     return lambda x,y: event.clear()
 
 def output_collections_to_file(collection_id: str, collection_tables : list[data_schema.CollectionTable], bpf_programs: list[BPFProgram], name: str,
-                               benchmark_name: str, verbose: bool, output_dir: Path, ids: tuple[int,int] | None = None):
+                               benchmark_name: str, verbose: bool, output_dir: Path, ids: tuple[int,int] | None = None,
+                               sink: ParquetSink | None = None, pipeline: FeaturePipeline | None = None):
     for bpf_program in bpf_programs:
         collection_tables.extend(bpf_program.pop_data())
+    if pipeline is not None:
+        collection_tables.extend(pipeline.pop_data())
     for collection_table in collection_tables:
         with pl.Config(tbl_cols=-1):
             if verbose:
                 print(f"{collection_table.name()}: {collection_table.table}")
+    if sink is not None:
+        sink.put(collection_tables)
+        return collection_tables
+    for collection_table in collection_tables:
         full_path = Path(output_dir/benchmark_name/collection_id/f"{collection_table.name()}.{name}.parquet")
         collection_table.table.write_parquet(full_path)
         if ids is not None:
@@ -79,7 +127,8 @@ def output_collections_to_file(collection_id: str, collection_tables : list[data
     return collection_tables
 
 def output_data_thread(collection_id: str, bpf_programs: list[BPFProgram], benchmark_name: str, run_event: Event,
-                       verbose: bool, output_dir: Path, lock: Lock, ended: bool, output_interval: int | float, user_id: int, group_id: int):
+                       verbose: bool, output_dir: Path, lock: Lock, ended: bool, output_interval: int | float, user_id: int, group_id: int,
+                       sink: ParquetSink | None = None, pipeline: FeaturePipeline | None = None):
     num : int = 0
     sleep(output_interval)
     while run_event.is_set():
@@ -88,7 +137,8 @@ def output_data_thread(collection_id: str, bpf_programs: list[BPFProgram], bench
             if(ended):
                 lock.release()
                 return
-            output_collections_to_file(collection_id, [], bpf_programs, str(num), benchmark_name, verbose, output_dir, (user_id, group_id))
+            output_collections_to_file(collection_id, [], bpf_programs, str(num), benchmark_name, verbose, output_dir, (user_id, group_id),
+                                       sink, pipeline)
         except Exception as e:
             print(e)
         lock.release()
@@ -115,12 +165,33 @@ def run_collect(
     run_event = Event()
     run_event.set()
 
-    for bpf_program in bpf_programs:
-        bpf_program.load(collection_id)
-        if verbose:
-            print(f"{bpf_program.name()} BPF program loaded")
+    # Threads started from here on inherit the collector CPUs, the benchmark gets the rest
+    benchmark_cpus = os.sched_getaffinity(0)
+    if generic_config.collector_cpus:
+        benchmark_cpus = (benchmark_cpus - set(generic_config.collector_cpus)) or benchmark_cpus
+        os.sched_setaffinity(0, generic_config.collector_cpus)
+
+    load_start = datetime.now()
+    load_times = load_hooks(bpf_programs, collection_id, generic_config.load_threads)
+    hook_load_sec = (datetime.now() - load_start).total_seconds()
+    # libbcc compiles in process, so this peak is the collector's through startup
+    hook_load_max_rss_kb = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
     if verbose:
-        print("Finished loading BPF programs")
+        for hook_name, load_time in load_times.items():
+            print(f"{hook_name} BPF program loaded in {load_time:.2f}s")
+        print(f"Finished loading BPF programs in {hook_load_sec:.2f}s, max RSS {hook_load_max_rss_kb}kB")
+
+    # Feeds features of the hooks' live buffers back to the kernel while they run
+    pipeline = None
+    if generic_config.feature_pipeline:
+        pipeline = FeaturePipeline(
+            bpf_programs,
+            collection_id,
+            window_ms=generic_config.feature_window_ms,
+            half_life_ms=generic_config.feature_ewma_half_life_ms,
+            tgid_slots=generic_config.feature_tgid_slots,
+        )
+        pipeline.start()
 
     # Configure signal capture
     signal.signal(signal.SIGINT, signal_handler_factory(run_event))
@@ -133,7 +204,10 @@ def run_collect(
     read_thread.start()
 
     # Create polling thread
-    poll_thread = Thread(target = poll_instrumentation, args = (benchmark, bpf_programs, queue, run_event, generic_config.poll_rate))
+    poll_thread = Thread(target = poll_instrumentation, args = (benchmark, bpf_programs, queue, run_event, generic_config.poll_rate,
+                                                                generic_config.poll_engine, generic_config.poller_threads,
+                                                                generic_config.poller_cpus, generic_config.numa_drain,
+                                                                generic_config.collector_cpus))
     poll_thread.start()
 
     # Create output thread
@@ -149,14 +223,40 @@ def run_collect(
     os.chown(output_dir, user_id, group_id)
     os.chown(Path(output_dir/benchmark.name()), user_id, group_id)
     os.chown(Path(output_dir/benchmark.name()/collection_id), user_id, group_id)
+    # "stream" appends to one file per table, "files" writes a new file per table each interval,
+    # "partitioned" new files per table and time bucket, see data_schema/dataset.py
+    sink = None
+    if generic_config.output_sink == "stream":
+        sink = ParquetSink(
+            Path(output_dir/benchmark.name()/collection_id),
+            compression=generic_config.parquet_compression,
+            row_group_size=generic_config.parquet_row_group_size,
+            queue_size=generic_config.output_queue_size,
+            ids=(user_id, group_id),
+        )
+    elif generic_config.output_sink == "partitioned":
+        sink = PartitionedSink(
+            Path(output_dir/benchmark.name()),
+            collection_id,
+            bucket_s=generic_config.partition_bucket_s,
+            compression=generic_config.parquet_compression,
+            row_group_size=generic_config.parquet_row_group_size,
+            queue_size=generic_config.output_queue_size,
+            ids=(user_id, group_id),
+        )
     output_thread = Thread(target = output_data_thread, args = (collection_id, bpf_programs, benchmark.name(),
                                                                 run_event, generic_config.output_dfs, output_dir,
-                                                                output_lock, ended, output_interval, user_id, group_id))
+                                                                output_lock, ended, output_interval, user_id, group_id,
+                                                                sink, pipeline))
     output_thread.daemon = True
     output_thread.start()
 
     tick = datetime.now()
+    # Collector CPU while the benchmark runs, excluding the benchmark itself and hook compilation
+    usage_start = resource.getrusage(resource.RUSAGE_SELF)
 
+    # the benchmark inherits the affinity of the thread that starts it
+    os.sched_setaffinity(0, benchmark_cpus)
     benchmark.run()
 
     if verbose:
@@ -165,6 +265,11 @@ def run_collect(
 
     collection_time_sec = (datetime.now() - tick).total_seconds()
     poll_thread.join()
+    if pipeline is not None:
+        pipeline.close()
+    usage_end = resource.getrusage(resource.RUSAGE_SELF)
+    collector_cpu_sec = (usage_end.ru_utime - usage_start.ru_utime) + (usage_end.ru_stime - usage_start.ru_stime)
+    lost_events = [bpf_program.lost_events() for bpf_program in bpf_programs]
     for bpf_program in bpf_programs:
         bpf_program.close()
 
@@ -178,6 +283,15 @@ def run_collect(
                 pl.lit(os.getpid()).alias("collection_pid"),
                 pl.lit(benchmark.name()).alias("benchmark_name"),
                 pl.lit([hook.name() for hook in bpf_programs]).cast(pl.List(pl.String())).alias("hooks"),
+                pl.lit(lost_events).cast(pl.List(pl.Int64())).alias("lost_events"),
+                pl.lit(collector_cpu_sec).alias("collector_cpu_sec"),
+                pl.lit(usage_end.ru_maxrss).alias("collector_max_rss_kb"),
+                pl.lit(hook_load_sec).alias("hook_load_sec"),
+                pl.lit(hook_load_max_rss_kb).alias("hook_load_max_rss_kb"),
+                pl.lit([format_cpulist(cpus) for cpus in numa_topology().values()]).cast(pl.List(pl.String())).alias("numa_node_cpus"),
+                pl.lit(format_cpulist(generic_config.collector_cpus)).alias("collector_cpus"),
+                pl.lit(format_cpulist(list(benchmark_cpus))).alias("benchmark_cpus"),
+                pl.lit(generic_config.numa_drain).alias("numa_drain"),
             ])
         )
     ]
@@ -186,8 +300,10 @@ def run_collect(
     ended = True
     collection_tables = output_collections_to_file(collection_id, collection_tables, bpf_programs, "end",
                                                    benchmark.name(), generic_config.output_dfs, output_dir,
-                                                   (user_id, group_id))
+                                                   (user_id, group_id), sink, pipeline)
     output_lock.release()
+    if sink is not None:
+        sink.close()
     collection_data = data_schema.CollectionData.from_tables(collection_tables)
 
     if generic_config.output_graphs:
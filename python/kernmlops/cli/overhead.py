@@ -0,0 +1,218 @@
+"""Measures what the collector costs the benchmark it observes.
+
+run_overhead() runs one benchmark `repeat` times for each variant: with no
+hooks, with every hook on its own and with all of them together. Each run is a
+separate `collect data` process so nothing a variant loaded lingers into the
+next, and every variant is compared against the hookless baseline.
+
+Throughput and latency come from the benchmark's own output where it prints
+them (YCSB and wrk), the collector's CPU time, peak RSS and lost events come
+from the system_info table of the run.
+"""
+
+import re
+import subprocess
+import sys
+import tempfile
+import time
+from dataclasses import dataclass
+from pathlib import Path
+from typing import Any
+
+import polars as pl
+import yaml
+
+BASELINE_VARIANT = "baseline"
+ALL_HOOKS_VARIANT = "all"
+
+_YCSB_THROUGHPUT = re.compile(r"^\[OVERALL\], Throughput\(ops/sec\), ([\d.]+)", re.M)
+_YCSB_PERCENTILE = re.compile(r"^\[([A-Z]+)\], (\d+)thPercentileLatency\(us\), ([\d.]+)", re.M)
+_WRK_THROUGHPUT = re.compile(r"^Requests/sec:\s+([\d.]+)", re.M)
+_WRK_PERCENTILE = re.compile(r"^\s+(\d+)(?:\.\d+)?%\s+([\d.]+)(us|ms|s)\s*$", re.M)
+_UNIT_US = {"us": 1.0, "ms": 1000.0, "s": 1000000.0}
+_COLLECTION_ID = re.compile(r"^[0-9a-f]{8}-[0-9a-f]{4}-[0-9a-f]{4}-[0-9a-f]{4}-[0-9a-f]{12}$")
+
+
+@dataclass(frozen=True)
+class BenchmarkMetrics:
+    throughput: float | None = None
+    p50_latency_us: float | None = None
+    p99_latency_us: float | None = None
+
+
+def parse_benchmark_metrics(output: str) -> BenchmarkMetrics:
+    """Reads YCSB or wrk results, None for whatever the benchmark did not print.
+
+    Benchmarks repeating their client report the mean throughput, and the
+    latency of the slowest operation and repetition.
+    """
+    throughputs = [float(value) for value in _YCSB_THROUGHPUT.findall(output) or _WRK_THROUGHPUT.findall(output)]
+    percentiles = dict[int, float]()
+    for operation, percentile, value in _YCSB_PERCENTILE.findall(output):
+        if operation in ("OVERALL", "CLEANUP"):
+            continue
+        percentiles[int(percentile)] = max(percentiles.get(int(percentile), 0.0), float(value))
+    for percentile, value, unit in _WRK_PERCENTILE.findall(output):
+        latency_us = float(value) * _UNIT_US[unit]
+        percentiles[int(percentile)] = max(percentiles.get(int(percentile), 0.0), latency_us)
+    return BenchmarkMetrics(
+        throughput=sum(throughputs) / len(throughputs) if throughputs else None,
+        p50_latency_us=percentiles.get(50),
+        p99_latency_us=percentiles.get(99),
+    )
+
+
+@dataclass(frozen=True)
+class OverheadRun:
+    variant: str
+    hooks: str
+    iteration: int
+    collection_id: str | None
+    return_code: int
+    wall_time_sec: float
+    throughput: float | None
+    p50_latency_us: float | None
+    p99_latency_us: float | None
+    collector_cpu_sec: float | None
+    collector_max_rss_kb: int | None
+    lost_events: int | None
+
+
+def overhead_variants(hooks: list[str]) -> list[tuple[str, list[str]]]:
+    return [(BASELINE_VARIANT, [])] + [(hook, [hook]) for hook in hooks] + [(ALL_HOOKS_VARIANT, list(hooks))]
+
+
+def _collect_process(config: dict[str, Any], benchmark_name: str, hooks: list[str]) -> tuple[int, str, float]:
+    """Runs `collect data` with only `hooks` enabled, echoing and returning its output."""
+    run_config = {**config, "collector_config": {**config.get("collector_config", {})}}
+    run_config["collector_config"]["generic"] = {
+        **run_config["collector_config"].get("generic", {}),
+        "hooks": hooks,
+    }
+    with tempfile.NamedTemporaryFile("w", suffix=".yaml", prefix="kernmlops-overhead-") as config_file:
+        yaml.safe_dump(run_config, config_file, sort_keys=False)
+        config_file.flush()
+        command = [
+            sys.executable,
+            str(Path(__file__).parent.parent),
+            "collect",
+            "data",
+            "-c",
+            config_file.name,
+            "-b",
+            benchmark_name,
+        ]
+        start = time.monotonic()
+        process = subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+        assert process.stdout is not None
+        output = list[str]()
+        for line in process.stdout:
+            sys.stdout.write(line)
+            output.append(line)
+        return_code = process.wait()
+        return return_code, "".join(output), time.monotonic() - start
+
+
+def _system_info(output_dir: Path, benchmark_name: str, collection_id: str) -> dict[str, Any]:
+    # hookless runs land in baseline/, the others in curated/
+    files = sorted(output_dir.glob(f"*/{benchmark_name}/{collection_id}/system_info.*.parquet"))
+    if not files:
+        return {}
+    return pl.read_parquet(files[0]).row(0, named=True)
+
+
+def run_overhead(
+    *,
+    config: dict[str, Any],
+    benchmark_name: str,
+    hooks: list[str],
+    repeat: int = 3,
+) -> pl.DataFrame:
+    """Runs every variant `repeat` times and returns one row per run."""
+    output_dir = Path(config.get("collector_config", {}).get("generic", {}).get("output_dir", "data"))
+    runs = list[OverheadRun]()
+    for iteration in range(max(repeat, 1)):
+        for variant, variant_hooks in overhead_variants(hooks):
+            print(f"overhead: {variant} run {iteration + 1}/{repeat}")
+            return_code, output, wall_time_sec = _collect_process(config, benchmark_name, variant_hooks)
+            lines = output.strip().splitlines()
+            collection_id = lines[-1].strip() if lines and _COLLECTION_ID.match(lines[-1].strip()) else None
+            system_info = _system_info(output_dir, benchmark_name, collection_id) if collection_id else {}
+            metrics = parse_benchmark_metrics(output)
+            lost_events = system_info.get("lost_events")
+            runs.append(OverheadRun(
+                variant=variant,
+                hooks=",".join(variant_hooks),
+                iteration=iteration,
+                collection_id=collection_id,
+                return_code=return_code,
+                wall_time_sec=system_info.get("collection_time_sec", wall_time_sec),
+                throughput=metrics.throughput,
+                p50_latency_us=metrics.p50_latency_us,
+                p99_latency_us=metrics.p99_latency_us,
+                collector_cpu_sec=system_info.get("collector_cpu_sec"),
+                collector_max_rss_kb=system_info.get("collector_max_rss_kb"),
+                lost_events=sum(lost_events) if lost_events is not None else None,
+            ))
+    return pl.DataFrame(runs, schema={
+        "variant": pl.String(),
+        "hooks": pl.String(),
+        "iteration": pl.Int64(),
+        "collection_id": pl.String(),
+        "return_code": pl.Int64(),
+        "wall_time_sec": pl.Float64(),
+        "throughput": pl.Float64(),
+        "p50_latency_us": pl.Float64(),
+        "p99_latency_us": pl.Float64(),
+        "collector_cpu_sec": pl.Float64(),
+        "collector_max_rss_kb": pl.Int64(),
+        "lost_events": pl.Int64(),
+    })
+
+
+def summarize_overhead(runs: pl.DataFrame) -> pl.DataFrame:
+    """Medians of each variant's successful runs and their change from the baseline in percent.
+
+    Benchmarks without a throughput figure fall back to wall time, so a
+    slowdown shows up as a negative work_rate_delta_pct in either case.
+    """
+    metrics = ["wall_time_sec", "throughput", "p50_latency_us", "p99_latency_us",
+               "collector_cpu_sec", "collector_max_rss_kb", "lost_events"]
+    summary = runs.filter(pl.col("return_code") == 0).group_by(["variant", "hooks"], maintain_order=True).agg(
+        [pl.len().alias("runs")] + [pl.median(metric) for metric in metrics]
+    ).with_columns(
+        pl.coalesce(pl.col("throughput"), 1 / pl.col("wall_time_sec")).alias("work_rate")
+    )
+    baseline = summary.filter(pl.col("variant") == BASELINE_VARIANT)
+    if baseline.is_empty():
+        return summary
+
+    def delta_pct(column: str) -> pl.Expr:
+        base = baseline[column][0]
+        if base is None or base == 0:
+            return pl.lit(None, dtype=pl.Float64()).alias(f"{column}_delta_pct")
+        return ((pl.col(column) - base) * 100 / base).alias(f"{column}_delta_pct")
+
+    return summary.with_columns([
+        delta_pct("work_rate"),
+        delta_pct("p50_latency_us"),
+        delta_pct("p99_latency_us"),
+    ])
+
+
+def write_overhead_report(runs: pl.DataFrame, report: Path) -> pl.DataFrame:
+    """Writes `<report>.runs` and `<report>.summary` as both Parquet and CSV."""
+    report.parent.mkdir(parents=True, exist_ok=True)
+    summary = summarize_overhead(runs)
+    for name, df in (("runs", runs), ("summary", summary)):
+        df.write_parquet(report.with_name(f"{report.name}.{name}.parquet"))
+        df.write_csv(report.with_name(f"{report.name}.{name}.csv"))
+    return summary
+
+
+__all__ = [
+    "parse_benchmark_metrics",
+    "run_overhead",
+    "summarize_overhead",
+    "write_overhead_report",
+]
@@ -0,0 +1,224 @@
+"""Streaming Parquet output for collection tables.
+
+Instead of a new `<table>.<num>.parquet` file per interval, ParquetSink keeps
+one ParquetWriter per table open for the whole collection and appends row
+groups to `<table>.stream.parquet`. Writes happen on a background thread fed by
+a bounded queue, so the output thread only pays for pop_data() and the hand off;
+when the writer falls behind put() blocks instead of buffering without limit.
+
+PartitionedSink instead writes each interval as new files of the hive
+partitioned layout in data_schema/dataset.py, for analysis that scans only
+the tables, collections and time buckets it needs.
+"""
+
+import json
+import os
+from pathlib import Path
+from queue import Queue
+from threading import Thread
+
+import data_schema
+import polars as pl
+import pyarrow as pa
+import pyarrow.parquet as pq
+from data_schema import UPTIME_TIMESTAMP
+from data_schema.dataset import MANIFEST_DIR, NO_TIME_BUCKET, partition_dir
+
+STREAM_FILE_TAG = "stream"
+
+
+class _TableStream:
+
+    def __init__(self, path: Path, schema: pa.Schema, compression: str):
+        self.path = path
+        self.writer = pq.ParquetWriter(path, schema, compression=compression)
+        self.pending = list[pa.Table]()
+        self.pending_rows = 0
+
+    @property
+    def schema(self) -> pa.Schema:
+        return self.writer.schema
+
+    def append(self, table: pa.Table, row_group_size: int):
+        self.pending.append(table)
+        self.pending_rows += table.num_rows
+        if self.pending_rows < row_group_size:
+            return
+        buffered = pa.concat_tables(self.pending)
+        full_rows = buffered.num_rows - buffered.num_rows % row_group_size
+        self.writer.write_table(buffered.slice(0, full_rows), row_group_size=row_group_size)
+        remainder = buffered.slice(full_rows)
+        self.pending = [remainder] if remainder.num_rows > 0 else []
+        self.pending_rows = remainder.num_rows
+
+    def close(self, row_group_size: int):
+        if self.pending_rows > 0:
+            self.writer.write_table(pa.concat_tables(self.pending), row_group_size=row_group_size)
+        self.pending.clear()
+        self.pending_rows = 0
+        self.writer.close()
+
+
+class ParquetSink:
+    """Appends every table of one collection to a single Parquet file per table."""
+
+    def __init__(
+        self,
+        output_dir: Path,
+        *,
+        compression: str = "zstd",
+        row_group_size: int = 65536,
+        queue_size: int = 8,
+        ids: tuple[int, int] | None = None,
+    ):
+        self.output_dir = output_dir
+        self.compression = compression
+        self.row_group_size = max(row_group_size, 1)
+        self.ids = ids
+        self._queue = Queue[list[data_schema.CollectionTable] | None](maxsize=max(queue_size, 1))
+        self._streams = dict[str, _TableStream]()
+        self._thread = Thread(target=self._run, name="parquet-sink", daemon=True)
+        self._thread.start()
+
+    def path(self, table_name: str) -> Path:
+        return self.output_dir / f"{table_name}.{STREAM_FILE_TAG}.parquet"
+
+    def put(self, collection_tables: list[data_schema.CollectionTable]):
+        """Hands the tables to the writer thread, blocks only while the queue is full."""
+        self._queue.put(collection_tables)
+
+    def close(self):
+        self._queue.put(None)
+        self._thread.join()
+        for stream in self._streams.values():
+            try:
+                stream.close(self.row_group_size)
+            except Exception as e:
+                print(f"error closing {stream.path}: {e}")
+        self._streams.clear()
+
+    def _run(self):
+        while (collection_tables := self._queue.get()) is not None:
+            for collection_table in collection_tables:
+                try:
+                    self._write(collection_table.name(), collection_table.table)
+                except Exception as e:
+                    print(f"error writing {collection_table.name()}: {e}")
+
+    def _write(self, table_name: str, df: pl.DataFrame):
+        # frames of hooks that never saw an event carry no schema to open a file with
+        if df.width == 0:
+            return
+        table = df.to_arrow()
+        stream = self._streams.get(table_name)
+        if stream is None:
+            stream = _TableStream(self.path(table_name), table.schema, self.compression)
+            self._streams[table_name] = stream
+            if self.ids is not None:
+                os.chown(stream.path, self.ids[0], self.ids[1])
+        if table.num_rows == 0:
+            return
+        if table.schema != stream.schema:
+            table = table.select(stream.schema.names).cast(stream.schema)
+        stream.append(table, self.row_group_size)
+
+
+class PartitionedSink(ParquetSink):
+    """Writes every interval of one collection's tables into its time bucket partitions."""
+
+    def __init__(
+        self,
+        output_dir: Path,
+        collection_id: str,
+        *,
+        bucket_s: int = 60,
+        compression: str = "zstd",
+        row_group_size: int = 65536,
+        queue_size: int = 8,
+        ids: tuple[int, int] | None = None,
+    ):
+        # set before the writer thread starts in ParquetSink.__init__
+        self.collection_id = collection_id
+        self.bucket_us = max(bucket_s, 1) * 1_000_000
+        self._parts = 0
+        self.ids = ids
+        manifest_path = output_dir / MANIFEST_DIR / f"{collection_id}.jsonl"
+        self._makedirs(output_dir, manifest_path.parent)
+        self._manifest = open(manifest_path, "a")
+        self._chown(manifest_path)
+        super().__init__(
+            output_dir,
+            compression=compression,
+            row_group_size=row_group_size,
+            queue_size=queue_size,
+            ids=ids,
+        )
+
+    def close(self):
+        super().close()
+        self._manifest.close()
+
+    def _chown(self, path: Path):
+        if self.ids is not None:
+            os.chown(path, self.ids[0], self.ids[1])
+
+    def _makedirs(self, root: Path, path: Path):
+        missing = [parent for parent in [path, *path.parents] if not parent.exists() and root in parent.parents]
+        path.mkdir(parents=True, exist_ok=True)
+        for parent in missing:
+            self._chown(parent)
+
+    def _write(self, table_name: str, df: pl.DataFrame):
+        if df.width == 0 or df.height == 0:
+            return
+        if UPTIME_TIMESTAMP not in df.columns:
+            self._write_part(table_name, NO_TIME_BUCKET, df)
+            return
+        buckets = df.with_columns((pl.col(UPTIME_TIMESTAMP) // self.bucket_us).alias("_time_bucket"))
+        for time_bucket in buckets["_time_bucket"].unique().sort().to_list():
+            self._write_part(
+                table_name,
+                time_bucket,
+                buckets.filter(pl.col("_time_bucket") == time_bucket).drop("_time_bucket"),
+            )
+
+    def _write_part(self, table_name: str, time_bucket: int, df: pl.DataFrame):
+        sort_by = [column for column in ("tgid", UPTIME_TIMESTAMP) if column in df.columns]
+        if sort_by:
+            df = df.sort(sort_by)
+        directory = partition_dir(self.output_dir, table_name, self.collection_id, time_bucket)
+        self._makedirs(self.output_dir, directory)
+        path = directory / f"part-{self._parts:06d}.parquet"
+        self._parts += 1
+        df.write_parquet(
+            path,
+            compression=self.compression,  # pyright: ignore [reportArgumentType]
+            row_group_size=self.row_group_size,
+            statistics=True,
+        )
+        self._chown(path)
+
+        def bound(column: str, reduce: str) -> int | None:
+            if column not in df.columns:
+                return None
+            value = getattr(df[column], reduce)()
+            return int(value) if value is not None else None
+
+        self._manifest.write(json.dumps({
+            "table": table_name,
+            "collection_id": self.collection_id,
+            "time_bucket": time_bucket,
+            "path": str(path.relative_to(self.output_dir)),
+            "rows": df.height,
+            "min_ts_uptime_us": bound(UPTIME_TIMESTAMP, "min"),
+            "max_ts_uptime_us": bound(UPTIME_TIMESTAMP, "max"),
+            "min_tgid": bound("tgid", "min"),
+            "max_tgid": bound("tgid", "max"),
+        }) + "\n")
+        self._manifest.flush()
+
+
+__all__ = [
+    "ParquetSink",
+    "PartitionedSink",
+]
@@ -13,17 +13,89 @@ class GenericCollectorConfig(ConfigBase):
     output_dir: str = "data"
     output_dfs: bool = False
     output_graphs: bool = False
+    # "stream" appends to one parquet file per table, "files" writes new files every output_interval,
+    # "partitioned" writes them by table, collection and time bucket
+    output_sink: str = "stream"
+    partition_bucket_s: int = 60
+    parquet_compression: str = "zstd"
+    parquet_row_group_size: int = 65536
+    # Intervals of tables queued for the writer thread before output blocks
+    output_queue_size: int = 8
     hooks: list[str] = field(default_factory=bpf.hook_names)
+    # Threads compiling hooks at startup, 1 loads them in order and 0 uses one per collector CPU
+    load_threads: int = 1
+    # "perf" or "ringbuf", see bpf_instrumentation/transport.py
+    transport: str = "perf"
+    ringbuf_pages: int = 64
+    wakeup_events: int = 1
+    aggregate: bool = False
+    flow_drain_ms: int = 1000
+    # Fault counts per tgid and 2MB region, in fstore and the fault_region table
+    fault_regions: bool = False
+    fault_region_drain_ms: int = 1000
+    # Hot events leave out comm, each task's name goes once to the task_comm table
+    intern_comm: bool = False
+    # The perf hook counts per tgid or "cgroup" at context switches instead of sampling
+    perf_counting: bool = False
+    perf_count_by: str = "tgid"
+    perf_count_drain_ms: int = 1000
+    # Turn off to measure the kprobe/hash fallback of entry/return hooks
+    fentry: bool = True
+    task_storage: bool = True
+    # Starting sampling of controlled hooks, `collect control` changes it while running
+    sample_every: int = 1
+    sample_period_us: int = 0
+    tgid_allowlist: list[int] = field(default_factory=list)
+    cgroup_allowlist: list[str] = field(default_factory=list)
+    # "epoll" polls a hook once its buffers have data, "sleep" polls every hook each poll_rate
+    poll_engine: str = "epoll"
+    # Dedicated threads the hooks are spread over, 0 polls all hooks from one thread
+    poller_threads: int = 0
+    # CPUs the poller threads are pinned to, round robin
+    poller_cpus: list[int] = field(default_factory=list)
+    # CPUs reserved for the collector's threads, the benchmark runs on the others
+    collector_cpus: list[int] = field(default_factory=list)
+    # One thread per NUMA node drains the perf buffers of its node's CPUs, see numa.py
+    numa_drain: bool = False
+    # Publish windowed features of the live hook buffers into fstore maps, see feature_pipeline.py
+    feature_pipeline: bool = False
+    feature_window_ms: int = 100
+    feature_ewma_half_life_ms: int = 1000
+    feature_tgid_slots: int = 4096
 
     def get_output_dir(self) -> Path:
         return Path(self.output_dir)
 
+    def get_hook_options(self) -> bpf.HookOptions:
+        return bpf.HookOptions(
+            transport=self.transport,
+            ringbuf_pages=self.ringbuf_pages,
+            wakeup_events=self.wakeup_events,
+            aggregate=self.aggregate,
+            flow_drain_ms=self.flow_drain_ms,
+            fault_regions=self.fault_regions,
+            fault_region_drain_ms=self.fault_region_drain_ms,
+            intern_comm=self.intern_comm,
+            perf_counting=self.perf_counting,
+            perf_count_by=self.perf_count_by,
+            perf_count_drain_ms=self.perf_count_drain_ms,
+            fentry=self.fentry,
+            task_storage=self.task_storage,
+            sample_every=self.sample_every,
+            sample_period_us=self.sample_period_us,
+            tgid_allowlist=tuple(self.tgid_allowlist),
+            cgroup_allowlist=tuple(self.cgroup_allowlist),
+        )
+
     def get_hooks(self) -> list[bpf.BPFProgram]:
-        return [
+        hooks = [
             hook()
             for hook_name, hook in bpf.all_hooks.items()
             if hook_name in self.hooks
         ]
+        for hook in hooks:
+            hook.configure(self.get_hook_options())
+        return hooks
 
 
 CollectorConfig = make_dataclass(
@@ -3,7 +3,7 @@
 from typing import Final, Mapping
 
 from data_collection.bpf_instrumentation.blk_io_hook import BlockIOBPFHook
-from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram, HookOptions
 from data_collection.bpf_instrumentation.cbmm import (
     CBMMBPFHook,
 )
@@ -65,6 +65,7 @@ __all__ = [
     "all_hooks",
     "hook_names",
     "BPFProgram",
+    "HookOptions",
     "CustomHWConfigManager",
     "QuantaRuntimeBPFHook",
 ]
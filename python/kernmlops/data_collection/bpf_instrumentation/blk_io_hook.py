@@ -1,38 +1,23 @@
-from dataclasses import dataclass
 from pathlib import Path
 from typing import cast
 
 import polars as pl
 from bcc import BPF
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.columnar import EventColumns
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.histogram import (
+  LatencyHistogram,
+  LatencyHistogramData,
+  expand_histograms,
+  histogram_frame,
+)
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import UPTIME_TIMESTAMP, CollectionTable
 from data_schema.block_io import BlockIOLatencyTable, BlockIOQueueTable, BlockIOTable
+from data_schema.latency_histogram import BlockIOLatencyHistogramTable
 
 
-@dataclass(frozen=True)
-class BlockIOQueueData:
-  cpu: int
-  device: int
-  sector: int
-  segments: int
-  block_io_bytes: int
-  block_io_start_uptime_us: int
-  block_io_flags: int
-  queue_length_segment_ios: int
-  queue_length_4k_ios: int
-
-@dataclass(frozen=True)
-class BlockIOLatencyData:
-  cpu: int
-  device: int
-  sector: int
-  segments: int
-  block_io_bytes: int
-  block_io_end_uptime_us: int
-  block_latency_us: int
-  block_io_latency_us: int
-  block_io_flags: int
-
 class BlockIOBPFHook(BPFProgram):
 
   @classmethod
@@ -48,28 +33,59 @@ class BlockIOBPFHook(BPFProgram):
     else:
         bpf_text = bpf_text.replace('__RQ_DISK__', 'q->disk')
     self.bpf_text = bpf_text
-    self.block_io_queue_data = list[BlockIOQueueData]()
-    self.block_io_latency_data = list[BlockIOLatencyData]()
+    self.block_io_queue_columns = EventColumns()
+    self.block_io_latency_columns = EventColumns()
+    self.histogram: LatencyHistogram | None = None
+    self.histogram_data = list[LatencyHistogramData]()
 
   def load(self, collection_id: str):
     self.collection_id = collection_id
-    self.bpf = BPF(text = self.bpf_text)
-    self.bpf["block_io_starts"].open_perf_buffer(self._queue_event_handler, page_cnt=64)
-    self.bpf["block_io_ends"].open_perf_buffer(self._latency_event_handler, page_cnt=64)
+    self.events = EventTransport(self.options)
+    bpf_text = self.bpf_text.replace("AGGREGATE", "1" if self.options.aggregate else "0")
+    bpf_text = expand_histograms(expand_control(bpf_text, self.name()))
+    self.bpf = BPF(text = self.events.expand(bpf_text))
+    self.control = apply_control(self.bpf, self.name(), self.options)
+    if self.options.aggregate:
+      self.histogram = LatencyHistogram(self.bpf, "block_io_latency_hist", {0: "block_latency", 1: "block_io_latency"})
+    else:
+      self.events.open_columns(self.bpf, "block_io_starts", self.block_io_queue_columns, page_cnt=64)
+      self.events.open_columns(self.bpf, "block_io_ends", self.block_io_latency_columns, page_cnt=64)
 
   def poll(self):
-    self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+    if self.histogram is not None:
+      self.histogram_data.extend(self.histogram.drain())
+    else:
+      self.events.poll(self.bpf)
 
   def close(self):
     self.bpf.cleanup()
 
+  def lost_events(self) -> int:
+    return self.events.lost_events(self.bpf)
+
+  def poll_fds(self) -> list[int]:
+    return self.events.poll_fds(self.bpf)
+
   def data(self) -> list[CollectionTable]:
+    return self._tables(self.histogram_data, self.block_io_latency_columns.frame(),
+                        self.block_io_queue_columns.frame())
+
+  def _tables(
+    self, histogram_data: list[LatencyHistogramData], latency: pl.DataFrame, queue: pl.DataFrame,
+  ) -> list[CollectionTable]:
+    if self.histogram is not None:
+      return [
+        BlockIOLatencyHistogramTable.from_df_id(
+          histogram_frame(histogram_data),
+          collection_id=self.collection_id,
+        ),
+      ]
     return list[CollectionTable]([
       BlockIOTable.from_tables(
         latency_table=cast(
           BlockIOLatencyTable,
           BlockIOLatencyTable.from_df_id(
-            pl.DataFrame(self.block_io_latency_data).rename({
+            latency.rename({
               "block_io_end_uptime_us": UPTIME_TIMESTAMP,
             }),
             collection_id=self.collection_id,
@@ -78,8 +94,10 @@ class BlockIOBPFHook(BPFProgram):
         queue_table=cast(
           BlockIOQueueTable,
           BlockIOQueueTable.from_df_id(
-            pl.DataFrame(self.block_io_queue_data).rename({
+            queue.rename({
               "block_io_start_uptime_us": UPTIME_TIMESTAMP,
+              "queue_length_segments": "queue_length_segment_ios",
+              "queue_length_4ks": "queue_length_4k_ios",
             }),
             collection_id=self.collection_id,
           ),
@@ -87,49 +105,22 @@ class BlockIOBPFHook(BPFProgram):
       ),
     ])
 
+  def recent_events(self) -> dict[str, pl.DataFrame]:
+    # aggregate mode keeps no per request queue lengths
+    if self.histogram is not None:
+      return {}
+    recent = self.block_io_queue_columns.pop_recent()
+    if len(recent) == 0:
+      return {}
+    return {"block_io_starts": recent.rename({"block_io_start_uptime_us": UPTIME_TIMESTAMP})}
+
   def clear(self):
-    self.block_io_queue_data.clear()
-    self.block_io_latency_data.clear()
+    self.histogram_data.clear()
+    self.block_io_queue_columns.clear()
+    self.block_io_latency_columns.clear()
 
   def pop_data(self) -> list[CollectionTable]:
-    block_io_tables = self.data()
-    self.clear()
-    return block_io_tables
-
-  def _queue_event_handler(self, cpu, block_io_start_perf_event, size):
-    event = self.bpf["block_io_starts"].event(block_io_start_perf_event)
-    sector = event.sector
-    if sector == 18446744073709551615: # this is -1 in a u64
-      sector = -1
-    self.block_io_queue_data.append(
-      BlockIOQueueData(
-        cpu=cpu,
-        device=event.device,
-        sector=sector,
-        segments=event.segments,
-        block_io_bytes=event.block_io_bytes,
-        block_io_start_uptime_us=event.block_io_start_uptime_us,
-        block_io_flags=event.block_io_flags,
-        queue_length_segment_ios=event.queue_length_segments,
-        queue_length_4k_ios=event.queue_length_4ks,
-      )
-    )
-
-  def _latency_event_handler(self, cpu, block_io_end_perf_event, size):
-    event = self.bpf["block_io_ends"].event(block_io_end_perf_event)
-    sector = event.sector
-    if sector == 18446744073709551615: # this is -1 in a u64
-      sector = -1
-    self.block_io_latency_data.append(
-      BlockIOLatencyData(
-        cpu=cpu,
-        device=event.device,
-        sector=sector,
-        segments=event.segments,
-        block_io_bytes=event.block_io_bytes,
-        block_io_end_uptime_us=event.block_io_end_uptime_us,
-        block_latency_us=event.block_latency_us,
-        block_io_latency_us=event.block_io_latency_us,
-        block_io_flags=event.block_io_flags,
-      )
-    )
+    # poll() keeps appending on its own thread, take each buffer as it is reset
+    histogram_data, self.histogram_data = self.histogram_data, list[LatencyHistogramData]()
+    return self._tables(histogram_data, self.block_io_latency_columns.pop(),
+                        self.block_io_queue_columns.pop())
@@ -17,6 +17,7 @@ typedef struct block_io_start_perf_event {
   u64 block_io_flags;
   int queue_length_segments;
   int queue_length_4ks;
+  u32 sample_weight;
 } block_io_start_perf_event_t;
 
 typedef struct block_io_end_perf_event {
@@ -28,6 +29,7 @@ typedef struct block_io_end_perf_event {
   u64 block_latency_us;
   u64 block_io_latency_us;
   u64 block_io_flags;
+  u32 sample_weight;
 } block_io_end_perf_event_t;
 
 struct queue_lengths {
@@ -40,12 +42,27 @@ struct start_key {
   u64 sector;
 };
 
+struct started_io {
+  u32 block_4ks;
+  // 0 when the issue was sampled out, so its completion is too
+  u32 sample_weight;
+};
+
+HOOK_CONTROL();
+
 BPF_HASH(device_queue, u32, struct queue_lengths);
-// we maintain started_4k_ios separately so we can manage scenarios where there is
+// we maintain started_ios separately so we can manage scenarios where there is
 // existing outstanding io for a device when this BPF program is installed
-BPF_HASH(started_4k_ios, struct start_key, u32, 1024);
-BPF_PERF_OUTPUT(block_io_starts);
-BPF_PERF_OUTPUT(block_io_ends);
+BPF_HASH(started_ios, struct start_key, struct started_io, 1024);
+EVENT_OUTPUT(block_io_starts, struct block_io_start_perf_event);
+EVENT_OUTPUT(block_io_ends, struct block_io_end_perf_event);
+
+#if AGGREGATE
+// completions run in interrupt context so these are keyed by device alone
+#define BLOCK_LATENCY    0
+#define BLOCK_IO_LATENCY 1
+LATENCY_HISTOGRAM(block_io_latency_hist);
+#endif
 
 static dev_t ddevt(struct gendisk* disk) {
   return (disk->major << 20) | disk->first_minor;
@@ -90,12 +107,18 @@ RAW_TRACEPOINT_PROBE(block_rq_issue) {
   if (!q_lengths) {
     return 0;
   }
+  // queue lengths count every request, sampling only decides what is reported
+  HOOK_WEIGHT(sample_weight);
   int block_4ks = block_4k_ios(bytes);
   struct start_key start;
   __builtin_memset(&start, 0, sizeof(start));
   start.dev = device;
   start.sector = sector;
-  started_4k_ios.update(&start, &block_4ks);
+  struct started_io started;
+  __builtin_memset(&started, 0, sizeof(started));
+  started.block_4ks = block_4ks;
+  started.sample_weight = sample_weight;
+  started_ios.update(&start, &started);
 
   __sync_fetch_and_add(&q_lengths->queue_length_4ks, block_4ks);
   __sync_fetch_and_add(&q_lengths->queue_length_segments, segments);
@@ -116,8 +139,13 @@ RAW_TRACEPOINT_PROBE(block_rq_issue) {
   data.block_io_flags = flags;
   data.queue_length_4ks = queue_length_4ks;
   data.queue_length_segments = queue_length_segments;
+  data.sample_weight = sample_weight;
 
-  block_io_starts.perf_submit(ctx, &data, sizeof(data));
+#if !AGGREGATE
+  if (sample_weight) {
+    EVENT_EMIT(block_io_starts, ctx, &data);
+  }
+#endif
 
   return 0;
 }
@@ -137,20 +165,42 @@ RAW_TRACEPOINT_PROBE(block_rq_complete) {
   u64 io_delta = ts - io_start_time_ns;
   u64 delta = ts - start_time_ns;
 
-  // store io data
-  struct block_io_end_perf_event data;
-  __builtin_memset(&data, 0, sizeof(data));
-  data.device = device;
-  data.sector = sector;
-  data.segments = segments;
-  data.block_io_bytes = bytes;
-  // TODO(Patrick): avoid division and multiplication
-  data.block_io_end_uptime_us = ts / 1000;
-  data.block_latency_us = delta / 1000;
-  data.block_io_latency_us = io_delta / 1000;
-  data.block_io_flags = flags;
+  struct start_key start;
+  __builtin_memset(&start, 0, sizeof(start));
+  start.dev = device;
+  start.sector = sector;
+  // completions follow their issue's sampling, ones whose issue was never seen decide alone
+  struct started_io* started = started_ios.lookup(&start);
+  u32 sample_weight = 0;
+  if (started) {
+    sample_weight = started->sample_weight;
+  } else {
+    HOOK_WEIGHT(unseen_weight, 1);
+    sample_weight = unseen_weight;
+  }
 
-  block_io_ends.perf_submit(ctx, &data, sizeof(data));
+  if (sample_weight) {
+#if AGGREGATE
+    LATENCY_RECORD(block_io_latency_hist, 0, device, BLOCK_LATENCY, delta / 1000, sample_weight);
+    LATENCY_RECORD(block_io_latency_hist, 0, device, BLOCK_IO_LATENCY, io_delta / 1000, sample_weight);
+#else
+    // store io data
+    struct block_io_end_perf_event data;
+    __builtin_memset(&data, 0, sizeof(data));
+    data.device = device;
+    data.sector = sector;
+    data.segments = segments;
+    data.block_io_bytes = bytes;
+    // TODO(Patrick): avoid division and multiplication
+    data.block_io_end_uptime_us = ts / 1000;
+    data.block_latency_us = delta / 1000;
+    data.block_io_latency_us = io_delta / 1000;
+    data.block_io_flags = flags;
+    data.sample_weight = sample_weight;
+
+    EVENT_EMIT(block_io_ends, ctx, &data);
+#endif
+  }
 
   // get device queue for request that just finished
   struct queue_lengths* q_lengths = device_queue.lookup(&device);
@@ -159,15 +209,11 @@ RAW_TRACEPOINT_PROBE(block_rq_complete) {
     return 0;
   }
   // ensure that the finished block io was tracked when it was inserted
-  struct start_key start;
-  __builtin_memset(&start, 0, sizeof(start));
-  start.dev = device;
-  start.sector = sector;
-  if (!started_4k_ios.lookup(&start)) {
+  if (!started) {
     return 0;
   }
   // clear the inserted state
-  started_4k_ios.delete(&start);
+  started_ios.delete(&start);
 
   // update device queue length to not include this finished io
   int block_4ks = block_4k_ios(bytes);
@@ -18,6 +18,7 @@ struct cbmm_eager_paging_inputs {
   u64 freq_cycles;
   u64 greatest_range_benefit;
   int decision;
+  u32 sample_weight;
 };
 
 struct cbmm_async_prezeroing {
@@ -42,37 +43,41 @@ struct cbmm_async_prezeroing_inputs {
   u64 zeroing_per_page_cost;
   u64 recent_used;
   int decision;
+  u32 sample_weight;
 };
 
 struct cbmm_action {
   int action;
+  u32 sample_weight;
   struct cbmm_eager_paging eager;
   struct cbmm_async_prezeroing prezero;
 };
 
+HOOK_CONTROL();
+
 BPF_HASH(cbmm_action_hash, u64, struct cbmm_action, 1024);
 
-BPF_PERF_OUTPUT(cbmm_eager);
-BPF_PERF_OUTPUT(cbmm_prezero);
+EVENT_OUTPUT(cbmm_eager, struct cbmm_eager_paging_inputs);
+EVENT_OUTPUT(cbmm_prezero, struct cbmm_async_prezeroing_inputs);
 
-static void insert_mm_estimate_changes(int action) {
+static void insert_mm_estimate_changes(int action, u32 sample_weight) {
   u64 tgid_pid = bpf_get_current_pid_tgid();
   struct cbmm_action stored_action;
   memset(&stored_action, 0, sizeof(struct cbmm_action));
   stored_action.action = action;
+  stored_action.sample_weight = sample_weight;
   cbmm_action_hash.lookup_or_try_init(&tgid_pid, &stored_action);
 }
 
 int kprobe__mm_estimate_changes(struct pt_regs* ctx, struct mm_action* action,
                                 struct mm_cost_delta* cost) {
-  switch (action->action) {
-    case MM_ACTION_EAGER_PAGING:
-    case MM_ACTION_RUN_PREZEROING:
-      insert_mm_estimate_changes(action->action);
-      break;
-    default:
-      break;
-  }
+  int kind = action->action;
+  if (kind != MM_ACTION_EAGER_PAGING && kind != MM_ACTION_RUN_PREZEROING)
+    return 0;
+  // Sampled out decisions are never stored, so the probes below skip them too,
+  // eager paging is stream 0 and prezeroing stream 1
+  HOOK_SAMPLE(sample_weight, kind == MM_ACTION_RUN_PREZEROING);
+  insert_mm_estimate_changes(kind, sample_weight);
   return 0;
 }
 
@@ -82,7 +87,8 @@ static void mm_decide_push_eager(struct pt_regs* ctx, int decision, struct cbmm_
   inputs.decision = decision;
   inputs.freq_cycles = action.eager.freq_cycles;
   inputs.greatest_range_benefit = action.eager.greatest_range_benefit;
-  cbmm_eager.perf_submit(ctx, &inputs, sizeof(inputs));
+  inputs.sample_weight = action.sample_weight;
+  EVENT_EMIT(cbmm_eager, ctx, &inputs);
 }
 
 static void mm_decide_push_prezero(struct pt_regs* ctx, int decision, struct cbmm_action action) {
@@ -98,7 +104,8 @@ static void mm_decide_push_prezero(struct pt_regs* ctx, int decision, struct cbm
   inputs.nfree = 10 * 3000 * 1000 / inputs.critical_section_cost;
   inputs.zeroing_per_page_cost = action.prezero.zeroing_per_page_cost;
   inputs.recent_used = action.prezero.recent_used;
-  cbmm_prezero.perf_submit(ctx, &inputs, sizeof(inputs));
+  inputs.sample_weight = action.sample_weight;
+  EVENT_EMIT(cbmm_prezero, ctx, &inputs);
 }
 
 int kretprobe__mm_decide(struct pt_regs* ctx) {
@@ -28,11 +28,16 @@ typedef struct trace_mm_khugepaged_scan_pmd_struct {
   u32 none_or_zero;
   u32 status;
   u32 unmapped;
+  u32 sample_weight;
 } trace_mm_khugepaged_scan_pmd_t;
 
-BPF_PERF_OUTPUT(trace_mm_khugepaged_scan_pmds);
+// Scans are stream 1, collapses stream 0
+HOOK_CONTROL();
+
+EVENT_OUTPUT(trace_mm_khugepaged_scan_pmds, trace_mm_khugepaged_scan_pmd_t);
 
 RAW_TRACEPOINT_PROBE(mm_khugepaged_scan_pmd) {
+  HOOK_SAMPLE(sample_weight, 1);
   u64 start = bpf_ktime_get_ns();
   trace_mm_khugepaged_scan_pmd_t data;
   __builtin_memset(&data, 0, sizeof(data));
@@ -47,13 +52,12 @@ RAW_TRACEPOINT_PROBE(mm_khugepaged_scan_pmd) {
   data.none_or_zero = ctx->args[4];
   data.status = ctx->args[5];
   data.unmapped = ctx->args[6];
+  data.sample_weight = sample_weight;
   data.end_ts_ns = bpf_ktime_get_ns();
-  trace_mm_khugepaged_scan_pmds.perf_submit(ctx, &data, sizeof(data));
+  EVENT_EMIT(trace_mm_khugepaged_scan_pmds, ctx, &data);
   return 0;
 }
 
-BPF_PERF_OUTPUT(collapse_huge_pages);
-
 typedef struct collapse_huge_page_struct {
   u32 pid;
   u32 tgid;
@@ -64,10 +68,19 @@ typedef struct collapse_huge_page_struct {
   u32 referenced;
   u32 unmapped;
   u64 cc;
+  u32 sample_weight;
 } collapse_huge_page_t;
 
+EVENT_OUTPUT(collapse_huge_pages, collapse_huge_page_t);
+// Weight of the collapse each task is inside of, its closing tracepoint reports with it
+// since the two rows are paired up in order and collapsing may sleep and migrate
+BPF_HASH(collapse_weights, u32, u32, 1024);
+
 int kprobe_collapse_huge_page(struct pt_regs* ctx, struct mm_struct* mm, u64 address,
                               int referenced, int unmapped, struct collapse_control* cc) {
+  HOOK_SAMPLE(sample_weight, 0);
+  u32 tid = bpf_get_current_pid_tgid();
+  collapse_weights.update(&tid, &sample_weight);
   u64 start = bpf_ktime_get_ns();
   collapse_huge_page_t data;
   __builtin_memset(&data, 0, sizeof(data));
@@ -78,9 +91,10 @@ int kprobe_collapse_huge_page(struct pt_regs* ctx, struct mm_struct* mm, u64 add
   data.pid = mm->owner->pid;
   data.tgid = mm->owner->tgid;
   data.cc = (u64)cc;
+  data.sample_weight = sample_weight;
   data.start_ts_ns = start;
   data.end_ts_ns = bpf_ktime_get_ns();
-  collapse_huge_pages.perf_submit(ctx, &data, sizeof(data));
+  EVENT_EMIT(collapse_huge_pages, ctx, &data);
   return 0;
 }
 
@@ -92,22 +106,30 @@ typedef struct trace_mm_collapse_huge_page_struct {
   u64 mm;
   u32 isolated;
   u32 status;
+  u32 sample_weight;
 } trace_mm_collapse_huge_page_t;
 
-BPF_PERF_OUTPUT(trace_mm_collapse_huge_pages);
+EVENT_OUTPUT(trace_mm_collapse_huge_pages, trace_mm_collapse_huge_page_t);
 // If this succeeds a folio was allocated meaning there was space
 
 RAW_TRACEPOINT_PROBE(mm_collapse_huge_page) {
+  u32 tid = bpf_get_current_pid_tgid();
+  u32* weight = collapse_weights.lookup(&tid);
+  if (!weight)
+    return 0;
+  u32 sample_weight = *weight;
+  collapse_weights.delete(&tid);
   u64 start = bpf_ktime_get_ns();
   trace_mm_collapse_huge_page_t data;
   __builtin_memset(&data, 0, sizeof(data));
   struct mm_struct* mm = (struct mm_struct*)ctx->args[0];
   data.isolated = (u32)ctx->args[1];
   data.status = (u32)ctx->args[2];
+  data.sample_weight = sample_weight;
   data.pid = mm->owner->pid;
   data.tgid = mm->owner->tgid;
   data.start_ts_ns = start;
   data.end_ts_ns = bpf_ktime_get_ns();
-  trace_mm_collapse_huge_pages.perf_submit(ctx, &data, sizeof(data));
+  EVENT_EMIT(trace_mm_collapse_huge_pages, ctx, &data);
   return 0;
 }
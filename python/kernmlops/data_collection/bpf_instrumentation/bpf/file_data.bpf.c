@@ -11,9 +11,11 @@ typedef struct file_open_perf_event {
   u32 file_inode;
   u64 file_size_bytes;
   char file_name[DNAME_INLINE_LEN];
+  u32 sample_weight;
 } file_open_perf_event_t;
 
-BPF_PERF_OUTPUT(file_open_events);
+HOOK_CONTROL();
+EVENT_OUTPUT(file_open_events, struct file_open_perf_event);
 
 static int probe_dentry(struct pt_regs* ctx, struct dentry* dentry, bool created) {
   u32 pid = bpf_get_current_pid_tgid();
@@ -26,6 +28,8 @@ static int probe_dentry(struct pt_regs* ctx, struct dentry* dentry, bool created
   if (!(created || file_size > 0)) {
     return 0;
   }
+  // only files that would be reported count towards the sampling
+  HOOK_SAMPLE(sample_weight);
 
   struct file_open_perf_event data;
   __builtin_memset(&data, 0, sizeof(data));
@@ -36,8 +40,9 @@ static int probe_dentry(struct pt_regs* ctx, struct dentry* dentry, bool created
   data.file_inode = dentry->d_inode->i_ino;
   data.file_size_bytes = file_size;
   bpf_probe_read(&data.file_name, DNAME_INLINE_LEN, (const void*)&dentry->d_iname);
+  data.sample_weight = sample_weight;
 
-  file_open_events.perf_submit(ctx, &data, sizeof(data));
+  EVENT_EMIT(file_open_events, ctx, &data);
 
   return 0;
 }
@@ -5,53 +5,64 @@ typedef struct start_data {
   u32 tgid;
   u64 ts;
   char buff[TASK_COMM_LEN];
+  u32 sample_weight;
 } start_data_t;
 
 typedef struct stop_data {
   u32 pid;
   u32 tgid;
   u64 ts;
+  u32 sample_weight;
 } stop_data_t;
 
-BPF_PERF_OUTPUT(copy_task_events);
-BPF_PERF_OUTPUT(release_task_events);
-BPF_PERF_OUTPUT(exec_events);
+typedef start_data_t exec_data_t;
+
+// Forks, exits and execs are sampled as streams 0, 1 and 2
+HOOK_CONTROL();
+
+EVENT_OUTPUT(copy_task_events, start_data_t);
+EVENT_OUTPUT(release_task_events, stop_data_t);
+EVENT_OUTPUT(exec_events, exec_data_t);
 
 int kretprobe_copy_process(struct pt_regs* ctx) {
   struct task_struct* task;
   if (IS_ERR(task = (struct task_struct*)PT_REGS_RC(ctx)))
     return 0;
-  start_data_t data;
-  bpf_get_current_comm(&data.buff, sizeof(data.buff));
-  data.ts = bpf_ktime_get_ns();
-  data.pid = task->pid;
-  data.tgid = task->tgid;
-  copy_task_events.perf_submit(ctx, &data, sizeof(data));
+  HOOK_SAMPLE(sample_weight, 0);
+  EVENT_RESERVE(copy_task_events, start_data_t, data);
+  data->sample_weight = sample_weight;
+  bpf_get_current_comm(&data->buff, sizeof(data->buff));
+  data->ts = bpf_ktime_get_ns();
+  data->pid = task->pid;
+  data->tgid = task->tgid;
+  EVENT_SUBMIT(copy_task_events, ctx, data);
   return 0;
 }
 
 int kprobe_do_exit(struct pt_regs* ctx, long code) {
+  HOOK_SAMPLE(sample_weight, 1);
   struct task_struct* task = (struct task_struct*)bpf_get_current_task();
-  stop_data_t data;
-  data.ts = bpf_ktime_get_ns();
-  data.pid = task->pid;
-  data.tgid = task->tgid;
-  release_task_events.perf_submit(ctx, &data, sizeof(data));
+  EVENT_RESERVE(release_task_events, stop_data_t, data);
+  data->sample_weight = sample_weight;
+  data->ts = bpf_ktime_get_ns();
+  data->pid = task->pid;
+  data->tgid = task->tgid;
+  EVENT_SUBMIT(release_task_events, ctx, data);
   return 0;
 }
 
-typedef start_data_t exec_data_t;
-
 int kretprobe_exec(struct pt_regs* ctx) {
   if (PT_REGS_RC(ctx) != 0)
     return 0;
 
-  exec_data_t data;
-  bpf_get_current_comm(data.buff, sizeof(data.buff));
-  data.pid = bpf_get_current_pid_tgid() >> 32;
-  data.tgid = (u32)bpf_get_current_pid_tgid();
-  data.ts = bpf_ktime_get_ns();
-  exec_events.perf_submit(ctx, &data, sizeof(data));
+  HOOK_SAMPLE(sample_weight, 2);
+  EVENT_RESERVE(exec_events, exec_data_t, data);
+  data->sample_weight = sample_weight;
+  bpf_get_current_comm(data->buff, sizeof(data->buff));
+  data->pid = bpf_get_current_pid_tgid() >> 32;
+  data->tgid = (u32)bpf_get_current_pid_tgid();
+  data->ts = bpf_ktime_get_ns();
+  EVENT_SUBMIT(exec_events, ctx, data);
 
   return 0;
 }
@@ -7,15 +7,19 @@ typedef struct madvise_output {
   u64 address;
   u64 length;
   int advice;
+  u32 sample_weight;
 } madvise_output_t;
 
-BPF_PERF_OUTPUT(madvise_output);
+// madvise calls are sampled as stream 0 and unmaps as stream 1
+HOOK_CONTROL();
+EVENT_OUTPUT(madvise_output, madvise_output_t);
 
 BPF_HASH(madvise_hash, u32, madvise_output_t, 32768);
 BPF_HASH(munmap_hash, u32, madvise_output_t, 32768);
 
 int kprobe__do_madvise(struct pt_regs* ctx, struct mm_struct* mm, unsigned long addr, size_t length,
                        int advice) {
+  HOOK_SAMPLE(sample_weight, 0);
   u32 pid = bpf_get_current_pid_tgid();
   madvise_output_t data;
   memset((void*)&data, 0, sizeof(data));
@@ -24,6 +28,7 @@ int kprobe__do_madvise(struct pt_regs* ctx, struct mm_struct* mm, unsigned long
   data.address = (u64)addr;
   data.length = (u64)length;
   data.advice = advice;
+  data.sample_weight = sample_weight;
   madvise_hash.insert(&pid, &data);
   return 0;
 }
@@ -37,7 +42,7 @@ int kretprobe__do_madvise(struct pt_regs* ctx) {
   if ((data = madvise_hash.lookup(&pid)) == NULL)
     madvise_hash.delete(&pid);
   return 0;
-  madvise_output.perf_submit(ctx, data, sizeof(madvise_output_t));
+  EVENT_EMIT(madvise_output, ctx, data);
   madvise_hash.delete(&pid);
   return 0;
 }
@@ -45,6 +50,7 @@ int kretprobe__do_madvise(struct pt_regs* ctx) {
 int kprobe__do_vmi_align_munmap(struct pt_regs* ctx, struct vm_area_struct* vma,
                                 struct mm_struct* mm, unsigned long start, unsigned long end,
                                 struct list_head* uf, bool unlock) {
+  HOOK_SAMPLE(sample_weight, 1);
   u32 pid = bpf_get_current_pid_tgid();
   madvise_output_t data;
   memset((void*)&data, 0, sizeof(data));
@@ -53,6 +59,7 @@ int kprobe__do_vmi_align_munmap(struct pt_regs* ctx, struct vm_area_struct* vma,
   data.address = (u64)start;
   data.length = (u64)(end - start);
   data.advice = -1;
+  data.sample_weight = sample_weight;
   munmap_hash.insert(&pid, &data);
   return 0;
 }
@@ -65,7 +72,7 @@ int kretprobe__do_vmi_align_munmap(struct pt_regs* ctx) {
   if (((int)PT_REGS_RC(ctx)) != 0)
     munmap_hash.delete(&pid);
   return 0;
-  madvise_output.perf_submit(ctx, data, sizeof(madvise_output_t));
+  EVENT_EMIT(madvise_output, ctx, data);
   munmap_hash.delete(&pid);
   return 0;
 }
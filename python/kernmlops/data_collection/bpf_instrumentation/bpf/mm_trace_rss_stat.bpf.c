@@ -7,9 +7,11 @@ typedef struct rss_stat_output {
   u64 ts;
   int member;
   u64 counter_value;
+  u32 sample_weight;
 } rss_stat_output_t;
 
-BPF_PERF_OUTPUT(rss_stat_output);
+HOOK_CONTROL();
+EVENT_OUTPUT(rss_stat_output, rss_stat_output_t);
 
 BPF_HASH(rss_stat_hash, u32, rss_stat_output_t, 32768);
 
@@ -18,6 +20,8 @@ BPF_HASH(rss_stat_hash, u32, rss_stat_output_t, 32768);
 #define PAGE_SZ 12
 
 RAW_TRACEPOINT_PROBE(rss_stat) {
+  // sampled out updates store nothing, so the tracepoint below skips them
+  HOOK_SAMPLE(sample_weight);
   rss_stat_output_t stack_data;
   u32 pid = bpf_get_current_pid_tgid();
   memset((void*)&stack_data, 0, sizeof(stack_data));
@@ -25,6 +29,7 @@ RAW_TRACEPOINT_PROBE(rss_stat) {
   struct mm_struct* mm = (struct mm_struct*)ctx->args[0];
   stack_data.pid = mm->owner->pid;
   stack_data.tgid = mm->owner->tgid;
+  stack_data.sample_weight = sample_weight;
 
   rss_stat_hash.insert(&pid, &stack_data);
   return 0;
@@ -41,7 +46,7 @@ TRACEPOINT_PROBE(kmem, rss_stat) {
   data->counter_value = (args->size) >> PAGE_SZ;
   data->ts = bpf_ktime_get_ns();
 
-  rss_stat_output.perf_submit(args, data, sizeof(rss_stat_output_t));
+  EVENT_EMIT(rss_stat_output, args, data);
   rss_stat_hash.delete(&pid);
   return 0;
 }
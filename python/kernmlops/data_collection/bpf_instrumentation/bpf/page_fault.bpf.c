@@ -11,6 +11,7 @@ typedef struct page_fault_info {
   u64 address;
   u32 flags;
   u64 ts_start;
+  u32 sample_weight;
 } page_fault_info_t;
 
 typedef struct page_fault_event {
@@ -22,57 +23,117 @@ typedef struct page_fault_event {
   u8 is_major;
   u8 is_write;
   u8 is_exec;
-  char comm[TASK_COMM_LEN];
+  TASK_COMM_FIELD(comm);
+  u32 sample_weight;
 } page_fault_event_t;
 
+HOOK_CONTROL();
+
+#if USE_TASK_STORAGE
+// Lives with the task, so no capacity limit and no hashing per fault
+BPF_TASK_STORAGE(fault_entry, page_fault_info_t);
+#else
 BPF_HASH(fault_entry, u32, page_fault_info_t, 10240);
-BPF_PERF_OUTPUT(page_fault_events);
+#endif
+EVENT_OUTPUT(page_fault_events, page_fault_event_t);
+TASK_COMMS();
+FAULT_REGIONS();
 
-// Entry probe - store fault info
-int trace_handle_mm_fault_entry(struct pt_regs* ctx, struct vm_area_struct* vma,
-                                unsigned long address, unsigned int flags) {
+static inline void fault_start(unsigned long address, unsigned int flags, u32 sample_weight) {
   u32 pid = bpf_get_current_pid_tgid();
-
+#if USE_TASK_STORAGE
+  page_fault_info_t* info = fault_entry.task_storage_get(bpf_get_current_task_btf(), 0,
+                                                         BPF_LOCAL_STORAGE_GET_F_CREATE);
+  if (!info)
+    return;
+  info->pid = pid;
+  info->address = address;
+  info->flags = flags;
+  info->ts_start = bpf_ktime_get_ns();
+  info->sample_weight = sample_weight;
+#else
   page_fault_info_t info = {};
   info.pid = pid;
   info.address = address;
   info.flags = flags;
   info.ts_start = bpf_ktime_get_ns();
+  info.sample_weight = sample_weight;
 
   fault_entry.update(&pid, &info);
-  return 0;
+#endif
 }
 
-// Return probe - check if major fault
-int trace_handle_mm_fault_return(struct pt_regs* ctx) {
+static inline int fault_finish(void* ctx, unsigned long ret) {
   u32 pid = bpf_get_current_pid_tgid();
+#if USE_TASK_STORAGE
+  page_fault_info_t* info = fault_entry.task_storage_get(bpf_get_current_task_btf(), 0, 0);
+  // ts_start of 0 marks storage whose fault was already reported
+  if (!info || info->ts_start == 0)
+    return 0;
+#else
   page_fault_info_t* info = fault_entry.lookup(&pid);
   if (!info)
     return 0;
-
-  // Get return value
-  unsigned long ret = PT_REGS_RC(ctx);
+#endif
 
   // Only process successful faults
-  if (ret & VM_FAULT_ERROR) {
-    fault_entry.delete(&pid);
-    return 0;
-  }
+  if (!(ret & VM_FAULT_ERROR)) {
+    page_fault_event_t event = {};
+    event.pid = info->pid;
+    event.tgid = bpf_get_current_pid_tgid() >> 32;
+    event.ts_uptime_us = info->ts_start / 1000;
+    event.address = info->address;
+    event.error_code = 0; // Not used in this approach
+    event.is_major = (ret & VM_FAULT_MAJOR) ? 1 : 0;
+    event.is_write = (info->flags & FAULT_FLAG_WRITE) ? 1 : 0;
+    event.is_exec = (info->flags & FAULT_FLAG_INSTRUCTION) ? 1 : 0;
+    event.sample_weight = info->sample_weight;
 
-  page_fault_event_t event = {};
-  event.pid = info->pid;
-  event.tgid = bpf_get_current_pid_tgid() >> 32;
-  event.ts_uptime_us = info->ts_start / 1000;
-  event.address = info->address;
-  event.error_code = 0; // Not used in this approach
-  event.is_major = (ret & VM_FAULT_MAJOR) ? 1 : 0;
-  event.is_write = (info->flags & FAULT_FLAG_WRITE) ? 1 : 0;
-  event.is_exec = (info->flags & FAULT_FLAG_INSTRUCTION) ? 1 : 0;
+#if FAULT_REGIONS_ENABLED
+    fault_region_count(event.tgid, event.address, event.is_major, event.is_write, event.is_exec,
+                       event.sample_weight, event.ts_uptime_us);
+#endif
+    // Aggregate mode leaves faults to the region map
+#if !(AGGREGATE && FAULT_REGIONS_ENABLED)
+    TASK_COMM_FILL(ctx, event.comm);
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+    EVENT_EMIT(page_fault_events, ctx, &event);
+#endif
+  }
 
-  page_fault_events.perf_submit(ctx, &event, sizeof(event));
+#if USE_TASK_STORAGE
+  info->ts_start = 0;
+#else
   fault_entry.delete(&pid);
+#endif
+  return 0;
+}
 
+#if USE_FENTRY
+KFUNC_PROBE(handle_mm_fault, struct vm_area_struct* vma, unsigned long address, unsigned int flags,
+            struct pt_regs* regs) {
+  // Sampled out faults leave no entry, so their return is skipped too
+  HOOK_SAMPLE(sample_weight);
+  fault_start(address, flags, sample_weight);
   return 0;
 }
+
+// fexit sees the return value directly, without a kretprobe trampoline per fault
+KRETFUNC_PROBE(handle_mm_fault, struct vm_area_struct* vma, unsigned long address,
+               unsigned int flags, struct pt_regs* regs, vm_fault_t ret) {
+  return fault_finish(ctx, ret);
+}
+#else
+// Entry probe - store fault info
+int trace_handle_mm_fault_entry(struct pt_regs* ctx, struct vm_area_struct* vma,
+                                unsigned long address, unsigned int flags) {
+  HOOK_SAMPLE(sample_weight);
+  fault_start(address, flags, sample_weight);
+  return 0;
+}
+
+// Return probe - check if major fault
+int trace_handle_mm_fault_return(struct pt_regs* ctx) {
+  return fault_finish(ctx, PT_REGS_RC(ctx));
+}
+#endif
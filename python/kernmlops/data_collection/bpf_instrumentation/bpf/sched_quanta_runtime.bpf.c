@@ -14,12 +14,22 @@ typedef struct quanta_runtime_perf_event {
   u32 tgid;
   u64 quanta_end_uptime_us;
   u32 quanta_run_length_us;
+  u32 sample_weight;
 } quanta_runtime_perf_event_t;
 
+// Kinds of latency and their sampling streams, run_start and queue_start see every switch either way
+#define QUANTA_RUNTIME 0
+#define QUANTA_QUEUED  1
+HOOK_CONTROL();
+
 BPF_HASH(run_start, u32);
 BPF_HASH(queue_start, u32);
-BPF_PERF_OUTPUT(quanta_runtimes);
-BPF_PERF_OUTPUT(quanta_queue_times);
+EVENT_OUTPUT(quanta_runtimes, struct quanta_runtime_perf_event);
+EVENT_OUTPUT(quanta_queue_times, struct quanta_runtime_perf_event);
+
+#if AGGREGATE
+LATENCY_HISTOGRAM(quanta_latency_hist);
+#endif
 
 #if USE_TRACEPOINT
 RAW_TRACEPOINT_PROBE(sched_wakeup_new) {
@@ -81,8 +91,16 @@ int trace_run(struct pt_regs* ctx, struct task_struct* prev) {
       // TODO(Patrick): avoid division and multiplication
       data.quanta_end_uptime_us = ts / 1000;
       data.quanta_run_length_us = delta / 1000;
+      HOOK_WEIGHT(queued_weight, QUANTA_QUEUED);
+      data.sample_weight = queued_weight;
       // TODO(Patrick): consider only submitting if greater than 10us or so
-      quanta_queue_times.perf_submit(ctx, &data, sizeof(data));
+      if (queued_weight) {
+#if AGGREGATE
+        LATENCY_RECORD(quanta_latency_hist, next_tgid, 0, QUANTA_QUEUED, data.quanta_run_length_us, queued_weight);
+#else
+        EVENT_EMIT(quanta_queue_times, ctx, &data);
+#endif
+      }
       queue_start.delete(&next_pid);
     }
     run_start.update(&next_pid, &ts);
@@ -108,8 +126,16 @@ int trace_run(struct pt_regs* ctx, struct task_struct* prev) {
   // TODO(Patrick): avoid division and multiplication
   data.quanta_end_uptime_us = ts / 1000;
   data.quanta_run_length_us = delta / 1000;
+  HOOK_WEIGHT(sample_weight, QUANTA_RUNTIME);
+  data.sample_weight = sample_weight;
 
-  quanta_runtimes.perf_submit(ctx, &data, sizeof(data));
+  if (sample_weight) {
+#if AGGREGATE
+    LATENCY_RECORD(quanta_latency_hist, tgid, 0, QUANTA_RUNTIME, data.quanta_run_length_us, sample_weight);
+#else
+    EVENT_EMIT(quanta_runtimes, ctx, &data);
+#endif
+  }
   run_start.delete(&pid);
   queue_start.update(&pid, &ts);
   return 0;
@@ -22,14 +22,18 @@ struct cc_event {
     u64 ts_uptime_us;
     u8 event_type;
     char ca_name[TCP_CA_NAME_MAX];
-    char comm[TASK_COMM_LEN];
+    TASK_COMM_FIELD(comm);
     u32 saddr;
     u32 daddr;
     u16 sport;
     u16 dport;
+    u32 sample_weight;
 };
 
-BPF_PERF_OUTPUT(cc_events);
+EVENT_OUTPUT(cc_events, struct cc_event);
+TASK_COMMS();
+// Each event type is its own sampling stream
+HOOK_CONTROL();
 BPF_HASH(socket_tracking, struct sock*, struct cc_event);
 
 // Helper to extract connection info from socket
@@ -50,7 +54,7 @@ int trace_assign_cc(struct pt_regs *ctx, struct sock *sk) {
     event.tgid = pid_tgid >> 32;
     event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
     event.event_type = EVENT_ASSIGN_CC;
-    bpf_get_current_comm(&event.comm, sizeof(event.comm));
+    TASK_COMM_FILL(ctx, event.comm);
     icsk = (struct inet_connection_sock *)sk;
     bpf_probe_read_kernel(&ca_ops, sizeof(ca_ops), &icsk->icsk_ca_ops);
     if (ca_ops) {
@@ -58,12 +62,16 @@ int trace_assign_cc(struct pt_regs *ctx, struct sock *sk) {
     }
     get_conn_info(sk, &event);
     socket_tracking.update(&sk, &event);
-    cc_events.perf_submit(ctx, &event, sizeof(event));
+    HOOK_SAMPLE(sample_weight, EVENT_ASSIGN_CC);
+    event.sample_weight = sample_weight;
+    EVENT_EMIT(cc_events, ctx, &event);
     return 0;
 }
 
 int trace_init_cc(struct pt_regs *ctx, struct sock *sk) {
+    HOOK_SAMPLE(sample_weight, EVENT_INIT_CC);
     struct cc_event event = {};
+    event.sample_weight = sample_weight;
     struct inet_connection_sock *icsk;
     struct tcp_congestion_ops *ca_ops;
     u64 pid_tgid = bpf_get_current_pid_tgid();
@@ -71,44 +79,48 @@ int trace_init_cc(struct pt_regs *ctx, struct sock *sk) {
     event.tgid = pid_tgid >> 32;
     event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
     event.event_type = EVENT_INIT_CC;
-    bpf_get_current_comm(&event.comm, sizeof(event.comm));
+    TASK_COMM_FILL(ctx, event.comm);
     icsk = (struct inet_connection_sock *)sk;
     bpf_probe_read_kernel(&ca_ops, sizeof(ca_ops), &icsk->icsk_ca_ops);
     if (ca_ops) {
         bpf_probe_read_kernel_str(&event.ca_name, sizeof(event.ca_name), &ca_ops->name);
     }
     get_conn_info(sk, &event);
-    cc_events.perf_submit(ctx, &event, sizeof(event));
+    EVENT_EMIT(cc_events, ctx, &event);
     return 0;
 }
 
 int trace_set_cc(struct pt_regs *ctx, struct sock *sk, const char *name) {
+    HOOK_SAMPLE(sample_weight, EVENT_SET_CC);
     struct cc_event event = {};
+    event.sample_weight = sample_weight;
     u64 pid_tgid = bpf_get_current_pid_tgid();
     event.pid = pid_tgid;
     event.tgid = pid_tgid >> 32;
     event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
     event.event_type = EVENT_SET_CC;
-    bpf_get_current_comm(&event.comm, sizeof(event.comm));
+    TASK_COMM_FILL(ctx, event.comm);
     bpf_probe_read_user_str(&event.ca_name, sizeof(event.ca_name), name);
     get_conn_info(sk, &event);
-    cc_events.perf_submit(ctx, &event, sizeof(event));
+    EVENT_EMIT(cc_events, ctx, &event);
     return 0;
 }
 
 int trace_reinit_cc(struct pt_regs *ctx, struct sock *sk, struct tcp_congestion_ops *ca) {
+    HOOK_SAMPLE(sample_weight, EVENT_REINIT_CC);
     struct cc_event event = {};
+    event.sample_weight = sample_weight;
     u64 pid_tgid = bpf_get_current_pid_tgid();
     event.pid = pid_tgid;
     event.tgid = pid_tgid >> 32;
     event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
     event.event_type = EVENT_REINIT_CC;
-    bpf_get_current_comm(&event.comm, sizeof(event.comm));
+    TASK_COMM_FILL(ctx, event.comm);
     if (ca) {
         bpf_probe_read_kernel_str(&event.ca_name, sizeof(event.ca_name), &ca->name);
     }
     get_conn_info(sk, &event);
-    cc_events.perf_submit(ctx, &event, sizeof(event));
+    EVENT_EMIT(cc_events, ctx, &event);
     return 0;
 }
 
@@ -121,7 +133,7 @@ int trace_cleanup_cc(struct pt_regs *ctx, struct sock *sk) {
     event.tgid = pid_tgid >> 32;
     event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
     event.event_type = EVENT_CLEANUP_CC;
-    bpf_get_current_comm(&event.comm, sizeof(event.comm));
+    TASK_COMM_FILL(ctx, event.comm);
     icsk = (struct inet_connection_sock *)sk;
     bpf_probe_read_kernel(&ca_ops, sizeof(ca_ops), &icsk->icsk_ca_ops);
     if (ca_ops) {
@@ -129,6 +141,8 @@ int trace_cleanup_cc(struct pt_regs *ctx, struct sock *sk) {
     }
     get_conn_info(sk, &event);
     socket_tracking.delete(&sk);
-    cc_events.perf_submit(ctx, &event, sizeof(event));
+    HOOK_SAMPLE(sample_weight, EVENT_CLEANUP_CC);
+    event.sample_weight = sample_weight;
+    EVENT_EMIT(cc_events, ctx, &event);
     return 0;
 }
@@ -44,7 +44,7 @@ struct cubic_event {
   u32 tgid;
   u64 ts_uptime_us;
   u8 event_type;
-  char comm[16];
+  TASK_COMM_FIELD(comm);
 
   // Connection info
   u32 saddr;
@@ -81,10 +81,34 @@ struct cubic_event {
   u32 acked;
   u8 in_slow_start;
   u8 is_tcp_friendly;
+  u32 sample_weight;
 };
 
-BPF_PERF_OUTPUT(cubic_events);
+EVENT_OUTPUT(cubic_events, struct cubic_event);
+TASK_COMMS();
+// Each callback is its own sampling stream, keyed by its event type
+HOOK_CONTROL();
 BPF_HASH(socket_tracking, struct sock*, struct cubic_event);
+TCP_FLOWS();
+
+// Publish one callback, as a raw event or folded into its flow's summaries
+static inline void cubic_emit(struct pt_regs* ctx, struct cubic_event* event) {
+#if AGGREGATE
+  struct tcp_flow_key key = {};
+  key.laddr = event->saddr;
+  key.raddr = event->daddr;
+  key.lport = event->sport;
+  key.rport = event->dport;
+  struct tcp_flow* flow = tcp_flow_get(&key);
+  if (!flow)
+    return;
+  tcp_flow_count(flow, event->event_type, 0, event->sample_weight);
+  // rtt_us is tcp_sock.srtt_us, the smoothed RTT shifted left by 3
+  tcp_flow_summarize(flow, event->cwnd, event->rtt_us >> 3);
+#else
+  EVENT_EMIT(cubic_events, ctx, event);
+#endif
+}
 
 // Helper to extract connection info
 static inline void get_conn_info(struct sock* sk, struct cubic_event* event) {
@@ -133,7 +157,10 @@ static inline void get_cubic_state(struct sock* sk, struct cubic_event* event) {
 
 // Trace cubictcp_cong_avoid
 int trace_cong_avoid(struct pt_regs* ctx, struct sock* sk, u32 ack, u32 acked) {
+  // sampled out callbacks return before their state reads
+  HOOK_SAMPLE(sample_weight, EVENT_CONG_AVOID);
   struct cubic_event event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
 
   event.pid = pid_tgid;
@@ -142,7 +169,7 @@ int trace_cong_avoid(struct pt_regs* ctx, struct sock* sk, u32 ack, u32 acked) {
   event.event_type = EVENT_CONG_AVOID;
   event.acked = acked;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
   get_conn_info(sk, &event);
   get_tcp_state(sk, &event);
   get_cubic_state(sk, &event);
@@ -153,14 +180,16 @@ int trace_cong_avoid(struct pt_regs* ctx, struct sock* sk, u32 ack, u32 acked) {
 
   // Update tracking
   socket_tracking.update(&sk, &event);
-  cubic_events.perf_submit(ctx, &event, sizeof(event));
+  cubic_emit(ctx, &event);
 
   return 0;
 }
 
 // Trace cubictcp_init
 int trace_init(struct pt_regs* ctx, struct sock* sk) {
+  HOOK_SAMPLE(sample_weight, EVENT_INIT);
   struct cubic_event event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
 
   event.pid = pid_tgid;
@@ -168,20 +197,22 @@ int trace_init(struct pt_regs* ctx, struct sock* sk) {
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.event_type = EVENT_INIT;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
   get_conn_info(sk, &event);
   get_tcp_state(sk, &event);
   get_cubic_state(sk, &event);
 
   socket_tracking.update(&sk, &event);
-  cubic_events.perf_submit(ctx, &event, sizeof(event));
+  cubic_emit(ctx, &event);
 
   return 0;
 }
 
 // Trace cubictcp_recalc_ssthresh (loss detection)
 int trace_recalc_ssthresh(struct pt_regs* ctx, struct sock* sk) {
+  HOOK_SAMPLE(sample_weight, EVENT_SSTHRESH);
   struct cubic_event event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
 
   event.pid = pid_tgid;
@@ -189,19 +220,21 @@ int trace_recalc_ssthresh(struct pt_regs* ctx, struct sock* sk) {
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.event_type = EVENT_SSTHRESH;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
   get_conn_info(sk, &event);
   get_tcp_state(sk, &event);
   get_cubic_state(sk, &event);
 
-  cubic_events.perf_submit(ctx, &event, sizeof(event));
+  cubic_emit(ctx, &event);
 
   return 0;
 }
 
 // Trace cubictcp_state
 int trace_state(struct pt_regs* ctx, struct sock* sk, u8 new_state) {
+  HOOK_SAMPLE(sample_weight, EVENT_STATE_CHANGE);
   struct cubic_event event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
 
   event.pid = pid_tgid;
@@ -209,19 +242,21 @@ int trace_state(struct pt_regs* ctx, struct sock* sk, u8 new_state) {
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.event_type = EVENT_STATE_CHANGE;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
   get_conn_info(sk, &event);
   get_tcp_state(sk, &event);
   get_cubic_state(sk, &event);
 
-  cubic_events.perf_submit(ctx, &event, sizeof(event));
+  cubic_emit(ctx, &event);
 
   return 0;
 }
 
 // Trace cubictcp_cwnd_event
 int trace_cwnd_event(struct pt_regs* ctx, struct sock* sk, int event) {
+  HOOK_SAMPLE(sample_weight, EVENT_CWND_EVENT);
   struct cubic_event ev = {};
+  ev.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
 
   ev.pid = pid_tgid;
@@ -229,19 +264,21 @@ int trace_cwnd_event(struct pt_regs* ctx, struct sock* sk, int event) {
   ev.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   ev.event_type = EVENT_CWND_EVENT;
 
-  bpf_get_current_comm(&ev.comm, sizeof(ev.comm));
+  TASK_COMM_FILL(ctx, ev.comm);
   get_conn_info(sk, &ev);
   get_tcp_state(sk, &ev);
   get_cubic_state(sk, &ev);
 
-  cubic_events.perf_submit(ctx, &ev, sizeof(ev));
+  cubic_emit(ctx, &ev);
 
   return 0;
 }
 
 // Trace hystart_update for HyStart detection
 int trace_hystart_update(struct pt_regs* ctx, struct sock* sk, u32 delay) {
+  HOOK_SAMPLE(sample_weight, EVENT_HYSTART);
   struct cubic_event event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
 
   event.pid = pid_tgid;
@@ -250,12 +287,12 @@ int trace_hystart_update(struct pt_regs* ctx, struct sock* sk, u32 delay) {
   event.event_type = EVENT_HYSTART;
   event.curr_rtt = delay;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
   get_conn_info(sk, &event);
   get_tcp_state(sk, &event);
   get_cubic_state(sk, &event);
 
-  cubic_events.perf_submit(ctx, &event, sizeof(event));
+  cubic_emit(ctx, &event);
 
   return 0;
 }
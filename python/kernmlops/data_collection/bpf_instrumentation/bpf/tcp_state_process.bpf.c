@@ -19,7 +19,8 @@ typedef struct tcp_state_event {
   u8 new_state;
   u8 event_type;
   u8 event_subtype; // For specific events like challenge ACK, reset, etc.
-  char comm[TASK_COMM_LEN];
+  TASK_COMM_FIELD(comm);
+  u32 sample_weight;
 } tcp_state_event_t;
 
 // Structure for statistics (stored in hash map)
@@ -41,8 +42,11 @@ struct tcp_state_stats {
 
 // Maps
 BPF_HASH(stats_map, u32, struct tcp_state_stats);
-BPF_PERF_OUTPUT(tcp_state_events);
+EVENT_OUTPUT(tcp_state_events, tcp_state_event_t);
+TASK_COMMS();
 BPF_HASH(state_distribution, u8, u64);
+// stats_map and state_distribution count every segment, sampling only thins the events
+HOOK_CONTROL();
 
 // Event subtypes
 #define SUBTYPE_NONE          0
@@ -53,6 +57,37 @@ BPF_HASH(state_distribution, u8, u64);
 #define SUBTYPE_DATA_QUEUE    5
 #define SUBTYPE_ABORT_DATA    6
 
+// Per-flow counter of each probe in aggregate mode
+#define STATE_BRANCH_ENTRY                   0
+#define STATE_BRANCH_LISTEN_STATE            1
+#define STATE_BRANCH_SYN_SENT_STATE          2
+#define STATE_BRANCH_SYN_RECV_TO_ESTABLISHED 3
+#define STATE_BRANCH_FIN_WAIT1_TO_FIN_WAIT2  4
+#define STATE_BRANCH_TO_TIME_WAIT            5
+#define STATE_BRANCH_LAST_ACK                6
+#define STATE_BRANCH_CHALLENGE_ACK           7
+#define STATE_BRANCH_RESET                   8
+#define STATE_BRANCH_FAST_OPEN               9
+#define STATE_BRANCH_ACK_PROCESSING          10
+#define STATE_BRANCH_DATA_QUEUE              11
+#define STATE_BRANCH_ABORT_ON_DATA           12
+
+TCP_FLOWS();
+
+// Publish one probe hit, as a raw event or as a count of the segment's flow
+static inline void state_emit(struct pt_regs* ctx, u32 branch, tcp_state_event_t* event) {
+#if AGGREGATE
+  struct tcp_flow_key* key = tcp_flow_current_key();
+  if (!key)
+    return;
+  struct tcp_flow* flow = tcp_flow_get(key);
+  if (flow)
+    tcp_flow_count(flow, branch, 0, event->sample_weight);
+#else
+  EVENT_EMIT(tcp_state_events, ctx, event);
+#endif
+}
+
 // Helper to get socket state
 static u8 get_sk_state(struct sock* sk) {
   u8 state = 0;
@@ -80,6 +115,28 @@ int trace_tcp_rcv_state_process(struct pt_regs* ctx, struct sock* sk) {
     state_distribution.update(&state, &init_count);
   }
 
+  // The decision is made once per segment here, the offset probes below reuse it
+  HOOK_SAMPLE_ENTRY(sample_weight);
+#if AGGREGATE
+  // The offset probes below count against the socket this CPU is processing, backlog
+  // processing runs in process context where a migration between probes may misattribute
+  struct tcp_flow_key* flow_key = tcp_flow_current_key();
+  if (!flow_key)
+    return 0;
+  tcp_flow_sock_key(sk, flow_key);
+  struct tcp_flow* flow = tcp_flow_get(flow_key);
+  if (!flow)
+    return 0;
+  tcp_flow_count(flow, STATE_BRANCH_ENTRY, 0, sample_weight);
+
+  struct tcp_sock* tp = (struct tcp_sock*)sk;
+  u32 cwnd = 0;
+  u32 srtt_us = 0;
+  bpf_probe_read_kernel(&cwnd, sizeof(cwnd), &tp->snd_cwnd);
+  bpf_probe_read_kernel(&srtt_us, sizeof(srtt_us), &tp->srtt_us);
+  // srtt_us holds the smoothed RTT shifted left by 3
+  tcp_flow_summarize(flow, cwnd, srtt_us >> 3);
+#endif
   return 0;
 }
 
@@ -91,7 +148,9 @@ int trace_listen_state(struct pt_regs* ctx) {
     __sync_fetch_and_add(&stats->listen_state, 1);
   }
 
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_state_event_t event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
   event.tgid = pid_tgid >> 32;
@@ -99,9 +158,9 @@ int trace_listen_state(struct pt_regs* ctx) {
   event.old_state = TCP_LISTEN;
   event.new_state = TCP_LISTEN;
   event.event_type = STATE_PROCESSING;
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
 
-  tcp_state_events.perf_submit(ctx, &event, sizeof(event));
+  state_emit(ctx, STATE_BRANCH_LISTEN_STATE, &event);
   return 0;
 }
 
@@ -113,7 +172,9 @@ int trace_syn_sent_state(struct pt_regs* ctx) {
     __sync_fetch_and_add(&stats->syn_sent_state, 1);
   }
 
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_state_event_t event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
   event.tgid = pid_tgid >> 32;
@@ -121,9 +182,9 @@ int trace_syn_sent_state(struct pt_regs* ctx) {
   event.old_state = TCP_SYN_SENT;
   event.new_state = TCP_SYN_SENT;
   event.event_type = STATE_PROCESSING;
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
 
-  tcp_state_events.perf_submit(ctx, &event, sizeof(event));
+  state_emit(ctx, STATE_BRANCH_SYN_SENT_STATE, &event);
   return 0;
 }
 
@@ -135,7 +196,9 @@ int trace_syn_recv_to_established(struct pt_regs* ctx) {
     __sync_fetch_and_add(&stats->syn_recv_to_established, 1);
   }
 
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_state_event_t event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
   event.tgid = pid_tgid >> 32;
@@ -143,9 +206,9 @@ int trace_syn_recv_to_established(struct pt_regs* ctx) {
   event.old_state = TCP_SYN_RECV;
   event.new_state = TCP_ESTABLISHED;
   event.event_type = STATE_TRANSITION;
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
 
-  tcp_state_events.perf_submit(ctx, &event, sizeof(event));
+  state_emit(ctx, STATE_BRANCH_SYN_RECV_TO_ESTABLISHED, &event);
   return 0;
 }
 
@@ -157,7 +220,9 @@ int trace_fin_wait1_to_fin_wait2(struct pt_regs* ctx) {
     __sync_fetch_and_add(&stats->fin_wait1_to_fin_wait2, 1);
   }
 
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_state_event_t event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
   event.tgid = pid_tgid >> 32;
@@ -165,9 +230,9 @@ int trace_fin_wait1_to_fin_wait2(struct pt_regs* ctx) {
   event.old_state = TCP_FIN_WAIT1;
   event.new_state = TCP_FIN_WAIT2;
   event.event_type = STATE_TRANSITION;
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
 
-  tcp_state_events.perf_submit(ctx, &event, sizeof(event));
+  state_emit(ctx, STATE_BRANCH_FIN_WAIT1_TO_FIN_WAIT2, &event);
   return 0;
 }
 
@@ -179,16 +244,18 @@ int trace_to_time_wait(struct pt_regs* ctx) {
     __sync_fetch_and_add(&stats->to_time_wait, 1);
   }
 
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_state_event_t event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
   event.tgid = pid_tgid >> 32;
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.new_state = TCP_TIME_WAIT;
   event.event_type = STATE_TRANSITION;
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
 
-  tcp_state_events.perf_submit(ctx, &event, sizeof(event));
+  state_emit(ctx, STATE_BRANCH_TO_TIME_WAIT, &event);
   return 0;
 }
 
@@ -200,7 +267,9 @@ int trace_last_ack(struct pt_regs* ctx) {
     __sync_fetch_and_add(&stats->to_last_ack, 1);
   }
 
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_state_event_t event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
   event.tgid = pid_tgid >> 32;
@@ -208,9 +277,9 @@ int trace_last_ack(struct pt_regs* ctx) {
   event.old_state = TCP_LAST_ACK;
   event.new_state = TCP_LAST_ACK;
   event.event_type = STATE_PROCESSING;
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
 
-  tcp_state_events.perf_submit(ctx, &event, sizeof(event));
+  state_emit(ctx, STATE_BRANCH_LAST_ACK, &event);
   return 0;
 }
 
@@ -222,16 +291,18 @@ int trace_challenge_ack(struct pt_regs* ctx) {
     __sync_fetch_and_add(&stats->challenge_acks, 1);
   }
 
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_state_event_t event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
   event.tgid = pid_tgid >> 32;
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.event_type = STATE_ERROR;
   event.event_subtype = SUBTYPE_CHALLENGE_ACK;
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
 
-  tcp_state_events.perf_submit(ctx, &event, sizeof(event));
+  state_emit(ctx, STATE_BRANCH_CHALLENGE_ACK, &event);
   return 0;
 }
 
@@ -243,16 +314,18 @@ int trace_reset(struct pt_regs* ctx) {
     __sync_fetch_and_add(&stats->resets, 1);
   }
 
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_state_event_t event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
   event.tgid = pid_tgid >> 32;
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.event_type = STATE_ERROR;
   event.event_subtype = SUBTYPE_RESET;
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
 
-  tcp_state_events.perf_submit(ctx, &event, sizeof(event));
+  state_emit(ctx, STATE_BRANCH_RESET, &event);
   return 0;
 }
 
@@ -264,16 +337,18 @@ int trace_fast_open(struct pt_regs* ctx) {
     __sync_fetch_and_add(&stats->fast_open_checks, 1);
   }
 
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_state_event_t event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
   event.tgid = pid_tgid >> 32;
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.event_type = STATE_PROCESSING;
   event.event_subtype = SUBTYPE_FAST_OPEN;
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
 
-  tcp_state_events.perf_submit(ctx, &event, sizeof(event));
+  state_emit(ctx, STATE_BRANCH_FAST_OPEN, &event);
   return 0;
 }
 
@@ -285,16 +360,18 @@ int trace_ack_processing(struct pt_regs* ctx) {
     __sync_fetch_and_add(&stats->ack_processing, 1);
   }
 
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_state_event_t event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
   event.tgid = pid_tgid >> 32;
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.event_type = STATE_PROCESSING;
   event.event_subtype = SUBTYPE_ACK_PROCESS;
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
 
-  tcp_state_events.perf_submit(ctx, &event, sizeof(event));
+  state_emit(ctx, STATE_BRANCH_ACK_PROCESSING, &event);
   return 0;
 }
 
@@ -306,16 +383,18 @@ int trace_data_queue(struct pt_regs* ctx) {
     __sync_fetch_and_add(&stats->data_queued, 1);
   }
 
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_state_event_t event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
   event.tgid = pid_tgid >> 32;
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.event_type = STATE_PROCESSING;
   event.event_subtype = SUBTYPE_DATA_QUEUE;
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
 
-  tcp_state_events.perf_submit(ctx, &event, sizeof(event));
+  state_emit(ctx, STATE_BRANCH_DATA_QUEUE, &event);
   return 0;
 }
 
@@ -327,15 +406,17 @@ int trace_abort_on_data(struct pt_regs* ctx) {
     __sync_fetch_and_add(&stats->abort_on_data, 1);
   }
 
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_state_event_t event = {};
+  event.sample_weight = sample_weight;
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
   event.tgid = pid_tgid >> 32;
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.event_type = STATE_ERROR;
   event.event_subtype = SUBTYPE_ABORT_DATA;
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
 
-  tcp_state_events.perf_submit(ctx, &event, sizeof(event));
+  state_emit(ctx, STATE_BRANCH_ABORT_ON_DATA, &event);
   return 0;
 }
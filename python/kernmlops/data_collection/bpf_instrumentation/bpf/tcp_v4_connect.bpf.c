@@ -65,17 +65,96 @@ typedef struct connect_event {
   u32 daddr;
   u16 sport;
   u16 dport;
-  char comm[TASK_COMM_LEN];
+  TASK_COMM_FIELD(comm);
+  // decided at entry and carried by the tracked event to every branch of the connect
+  u32 sample_weight;
 } connect_event_t;
 
-BPF_PERF_OUTPUT(connect_events);
+EVENT_OUTPUT(connect_events, connect_event_t);
+TASK_COMMS();
+HOOK_CONTROL();
+#if USE_TASK_STORAGE
+// The connect in flight on this task, start_ts of 0 once it returned
+typedef struct connect_state {
+  u64 start_ts;
+  connect_event_t event;
+} connect_state_t;
+
+BPF_TASK_STORAGE(connect_states, connect_state_t);
+#else
 BPF_HASH(connect_start_times, u32, u64);
 BPF_HASH(connect_tracking, u32, connect_event_t);
+#endif
+
+// Statistics tracking, per-CPU so concurrent connects never share a counter
+BPF_PERCPU_ARRAY(branch_stats, u64, 32);
+BPF_PERCPU_ARRAY(path_stats, u64, 4);
+BPF_PERCPU_ARRAY(error_stats, u64, 8);
+
+#if AGGREGATE
+#define CONNECT_LATENCY 0
+LATENCY_HISTOGRAM(connect_latency_hist);
+#endif
+
+// Publish one branch observation, as a raw event or as a histogram count per branch,
+// sampled out connects are still tracked since the statistics count every branch
+static inline void connect_emit(struct pt_regs* ctx, connect_event_t* event) {
+  if (!event->sample_weight)
+    return;
+#if AGGREGATE
+  u32 tgid = bpf_get_current_pid_tgid() >> 32;
+  LATENCY_RECORD(connect_latency_hist, tgid, event->branch_type, CONNECT_LATENCY, event->latency_ns / 1000, event->sample_weight);
+#else
+  EVENT_EMIT(connect_events, ctx, event);
+#endif
+}
+
+static inline void connect_track(u32 tid, u64 ts, connect_event_t* event) {
+#if USE_TASK_STORAGE
+  connect_state_t* state = connect_states.task_storage_get(bpf_get_current_task_btf(), 0,
+                                                           BPF_LOCAL_STORAGE_GET_F_CREATE);
+  if (state) {
+    state->start_ts = ts;
+    __builtin_memcpy(&state->event, event, sizeof(state->event));
+  }
+#else
+  connect_start_times.update(&tid, &ts);
+  connect_tracking.update(&tid, event);
+#endif
+}
+
+static inline connect_event_t* connect_tracked(u32 tid) {
+#if USE_TASK_STORAGE
+  connect_state_t* state = connect_states.task_storage_get(bpf_get_current_task_btf(), 0, 0);
+  if (!state || state->start_ts == 0)
+    return 0;
+  return &state->event;
+#else
+  return connect_tracking.lookup(&tid);
+#endif
+}
 
-// Statistics tracking
-BPF_ARRAY(branch_stats, u64, 32);
-BPF_ARRAY(path_stats, u64, 4);
-BPF_ARRAY(error_stats, u64, 8);
+static inline u64* connect_started(u32 tid) {
+#if USE_TASK_STORAGE
+  connect_state_t* state = connect_states.task_storage_get(bpf_get_current_task_btf(), 0, 0);
+  if (!state || state->start_ts == 0)
+    return 0;
+  return &state->start_ts;
+#else
+  return connect_start_times.lookup(&tid);
+#endif
+}
+
+static inline void connect_untrack(u32 tid) {
+#if USE_TASK_STORAGE
+  connect_state_t* state = connect_states.task_storage_get(bpf_get_current_task_btf(), 0, 0);
+  if (state)
+    state->start_ts = 0;
+#else
+  connect_start_times.delete(&tid);
+  connect_tracking.delete(&tid);
+#endif
+}
 
 // Main entry point
 int trace_tcp_v4_connect(struct pt_regs* ctx, struct sock* sk, struct sockaddr* uaddr) {
@@ -83,15 +162,14 @@ int trace_tcp_v4_connect(struct pt_regs* ctx, struct sock* sk, struct sockaddr*
   u32 tid = bpf_get_current_pid_tgid();
   u64 ts = bpf_ktime_get_ns();
 
-  // Store start time for latency calculation
-  connect_start_times.update(&tid, &ts);
-
   event.pid = tid;
   event.tgid = tid >> 32;
   event.ts_uptime_us = ts / 1000;
   event.branch_type = CONNECT_ENTRY;
   event.latency_ns = 0;
   event.error_code = ERR_NONE;
+  HOOK_WEIGHT(sample_weight);
+  event.sample_weight = sample_weight;
 
   // Try to get destination address
   struct sockaddr_in* sin = (struct sockaddr_in*)uaddr;
@@ -103,13 +181,13 @@ int trace_tcp_v4_connect(struct pt_regs* ctx, struct sock* sk, struct sockaddr*
   bpf_probe_read(&event.saddr, sizeof(event.saddr), &inet->inet_saddr);
   bpf_probe_read(&event.sport, sizeof(event.sport), &inet->inet_sport);
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
 
-  // Store for tracking
-  connect_tracking.update(&tid, &event);
+  // Store start time and event for the branch probes
+  connect_track(tid, ts, &event);
 
   // Submit entry event
-  connect_events.perf_submit(ctx, &event, sizeof(event));
+  connect_emit(ctx, &event);
 
   // Update statistics
   u64* count = branch_stats.lookup(&event.branch_type);
@@ -122,11 +200,11 @@ int trace_tcp_v4_connect(struct pt_regs* ctx, struct sock* sk, struct sockaddr*
 // Invalid address length check (offset 0x4f0)
 int trace_invalid_addrlen(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -136,7 +214,7 @@ int trace_invalid_addrlen(struct pt_regs* ctx) {
     event->error_code = ERR_EINVAL;
     event->path_type = PATH_ERROR;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -158,11 +236,11 @@ int trace_invalid_addrlen(struct pt_regs* ctx) {
 // Wrong address family (offset 0x4e6)
 int trace_wrong_family(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -172,7 +250,7 @@ int trace_wrong_family(struct pt_regs* ctx) {
     event->error_code = ERR_EAFNOSUPPORT;
     event->path_type = PATH_ERROR;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -194,11 +272,11 @@ int trace_wrong_family(struct pt_regs* ctx) {
 // Route lookup (offset 0x17c)
 int trace_route_lookup(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -206,7 +284,7 @@ int trace_route_lookup(struct pt_regs* ctx) {
     event->ts_uptime_us = ts / 1000;
     event->branch_type = CONNECT_ROUTE_LOOKUP;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -218,11 +296,11 @@ int trace_route_lookup(struct pt_regs* ctx) {
 // Route lookup error (offset 0x46c)
 int trace_route_error(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -233,7 +311,7 @@ int trace_route_error(struct pt_regs* ctx) {
     event->error_code = -1;
     event->path_type = PATH_ERROR;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -255,11 +333,11 @@ int trace_route_error(struct pt_regs* ctx) {
 // Multicast/broadcast check (offset 0x4fa)
 int trace_multicast_bcast(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -269,7 +347,7 @@ int trace_multicast_bcast(struct pt_regs* ctx) {
     event->error_code = ERR_ENETUNREACH;
     event->path_type = PATH_ERROR;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -291,11 +369,11 @@ int trace_multicast_bcast(struct pt_regs* ctx) {
 // No source address branch (offset 0x3fe)
 int trace_no_src_addr(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -303,7 +381,7 @@ int trace_no_src_addr(struct pt_regs* ctx) {
     event->ts_uptime_us = ts / 1000;
     event->branch_type = CONNECT_NO_SRC_ADDR;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -315,11 +393,11 @@ int trace_no_src_addr(struct pt_regs* ctx) {
 // Source binding failure (offset 0x417)
 int trace_src_bind_fail(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -329,7 +407,7 @@ int trace_src_bind_fail(struct pt_regs* ctx) {
     event->error_code = -1;
     event->path_type = PATH_ERROR;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -351,11 +429,11 @@ int trace_src_bind_fail(struct pt_regs* ctx) {
 // Port allocation via inet_hash_connect (offset 0x27e)
 int trace_port_alloc(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -363,7 +441,7 @@ int trace_port_alloc(struct pt_regs* ctx) {
     event->ts_uptime_us = ts / 1000;
     event->branch_type = CONNECT_PORT_ALLOC;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -375,11 +453,11 @@ int trace_port_alloc(struct pt_regs* ctx) {
 // inet_hash_connect error (offset 0x283)
 int trace_hash_error(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -388,7 +466,7 @@ int trace_hash_error(struct pt_regs* ctx) {
     event->branch_type = CONNECT_HASH_ERROR;
     event->path_type = PATH_ERROR;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -400,11 +478,11 @@ int trace_hash_error(struct pt_regs* ctx) {
 // Fast open defer (offset 0x3b1)
 int trace_fastopen_defer(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -413,7 +491,7 @@ int trace_fastopen_defer(struct pt_regs* ctx) {
     event->branch_type = CONNECT_FASTOPEN_DEFER;
     event->path_type = PATH_FASTOPEN;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -435,11 +513,11 @@ int trace_fastopen_defer(struct pt_regs* ctx) {
 // Regular SYN sending via tcp_connect (offset 0x42d)
 int trace_regular_syn(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -448,7 +526,7 @@ int trace_regular_syn(struct pt_regs* ctx) {
     event->branch_type = CONNECT_REGULAR_SYN;
     event->path_type = PATH_SLOW;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -470,11 +548,11 @@ int trace_regular_syn(struct pt_regs* ctx) {
 // tcp_connect error (offset 0x43a)
 int trace_tcp_connect_err(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -484,7 +562,7 @@ int trace_tcp_connect_err(struct pt_regs* ctx) {
     event->error_code = -1;
     event->path_type = PATH_ERROR;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -496,11 +574,11 @@ int trace_tcp_connect_err(struct pt_regs* ctx) {
 // ENETUNREACH specific handling (offset 0x48d)
 int trace_enetunreach(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -510,7 +588,7 @@ int trace_enetunreach(struct pt_regs* ctx) {
     event->error_code = ERR_ENETUNREACH;
     event->path_type = PATH_ERROR;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -522,11 +600,11 @@ int trace_enetunreach(struct pt_regs* ctx) {
 // New source port selection (offset 0x337)
 int trace_new_sport(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -534,7 +612,7 @@ int trace_new_sport(struct pt_regs* ctx) {
     event->ts_uptime_us = ts / 1000;
     event->branch_type = CONNECT_NEW_SPORT;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -546,11 +624,11 @@ int trace_new_sport(struct pt_regs* ctx) {
 // Write sequence initialization (offset 0x372)
 int trace_write_seq_init(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -558,7 +636,7 @@ int trace_write_seq_init(struct pt_regs* ctx) {
     event->ts_uptime_us = ts / 1000;
     event->branch_type = CONNECT_WRITE_SEQ_INIT;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -570,11 +648,11 @@ int trace_write_seq_init(struct pt_regs* ctx) {
 // Error path - failure label (offset 0x289)
 int trace_error_path(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
     }
@@ -583,7 +661,7 @@ int trace_error_path(struct pt_regs* ctx) {
     event->branch_type = CONNECT_ERROR_PATH;
     event->path_type = PATH_ERROR;
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
@@ -605,14 +683,13 @@ int trace_error_path(struct pt_regs* ctx) {
 // Return probe - capture final result and cleanup
 int trace_tcp_v4_connect_return(struct pt_regs* ctx) {
   u32 tid = bpf_get_current_pid_tgid();
-  connect_event_t* event = connect_tracking.lookup(&tid);
+  connect_event_t* event = connect_tracked(tid);
 
   if (event) {
     u64 ts = bpf_ktime_get_ns();
-    u64* start = connect_start_times.lookup(&tid);
+    u64* start = connect_started(tid);
     if (start) {
       event->latency_ns = ts - *start;
-      connect_start_times.delete(&tid);
     }
 
     event->ts_uptime_us = ts / 1000;
@@ -635,13 +712,13 @@ int trace_tcp_v4_connect_return(struct pt_regs* ctx) {
         (*path_count)++;
     }
 
-    connect_events.perf_submit(ctx, event, sizeof(*event));
+    connect_emit(ctx, event);
 
     u64* count = branch_stats.lookup(&event->branch_type);
     if (count)
       (*count)++;
 
-    connect_tracking.delete(&tid);
+    connect_untrack(tid);
   }
 
   return 0;
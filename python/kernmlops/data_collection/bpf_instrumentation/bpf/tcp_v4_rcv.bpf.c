@@ -4,6 +4,7 @@
 #include <linux/socket.h>
 #include <linux/tcp.h>
 #include <net/sock.h>
+#include <net/tcp_states.h>
 #include <uapi/linux/ptrace.h>
 
 // Branch types for TCP receive processing
@@ -47,14 +48,63 @@ typedef struct tcp_branch_event {
   u32 daddr;
   u16 sport;
   u16 dport;
-  char comm[TASK_COMM_LEN];
+  TASK_COMM_FIELD(comm);
+  u32 sample_weight;
 } tcp_branch_event_t;
 
-BPF_PERF_OUTPUT(tcp_branch_events);
+EVENT_OUTPUT(tcp_branch_events, tcp_branch_event_t);
+TASK_COMMS();
+// Sampled out packets return before paying for the comm and header reads
+HOOK_CONTROL();
+TCP_FLOWS();
+
+#if AGGREGATE
+// Remember the flow of the packet this CPU receives, header reads are paid even when sampled out
+static inline void rcv_flow_enter(struct sk_buff* skb) {
+  struct tcp_flow_key* key = tcp_flow_current_key();
+  if (!key)
+    return;
+  unsigned char* head = NULL;
+  u16 network_header = 0;
+  u16 transport_header = 0;
+  bpf_probe_read_kernel(&head, sizeof(head), &skb->head);
+  bpf_probe_read_kernel(&network_header, sizeof(network_header), &skb->network_header);
+  bpf_probe_read_kernel(&transport_header, sizeof(transport_header), &skb->transport_header);
+
+  // Received packets come from the remote end, so the source is the flow's remote
+  struct iphdr* ip = (struct iphdr*)(head + network_header);
+  struct tcphdr* tcp = (struct tcphdr*)(head + transport_header);
+  bpf_probe_read_kernel(&key->laddr, sizeof(key->laddr), &ip->daddr);
+  bpf_probe_read_kernel(&key->raddr, sizeof(key->raddr), &ip->saddr);
+  bpf_probe_read_kernel(&key->lport, sizeof(key->lport), &tcp->dest);
+  bpf_probe_read_kernel(&key->rport, sizeof(key->rport), &tcp->source);
+}
+#endif
+
+// Publish one branch observation, as a raw event or as a count of the packet's flow
+static inline void rcv_emit(struct pt_regs* ctx, tcp_branch_event_t* event) {
+#if AGGREGATE
+  struct tcp_flow_key* key = tcp_flow_current_key();
+  if (!key)
+    return;
+  struct tcp_flow* flow = tcp_flow_get(key);
+  if (flow)
+    tcp_flow_count(flow, event->branch_type, event->drop_reason, event->sample_weight);
+#else
+  EVENT_EMIT(tcp_branch_events, ctx, event);
+#endif
+}
 
 // Main entry - track all packets
+// The sampling decision is made once per packet here, the branch probes below
+// fire later in the same tcp_v4_rcv call on this CPU and reuse it
 int trace_tcp_v4_rcv(struct pt_regs* ctx, struct sk_buff* skb) {
+#if AGGREGATE
+  rcv_flow_enter(skb);
+#endif
+  HOOK_SAMPLE_ENTRY(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -63,7 +113,7 @@ int trace_tcp_v4_rcv(struct pt_regs* ctx, struct sk_buff* skb) {
   event.branch_type = TCP_BRANCH_ENTRY;
   event.drop_reason = 0;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  TASK_COMM_FILL(ctx, event.comm);
 
   // Try to extract packet info from skb
   struct iphdr* ip = NULL;
@@ -79,13 +129,15 @@ int trace_tcp_v4_rcv(struct pt_regs* ctx, struct sk_buff* skb) {
   bpf_probe_read(&event.sport, sizeof(event.sport), &tcp->source);
   bpf_probe_read(&event.dport, sizeof(event.dport), &tcp->dest);
 
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // Track "not for host" branch
 int trace_not_for_host(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -94,14 +146,16 @@ int trace_not_for_host(struct pt_regs* ctx) {
   event.branch_type = TCP_BRANCH_NOT_FOR_HOST;
   event.drop_reason = SKB_DROP_REASON_NOT_SPECIFIED;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // Track "no socket found" branch
 int trace_no_socket(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -110,14 +164,16 @@ int trace_no_socket(struct pt_regs* ctx) {
   event.branch_type = TCP_BRANCH_NO_SOCKET;
   event.drop_reason = SKB_DROP_REASON_NO_SOCKET;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // Track TIME_WAIT state
 int trace_time_wait(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -126,14 +182,16 @@ int trace_time_wait(struct pt_regs* ctx) {
   event.branch_type = TCP_BRANCH_TIME_WAIT;
   event.drop_reason = 0;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // Track checksum error
 int trace_checksum_error(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -142,14 +200,16 @@ int trace_checksum_error(struct pt_regs* ctx) {
   event.branch_type = TCP_BRANCH_CHECKSUM_ERR;
   event.drop_reason = SKB_DROP_REASON_TCP_CSUM;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // Track LISTEN state processing
 int trace_listen_state(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -157,14 +217,16 @@ int trace_listen_state(struct pt_regs* ctx) {
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.branch_type = TCP_BRANCH_LISTEN;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // Track socket busy/backlog
 int trace_socket_busy(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -172,14 +234,16 @@ int trace_socket_busy(struct pt_regs* ctx) {
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.branch_type = TCP_BRANCH_SOCKET_BUSY;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // Track XFRM policy drop
 int trace_xfrm_policy_drop(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -188,14 +252,16 @@ int trace_xfrm_policy_drop(struct pt_regs* ctx) {
   event.branch_type = TCP_BRANCH_XFRM_DROP;
   event.drop_reason = SKB_DROP_REASON_XFRM_POLICY;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // Track NEW_SYN_RECV state
 int trace_new_syn_recv(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -203,14 +269,16 @@ int trace_new_syn_recv(struct pt_regs* ctx) {
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.branch_type = TCP_BRANCH_NEW_SYN_RECV;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // NEW: Track packet too small
 int trace_pkt_too_small(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -219,14 +287,16 @@ int trace_pkt_too_small(struct pt_regs* ctx) {
   event.branch_type = TCP_BRANCH_PKT_TOO_SMALL;
   event.drop_reason = SKB_DROP_REASON_PKT_TOO_SMALL;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // NEW: Track min TTL drop
 int trace_min_ttl_drop(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -235,14 +305,16 @@ int trace_min_ttl_drop(struct pt_regs* ctx) {
   event.branch_type = TCP_BRANCH_MIN_TTL_DROP;
   event.drop_reason = SKB_DROP_REASON_TCP_MINTTL;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // NEW: Track socket filter drop
 int trace_socket_filter_drop(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -251,14 +323,16 @@ int trace_socket_filter_drop(struct pt_regs* ctx) {
   event.branch_type = TCP_BRANCH_SOCKET_FILTER;
   event.drop_reason = SKB_DROP_REASON_SOCKET_FILTER;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // NEW: Track tcp_v4_do_rcv call (direct processing)
 int trace_do_rcv_call(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -266,14 +340,16 @@ int trace_do_rcv_call(struct pt_regs* ctx) {
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.branch_type = TCP_BRANCH_DO_RCV_CALL;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // NEW: Track MD5 hash failure
 int trace_md5_fail(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -282,14 +358,16 @@ int trace_md5_fail(struct pt_regs* ctx) {
   event.branch_type = TCP_BRANCH_MD5_FAIL;
   event.drop_reason = SKB_DROP_REASON_NOT_SPECIFIED;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // NEW: Track backlog add
 int trace_backlog_add(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -297,14 +375,16 @@ int trace_backlog_add(struct pt_regs* ctx) {
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.branch_type = TCP_BRANCH_BACKLOG_ADD;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // NEW: Track request stolen path
 int trace_req_stolen(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -312,14 +392,16 @@ int trace_req_stolen(struct pt_regs* ctx) {
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.branch_type = TCP_BRANCH_REQ_STOLEN;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // NEW: Track listen overflow/drop
 int trace_listen_drop(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -327,14 +409,16 @@ int trace_listen_drop(struct pt_regs* ctx) {
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.branch_type = TCP_BRANCH_LISTEN_DROP;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // NEW: Track RST sent
 int trace_rst_sent(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -342,14 +426,16 @@ int trace_rst_sent(struct pt_regs* ctx) {
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.branch_type = TCP_BRANCH_RST_SENT;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
 
 // NEW: Track established socket processing
 int trace_established(struct pt_regs* ctx) {
+  HOOK_SAMPLE_INNER(sample_weight);
   tcp_branch_event_t event = {};
+  event.sample_weight = sample_weight;
 
   u64 pid_tgid = bpf_get_current_pid_tgid();
   event.pid = pid_tgid;
@@ -357,7 +443,7 @@ int trace_established(struct pt_regs* ctx) {
   event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
   event.branch_type = TCP_BRANCH_ESTABLISHED;
 
-  bpf_get_current_comm(&event.comm, sizeof(event.comm));
-  tcp_branch_events.perf_submit(ctx, &event, sizeof(event));
+  TASK_COMM_FILL(ctx, event.comm);
+  rcv_emit(ctx, &event);
   return 0;
 }
@@ -7,31 +7,38 @@ typedef struct unmap_range_output {
   u64 start;
   u64 end;
   int huge;
+  u32 sample_weight;
 } unmap_range_output_t;
 
-BPF_PERF_OUTPUT(unmap_range_output);
+// Regular ranges are sampled as stream 0 and huge page ranges as stream 1
+HOOK_CONTROL();
+EVENT_OUTPUT(unmap_range_output, unmap_range_output_t);
 
 int kprobe__unmap_page_range(struct pt_regs* ctx, struct mm_gather* tlb, struct vm_area_struct* vma,
                              unsigned long start, unsigned long end, struct zap_details* details) {
+  HOOK_SAMPLE(sample_weight, 0);
   unmap_range_output_t data;
   data.tgid = vma->vm_mm->owner->tgid;
   data.ts_ns = bpf_ktime_get_ns();
   data.start = start;
   data.end = end;
   data.huge = false;
-  unmap_range_output.perf_submit(ctx, &data, sizeof(unmap_range_output_t));
+  data.sample_weight = sample_weight;
+  EVENT_EMIT(unmap_range_output, ctx, &data);
   return 0;
 }
 
 int kprobe__unmap_hugepage_range(struct pt_regs* ctx, struct mm_gather* tlb,
                                  struct vm_area_struct* vma, unsigned long start, unsigned long end,
                                  struct page* ref_page, zap_flags_t zap_flags) {
+  HOOK_SAMPLE(sample_weight, 1);
   unmap_range_output_t data;
   data.tgid = vma->vm_mm->owner->tgid;
   data.ts_ns = bpf_ktime_get_ns();
   data.start = start;
   data.end = end;
   data.huge = true;
-  unmap_range_output.perf_submit(ctx, &data, sizeof(unmap_range_output_t));
+  data.sample_weight = sample_weight;
+  EVENT_EMIT(unmap_range_output, ctx, &data);
   return 0;
 }
@@ -6,87 +6,166 @@ typedef struct zswap_event {
   u32 tgid;
   u64 start_ts;
   u64 end_ts;
+  u32 sample_weight;
 } zswap_event_t;
 
-BPF_PERF_OUTPUT(zswap_store_events);
-BPF_PERF_OUTPUT(zswap_load_events);
-BPF_PERF_OUTPUT(zswap_invalidate_events);
+EVENT_OUTPUT(zswap_store_events, zswap_event_t);
+EVENT_OUTPUT(zswap_load_events, zswap_event_t);
+EVENT_OUTPUT(zswap_invalidate_events, zswap_event_t);
 
+#define ZSWAP_STORE      0
+#define ZSWAP_LOAD       1
+#define ZSWAP_INVALIDATE 2
+
+// Each kind of operation is its own sampling stream
+HOOK_CONTROL();
+
+#if AGGREGATE
+LATENCY_HISTOGRAM(zswap_latency_hist);
+#endif
+
+#if USE_TASK_STORAGE
+// Start time of the operation in flight for each kind, 0 when none is
+typedef struct zswap_starts {
+  u64 ts[3];
+} zswap_starts_t;
+
+BPF_TASK_STORAGE(zswap_start_times, zswap_starts_t);
+#else
 BPF_HASH(stores, u64, u64);
 BPF_HASH(loads, u64, u64);
 BPF_HASH(invalidates, u64, u64);
+#endif
 
-int trace_zswap_store_entry(struct pt_regs* ctx) {
-  u64 id = bpf_get_current_pid_tgid();
+static inline void zswap_start(int kind) {
   u64 start_ts = bpf_ktime_get_ns();
-  stores.update(&id, &start_ts);
+#if USE_TASK_STORAGE
+  zswap_starts_t* starts = zswap_start_times.task_storage_get(bpf_get_current_task_btf(), 0,
+                                                              BPF_LOCAL_STORAGE_GET_F_CREATE);
+  if (starts)
+    starts->ts[kind] = start_ts;
+#else
+  u64 id = bpf_get_current_pid_tgid();
+  if (kind == ZSWAP_STORE)
+    stores.update(&id, &start_ts);
+  else if (kind == ZSWAP_LOAD)
+    loads.update(&id, &start_ts);
+  else
+    invalidates.update(&id, &start_ts);
+#endif
+}
+
+// Consumes the start time recorded for kind, 0 if there was none
+static inline u64 zswap_finish(int kind) {
+  u64 start_ts = 0;
+#if USE_TASK_STORAGE
+  zswap_starts_t* starts = zswap_start_times.task_storage_get(bpf_get_current_task_btf(), 0, 0);
+  if (starts) {
+    start_ts = starts->ts[kind];
+    starts->ts[kind] = 0;
+  }
+#else
+  u64 id = bpf_get_current_pid_tgid();
+  u64* found;
+  if (kind == ZSWAP_STORE)
+    found = stores.lookup(&id);
+  else if (kind == ZSWAP_LOAD)
+    found = loads.lookup(&id);
+  else
+    found = invalidates.lookup(&id);
+  if (found == 0)
+    return 0;
+  start_ts = *found;
+  if (kind == ZSWAP_STORE)
+    stores.delete(&id);
+  else if (kind == ZSWAP_LOAD)
+    loads.delete(&id);
+  else
+    invalidates.delete(&id);
+#endif
+  return start_ts;
+}
+
+int trace_zswap_store_entry(struct pt_regs* ctx) {
+  zswap_start(ZSWAP_STORE);
   return 0;
 }
 
 int trace_zswap_store_return(struct pt_regs* ctx) {
   u64 id = bpf_get_current_pid_tgid();
-  u64* start_ts = stores.lookup(&id);
+  u64 start_ts = zswap_finish(ZSWAP_STORE);
   if (start_ts == 0)
     return 0;
   struct task_struct* task;
   if (IS_ERR(task = (struct task_struct*)PT_REGS_RC(ctx)))
     return 0;
-  zswap_event_t event;
+  HOOK_SAMPLE(sample_weight, ZSWAP_STORE);
+  zswap_event_t event = {};
   event.pid = (u32)(id);
   event.tgid = (u32)(id >> 32);
-  event.start_ts = *start_ts;
+  event.start_ts = start_ts;
   event.end_ts = bpf_ktime_get_ns();
-  zswap_store_events.perf_submit(ctx, &event, sizeof(event));
-  stores.delete(&id);
+  event.sample_weight = sample_weight;
+#if AGGREGATE
+  LATENCY_RECORD(zswap_latency_hist, event.tgid, 0, ZSWAP_STORE, (event.end_ts - event.start_ts) / 1000, sample_weight);
+#else
+  EVENT_EMIT(zswap_store_events, ctx, &event);
+#endif
   return 0;
 }
 
 int trace_zswap_load_entry(struct pt_regs* ctx) {
-  u64 id = bpf_get_current_pid_tgid();
-  u64 start_ts = bpf_ktime_get_ns();
-  loads.update(&id, &start_ts);
+  zswap_start(ZSWAP_LOAD);
   return 0;
 }
 
 int trace_zswap_load_return(struct pt_regs* ctx) {
   u64 id = bpf_get_current_pid_tgid();
-  u64* start_ts = loads.lookup(&id);
+  u64 start_ts = zswap_finish(ZSWAP_LOAD);
   if (start_ts == 0)
     return 0;
   struct task_struct* task;
   if (IS_ERR(task = (struct task_struct*)PT_REGS_RC(ctx)))
     return 0;
-  zswap_event_t event;
+  HOOK_SAMPLE(sample_weight, ZSWAP_LOAD);
+  zswap_event_t event = {};
   event.pid = (u32)(id);
   event.tgid = (u32)(id >> 32);
-  event.start_ts = *start_ts;
+  event.start_ts = start_ts;
   event.end_ts = bpf_ktime_get_ns();
-  zswap_load_events.perf_submit(ctx, &event, sizeof(event));
-  loads.delete(&id);
+  event.sample_weight = sample_weight;
+#if AGGREGATE
+  LATENCY_RECORD(zswap_latency_hist, event.tgid, 0, ZSWAP_LOAD, (event.end_ts - event.start_ts) / 1000, sample_weight);
+#else
+  EVENT_EMIT(zswap_load_events, ctx, &event);
+#endif
   return 0;
 }
 
 int trace_zswap_invalidate_entry(struct pt_regs* ctx) {
-  u64 id = bpf_get_current_pid_tgid();
-  u64 start_ts = bpf_ktime_get_ns();
-  invalidates.update(&id, &start_ts);
+  zswap_start(ZSWAP_INVALIDATE);
   return 0;
 }
 
 int trace_zswap_invalidate_return(struct pt_regs* ctx) {
   u64 id = bpf_get_current_pid_tgid();
-  u64* start_ts = invalidates.lookup(&id);
+  u64 start_ts = zswap_finish(ZSWAP_INVALIDATE);
   if (start_ts == 0)
     return 0;
   struct task_struct* task;
   if (IS_ERR(task = (struct task_struct*)PT_REGS_RC(ctx)))
     return 0;
-  zswap_event_t event;
+  HOOK_SAMPLE(sample_weight, ZSWAP_INVALIDATE);
+  zswap_event_t event = {};
   event.pid = (u32)(id);
   event.tgid = (u32)(id >> 32);
-  event.start_ts = *start_ts;
+  event.start_ts = start_ts;
   event.end_ts = bpf_ktime_get_ns();
-  zswap_invalidate_events.perf_submit(ctx, &event, sizeof(event));
-  invalidates.delete(&id);
+  event.sample_weight = sample_weight;
+#if AGGREGATE
+  LATENCY_RECORD(zswap_latency_hist, event.tgid, 0, ZSWAP_INVALIDATE, (event.end_ts - event.start_ts) / 1000, sample_weight);
+#else
+  EVENT_EMIT(zswap_invalidate_events, ctx, &event);
+#endif
   return 0;
 }
@@ -1,15 +1,53 @@
 """Abstract definition of a BPF program."""
 
 
+from dataclasses import dataclass
+
+import polars as pl
 from data_schema import CollectionTable
 from typing_extensions import Final, Protocol
 
 POLL_TIMEOUT_MS: Final[int] = 5
 
 
+@dataclass(frozen=True)
+class HookOptions:
+  """How a hook moves events out of the kernel, see transport.py."""
+  # "perf" for per-CPU perf buffers, "ringbuf" for one shared BPF ring buffer
+  transport: str = "perf"
+  # Size of each ring buffer in pages, must be a power of two
+  ringbuf_pages: int = 64
+  # Events queued per perf buffer or ring buffer CPU before waking the collector, 1 wakes on every event
+  wakeup_events: int = 1
+  # Latency hooks keep per-CPU histograms, TCP hooks per-flow counters and the page fault hook per region counts
+  # in the kernel instead of emitting raw events
+  aggregate: bool = False
+  # How often aggregate TCP hooks report flows that are still open, closed flows are reported as they close
+  flow_drain_ms: int = 1000
+  # The page fault hook counts faults per tgid and 2MB region, kept in fstore as "fault_regions", see heatmap.py
+  fault_regions: bool = False
+  fault_region_drain_ms: int = 1000
+  # Events carry no comm, hooks emit each task's name once and on rename instead, see comm.py
+  intern_comm: bool = False
+  # The perf hook reads its counters at each context switch into totals per tgid or "cgroup" instead of sampling, see perf_counting.py
+  perf_counting: bool = False
+  perf_count_by: str = "tgid"
+  perf_count_drain_ms: int = 1000
+  # Entry/return pairs prefer fentry/fexit and task local storage where the kernel has them
+  fentry: bool = True
+  task_storage: bool = True
+  # Initial sampling of hooks that consult the shared control map, see control.py
+  sample_every: int = 1
+  sample_period_us: int = 0
+  tgid_allowlist: tuple[int, ...] = ()
+  cgroup_allowlist: tuple[str, ...] = ()
+
+
 class BPFProgram(Protocol):
   """Loadable BPF program that returns performance data."""
 
+  options: HookOptions = HookOptions()
+
   @classmethod
   def name(cls) -> str: ...
 
@@ -19,8 +57,31 @@ class BPFProgram(Protocol):
 
   def close(self) -> None: ...
 
+  def configure(self, options: HookOptions) -> None:
+    """Set before load, hooks without event outputs may ignore it."""
+    self.options = options
+
+  def lost_events(self) -> int:
+    """Events dropped because the collector fell behind since load."""
+    return 0
+
+  def poll_fds(self) -> list[int]:
+    """Descriptors that turn readable when poll() has events to read.
+
+    Hooks without any are polled on the poll_rate tick, see poller.py.
+    """
+    return []
+
   def data(self) -> list[CollectionTable]: ...
 
+  def recent_events(self) -> dict[str, pl.DataFrame]:
+    """Raw events buffered since the previous call, by event output name.
+
+    Read by the feature pipeline while the output still owns the buffers, see
+    feature_pipeline.py. Hooks it takes no features from return nothing.
+    """
+    return {}
+
   # def last_k_ms(self, ms: int) -> list[CollectionTable]: ...
 
   # def last_k_data(self, k: int) -> list[CollectionTable]:
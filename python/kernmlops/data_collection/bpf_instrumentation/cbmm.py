@@ -3,7 +3,9 @@ from pathlib import Path
 
 import polars as pl
 from bcc import BPF
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import CollectionTable
 from data_schema.generic_table import (
     CBMMEagerDataTable,
@@ -16,6 +18,7 @@ class CBMMEagerTracingRuntimeData:
     freq_cycles: int
     greatest_range_benefit: int
     decision: bool
+    sample_weight: int
 
 @dataclass(frozen=True)
 class CBMMPrezeroingTracingRuntimeData:
@@ -27,6 +30,7 @@ class CBMMPrezeroingTracingRuntimeData:
     zeroing_per_page_cost: int
     recent_used: int
     decision: bool
+    sample_weight: int
 
 
 class CBMMBPFHook(BPFProgram):
@@ -43,7 +47,9 @@ class CBMMBPFHook(BPFProgram):
 
     def load(self, collection_id: str):
         self.collection_id = collection_id
-        self.bpf = BPF(text = self.bpf_text)
+        self.events = EventTransport(self.options)
+        self.bpf = BPF(text = self.events.expand(expand_control(self.bpf_text, self.name())))
+        self.control = apply_control(self.bpf, self.name(), self.options)
         self.bpf.attach_kprobe(event=b"mm_estimate_changes", fn_name=b"kprobe__mm_estimate_changes")
         self.bpf.attach_kretprobe(event=b"mm_decide", fn_name=b"kretprobe__mm_decide")
         self.bpf.attach_kprobe(event=b"mm_estimate_eager_page_cost_benefit", fn_name=b"kprobe__mm_estimate_eager_page_cost_benefit")
@@ -54,15 +60,21 @@ class CBMMBPFHook(BPFProgram):
         #self.bpf.attach_kprobe(event=b"mm_estimate_async_prezeroing_lock_contention_cost",
         #   fn_name=b"kprobe__mm_estimate_async_prezeroing_lock_contention_cost")
         self.bpf.attach_kretprobe(event=b"mm_estimated_prezeroed_used", fn_name=b"kretprobe__mm_estimated_prezeroed_used")
-        self.bpf["cbmm_eager"].open_perf_buffer(self._cbmm_eager_eh, page_cnt=64)
-        self.bpf["cbmm_prezero"].open_perf_buffer(self._cbmm_prezero_eh, page_cnt=64)
+        self.events.open(self.bpf, "cbmm_eager", self._cbmm_eager_eh, page_cnt=64)
+        self.events.open(self.bpf, "cbmm_prezero", self._cbmm_prezero_eh, page_cnt=64)
 
     def poll(self):
-        self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+        self.events.poll(self.bpf)
 
     def close(self):
         self.bpf.cleanup()
 
+    def lost_events(self) -> int:
+        return self.events.lost_events(self.bpf)
+
+    def poll_fds(self) -> list[int]:
+        return self.events.poll_fds(self.bpf)
+
     def data(self) -> list[CollectionTable]:
         return [
             CBMMPrezeroingDataTable.from_df_id(
@@ -84,18 +96,17 @@ class CBMMBPFHook(BPFProgram):
         self.cbmm_eager.clear()
         self.cbmm_prezero.clear()
 
-    def _cbmm_eager_eh(self, cpu, cbmm_eager_paging_inputs, size):
-        event = self.bpf["cbmm_eager"].event(cbmm_eager_paging_inputs)
+    def _cbmm_eager_eh(self, cpu, event):
         self.cbmm_eager.append(
             CBMMEagerTracingRuntimeData(
                 freq_cycles=event.freq_cycles,
                 greatest_range_benefit=event.greatest_range_benefit,
                 decision=bool(event.decision),
+                sample_weight=event.sample_weight,
             )
         )
 
-    def _cbmm_prezero_eh(self, cpu, cbmm_async_prezeroing_inputs, size):
-        event = self.bpf["cbmm_prezero"].event(cbmm_async_prezeroing_inputs)
+    def _cbmm_prezero_eh(self, cpu, event):
         x = CBMMPrezeroingTracingRuntimeData(
                 load=event.load,
                 daemon_cost=event.daemon_cost,
@@ -105,6 +116,7 @@ class CBMMBPFHook(BPFProgram):
                 zeroing_per_page_cost=event.zeroing_per_page_cost,
                 recent_used=event.recent_used,
                 decision=bool(event.decision),
+                sample_weight=event.sample_weight,
             )
         self.cbmm_prezero.append(x
         )
@@ -4,7 +4,9 @@ from typing import cast
 
 import polars as pl
 from bcc import BPF
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import CollectionTable
 from data_schema.generic_table import (
   CollapseHugePageDataTableRaw,
@@ -29,6 +31,7 @@ class TraceMMKhugepagedScanPMDRuntimeData:
   none_or_zero: int
   status: int
   unmapped: bool
+  sample_weight: int
 
 @dataclass(frozen=True)
 class CollapseHugePageRuntimeData:
@@ -42,6 +45,7 @@ class CollapseHugePageRuntimeData:
   unmapped: int
   referenced: int
   cc: str
+  sample_weight: int
 
 @dataclass(frozen=True)
 class TraceMMCollapseHugePageRuntimeData:
@@ -52,6 +56,7 @@ class TraceMMCollapseHugePageRuntimeData:
   mm: str
   isolated: bool
   status: int
+  sample_weight: int
 
 class CollapseHugePageBPFHook(BPFProgram):
 
@@ -68,19 +73,27 @@ class CollapseHugePageBPFHook(BPFProgram):
 
   def load(self, collection_id: str):
     self.collection_id = collection_id
-    self.bpf = BPF(text = self.bpf_text)
+    self.events = EventTransport(self.options)
+    self.bpf = BPF(text = self.events.expand(expand_control(self.bpf_text, self.name())))
+    self.control = apply_control(self.bpf, self.name(), self.options)
     #self.bpf.attach_raw_tracepoint(tp=b"mm_collapse_huge_page", fn_name=b"mm_collapse_huge_page")
     self.bpf.attach_kprobe(event=b"collapse_huge_page", fn_name=b"kprobe_collapse_huge_page")
-    self.bpf["collapse_huge_pages"].open_perf_buffer(self._collapse_huge_pages_eh, page_cnt=64)
-    self.bpf["trace_mm_collapse_huge_pages"].open_perf_buffer(self._trace_huge_pages_eh, page_cnt=64)
-    self.bpf["trace_mm_khugepaged_scan_pmds"].open_perf_buffer(self._trace_khugepaged_scan_eh, page_cnt=64)
+    self.events.open(self.bpf, "collapse_huge_pages", self._collapse_huge_pages_eh, page_cnt=64)
+    self.events.open(self.bpf, "trace_mm_collapse_huge_pages", self._trace_huge_pages_eh, page_cnt=64)
+    self.events.open(self.bpf, "trace_mm_khugepaged_scan_pmds", self._trace_khugepaged_scan_eh, page_cnt=64)
 
   def poll(self):
-    self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+    self.events.poll(self.bpf)
 
   def close(self):
     self.bpf.cleanup()
 
+  def lost_events(self) -> int:
+    return self.events.lost_events(self.bpf)
+
+  def poll_fds(self) -> list[int]:
+    return self.events.poll_fds(self.bpf)
+
   def data(self) -> list[CollectionTable]:
     if len(self.collapse_huge_pages) == 0 or len(self.trace_mm_collapse_huge_pages) == 0 or len(self.trace_mm_khugepaged_scan_pmds) == 0:
         return []
@@ -114,8 +127,7 @@ class CollapseHugePageBPFHook(BPFProgram):
     self.clear()
     return quanta_tables
 
-  def _trace_khugepaged_scan_eh(self, cpu, trace_mm_khugepaged_scan_pmd_struct, size):
-      event = self.bpf["trace_mm_khugepaged_scan_pmds"].event(trace_mm_khugepaged_scan_pmd_struct)
+  def _trace_khugepaged_scan_eh(self, cpu, event):
       self.trace_mm_khugepaged_scan_pmds.append(
         TraceMMKhugepagedScanPMDRuntimeData(
           pid=event.pid,
@@ -129,12 +141,12 @@ class CollapseHugePageBPFHook(BPFProgram):
           none_or_zero=event.none_or_zero,
           status=event.status,
           unmapped=event.unmapped,
+          sample_weight=event.sample_weight,
           )
         )
 
 
-  def _trace_huge_pages_eh(self, cpu, trace_mm_collapse_huge_page_struct, size):
-    event = self.bpf["trace_mm_collapse_huge_pages"].event(trace_mm_collapse_huge_page_struct)
+  def _trace_huge_pages_eh(self, cpu, event):
     self.trace_mm_collapse_huge_pages.append(
       TraceMMCollapseHugePageRuntimeData(
           pid=event.pid,
@@ -144,11 +156,11 @@ class CollapseHugePageBPFHook(BPFProgram):
           mm=hex(event.mm),
           isolated=event.isolated,
           status=event.status,
+          sample_weight=event.sample_weight,
       )
     )
 
-  def _collapse_huge_pages_eh(self, cpu, collapse_huge_page_struct, size):
-    event = self.bpf["collapse_huge_pages"].event(collapse_huge_page_struct)
+  def _collapse_huge_pages_eh(self, cpu, event):
     self.collapse_huge_pages.append(
       CollapseHugePageRuntimeData(
           pid=event.pid,
@@ -160,5 +172,6 @@ class CollapseHugePageBPFHook(BPFProgram):
           referenced=event.referenced,
           unmapped=event.unmapped,
           cc=hex(event.cc),
+          sample_weight=event.sample_weight,
       )
     )
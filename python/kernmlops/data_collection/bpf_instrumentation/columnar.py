@@ -0,0 +1,145 @@
+"""Columnar buffering of raw BPF events.
+
+Decoding every event into a ctypes object and then a dataclass costs several
+Python allocations per kernel event. EventColumns instead copies the raw event
+bytes into a growable numpy structured array laid out like the C struct, and
+splits it into one contiguous array per field only when a DataFrame is built.
+
+Columns come out the way the dataclass rows used to infer them: integers are
+Int64 (unsigned 64-bit values are reinterpreted, so -1 stays -1), char arrays
+are strings and the producing CPU is prepended as `cpu`.
+
+Events are appended on the poller thread while the collector thread builds
+frames and clears, and ctypes.memmove drops the GIL mid copy, so every access
+to the buffer holds the buffer's lock.
+
+Once pop_recent() has been called, pop() and clear() keep the rows it has not
+read yet, so its reader sees every event however the output's pops fall
+between its own.
+"""
+
+import ctypes as ct
+from threading import RLock
+from typing import Any, Final
+
+import numpy as np
+import polars as pl
+
+INITIAL_CAPACITY: Final[int] = 4096
+
+
+class EventColumns:
+  """Growable buffer of one event type, handed to Polars in bulk."""
+
+  def __init__(self, capacity: int = INITIAL_CAPACITY):
+    self._capacity = capacity
+    self._dtype: np.dtype | None = None
+    self._rows: np.ndarray | None = None
+    self._cpus = np.empty(0, dtype=np.int64)
+    self._len = 0
+    # rows before _out were already popped and stay only for pop_recent()
+    self._out = 0
+    # where the next pop_recent() starts, set once a reader called it
+    self._recent = 0
+    self._reading = False
+    # reentrant so pop() can frame and reset in one hold
+    self.lock = RLock()
+
+  def __len__(self) -> int:
+    with self.lock:
+      return self._len - self._out
+
+  @property
+  def bound(self) -> bool:
+    return self._dtype is not None
+
+  def bind(self, event_class: type[ct.Structure]):
+    """Fix the row layout from the ctypes class BCC generated for the event."""
+    dtype = np.dtype(event_class)
+    # numpy must agree with ctypes on padding or the copied rows would shear
+    assert dtype.itemsize == ct.sizeof(event_class)
+    with self.lock:
+      self._dtype = dtype
+      self._rows = np.empty(self._capacity, dtype=dtype)
+      self._cpus = np.empty(self._capacity, dtype=np.int64)
+
+  def append(self, cpu: int, data: int):
+    """Copy one raw event from the BPF buffer at address data."""
+    with self.lock:
+      assert self._rows is not None
+      if self._len == len(self._rows):
+        self._grow()
+      ct.memmove(self._rows.ctypes.data + self._len * self._rows.itemsize, data, self._rows.itemsize)
+      self._cpus[self._len] = cpu
+      self._len += 1
+
+  def _grow(self):
+    assert self._rows is not None
+    capacity = 2 * len(self._rows)
+    rows = np.empty(capacity, dtype=self._rows.dtype)
+    rows[:self._len] = self._rows[:self._len]
+    cpus = np.empty(capacity, dtype=np.int64)
+    cpus[:self._len] = self._cpus[:self._len]
+    self._rows, self._cpus = rows, cpus
+
+  def clear(self):
+    """Drop the buffered events, moving any pop_recent() has not read to the front."""
+    # keep the grown buffers, the next interval likely needs the same room
+    with self.lock:
+      keep = min(self._recent, self._len) if self._reading else self._len
+      tail = self._len - keep
+      if tail and keep:
+        assert self._rows is not None
+        self._rows[:tail] = self._rows[keep:self._len]
+        self._cpus[:tail] = self._cpus[keep:self._len]
+      self._len = tail
+      self._out = tail
+      self._recent = 0
+
+  def pop(self) -> pl.DataFrame:
+    """Every buffered event, removed in the same hold so no append lands in between."""
+    with self.lock:
+      frame = self.frame()
+      self.clear()
+      return frame
+
+  def pop_recent(self) -> pl.DataFrame:
+    """Events appended since the previous call, for one reader besides the output."""
+    with self.lock:
+      start, end = min(self._recent, self._len), self._len
+      self._recent = end
+      self._reading = True
+      return self.frame(start, end)
+
+  def frame(self, start: int | None = None, end: int | None = None) -> pl.DataFrame:
+    """Buffered events as a DataFrame that does not alias the buffer."""
+    with self.lock:
+      if self._rows is None or self._dtype is None:
+        return pl.DataFrame()
+      start = self._out if start is None else start
+      end = self._len if end is None else end
+      rows = self._rows[start:end]
+      columns = dict[str, Any]({"cpu": self._cpus[start:end].copy()})
+      # the copies must be made before an append can grow or overwrite the rows
+      for name in self._dtype.names or ():
+        columns[name] = _column(rows[name])
+    return pl.DataFrame(columns)
+
+
+def _column(field: np.ndarray) -> Any:
+  # fields are strided views into the rows, every branch below makes a contiguous copy
+  if field.dtype.kind == "S":
+    try:
+      return pl.Series(field).cast(pl.String())
+    except pl.exceptions.InvalidOperationError:
+      return pl.Series([value.decode("utf-8", "replace") for value in field.tolist()], dtype=pl.String())
+  if field.dtype == np.uint64:
+    return np.ascontiguousarray(field).view(np.int64)
+  if field.dtype.kind in ("i", "u", "b"):
+    return field.astype(np.int64)
+  return np.ascontiguousarray(field)
+
+
+__all__ = [
+  "EventColumns",
+]
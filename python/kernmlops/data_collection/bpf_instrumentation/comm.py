@@ -0,0 +1,127 @@
+"""Interning of the task comm carried by hot events.
+
+Most events spend 16 bytes, often half their payload, on the comm of the task
+that produced them. Hooks name the comm through placeholders so interning can
+leave it out of the events and emit each task's name once instead:
+
+  TASK_COMM_FIELD(field);       `char field[TASK_COMM_LEN]` in an event struct, nothing when interned
+  TASK_COMM_FILL(ctx, field);   fill field, e.g. event.comm, or intern the current task's name
+
+Interned names go out on task_comm_events the first time a task produces an
+event and again after __set_task_comm renames it, exec included. A task is
+remembered by pid and start time so a reused pid is named again. Events read
+back through CollectionData get their comm joined from the task_comm table,
+see data_schema/task_comm.py.
+"""
+
+import re
+from typing import Any, Final
+
+from bcc import BPF
+from data_collection.bpf_instrumentation.columnar import EventColumns
+from data_collection.bpf_instrumentation.transport import EventTransport
+from data_schema import CollectionTable
+
+TASK_COMM_MAX_ENTRIES: Final[int] = 16384
+
+_DECLARATIONS: Final[str] = f"""#include <linux/sched.h>
+
+struct task_comm_event {{
+  u32 pid;
+  u32 tgid;
+  u64 ts_uptime_us;
+  char comm[TASK_COMM_LEN];
+}};
+
+// Start time of the task each pid was last named for
+BPF_TABLE("lru_hash", u32, u64, task_comm_seen, {TASK_COMM_MAX_ENTRIES});
+EVENT_OUTPUT(task_comm_events, struct task_comm_event);
+
+static inline void task_comm_intern(void* ctx) {{
+  u64 pid_tgid = bpf_get_current_pid_tgid();
+  u32 pid = pid_tgid;
+  struct task_struct* task = (struct task_struct*)bpf_get_current_task();
+  u64 start_time = task->start_time;
+  u64* seen = task_comm_seen.lookup(&pid);
+  if (seen && *seen == start_time)
+    return;
+  task_comm_seen.update(&pid, &start_time);
+  struct task_comm_event event = {{}};
+  event.pid = pid;
+  event.tgid = pid_tgid >> 32;
+  event.ts_uptime_us = bpf_ktime_get_ns() / 1000;
+  bpf_get_current_comm(&event.comm, sizeof(event.comm));
+  EVENT_EMIT(task_comm_events, ctx, &event);
+}}
+
+// The renamed task is named again by its next event
+int trace_task_comm_rename(struct pt_regs* ctx, struct task_struct* tsk) {{
+  u32 pid = tsk->pid;
+  task_comm_seen.delete(&pid);
+  return 0;
+}}
+"""
+
+_PLACEHOLDER = re.compile(r"\b(TASK_COMMS|TASK_COMM_FIELD|TASK_COMM_FILL)\s*\(([^;]*)\)\s*;")
+
+
+def expand_comm(bpf_text: str, intern: bool) -> str:
+  """Expands the comm placeholders, TASK_COMMS(); declares the interning maps when interned."""
+
+  def _expand_one(match: re.Match[str]) -> str:
+    kind = match.group(1)
+    args = [arg.strip() for arg in match.group(2).split(",")]
+    if kind == "TASK_COMMS":
+      return _DECLARATIONS if intern else ""
+    if kind == "TASK_COMM_FIELD":
+      return "" if intern else f"char {args[0]}[TASK_COMM_LEN];"
+    ctx, field = args
+    if intern:
+      return f"task_comm_intern({ctx});"
+    return f"bpf_get_current_comm(&{field}, sizeof({field}));"
+
+  return _PLACEHOLDER.sub(_expand_one, bpf_text)
+
+
+def event_comm(event: Any, errors: str = "replace") -> str | None:
+  """The comm of a decoded event, None when its hook interns comms."""
+  comm = getattr(event, "comm", None)
+  return comm.decode("utf-8", errors) if comm is not None else None
+
+
+class _SharedColumns(EventColumns):
+  """One buffer every interning hook appends to, whichever poller thread it runs on."""
+
+  def bind(self, event_class: type):
+    with self.lock:
+      if not self.bound:
+        super().bind(event_class)
+
+
+_task_comms: Final[_SharedColumns] = _SharedColumns()
+
+
+class TaskComms:
+  """Opens a hook's interned names.
+
+  The names of every hook go to a single buffer so one task_comm table comes
+  out per interval, popped by whichever interning hook is popped first.
+  """
+
+  def __init__(self, bpf: BPF, events: EventTransport):
+    bpf.attach_kprobe(event=b"__set_task_comm", fn_name=b"trace_task_comm_rename")
+    events.open_columns(bpf, "task_comm_events", _task_comms, page_cnt=64)
+
+  def pop(self, collection_id: str) -> list[CollectionTable]:
+    from data_schema.task_comm import TaskCommTable
+    frame = _task_comms.pop()
+    if len(frame) == 0:
+      return []
+    return [TaskCommTable.from_df_id(frame.drop("cpu"), collection_id=collection_id)]
+
+
+__all__ = [
+  "event_comm",
+  "expand_comm",
+  "TaskComms",
+]
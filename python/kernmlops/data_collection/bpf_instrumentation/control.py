@@ -0,0 +1,311 @@
+"""Runtime sampling and filtering shared by all hooks.
+
+Hooks consult one control entry per hook in a BPF array pinned under bpffs,
+so every loaded program, and any other process, sees the same settings and
+they can change without recompiling or reloading anything:
+
+  HOOK_CONTROL();              declare the control maps and hook_admit() for this hook
+  HOOK_SAMPLE(var[, stream]);  `u32 var` sampling weight, returns 0 from the probe when not admitted
+  HOOK_WEIGHT(var[, stream]);  as HOOK_SAMPLE but var is 0 instead of returning, for probes
+                               whose bookkeeping must see every event
+
+An admitted event's weight is how many events of its stream this CPU saw
+since its previous admitted one, so summing sample_weight estimates the
+unsampled count. Hooks emitting several kinds of event give each kind its own
+stream, below HOOK_STREAMS, so one kind's weight never counts another's
+events. A zeroed entry admits everything with weight 1, which is also what
+hooks get before anyone writes a control.
+
+Hooks with probes inside a function, e.g. offsets into tcp_v4_rcv that each
+see a packet its entry probe already saw, decide once per call instead:
+
+  HOOK_SAMPLE_ENTRY(var);  as HOOK_SAMPLE, and remembers the decision for this CPU
+  HOOK_SAMPLE_INNER(var);  the weight the latest HOOK_SAMPLE_ENTRY on this CPU gave
+
+Every hook emitting events from BPF is in CONTROLLED_HOOKS. memory_usage and
+process_metadata read /proc and perf reads counters, none of them has events
+to sample, so writing their entry is an error rather than a setting nothing
+reads.
+"""
+
+import ctypes as ct
+import os
+import re
+from collections.abc import Iterable
+from dataclasses import dataclass
+from pathlib import Path
+from typing import Final
+
+from bcc import BPF
+from data_collection.bpf_instrumentation.bpf_hook import HookOptions
+
+CONTROL_PIN_PREFIX: Final[str] = "/sys/fs/bpf/kernmlops_"
+
+CONTROL_DISABLED: Final[int] = 1
+CONTROL_FILTER_TGID: Final[int] = 2
+CONTROL_FILTER_CGROUP: Final[int] = 4
+
+# Slot of each hook in the control array, append only since other processes index by it
+CONTROL_SLOTS: Final[tuple[str, ...]] = (
+  "file_data",
+  "memory_usage",
+  "process_metadata",
+  "quanta_runtime",
+  "block_io",
+  "perf",
+  "collapse_huge_pages",
+  "cbmm",
+  "madvise",
+  "unmap_range",
+  "mm_rss_stat",
+  "process_trace",
+  "zswap_runtime",
+  "page_fault",
+  "tcp_v4_rcv",
+  "tcp_state_process",
+  "tcp_v4_connect",
+  "tcp_congestion_control",
+  "tcp_cubic",
+)
+CONTROL_MAX_SLOTS: Final[int] = 64
+# Hooks whose programs consult their control entry
+CONTROLLED_HOOKS: Final[tuple[str, ...]] = (
+  "file_data",
+  "quanta_runtime",
+  "block_io",
+  "collapse_huge_pages",
+  "cbmm",
+  "madvise",
+  "unmap_range",
+  "mm_rss_stat",
+  "process_trace",
+  "zswap_runtime",
+  "page_fault",
+  "tcp_v4_rcv",
+  "tcp_state_process",
+  "tcp_v4_connect",
+  "tcp_congestion_control",
+  "tcp_cubic",
+)
+# Independently sampled kinds of event per hook
+HOOK_STREAMS: Final[int] = 8
+TGID_ALLOWLIST_SIZE: Final[int] = 4096
+CGROUP_ALLOWLIST_SIZE: Final[int] = 1024
+
+_DECLARATIONS: Final[str] = f"""#define CONTROL_DISABLED      {CONTROL_DISABLED}
+#define CONTROL_FILTER_TGID   {CONTROL_FILTER_TGID}
+#define CONTROL_FILTER_CGROUP {CONTROL_FILTER_CGROUP}
+
+struct hook_control {{
+  u32 flags;
+  u32 sample_every;
+  u64 sample_period_ns;
+}};
+
+struct hook_sample_state {{
+  u64 seen;
+  u64 last_ns;
+}};
+
+BPF_TABLE_PINNED("array", u32, struct hook_control, hook_controls, {CONTROL_MAX_SLOTS}, "{CONTROL_PIN_PREFIX}hook_controls");
+BPF_TABLE_PINNED("hash", u32, u8, hook_tgid_allow, {TGID_ALLOWLIST_SIZE}, "{CONTROL_PIN_PREFIX}tgid_allow");
+BPF_TABLE_PINNED("hash", u64, u8, hook_cgroup_allow, {CGROUP_ALLOWLIST_SIZE}, "{CONTROL_PIN_PREFIX}cgroup_allow");
+"""
+
+_ADMIT: Final[str] = f"""BPF_PERCPU_ARRAY(hook_sample_state, struct hook_sample_state, {HOOK_STREAMS});
+
+// Sampling weight of the current event of stream, 0 when it should not be emitted
+static inline u32 hook_admit(u32 stream) {{
+  u32 slot = CONTROL_SLOT;
+  struct hook_control* control = hook_controls.lookup(&slot);
+  if (!control)
+    return 1;
+  if (control->flags & CONTROL_DISABLED)
+    return 0;
+  if (control->flags & CONTROL_FILTER_TGID) {{
+    u32 tgid = bpf_get_current_pid_tgid() >> 32;
+    if (!hook_tgid_allow.lookup(&tgid))
+      return 0;
+  }}
+  if (control->flags & CONTROL_FILTER_CGROUP) {{
+    u64 cgroup_id = bpf_get_current_cgroup_id();
+    if (!hook_cgroup_allow.lookup(&cgroup_id))
+      return 0;
+  }}
+  if (control->sample_every <= 1 && control->sample_period_ns == 0)
+    return 1;
+  struct hook_sample_state* state = hook_sample_state.lookup(&stream);
+  if (!state)
+    return 1;
+  state->seen++;
+  if (state->seen < control->sample_every)
+    return 0;
+  if (control->sample_period_ns) {{
+    u64 now = bpf_ktime_get_ns();
+    if (now - state->last_ns < control->sample_period_ns)
+      return 0;
+    state->last_ns = now;
+  }}
+  u32 weight = state->seen > 0xffffffff ? 0xffffffff : state->seen;
+  state->seen = 0;
+  return weight;
+}}
+
+// hook_admit() of the function entry this CPU is currently inside of
+BPF_PERCPU_ARRAY(hook_entry_weight, u32, 1);
+
+static inline u32 hook_admit_entry(void) {{
+  u32 weight = hook_admit(0);
+  u32 zero = 0;
+  u32* entry = hook_entry_weight.lookup(&zero);
+  if (entry)
+    *entry = weight;
+  return weight;
+}}
+
+static inline u32 hook_admitted_entry(void) {{
+  u32 zero = 0;
+  u32* entry = hook_entry_weight.lookup(&zero);
+  return entry ? *entry : 1;
+}}
+"""
+
+_PLACEHOLDER = re.compile(
+  r"\b(HOOK_CONTROL|HOOK_SAMPLE_ENTRY|HOOK_SAMPLE_INNER|HOOK_SAMPLE|HOOK_WEIGHT)\s*\(([^;]*)\)\s*;"
+)
+
+
+def control_slot(hook_name: str) -> int:
+  return CONTROL_SLOTS.index(hook_name)
+
+
+def check_controlled(hook_name: str):
+  if hook_name not in CONTROLLED_HOOKS:
+    raise ValueError(
+      f"{hook_name} does not support sampling control, only {', '.join(CONTROLLED_HOOKS)} do"
+    )
+
+
+def expand_control(bpf_text: str, hook_name: str) -> str:
+  check_controlled(hook_name)
+  slot = control_slot(hook_name)
+
+  def _expand_one(match: re.Match[str]) -> str:
+    if match.group(1) == "HOOK_CONTROL":
+      return _DECLARATIONS + _ADMIT.replace("CONTROL_SLOT", str(slot))
+    args = [arg.strip() for arg in match.group(2).split(",")]
+    var = args[0]
+    if match.group(1) == "HOOK_SAMPLE_ENTRY":
+      return f"u32 {var} = hook_admit_entry(); if (!{var}) return 0;"
+    if match.group(1) == "HOOK_SAMPLE_INNER":
+      return f"u32 {var} = hook_admitted_entry(); if (!{var}) return 0;"
+    stream = args[1] if len(args) > 1 else "0"
+    if match.group(1) == "HOOK_WEIGHT":
+      return f"u32 {var} = hook_admit({stream});"
+    return f"u32 {var} = hook_admit({stream}); if (!{var}) return 0;"
+
+  return _PLACEHOLDER.sub(_expand_one, bpf_text)
+
+
+@dataclass(frozen=True)
+class SamplingControl:
+  """Settings of one hook's control entry, the defaults admit every event."""
+  enabled: bool = True
+  # Emit one in every sample_every events per CPU
+  sample_every: int = 1
+  # Emit at most one event per CPU per period, 0 for no limit
+  sample_period_us: int = 0
+  filter_tgids: bool = False
+  filter_cgroups: bool = False
+
+  def flags(self) -> int:
+    flags = 0 if self.enabled else CONTROL_DISABLED
+    if self.filter_tgids:
+      flags |= CONTROL_FILTER_TGID
+    if self.filter_cgroups:
+      flags |= CONTROL_FILTER_CGROUP
+    return flags
+
+
+def cgroup_id(cgroup: int | str | Path) -> int:
+  """cgroup v2 ids are the inode numbers of their directories."""
+  if isinstance(cgroup, int):
+    return cgroup
+  path = Path(cgroup)
+  if not path.is_absolute():
+    path = Path("/sys/fs/cgroup") / path
+  return os.stat(path).st_ino
+
+
+class HookControl:
+  """Reads and writes the pinned control maps.
+
+  Given a loaded hook's BPF object the maps come from it, otherwise a program
+  declaring only the pinned maps is compiled to open them.
+  """
+
+  def __init__(self, bpf: BPF | None = None):
+    self.bpf = bpf if bpf is not None else BPF(text=_DECLARATIONS)
+    self.controls = self.bpf["hook_controls"]
+    self.tgid_allow = self.bpf["hook_tgid_allow"]
+    self.cgroup_allow = self.bpf["hook_cgroup_allow"]
+
+  def set(self, hook_name: str, control: SamplingControl):
+    check_controlled(hook_name)
+    key = self.controls.Key(control_slot(hook_name))
+    leaf = self.controls.Leaf()
+    leaf.flags = control.flags()
+    leaf.sample_every = max(control.sample_every, 1)
+    leaf.sample_period_ns = max(control.sample_period_us, 0) * 1000
+    self.controls[key] = leaf
+
+  def get(self, hook_name: str) -> SamplingControl:
+    leaf = self.controls[self.controls.Key(control_slot(hook_name))]
+    return SamplingControl(
+      enabled=not leaf.flags & CONTROL_DISABLED,
+      sample_every=max(leaf.sample_every, 1),
+      sample_period_us=leaf.sample_period_ns // 1000,
+      filter_tgids=bool(leaf.flags & CONTROL_FILTER_TGID),
+      filter_cgroups=bool(leaf.flags & CONTROL_FILTER_CGROUP),
+    )
+
+  def allow_tgids(self, tgids: Iterable[int], *, replace: bool = False):
+    if replace:
+      self.tgid_allow.clear()
+    for tgid in tgids:
+      self.tgid_allow[self.tgid_allow.Key(tgid)] = ct.c_uint8(1)
+
+  def allow_cgroups(self, cgroups: Iterable[int | str | Path], *, replace: bool = False):
+    if replace:
+      self.cgroup_allow.clear()
+    for cgroup in cgroups:
+      self.cgroup_allow[self.cgroup_allow.Key(cgroup_id(cgroup))] = ct.c_uint8(1)
+
+
+def apply_control(bpf: BPF, hook_name: str, options: HookOptions) -> HookControl:
+  """Writes the sampling a collection was configured with, replacing what a previous run left pinned."""
+  control = HookControl(bpf)
+  control.set(hook_name, SamplingControl(
+    sample_every=options.sample_every,
+    sample_period_us=options.sample_period_us,
+    filter_tgids=bool(options.tgid_allowlist),
+    filter_cgroups=bool(options.cgroup_allowlist),
+  ))
+  if options.tgid_allowlist:
+    control.allow_tgids(options.tgid_allowlist, replace=True)
+  if options.cgroup_allowlist:
+    control.allow_cgroups(options.cgroup_allowlist, replace=True)
+  return control
+
+
+__all__ = [
+  "apply_control",
+  "cgroup_id",
+  "check_controlled",
+  "CONTROLLED_HOOKS",
+  "control_slot",
+  "expand_control",
+  "HOOK_STREAMS",
+  "HookControl",
+  "SamplingControl",
+]
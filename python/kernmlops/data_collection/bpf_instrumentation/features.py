@@ -0,0 +1,43 @@
+"""Kernel BPF features the hooks pick between at load time."""
+
+import platform
+import re
+from functools import cache
+
+from bcc import BPF
+
+
+@cache
+def kernel_version() -> tuple[int, int]:
+  match = re.match(r"(\d+)\.(\d+)", platform.release())
+  if match is None:
+    return (0, 0)
+  return (int(match.group(1)), int(match.group(2)))
+
+
+@cache
+def supports_fentry() -> bool:
+  """fentry/fexit skip the kretprobe trampoline and see the arguments on return."""
+  return bool(BPF.support_kfunc())
+
+
+def supports_task_storage(fentry: bool) -> bool:
+  """Task local storage replaces pid keyed hashes for entry/return correlation.
+
+  Tracing programs could use it from 5.11, kprobes only since 6.2.
+  """
+  return kernel_version() >= ((5, 11) if fentry else (6, 2))
+
+
+def feature_flags(fentry: bool, task_storage: bool) -> tuple[bool, bool]:
+  """Narrows the requested features to what this kernel supports."""
+  fentry = fentry and supports_fentry()
+  return fentry, task_storage and supports_task_storage(fentry)
+
+
+__all__ = [
+  "feature_flags",
+  "kernel_version",
+  "supports_fentry",
+  "supports_task_storage",
+]
@@ -3,7 +3,9 @@ from pathlib import Path
 
 import polars as pl
 from bcc import BPF
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import CollectionTable, FileDataTable
 
 
@@ -16,6 +18,7 @@ class FileOpenData:
   file_inode: int
   file_size_bytes: int
   file_name: str
+  sample_weight: int
 
 
 class FileDataBPFHook(BPFProgram):
@@ -47,19 +50,27 @@ class FileDataBPFHook(BPFProgram):
 
   def load(self, collection_id: str):
     self.collection_id = collection_id
-    self.bpf = BPF(text = self.bpf_text)
+    self.events = EventTransport(self.options)
+    self.bpf = BPF(text = self.events.expand(expand_control(self.bpf_text, self.name())))
+    self.control = apply_control(self.bpf, self.name(), self.options)
     self.bpf.attach_kprobe(event=b"vfs_create", fn_name=b"trace_create")
     self.bpf.attach_kprobe(event=b"vfs_open", fn_name=b"trace_open")
     if BPF.get_kprobe_functions(b"security_inode_create"):
         self.bpf.attach_kprobe(event=b"security_inode_create", fn_name=b"trace_security_inode_create")
-    self.bpf["file_open_events"].open_perf_buffer(self._file_open_event_handler, page_cnt=64)
+    self.events.open(self.bpf, "file_open_events", self._file_open_event_handler, page_cnt=64)
 
   def poll(self):
-    self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+    self.events.poll(self.bpf)
 
   def close(self):
     self.bpf.cleanup()
 
+  def lost_events(self) -> int:
+    return self.events.lost_events(self.bpf)
+
+  def poll_fds(self) -> list[int]:
+    return self.events.poll_fds(self.bpf)
+
   def data(self) -> list[CollectionTable]:
     return [
       FileDataTable.from_df_id(
@@ -76,8 +87,7 @@ class FileDataBPFHook(BPFProgram):
     self.clear()
     return file_tables
 
-  def _file_open_event_handler(self, cpu, file_open_perf_event, size):
-    event = self.bpf["file_open_events"].event(file_open_perf_event)
+  def _file_open_event_handler(self, cpu, event):
     try:
         data = FileOpenData(
             cpu=cpu,
@@ -87,6 +97,7 @@ class FileDataBPFHook(BPFProgram):
             file_inode=event.file_inode,
             file_size_bytes=event.file_size_bytes,
             file_name=event.file_name.decode('utf-8'),
+            sample_weight=event.sample_weight,
         )
         self.file_open_data.append(data)
     except Exception as _:
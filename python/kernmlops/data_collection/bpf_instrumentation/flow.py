@@ -0,0 +1,316 @@
+"""Per-flow TCP counters kept in a BPF LRU hash.
+
+TCP hooks in aggregate mode count their branches against the connection they
+belong to instead of emitting an event per packet, using one placeholder
+expanded here before the event placeholders:
+
+  TCP_FLOWS();    declare the flow map and the tcp_flow_* helpers below, nothing in raw mode
+
+  tcp_flow_sock_key(sk, key)                    4-tuple of a socket
+  tcp_flow_get(key)                             flow of a 4-tuple, created on first use
+  tcp_flow_current_key()                        per-CPU 4-tuple of the packet being handled
+  tcp_flow_count(flow, branch, drop, weight)    count a branch and its drop reason
+  tcp_flow_summarize(flow, cwnd, srtt_us)       fold one cwnd/RTT sample into the flow
+
+Flows are keyed by local and remote endpoint so the receive, state and cubic
+hooks agree on a connection's key. A socket moving to TCP_CLOSE publishes its
+flow on tcp_flow_closed and deletes it; flows still open are drained every
+drain interval as the counts they gained since the previous drain.
+"""
+
+import socket
+import struct
+import time
+from dataclasses import dataclass
+from typing import Any, Final
+
+import polars as pl
+from bcc import BPF
+from data_collection.bpf_instrumentation.histogram import DrainTotals
+from data_collection.bpf_instrumentation.transport import EventTransport
+from data_schema import UPTIME_TIMESTAMP
+
+TCP_FLOW_MAX_ENTRIES: Final[int] = 16384
+TCP_FLOW_BRANCHES: Final[int] = 32
+# SKB_DROP_REASON_* counted per flow, slot 0 counts every other reason
+TCP_FLOW_DROP_REASONS: Final[tuple[int, ...]] = (0, 2, 3, 4, 5, 6, 14, 70)
+
+_DROP_SLOTS: Final[str] = "\n".join(
+  f"  case {reason}: return {slot};"
+  for slot, reason in enumerate(TCP_FLOW_DROP_REASONS)
+  if reason != 0
+)
+
+_DECLARATIONS: Final[str] = f"""#define TCP_FLOW_BRANCHES {TCP_FLOW_BRANCHES}
+#define TCP_FLOW_DROPS    {len(TCP_FLOW_DROP_REASONS)}
+
+struct tcp_flow_key {{
+  u32 laddr;
+  u32 raddr;
+  u16 lport;
+  u16 rport;
+}};
+
+struct tcp_flow {{
+  struct tcp_flow_key key;
+  u8 closed;
+  u64 first_ts_us;
+  u64 last_ts_us;
+  u64 branch_counts[TCP_FLOW_BRANCHES];
+  u64 drop_counts[TCP_FLOW_DROPS];
+  u32 cwnd_min;
+  u32 cwnd_max;
+  u32 cwnd_last;
+  u64 cwnd_sum;
+  u64 cwnd_samples;
+  u32 srtt_min_us;
+  u32 srtt_max_us;
+  u32 srtt_last_us;
+  u64 srtt_sum_us;
+  u64 rtt_samples;
+}};
+
+// LRU so flows that never close age out instead of filling the map
+BPF_TABLE("lru_hash", struct tcp_flow_key, struct tcp_flow, tcp_flows, {TCP_FLOW_MAX_ENTRIES});
+// Never written, a zeroed flow too large to build on the BPF stack
+BPF_ARRAY(tcp_flow_zero, struct tcp_flow, 1);
+BPF_PERCPU_ARRAY(tcp_flow_current, struct tcp_flow_key, 1);
+EVENT_OUTPUT(tcp_flow_closed, struct tcp_flow);
+
+static inline u32 tcp_flow_drop_slot(u8 drop_reason) {{
+  switch (drop_reason) {{
+{_DROP_SLOTS}
+  default: return 0;
+  }}
+}}
+
+static inline void tcp_flow_sock_key(struct sock* sk, struct tcp_flow_key* key) {{
+  struct inet_sock* inet = (struct inet_sock*)sk;
+  bpf_probe_read_kernel(&key->laddr, sizeof(key->laddr), &inet->inet_saddr);
+  bpf_probe_read_kernel(&key->raddr, sizeof(key->raddr), &inet->inet_daddr);
+  bpf_probe_read_kernel(&key->lport, sizeof(key->lport), &inet->inet_sport);
+  bpf_probe_read_kernel(&key->rport, sizeof(key->rport), &inet->inet_dport);
+}}
+
+// Offset probes see no arguments, they count against the packet their CPU entered with
+static inline struct tcp_flow_key* tcp_flow_current_key(void) {{
+  u32 zero = 0;
+  return tcp_flow_current.lookup(&zero);
+}}
+
+static inline struct tcp_flow* tcp_flow_get(struct tcp_flow_key* key) {{
+  u32 zero = 0;
+  struct tcp_flow* init = tcp_flow_zero.lookup(&zero);
+  if (!init)
+    return NULL;
+  struct tcp_flow* flow = tcp_flows.lookup_or_try_init(key, init);
+  if (!flow)
+    return NULL;
+  u64 now_us = bpf_ktime_get_ns() / 1000;
+  if (flow->first_ts_us == 0) {{
+    flow->key = *key;
+    flow->first_ts_us = now_us;
+  }}
+  flow->last_ts_us = now_us;
+  return flow;
+}}
+
+static inline void tcp_flow_count(struct tcp_flow* flow, u32 branch, u8 drop_reason, u32 weight) {{
+  if (branch < TCP_FLOW_BRANCHES)
+    __sync_fetch_and_add(&flow->branch_counts[branch], weight);
+  if (drop_reason) {{
+    u32 slot = tcp_flow_drop_slot(drop_reason);
+    __sync_fetch_and_add(&flow->drop_counts[slot], weight);
+  }}
+}}
+
+// min/max are not atomic, a racing CPU may lose an extreme but never a sample
+static inline void tcp_flow_summarize(struct tcp_flow* flow, u32 cwnd, u32 srtt_us) {{
+  if (cwnd) {{
+    if (flow->cwnd_min == 0 || cwnd < flow->cwnd_min)
+      flow->cwnd_min = cwnd;
+    if (cwnd > flow->cwnd_max)
+      flow->cwnd_max = cwnd;
+    flow->cwnd_last = cwnd;
+    __sync_fetch_and_add(&flow->cwnd_sum, cwnd);
+    __sync_fetch_and_add(&flow->cwnd_samples, 1);
+  }}
+  if (srtt_us) {{
+    if (flow->srtt_min_us == 0 || srtt_us < flow->srtt_min_us)
+      flow->srtt_min_us = srtt_us;
+    if (srtt_us > flow->srtt_max_us)
+      flow->srtt_max_us = srtt_us;
+    flow->srtt_last_us = srtt_us;
+    __sync_fetch_and_add(&flow->srtt_sum_us, srtt_us);
+    __sync_fetch_and_add(&flow->rtt_samples, 1);
+  }}
+}}
+
+int trace_tcp_flow_set_state(struct pt_regs* ctx, struct sock* sk, int state) {{
+  if (state != TCP_CLOSE)
+    return 0;
+  struct tcp_flow_key key = {{}};
+  tcp_flow_sock_key(sk, &key);
+  struct tcp_flow* flow = tcp_flows.lookup(&key);
+  if (!flow)
+    return 0;
+  flow->closed = 1;
+  flow->last_ts_us = bpf_ktime_get_ns() / 1000;
+  EVENT_EMIT(tcp_flow_closed, ctx, flow);
+  tcp_flows.delete(&key);
+  return 0;
+}}
+"""
+
+_PLACEHOLDER = "TCP_FLOWS();"
+
+
+def expand_flows(bpf_text: str, enabled: bool) -> str:
+  """Raw mode drops the placeholder so it allocates no flow map and no closed output."""
+  return bpf_text.replace(_PLACEHOLDER, _DECLARATIONS if enabled else "")
+
+
+@dataclass(frozen=True)
+class TcpFlowData:
+  ts_uptime_us: int
+  laddr: str
+  raddr: str
+  lport: int
+  rport: int
+  closed: bool
+  first_ts_us: int
+  last_ts_us: int
+  branch_counts: list[int]
+  drop_counts: list[int]
+  cwnd_min: int
+  cwnd_max: int
+  cwnd_last: int
+  cwnd_sum: int
+  cwnd_samples: int
+  srtt_min_us: int
+  srtt_max_us: int
+  srtt_last_us: int
+  srtt_sum_us: int
+  rtt_samples: int
+
+
+def flow_frame(rows: list[TcpFlowData]) -> pl.DataFrame:
+  # explicit schema so a tick without any drained flows still yields a valid table
+  return pl.DataFrame(rows, schema={
+    UPTIME_TIMESTAMP: pl.Int64(),
+    "laddr": pl.String(),
+    "raddr": pl.String(),
+    "lport": pl.Int32(),
+    "rport": pl.Int32(),
+    "closed": pl.Boolean(),
+    "first_ts_us": pl.Int64(),
+    "last_ts_us": pl.Int64(),
+    "branch_counts": pl.List(pl.Int64()),
+    "drop_counts": pl.List(pl.Int64()),
+    "cwnd_min": pl.Int64(),
+    "cwnd_max": pl.Int64(),
+    "cwnd_last": pl.Int64(),
+    "cwnd_sum": pl.Int64(),
+    "cwnd_samples": pl.Int64(),
+    "srtt_min_us": pl.Int64(),
+    "srtt_max_us": pl.Int64(),
+    "srtt_last_us": pl.Int64(),
+    "srtt_sum_us": pl.Int64(),
+    "rtt_samples": pl.Int64(),
+  })
+
+
+_FlowKey = tuple[int, int, int, int]
+
+
+class TcpFlows:
+  """Collects the flows of one hook's map, closed ones as they close and open ones every drain_ms.
+
+  Rows carry the counts and sums a flow gained since its previous row, while
+  the min, max and last summaries cover the flow's whole lifetime so far.
+  """
+
+  def __init__(self, bpf: BPF, events: EventTransport, drain_ms: int):
+    self.table = bpf["tcp_flows"]
+    self.drain_s = max(drain_ms, 0) / 1000
+    self.rows = list[TcpFlowData]()
+    self._totals = DrainTotals()
+    self._next_drain = time.monotonic() + self.drain_s
+    bpf.attach_kprobe(event=b"tcp_set_state", fn_name=b"trace_tcp_flow_set_state")
+    events.open(bpf, "tcp_flow_closed", self._closed_handler, page_cnt=64)
+
+  def poll(self):
+    """Drains the open flows once the drain interval has passed, the closed ones arrive through poll()."""
+    if time.monotonic() < self._next_drain:
+      return
+    self.drain()
+    self._next_drain = time.monotonic() + self.drain_s
+
+  def drain(self):
+    ts_uptime_us = int(time.clock_gettime_ns(time.CLOCK_BOOTTIME) / 1000)
+    flows = dict[_FlowKey, tuple[Any, Any]]((_flow_key(key), (key, flow)) for key, flow in self.table.items())
+    deltas = self._totals.drain((flow_key, _flow_total(flow)) for flow_key, (_, flow) in flows.items())
+    for flow_key, delta in deltas.items():
+      if any(delta):
+        key, flow = flows[flow_key]
+        self.rows.append(self._row(key, flow, ts_uptime_us, False, delta))
+
+  def pop(self) -> list[TcpFlowData]:
+    rows = self.rows
+    self.rows = list[TcpFlowData]()
+    return rows
+
+  def _closed_handler(self, cpu: int, flow: Any):
+    delta = self._totals.pop(_flow_key(flow.key), _flow_total(flow))
+    self.rows.append(self._row(flow.key, flow, flow.last_ts_us, True, delta))
+
+  def _row(self, key: Any, flow: Any, ts_uptime_us: int, closed: bool, delta: tuple[int, ...]) -> TcpFlowData:
+    branches = TCP_FLOW_BRANCHES
+    drops = len(TCP_FLOW_DROP_REASONS)
+    cwnd_sum, cwnd_samples, srtt_sum_us, rtt_samples = delta[branches + drops:]
+    return TcpFlowData(
+      ts_uptime_us=ts_uptime_us,
+      laddr=socket.inet_ntoa(struct.pack("I", key.laddr)),
+      raddr=socket.inet_ntoa(struct.pack("I", key.raddr)),
+      lport=socket.ntohs(key.lport),
+      rport=socket.ntohs(key.rport),
+      closed=closed,
+      first_ts_us=flow.first_ts_us,
+      last_ts_us=flow.last_ts_us,
+      branch_counts=list(delta[:branches]),
+      drop_counts=list(delta[branches:branches + drops]),
+      cwnd_min=flow.cwnd_min,
+      cwnd_max=flow.cwnd_max,
+      cwnd_last=flow.cwnd_last,
+      cwnd_sum=cwnd_sum,
+      cwnd_samples=cwnd_samples,
+      srtt_min_us=flow.srtt_min_us,
+      srtt_max_us=flow.srtt_max_us,
+      srtt_last_us=flow.srtt_last_us,
+      srtt_sum_us=srtt_sum_us,
+      rtt_samples=rtt_samples,
+    )
+
+
+def _flow_key(key: Any) -> _FlowKey:
+  return (key.laddr, key.raddr, key.lport, key.rport)
+
+
+def _flow_total(flow: Any) -> tuple[int, ...]:
+  return (
+    *flow.branch_counts,
+    *flow.drop_counts,
+    flow.cwnd_sum,
+    flow.cwnd_samples,
+    flow.srtt_sum_us,
+    flow.rtt_samples,
+  )
+
+
+__all__ = [
+  "expand_flows",
+  "flow_frame",
+  "TCP_FLOW_DROP_REASONS",
+  "TcpFlowData",
+  "TcpFlows",
+]
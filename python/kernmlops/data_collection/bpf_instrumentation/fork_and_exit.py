@@ -1,21 +1,15 @@
-from dataclasses import dataclass
 from pathlib import Path
 
 import polars as pl
 from bcc import BPF
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.columnar import EventColumns
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import CollectionTable
 from data_schema.generic_table import ProcessTraceDataTable
 
 
-@dataclass(frozen=True)
-class TraceProcessStat:
-  pid: int
-  tgid: int
-  ts_ns: int
-  name: str
-  cap_type: str
-
 class TraceProcessHook(BPFProgram):
 
   @classmethod
@@ -24,72 +18,65 @@ class TraceProcessHook(BPFProgram):
 
   def __init__(self):
     self.bpf_text = open(Path(__file__).parent / "bpf/fork_and_exit.bpf.c", "r").read()
-    self.trace_process = list[TraceProcessStat]()
+    # keyed by the cap_type each output records
+    self.trace_columns = {
+      "start": EventColumns(),
+      "end": EventColumns(),
+      "exec": EventColumns(),
+    }
 
   def load(self, collection_id: str):
     self.collection_id = collection_id
-    self.bpf = BPF(text = self.bpf_text)
+    self.events = EventTransport(self.options)
+    self.bpf = BPF(text = self.events.expand(expand_control(self.bpf_text, self.name())))
+    self.control = apply_control(self.bpf, self.name(), self.options)
     self.bpf.attach_kretprobe(event=b"copy_process", fn_name=b"kretprobe_copy_process")
     self.bpf.attach_kprobe(event=b"do_exit", fn_name=b"kprobe_do_exit")
     self.bpf.attach_kretprobe(event=b"__set_task_comm", fn_name=b"kretprobe_exec")
-    self.bpf["copy_task_events"].open_perf_buffer(self._create_task_eh, page_cnt=128)
-    self.bpf["release_task_events"].open_perf_buffer(self._release_task_eh, page_cnt=128)
-    self.bpf["exec_events"].open_perf_buffer(self._exec_eh, page_cnt=128)
+    self.events.open_columns(self.bpf, "copy_task_events", self.trace_columns["start"], page_cnt=128)
+    self.events.open_columns(self.bpf, "release_task_events", self.trace_columns["end"], page_cnt=128)
+    self.events.open_columns(self.bpf, "exec_events", self.trace_columns["exec"], page_cnt=128)
 
   def poll(self):
-    self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+    self.events.poll(self.bpf)
 
   def close(self):
     self.bpf.cleanup()
 
+  def lost_events(self) -> int:
+    return self.events.lost_events(self.bpf)
+
+  def poll_fds(self) -> list[int]:
+    return self.events.poll_fds(self.bpf)
+
   def data(self) -> list[CollectionTable]:
+    return self._tables({cap_type: columns.frame() for cap_type, columns in self.trace_columns.items()})
+
+  def _tables(self, events: dict[str, pl.DataFrame]) -> list[CollectionTable]:
+    frames = list[pl.DataFrame]()
+    for cap_type, frame in events.items():
+      if len(frame) == 0:
+        continue
+      # exits carry no comm
+      name = pl.col("buff") if "buff" in frame.columns else pl.lit("")
+      frames.append(frame.select(
+        pl.col("pid"),
+        pl.col("tgid"),
+        pl.col("ts").alias("ts_ns"),
+        name.alias("name"),
+        pl.lit(cap_type).alias("cap_type"),
+        pl.col("sample_weight"),
+      ))
     return [
             ProcessTraceDataTable.from_df_id(
-                pl.DataFrame(self.trace_process),
+                pl.concat(frames) if frames else pl.DataFrame(),
                 collection_id=self.collection_id,
             ),
         ]
 
   def clear(self):
-    self.trace_process.clear()
+    for columns in self.trace_columns.values():
+      columns.clear()
 
   def pop_data(self) -> list[CollectionTable]:
-    tables = self.data()
-    self.clear()
-    return tables
-
-  def _create_task_eh(self, cpu, start_data, size):
-      event = self.bpf["copy_task_events"].event(start_data)
-      self.trace_process.append(
-        TraceProcessStat(
-          pid=event.pid,
-          tgid=event.tgid,
-          ts_ns=event.ts,
-          name=event.buff.decode("ascii"),
-          cap_type="start"
-        )
-      )
-
-  def _release_task_eh(self, cpu, start_data, size):
-      event = self.bpf["release_task_events"].event(start_data)
-      self.trace_process.append(
-        TraceProcessStat(
-          pid=event.pid,
-          tgid=event.tgid,
-          ts_ns=event.ts,
-          name="",
-          cap_type="end"
-        )
-      )
-
-  def _exec_eh(self, cpu, start_data, size):
-      event = self.bpf["exec_events"].event(start_data)
-      self.trace_process.append(
-        TraceProcessStat(
-          pid=event.pid,
-          tgid=event.tgid,
-          ts_ns=event.ts,
-          name=event.buff.decode("ascii"),
-          cap_type="exec"
-        )
-      )
+    return self._tables({cap_type: columns.pop() for cap_type, columns in self.trace_columns.items()})
@@ -0,0 +1,204 @@
+"""Per 2MB region fault counts kept in a BPF LRU hash.
+
+The page fault hook can count every fault against the huge page sized region
+it hit, keyed by tgid and address >> 21, instead of leaving the bucketing to
+offline joins. One placeholder is expanded here before the event placeholders:
+
+  FAULT_REGIONS();    declare the region map and fault_region_count() below
+
+  fault_region_count(tgid, address, is_major, is_write, is_exec, weight, ts_us)
+
+FAULT_REGIONS_ENABLED is 1 when the map exists so callers can guard the call.
+The map is registered in fstore as "fault_regions" for in-kernel huge page
+policies to look up, with the layout
+
+  key   struct fault_region_key { u64 tgid; u64 region; }
+  value struct fault_region { u64 faults, major_faults, write_faults,
+                              exec_faults, first_ts_us, last_ts_us;
+                              u32 access; u32 pad; }
+
+access ORs FAULT_REGION_READ/WRITE/EXEC of every fault seen. Userspace drains
+the regions every drain interval as the faults they gained since the previous
+drain, see FaultRegionTable.
+"""
+
+import time
+from dataclasses import dataclass
+from typing import Any, Final
+
+import polars as pl
+from bcc import BPF
+from data_collection.bpf_instrumentation.histogram import DrainTotals
+from data_collection.fstore import FStore
+from data_schema import UPTIME_TIMESTAMP
+
+FAULT_REGION_SHIFT: Final[int] = 21
+FAULT_REGION_MAX_ENTRIES: Final[int] = 65536
+FAULT_REGIONS_FSTORE_NAME: Final[str] = "fault_regions"
+
+FAULT_REGION_READ: Final[int] = 0x1
+FAULT_REGION_WRITE: Final[int] = 0x2
+FAULT_REGION_EXEC: Final[int] = 0x4
+
+_DECLARATIONS: Final[str] = f"""#define FAULT_REGIONS_ENABLED 1
+#define FAULT_REGION_SHIFT {FAULT_REGION_SHIFT}
+#define FAULT_REGION_READ  {FAULT_REGION_READ}
+#define FAULT_REGION_WRITE {FAULT_REGION_WRITE}
+#define FAULT_REGION_EXEC  {FAULT_REGION_EXEC}
+
+// No padding, the key is hashed as raw bytes
+struct fault_region_key {{
+  u64 tgid;
+  u64 region;
+}};
+
+struct fault_region {{
+  u64 faults;
+  u64 major_faults;
+  u64 write_faults;
+  u64 exec_faults;
+  u64 first_ts_us;
+  u64 last_ts_us;
+  u32 access;
+  u32 pad;
+}};
+
+BPF_TABLE("lru_hash", struct fault_region_key, struct fault_region, fault_regions, {FAULT_REGION_MAX_ENTRIES});
+
+static inline void fault_region_count(u32 tgid, u64 address, u8 is_major, u8 is_write, u8 is_exec,
+                                      u32 weight, u64 ts_us) {{
+  struct fault_region_key key = {{}};
+  key.tgid = tgid;
+  key.region = address >> FAULT_REGION_SHIFT;
+  struct fault_region init = {{}};
+  init.first_ts_us = ts_us;
+  struct fault_region* region = fault_regions.lookup_or_try_init(&key, &init);
+  if (!region)
+    return;
+  __sync_fetch_and_add(&region->faults, weight);
+  if (is_major)
+    __sync_fetch_and_add(&region->major_faults, weight);
+  if (is_write)
+    __sync_fetch_and_add(&region->write_faults, weight);
+  if (is_exec)
+    __sync_fetch_and_add(&region->exec_faults, weight);
+  // Racing writers may drop a bit the first time two kinds of access meet, the counts stay exact
+  region->access |= is_exec ? FAULT_REGION_EXEC : is_write ? FAULT_REGION_WRITE : FAULT_REGION_READ;
+  if (ts_us > region->last_ts_us)
+    region->last_ts_us = ts_us;
+}}
+"""
+
+_DISABLED: Final[str] = "#define FAULT_REGIONS_ENABLED 0\n"
+
+_PLACEHOLDER = "FAULT_REGIONS();"
+
+
+def expand_regions(bpf_text: str, enabled: bool) -> str:
+  return bpf_text.replace(_PLACEHOLDER, _DECLARATIONS if enabled else _DISABLED)
+
+
+@dataclass(frozen=True)
+class FaultRegionData:
+  ts_uptime_us: int
+  tgid: int
+  region: int
+  faults: int
+  major_faults: int
+  write_faults: int
+  exec_faults: int
+  access: int
+  first_ts_us: int
+  last_ts_us: int
+
+
+def region_frame(rows: list[FaultRegionData]) -> pl.DataFrame:
+  # explicit schema so a tick without any drained regions still yields a valid table
+  return pl.DataFrame(rows, schema={
+    UPTIME_TIMESTAMP: pl.Int64(),
+    "tgid": pl.Int64(),
+    "region": pl.Int64(),
+    "faults": pl.Int64(),
+    "major_faults": pl.Int64(),
+    "write_faults": pl.Int64(),
+    "exec_faults": pl.Int64(),
+    "access": pl.Int64(),
+    "first_ts_us": pl.Int64(),
+    "last_ts_us": pl.Int64(),
+  })
+
+
+_RegionKey = tuple[int, int]
+
+
+class FaultRegions:
+  """Registers one hook's region map in fstore and drains it every drain_ms.
+
+  Rows carry the faults a region gained since its previous row, while access
+  and the touch timestamps cover its whole lifetime in the map so far.
+  """
+
+  def __init__(self, bpf: BPF, drain_ms: int):
+    self.table = bpf["fault_regions"]
+    self.drain_s = max(drain_ms, 0) / 1000
+    self.rows = list[FaultRegionData]()
+    self._totals = DrainTotals()
+    self._next_drain = time.monotonic() + self.drain_s
+    self.fstore: FStore | None = None
+    try:
+      self.fstore = FStore()
+      self.fstore.register(self.table.map_fd, FAULT_REGIONS_FSTORE_NAME)
+    except OSError as e:
+      print(f"info: fault regions are not in fstore: {e}")
+      if self.fstore is not None:
+        self.fstore.close()
+        self.fstore = None
+
+  def poll(self):
+    if time.monotonic() < self._next_drain:
+      return
+    self.drain()
+    self._next_drain = time.monotonic() + self.drain_s
+
+  def drain(self):
+    ts_uptime_us = int(time.clock_gettime_ns(time.CLOCK_BOOTTIME) / 1000)
+    regions = dict[_RegionKey, Any](((key.tgid, key.region), region) for key, region in self.table.items())
+    deltas = self._totals.drain(
+      (region_key, (region.faults, region.major_faults, region.write_faults, region.exec_faults))
+      for region_key, region in regions.items()
+    )
+    for (tgid, region_id), (faults, major_faults, write_faults, exec_faults) in deltas.items():
+      if faults == 0:
+        continue
+      region = regions[(tgid, region_id)]
+      self.rows.append(FaultRegionData(
+        ts_uptime_us=ts_uptime_us,
+        tgid=tgid,
+        region=region_id,
+        faults=faults,
+        major_faults=major_faults,
+        write_faults=write_faults,
+        exec_faults=exec_faults,
+        access=region.access,
+        first_ts_us=region.first_ts_us,
+        last_ts_us=region.last_ts_us,
+      ))
+
+  def pop(self) -> list[FaultRegionData]:
+    rows = self.rows
+    self.rows = list[FaultRegionData]()
+    return rows
+
+  def close(self):
+    if self.fstore is not None:
+      self.fstore.close()
+      self.fstore = None
+
+
+__all__ = [
+  "expand_regions",
+  "FAULT_REGION_SHIFT",
+  "FaultRegionData",
+  "FaultRegions",
+  "region_frame",
+]
@@ -0,0 +1,161 @@
+"""Per-CPU log2 latency histograms kept in BPF maps.
+
+Hooks in aggregate mode count latencies in the kernel instead of emitting an
+event per occurrence, using two placeholders expanded here:
+
+  LATENCY_HISTOGRAM(name);                                   declare a histogram map
+  LATENCY_RECORD(name, tgid, id, kind, value_us[, weight]);  count value_us in its log2 bucket
+
+`id` is hook specific (device, branch, ...) and `kind` distinguishes the
+latencies a single hook tracks. Sampled hooks pass the event's sample_weight
+so counts still estimate every occurrence. Like the event placeholders these
+are textual since BCC refuses table methods inside macros.
+
+Bucket b counts values in [2^(b-1), 2^b - 1] with bucket 0 holding zeros,
+matching bpf_log2l and BCC's own histograms.
+
+DrainTotals turns the running counts of an LRU map's entries into deltas since
+the previous drain, for these histograms and the other aggregate maps.
+"""
+
+import re
+import time
+from collections.abc import Hashable, Iterable, Mapping
+from dataclasses import dataclass
+from typing import Final
+
+import polars as pl
+from bcc import BPF
+from data_schema import UPTIME_TIMESTAMP
+
+HISTOGRAM_MAX_ENTRIES: Final[int] = 10240
+
+_KEY_STRUCT: Final[str] = """struct latency_hist_key {
+  u32 tgid;
+  u32 id;
+  u32 kind;
+  u32 slot;
+};
+"""
+
+_PLACEHOLDER = re.compile(r"\b(LATENCY_HISTOGRAM|LATENCY_RECORD)\s*\(([^;]*)\)\s*;")
+
+
+@dataclass(frozen=True)
+class LatencyHistogramData:
+  ts_uptime_us: int
+  tgid: int
+  key_id: int
+  latency_kind: str
+  bucket: int
+  count: int
+
+
+def histogram_frame(rows: list[LatencyHistogramData]) -> pl.DataFrame:
+  # explicit schema so a tick without any drained buckets still yields a valid table
+  return pl.DataFrame(rows, schema={
+    UPTIME_TIMESTAMP: pl.Int64(),
+    "tgid": pl.Int64(),
+    "key_id": pl.Int64(),
+    "latency_kind": pl.String(),
+    "bucket": pl.Int64(),
+    "count": pl.Int64(),
+  })
+
+
+def expand_histograms(bpf_text: str) -> str:
+  declared = False
+
+  def _expand_one(match: re.Match[str]) -> str:
+    nonlocal declared
+    args = [arg.strip() for arg in match.group(2).split(",")]
+    if match.group(1) == "LATENCY_HISTOGRAM":
+      (name,) = args
+      # LRU so exited tgids age out instead of filling the map
+      table = f'BPF_TABLE("lru_percpu_hash", struct latency_hist_key, u64, {name}, {HISTOGRAM_MAX_ENTRIES});'
+      if declared:
+        return table
+      declared = True
+      return _KEY_STRUCT + table
+    name, tgid, key_id, kind, value_us, *weight = args
+    return (
+      f"{{ struct latency_hist_key {name}_key = {{}}; "
+      f"{name}_key.tgid = {tgid}; {name}_key.id = {key_id}; {name}_key.kind = {kind}; "
+      f"{name}_key.slot = bpf_log2l({value_us}); "
+      f"{name}.increment({name}_key, {weight[0] if weight else 1}); }}"
+    )
+
+  return _PLACEHOLDER.sub(_expand_one, bpf_text)
+
+
+class DrainTotals:
+  """Running counts per map entry as of the previous drain.
+
+  Every drain rebuilds the totals from the entries it read, so ones the LRU
+  evicted drop out instead of piling up. An entry with any count below its
+  previous total was evicted and recreated, its whole count is new.
+  """
+
+  def __init__(self):
+    self._totals = dict[Hashable, tuple[int, ...]]()
+    # entries the last drain no longer found, for a pop() trailing their removal
+    self._gone = dict[Hashable, tuple[int, ...]]()
+
+  def drain(self, entries: Iterable[tuple[Hashable, tuple[int, ...]]]) -> dict[Hashable, tuple[int, ...]]:
+    """Each entry's counts since the previous drain, from (key, total) of every entry in the map."""
+    totals = dict(entries)
+    deltas = {key: _delta(total, self._totals.get(key)) for key, total in totals.items()}
+    self._gone = {key: total for key, total in self._totals.items() if key not in totals}
+    self._totals = totals
+    return deltas
+
+  def pop(self, key: Hashable, total: tuple[int, ...]) -> tuple[int, ...]:
+    """Counts since the previous drain of an entry that left the map, which is forgotten."""
+    previous = self._totals.pop(key, None)
+    return _delta(total, previous if previous is not None else self._gone.pop(key, None))
+
+
+def _delta(total: tuple[int, ...], previous: tuple[int, ...] | None) -> tuple[int, ...]:
+  if previous is None or any(now < before for now, before in zip(total, previous)):
+    return total
+  return tuple(now - before for now, before in zip(total, previous))
+
+
+class LatencyHistogram:
+  """Drains the per-CPU counts of one histogram map as deltas since the last drain."""
+
+  def __init__(self, bpf: BPF, name: str, kinds: Mapping[int, str]):
+    self.table = bpf[name]
+    self.kinds = kinds
+    self._totals = DrainTotals()
+
+  def drain(self) -> list[LatencyHistogramData]:
+    ts_uptime_us = int(time.clock_gettime_ns(time.CLOCK_BOOTTIME) / 1000)
+    deltas = list[LatencyHistogramData]()
+    buckets = self._totals.drain(
+      ((key.tgid, key.id, key.kind, key.slot), (sum(per_cpu_counts),))
+      for key, per_cpu_counts in self.table.items()
+    )
+    for (tgid, key_id, kind, slot), (count,) in buckets.items():
+      if count == 0:
+        continue
+      deltas.append(
+        LatencyHistogramData(
+          ts_uptime_us=ts_uptime_us,
+          tgid=tgid,
+          key_id=key_id,
+          latency_kind=self.kinds.get(kind, str(kind)),
+          bucket=slot,
+          count=count,
+        )
+      )
+    return deltas
+
+
+__all__ = [
+  "DrainTotals",
+  "expand_histograms",
+  "histogram_frame",
+  "LatencyHistogram",
+  "LatencyHistogramData",
+]
@@ -0,0 +1,58 @@
+"""Loading the configured hooks at collect start.
+
+Nearly all of a hook's load time is BCC compiling its program with clang/LLVM
+inside libbcc. ctypes releases the GIL for that call, so spreading the hooks
+over threads can make startup approach the slowest hook instead of the sum of
+all of them. load_threads: 1, the default, still loads the hooks one after
+another; the pool stays opt-in until a real multi-hook run has been checked
+against it. Each compile in flight holds its own clang state, so peak RSS
+during startup grows with the threads in use.
+collect records hook_load_sec and hook_load_max_rss_kb in system_info to weigh
+one against the other on a given host.
+
+Compiled BCC programs cannot be cached across runs since their bytecode
+embeds the file descriptors of maps created by the process that compiled it.
+"""
+
+import os
+import time
+from collections.abc import Sequence
+from concurrent.futures import ThreadPoolExecutor
+from pathlib import Path
+
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.control import CONTROL_PIN_PREFIX, HookControl
+
+
+def _ensure_control_pinned():
+  # Concurrent first loads would race to create and pin the shared control maps
+  pins = ("hook_controls", "tgid_allow", "cgroup_allow")
+  if not all(Path(f"{CONTROL_PIN_PREFIX}{pin}").exists() for pin in pins):
+    HookControl()
+
+
+def _timed_load(hook: BPFProgram, collection_id: str) -> float:
+  start = time.perf_counter()
+  hook.load(collection_id)
+  return time.perf_counter() - start
+
+
+def load_hooks(hooks: Sequence[BPFProgram], collection_id: str, threads: int = 1) -> dict[str, float]:
+  """Loads every hook, on up to `threads` threads, and returns the seconds each took.
+
+  0 uses one thread per CPU of the calling thread's affinity, 1 loads them in
+  order. The first failure is raised once all hooks finished loading.
+  """
+  if threads <= 0:
+    threads = len(os.sched_getaffinity(0))
+  if threads <= 1 or len(hooks) <= 1:
+    return {hook.name(): _timed_load(hook, collection_id) for hook in hooks}
+  _ensure_control_pinned()
+  with ThreadPoolExecutor(max_workers=min(threads, len(hooks)), thread_name_prefix="hook-load") as pool:
+    futures = [pool.submit(_timed_load, hook, collection_id) for hook in hooks]
+  return {hook.name(): future.result() for hook, future in zip(hooks, futures)}
+
+
+__all__ = [
+  "load_hooks",
+]
@@ -3,7 +3,9 @@ from pathlib import Path
 
 import polars as pl
 from bcc import BPF
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import CollectionTable
 from data_schema.generic_table import MadviseDataTable
 
@@ -43,6 +45,7 @@ class MadviseStat:
   address: int
   length: int
   advice: str
+  sample_weight: int
 
 class MadviseBPFHook(BPFProgram):
 
@@ -57,7 +60,9 @@ class MadviseBPFHook(BPFProgram):
 
   def load(self, collection_id: str):
     self.collection_id = collection_id
-    self.bpf = BPF(text = self.bpf_text)
+    self.events = EventTransport(self.options)
+    self.bpf = BPF(text = self.events.expand(expand_control(self.bpf_text, self.name())))
+    self.control = apply_control(self.bpf, self.name(), self.options)
     self.bpf.attach_kprobe(event=b"do_madvise",
                            fn_name=b"kprobe__do_madvise")
     self.bpf.attach_kretprobe(event=b"do_madvise",
@@ -66,14 +71,20 @@ class MadviseBPFHook(BPFProgram):
                            fn_name=b"kprobe__do_vmi_align_munmap")
     self.bpf.attach_kretprobe(event=b"do_vmi_align_munmap",
                               fn_name=b"kretprobe__do_vmi_align_munmap")
-    self.bpf["madvise_output"].open_perf_buffer(self._madvise_eh, page_cnt=64)
+    self.events.open(self.bpf, "madvise_output", self._madvise_eh, page_cnt=64)
 
   def poll(self):
-    self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+    self.events.poll(self.bpf)
 
   def close(self):
     self.bpf.cleanup()
 
+  def lost_events(self) -> int:
+    return self.events.lost_events(self.bpf)
+
+  def poll_fds(self) -> list[int]:
+    return self.events.poll_fds(self.bpf)
+
   def data(self) -> list[CollectionTable]:
     return [
             MadviseDataTable.from_df_id(
@@ -90,8 +101,7 @@ class MadviseBPFHook(BPFProgram):
     self.clear()
     return tables
 
-  def _madvise_eh(self, cpu, madvise_struct, size):
-      event = self.bpf["madvise_output"].event(madvise_struct)
+  def _madvise_eh(self, cpu, event):
       advice = ADVICE_ASSIGN_DICT[event.advice] if event.advice in ADVICE_ASSIGN_DICT.keys() else "UNKNOWN"
       self.madvise_stat.append(
         MadviseStat(
@@ -100,5 +110,6 @@ class MadviseBPFHook(BPFProgram):
           address=event.address,
           length=event.length,
           advice=advice,
+          sample_weight=event.sample_weight,
         )
       )
@@ -3,7 +3,9 @@ from pathlib import Path
 
 import polars as pl
 from bcc import BPF
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import CollectionTable
 from data_schema.generic_table import TraceMMRSSStatDataTable
 
@@ -15,6 +17,7 @@ class TraceRSSStat:
   ts_ns: int
   member: str
   count: int
+  sample_weight: int
 
 MEMBER_ASSIGN_ARR = ["MM_FILEPAGES", "MM_ANONPAGES", "MM_SWAPENTS", "MM_SHMEMPAGES"]
 
@@ -31,16 +34,24 @@ class TraceRSSStatBPFHook(BPFProgram):
 
   def load(self, collection_id: str):
     self.collection_id = collection_id
-    self.bpf = BPF(text = self.bpf_text)
+    self.events = EventTransport(self.options)
+    self.bpf = BPF(text = self.events.expand(expand_control(self.bpf_text, self.name())))
+    self.control = apply_control(self.bpf, self.name(), self.options)
     #self.bpf.attach_raw_tracepoint(tp=b"mm_trace_rss_stat", fn_name=b"mm_trace_rss_stat")
-    self.bpf["rss_stat_output"].open_perf_buffer(self._mm_trace_rss_stat_eh, page_cnt=256)
+    self.events.open(self.bpf, "rss_stat_output", self._mm_trace_rss_stat_eh, page_cnt=256)
 
   def poll(self):
-    self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+    self.events.poll(self.bpf)
 
   def close(self):
     self.bpf.cleanup()
 
+  def lost_events(self) -> int:
+    return self.events.lost_events(self.bpf)
+
+  def poll_fds(self) -> list[int]:
+    return self.events.poll_fds(self.bpf)
+
   def data(self) -> list[CollectionTable]:
     return [
             TraceMMRSSStatDataTable.from_df_id(
@@ -57,8 +68,7 @@ class TraceRSSStatBPFHook(BPFProgram):
     self.clear()
     return quanta_tables
 
-  def _mm_trace_rss_stat_eh(self, cpu, rss_stat_struct, size):
-      event = self.bpf["rss_stat_output"].event(rss_stat_struct)
+  def _mm_trace_rss_stat_eh(self, cpu, event):
       self.trace_rss_stat.append(
         TraceRSSStat(
           pid=event.pid,
@@ -66,5 +76,6 @@ class TraceRSSStatBPFHook(BPFProgram):
           ts_ns=event.ts,
           member=MEMBER_ASSIGN_ARR[event.member],
           count=event.counter_value,
+          sample_weight=event.sample_weight,
         )
       )
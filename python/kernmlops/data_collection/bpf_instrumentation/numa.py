@@ -0,0 +1,124 @@
+"""NUMA node local draining of per-CPU perf buffers.
+
+The kernel allocates the pages of each CPU's perf buffer on that CPU's node,
+so a collector that polls them all from one thread reads remote memory for
+every other node. NodePoller.per_node starts one poller per node that is
+pinned to the node, collector CPUs of the node first, and consumes only the
+buffers of the node's CPUs.
+
+Those buffers then leave the hooks' own poll() and poll_fds(), which keep
+everything else: ring buffers, which are one per output and not per CPU,
+aggregate map drains and /proc readers stay with the regular pollers.
+"""
+
+import os
+import select
+from collections.abc import Sequence
+from threading import Event, Thread
+from typing import Final
+
+from bcc import BPF
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.transport import EventTransport, Transport
+from data_collection.system_info import numa_topology
+
+NODE_POLL_TIMEOUT_S: Final[float] = 0.1
+
+
+def _perf_transport(hook: BPFProgram) -> tuple[EventTransport, BPF] | None:
+  events = getattr(hook, "events", None)
+  bpf = getattr(hook, "bpf", None)
+  if not isinstance(events, EventTransport) or bpf is None or events.transport != Transport.PERF:
+    return None
+  return events, bpf
+
+
+class NodePoller:
+  """Consumes the perf buffers of one node's CPUs as soon as they have data."""
+
+  def __init__(self, node: int, cpus: Sequence[int], pin_cpus: Sequence[int], hooks: Sequence[BPFProgram]):
+    self.node = node
+    self.cpus = frozenset(cpus)
+    self.pin_cpus = set(pin_cpus)
+    self._epoll = select.epoll()
+    self._fd_transports = dict[int, tuple[EventTransport, BPF]]()
+    self.transports = list[tuple[EventTransport, BPF]]()
+    for hook in hooks:
+      transport = _perf_transport(hook)
+      if transport is None:
+        continue
+      self.transports.append(transport)
+      for fd in transport[0].perf_cpu_fds(transport[1], self.cpus):
+        self._epoll.register(fd, select.EPOLLIN)
+        self._fd_transports[fd] = transport
+    self._thread: Thread | None = None
+    self._stop = Event()
+
+  @classmethod
+  def per_node(cls, hooks: Sequence[BPFProgram], collector_cpus: Sequence[int] = ()) -> list["NodePoller"]:
+    """One poller per node and hands them the hooks' perf buffers.
+
+    A node without collector CPUs is drained from all collector CPUs rather
+    than from CPUs reserved for the benchmark.
+    """
+    pollers = [
+      cls(
+        node,
+        cpus,
+        [cpu for cpu in collector_cpus if cpu in cpus] or list(collector_cpus) or cpus,
+        hooks,
+      )
+      for node, cpus in numa_topology().items()
+    ]
+    for hook in hooks:
+      transport = _perf_transport(hook)
+      if transport is not None:
+        transport[0].cpu_drained = True
+    return pollers
+
+  def drain(self):
+    for events, bpf in self.transports:
+      events.poll_cpus(bpf, self.cpus)
+
+  def start(self):
+    self._thread = Thread(target=self._run, name=f"node-poller-{self.node}", daemon=True)
+    self._thread.start()
+
+  def _run(self):
+    # pid 0 pins only the calling thread
+    os.sched_setaffinity(0, self.pin_cpus)
+    while not self._stop.is_set():
+      try:
+        ready_fds = self._epoll.poll(NODE_POLL_TIMEOUT_S)
+        if not ready_fds:
+          # batched producers may sit below their wakeup watermark
+          self.drain()
+          continue
+        ready = list[tuple[EventTransport, BPF]]()
+        for fd, _ in ready_fds:
+          transport = self._fd_transports[fd]
+          if transport not in ready:
+            ready.append(transport)
+        for events, bpf in ready:
+          events.poll_cpus(bpf, self.cpus)
+      except InterruptedError:
+        pass
+      except Exception as e:
+        print(f"error draining node {self.node}: {e}")
+
+  def close(self):
+    """Stops the thread, then drains what is left of the node's buffers."""
+    self._stop.set()
+    if self._thread is not None:
+      self._thread.join()
+      self._thread = None
+    try:
+      self.drain()
+    except Exception:
+      pass
+    self._epoll.close()
+
+
+__all__ = [
+  "NodePoller",
+]
@@ -1,26 +1,22 @@
-from dataclasses import dataclass
 from pathlib import Path
 
 import polars as pl
 from bcc import BPF
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.columnar import EventColumns
+from data_collection.bpf_instrumentation.comm import TaskComms, expand_comm
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.features import feature_flags
+from data_collection.bpf_instrumentation.heatmap import (
+    FaultRegionData,
+    FaultRegions,
+    expand_regions,
+    region_frame,
+)
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import CollectionTable
 
 
-@dataclass(frozen=True)
-class PageFaultData:
-    cpu: int
-    pid: int
-    tgid: int
-    ts_uptime_us: int
-    address: int
-    error_code: int
-    is_major: bool
-    is_write: bool
-    is_exec: bool
-    comm: str
-
-
 class PageFaultBPFHook(BPFProgram):
 
     @classmethod
@@ -39,63 +35,91 @@ class PageFaultBPFHook(BPFProgram):
             bpf_text = bpf_text.replace('FAULT_FLAG_INSTRUCTION', '0x20')
 
         self.bpf_text = bpf_text
-        self.page_fault_data = list[PageFaultData]()
+        self.page_fault_columns = EventColumns()
+        self.comms: TaskComms | None = None
+        self.regions: FaultRegions | None = None
 
     def load(self, collection_id: str):
         self.collection_id = collection_id
-        self.bpf = BPF(text=self.bpf_text)
-
-        # Attach kprobe and kretprobe with explicit function names
-        self.bpf.attach_kprobe(event=b"handle_mm_fault", fn_name=b"trace_handle_mm_fault_entry")
-        self.bpf.attach_kretprobe(event=b"handle_mm_fault", fn_name=b"trace_handle_mm_fault_return")
-
-        # Open perf buffer for receiving events
-        self.bpf["page_fault_events"].open_perf_buffer(
-            self._page_fault_handler, page_cnt=128
+        self.events = EventTransport(self.options)
+        fentry, task_storage = feature_flags(self.options.fentry, self.options.task_storage)
+        bpf_text = self.bpf_text.replace('USE_FENTRY', '1' if fentry else '0')
+        bpf_text = bpf_text.replace('USE_TASK_STORAGE', '1' if task_storage else '0')
+        bpf_text = bpf_text.replace('AGGREGATE', '1' if self.options.aggregate else '0')
+        bpf_text = expand_regions(bpf_text, self.options.fault_regions)
+        bpf_text = expand_comm(expand_control(bpf_text, self.name()), self.options.intern_comm)
+        self.bpf = BPF(text=self.events.expand(bpf_text))
+        self.control = apply_control(self.bpf, self.name(), self.options)
+        if self.options.intern_comm:
+            self.comms = TaskComms(self.bpf, self.events)
+        if self.options.fault_regions:
+            self.regions = FaultRegions(self.bpf, self.options.fault_region_drain_ms)
+
+        # fentry/fexit programs are attached by BCC on load
+        if not fentry:
+            self.bpf.attach_kprobe(event=b"handle_mm_fault", fn_name=b"trace_handle_mm_fault_entry")
+            self.bpf.attach_kretprobe(event=b"handle_mm_fault", fn_name=b"trace_handle_mm_fault_return")
+
+        # Open event output for receiving events
+        self.events.open_columns(
+            self.bpf, "page_fault_events", self.page_fault_columns, page_cnt=128
         )
 
     def poll(self):
-        self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+        self.events.poll(self.bpf)
+        if self.regions is not None:
+            self.regions.poll()
 
     def close(self):
+        if self.regions is not None:
+            self.regions.close()
         self.bpf.cleanup()
 
-    def _page_fault_handler(self, cpu, data, size):
-        event = self.bpf["page_fault_events"].event(data)
-        try:
-            self.page_fault_data.append(
-                PageFaultData(
-                    cpu=cpu,
-                    pid=event.pid,
-                    tgid=event.tgid,
-                    ts_uptime_us=event.ts_uptime_us,
-                    address=event.address,
-                    error_code=event.error_code,
-                    is_major=bool(event.is_major),
-                    is_write=bool(event.is_write),
-                    is_exec=bool(event.is_exec),
-                    comm=event.comm.decode('utf-8', 'replace')
-                )
-            )
-        except Exception as e:
-            # Log errors for debugging
-            print(f"Error handling page fault event: {e}")
+    def lost_events(self) -> int:
+        return self.events.lost_events(self.bpf)
+
+    def poll_fds(self) -> list[int]:
+        return self.events.poll_fds(self.bpf)
 
     def data(self) -> list[CollectionTable]:
+        regions = self.regions.rows if self.regions is not None else None
+        return self._tables(regions, self.page_fault_columns.frame())
+
+    def _tables(self, regions: list[FaultRegionData] | None, faults: pl.DataFrame) -> list[CollectionTable]:
+        from data_schema.fault_region import FaultRegionTable
         from data_schema.page_fault import PageFaultTable
-        if len(self.page_fault_data) == 0:
-            return []
-        return [
+        tables = list[CollectionTable]()
+        if regions is not None:
+            tables.append(
+                FaultRegionTable.from_df_id(
+                    region_frame(regions),
+                    collection_id=self.collection_id
+                )
+            )
+        if len(faults) == 0:
+            return tables
+        tables.append(
             PageFaultTable.from_df_id(
-                pl.DataFrame(self.page_fault_data),
+                faults.with_columns(
+                    pl.col("is_major", "is_write", "is_exec").cast(pl.Boolean())
+                ),
                 collection_id=self.collection_id
             )
-        ]
+        )
+        return tables
+
+    def recent_events(self) -> dict[str, pl.DataFrame]:
+        return {"page_fault_events": self.page_fault_columns.pop_recent()}
 
     def clear(self):
-        self.page_fault_data.clear()
+        self.page_fault_columns.clear()
+        if self.regions is not None:
+            self.regions.pop()
 
     def pop_data(self) -> list[CollectionTable]:
-        tables = self.data()
-        self.clear()
+        # the poller keeps appending events and drained regions, take each as it is reset
+        regions = self.regions.pop() if self.regions is not None else None
+        tables = self._tables(regions, self.page_fault_columns.pop())
+        if self.comms is not None:
+            tables.extend(self.comms.pop(self.collection_id))
         return tables
@@ -0,0 +1,204 @@
+"""Counting mode of the perf hook.
+
+Instead of a BPF program per counter overflow, every counter is opened in a
+perf event array and read with bpf_perf_event_read_value() at each context
+switch. The delta since the CPU's previous switch belongs to the task being
+switched out and is summed into a per-CPU LRU hash keyed by its tgid and
+cgroup, or by cgroup alone. Userspace drains the totals every drain interval
+as the deltas each key gained since the previous drain.
+
+Counters multiplexed onto the PMU are scaled by enabled/running time in the
+kernel, so a delta estimates what the counter would have counted alone.
+"""
+
+import time
+from dataclasses import dataclass
+from typing import Any, Final
+
+import polars as pl
+from bcc import BPF, PerfHWConfig, PerfType
+from data_collection.bpf_instrumentation.histogram import DrainTotals
+from data_schema import UPTIME_TIMESTAMP
+
+PERF_COUNT_MAX_ENTRIES: Final[int] = 10240
+
+
+@dataclass(frozen=True)
+class PerfCounter:
+  name: str
+  ev_type: int
+  ev_config: int
+
+
+# Counted alongside the perf tables' events so IPC comes with every row
+BASE_COUNTERS: Final[tuple[PerfCounter, ...]] = (
+  PerfCounter("cycles", PerfType.HARDWARE, PerfHWConfig.CPU_CYCLES),
+  PerfCounter("instructions", PerfType.HARDWARE, PerfHWConfig.INSTRUCTIONS),
+)
+
+_DECLARATIONS: Final[str] = f"""#include <linux/sched.h>
+
+#define PERF_COUNTERS PERF_COUNTER_SLOTS
+
+// No padding, the key is hashed as raw bytes
+struct perf_count_key {{
+  u64 tgid;
+  u64 cgroup_id;
+}};
+
+struct perf_counts {{
+  u64 on_cpu_ns;
+  u64 counts[PERF_COUNTERS];
+}};
+
+// What each counter read at this CPU's previous switch
+struct perf_count_last {{
+  u64 ts_ns;
+  u64 counter[PERF_COUNTERS];
+  u64 enabled[PERF_COUNTERS];
+  u64 running[PERF_COUNTERS];
+}};
+
+BPF_PERCPU_ARRAY(perf_count_last, struct perf_count_last, 1);
+BPF_TABLE("lru_percpu_hash", struct perf_count_key, struct perf_counts, perf_counts, {PERF_COUNT_MAX_ENTRIES});
+PERF_COUNTER_ARRAYS
+
+static inline u64 perf_count_delta(struct perf_count_last* last, u32 slot,
+                                   struct bpf_perf_event_value* value) {{
+  if (slot >= PERF_COUNTERS)
+    return 0;
+  u64 counter = value->counter - last->counter[slot];
+  u64 enabled = value->enabled - last->enabled[slot];
+  u64 running = value->running - last->running[slot];
+  last->counter[slot] = value->counter;
+  last->enabled[slot] = value->enabled;
+  last->running[slot] = value->running;
+  // Multiplexed, scale to the time the counter was enabled
+  if (running && running < enabled)
+    counter = counter * enabled / running;
+  return counter;
+}}
+
+TRACEPOINT_PROBE(sched, sched_switch) {{
+  u32 zero = 0;
+  struct perf_count_last* last = perf_count_last.lookup(&zero);
+  if (!last)
+    return 0;
+  u64 now = bpf_ktime_get_ns();
+  // The first switch of a CPU only sets its baseline
+  struct perf_counts* counts = NULL;
+  if (last->ts_ns) {{
+    struct perf_count_key key = {{}};
+    key.tgid = PERF_COUNT_BY_CGROUP ? 0 : bpf_get_current_pid_tgid() >> 32;
+    key.cgroup_id = bpf_get_current_cgroup_id();
+    struct perf_counts init = {{}};
+    counts = perf_counts.lookup_or_try_init(&key, &init);
+    if (counts)
+      counts->on_cpu_ns += now - last->ts_ns;
+  }}
+  last->ts_ns = now;
+  struct bpf_perf_event_value value = {{}};
+  u64 delta = 0;
+PERF_COUNTER_READS
+  return 0;
+}}
+"""
+
+_READ: Final[str] = """  if (!NAME_counter.perf_counter_value(CUR_CPU_IDENTIFIER, &value, sizeof(value))) {
+    delta = perf_count_delta(last, SLOT, &value);
+    if (counts)
+      counts->counts[SLOT] += delta;
+  }
+"""
+
+
+def expand_counting(counters: list[PerfCounter], by_cgroup: bool) -> str:
+  """Program reading counters in order, their slot in perf_counts.counts is their index."""
+  arrays = "\n".join(f"BPF_PERF_ARRAY({counter.name}_counter, MAX_CPUS);" for counter in counters)
+  reads = "".join(
+    _READ.replace("NAME", counter.name).replace("SLOT", str(slot))
+    for slot, counter in enumerate(counters)
+  )
+  return _DECLARATIONS.replace(
+    "PERF_COUNTER_SLOTS", str(max(len(counters), 1))
+  ).replace(
+    "PERF_COUNTER_ARRAYS", arrays
+  ).replace(
+    "PERF_COUNTER_READS", reads
+  ).replace(
+    "PERF_COUNT_BY_CGROUP", "1" if by_cgroup else "0"
+  )
+
+
+class PerfCounting:
+  """Opens the counters of one hook's counting program and drains their totals every drain_ms."""
+
+  def __init__(self, bpf: BPF, counters: list[PerfCounter], drain_ms: int):
+    self.counters = counters
+    self.table = bpf["perf_counts"]
+    self.drain_s = max(drain_ms, 0) / 1000
+    self.rows = list[dict[str, Any]]()
+    self._totals = DrainTotals()
+    self._next_drain = time.monotonic() + self.drain_s
+    for counter in counters:
+      bpf[f"{counter.name}_counter"].open_perf_event(counter.ev_type, counter.ev_config)
+
+  def poll(self):
+    if time.monotonic() < self._next_drain:
+      return
+    self.drain()
+    self._next_drain = time.monotonic() + self.drain_s
+
+  def drain(self):
+    ts_uptime_us = int(time.clock_gettime_ns(time.CLOCK_BOOTTIME) / 1000)
+    deltas = self._totals.drain(
+      (
+        (key.tgid, key.cgroup_id),
+        (
+          sum(counts.on_cpu_ns for counts in per_cpu),
+          *(
+            sum(counts.counts[slot] for counts in per_cpu)
+            for slot in range(len(self.counters))
+          ),
+        ),
+      )
+      for key, per_cpu in self.table.items()
+    )
+    for (tgid, cgroup_id), counts in deltas.items():
+      if not any(counts):
+        continue
+      row: dict[str, Any] = {
+        UPTIME_TIMESTAMP: ts_uptime_us,
+        "tgid": tgid,
+        "cgroup_id": cgroup_id,
+        "on_cpu_ns": counts[0],
+      }
+      for counter, count in zip(self.counters, counts[1:]):
+        row[counter.name] = count
+      self.rows.append(row)
+
+  def pop(self) -> list[dict[str, Any]]:
+    rows = self.rows
+    self.rows = list[dict[str, Any]]()
+    return rows
+
+
+def counts_frame(rows: list[dict[str, Any]], counter_names: list[str]) -> pl.DataFrame:
+  # every known counter gets a column, null when it was not opened
+  schema = pl.Schema({
+    UPTIME_TIMESTAMP: pl.Int64(),
+    "tgid": pl.Int64(),
+    "cgroup_id": pl.Int64(),
+    "on_cpu_ns": pl.Int64(),
+    **{name: pl.Int64() for name in counter_names},
+  })
+  return pl.DataFrame(rows, schema=schema)
+
+
+__all__ = [
+  "BASE_COUNTERS",
+  "counts_frame",
+  "expand_counting",
+  "PerfCounter",
+  "PerfCounting",
+]
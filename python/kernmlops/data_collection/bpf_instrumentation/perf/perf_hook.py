@@ -1,66 +1,50 @@
-from dataclasses import dataclass
 from fcntl import ioctl
 from pathlib import Path
 from typing import Any, Final
 
 import polars as pl
 from bcc import BPF, PerfType
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.columnar import EventColumns
 from data_collection.bpf_instrumentation.perf.perf_config import (
   PERF_EVENT_IOC_DISABLE,
   PERF_EVENT_IOC_ENABLE,
   PERF_IOC_FLAG_GROUP,
   CustomHWConfigManager,
 )
+from data_collection.bpf_instrumentation.perf.perf_counting import (
+  BASE_COUNTERS,
+  PerfCounter,
+  PerfCounting,
+  counts_frame,
+  expand_counting,
+)
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import CollectionTable
-from data_schema.perf import PerfCollectionTable, perf_table_types
+from data_schema.perf import PerfCollectionTable, PerfCountsTable, perf_table_types
 
 PERF_HANDLER: Final[str] = """
-BPF_PERF_OUTPUT(NAME);
+EVENT_OUTPUT(NAME, struct perf_event_data);
 int NAME_on(struct bpf_perf_event_data* ctx) {
   struct bpf_perf_event_value value_buf;
   if (bpf_perf_prog_read_value(ctx, (void*)&value_buf, sizeof(struct bpf_perf_event_value))) {
     return 0;
   }
-  struct perf_event_data data;
-  __builtin_memset(&data, 0, sizeof(data));
+  EVENT_RESERVE(NAME, struct perf_event_data, data);
   u32 pid = bpf_get_current_pid_tgid();
   u32 tgid = bpf_get_current_pid_tgid() >> 32;
   u64 ts = bpf_ktime_get_ns();
-  data.pid = pid;
-  data.tgid = tgid;
-  data.ts_uptime_us = ts / 1000;
-  data.count = value_buf.counter;
-  data.enabled_time_us = value_buf.enabled / 1000;
-  data.running_time_us = value_buf.running / 1000;
-  NAME.perf_submit(ctx, &data, sizeof(data));
+  data->pid = pid;
+  data->tgid = tgid;
+  data->ts_uptime_us = ts / 1000;
+  data->count = value_buf.counter;
+  data->enabled_time_us = value_buf.enabled / 1000;
+  data->running_time_us = value_buf.running / 1000;
+  EVENT_SUBMIT(NAME, ctx, data);
   return 0;
 }
 """
 
-@dataclass(frozen=True)
-class PerfData:
-  cpu: int
-  pid: int
-  tgid: int
-  ts_uptime_us: int
-  cumulative_count: int
-  pmu_enabled_time_us: int
-  pmu_running_time_us: int
-
-  @classmethod
-  def from_event(cls, cpu: int, event: Any):
-    return PerfData(
-        cpu=cpu,
-        pid=event.pid,
-        tgid=event.tgid,
-        ts_uptime_us=event.ts_uptime_us,
-        cumulative_count=event.count,
-        pmu_enabled_time_us=event.enabled_time_us,
-        pmu_running_time_us=event.running_time_us,
-    )
-
-
 class PerfBPFHook(BPFProgram):
 
   @classmethod
@@ -68,10 +52,13 @@ class PerfBPFHook(BPFProgram):
     return "perf"
 
   def __init__(self):
-    self._perf_data = dict[str, list[PerfData]]()
+    self._perf_data = dict[str, EventColumns]()
     self.bpf_text = open(Path(__file__).parent / "../bpf/perf.bpf.c", "r").read()
+    # Counting mode compiles none of the sampling handlers
+    self.counting_text = self.bpf_text
     self.loaded_hw_event_configs = dict[type[PerfCollectionTable], int]()
     self.group_fds: dict[int, int] | None = None
+    self.counting: PerfCounting | None = None
 
     # add perf handlers
     def init_perf_handler(perf_event: type[PerfCollectionTable]):
@@ -79,13 +66,13 @@ class PerfBPFHook(BPFProgram):
         hw_config_value = CustomHWConfigManager.get_hw_config(perf_event)
         if hw_config_value is not None:
           self.bpf_text += PERF_HANDLER.replace("NAME", perf_event.name())
-          self._perf_data[perf_event.name()] = list[PerfData]()
+          self._perf_data[perf_event.name()] = EventColumns()
           self.loaded_hw_event_configs[perf_event] = hw_config_value
         else:
           print(f"info: could not enable perf counter for {perf_event.name()}")
       else:
         self.bpf_text += PERF_HANDLER.replace("NAME", perf_event.name())
-        self._perf_data[perf_event.name()] = list[PerfData]()
+        self._perf_data[perf_event.name()] = EventColumns()
         self.loaded_hw_event_configs[perf_event] = perf_event.ev_config()
 
     for perf_event in list(perf_table_types.values()):
@@ -122,7 +109,11 @@ class PerfBPFHook(BPFProgram):
 
   def load(self, collection_id: str):
     self.collection_id = collection_id
-    self.bpf = BPF(text = self.bpf_text)
+    self.events = EventTransport(self.options)
+    if self.options.perf_counting:
+      self._load_counting()
+      return
+    self.bpf = BPF(text = self.events.expand(self.bpf_text))
     # sample frequency is in hertz
     for event, hw_config in self.loaded_hw_event_configs.items():
       self._attach_perf_event(
@@ -132,7 +123,16 @@ class PerfBPFHook(BPFProgram):
         sample_freq=1000,
       )
     for event_name in self._perf_data.keys():
-      self.bpf[event_name].open_perf_buffer(self._perf_handler(event_name), page_cnt=64)
+      self.events.open_columns(self.bpf, event_name, self._perf_data[event_name], page_cnt=64)
+
+  def _load_counting(self):
+    counters = list(BASE_COUNTERS) + [
+      PerfCounter(event.name(), event.ev_type(), hw_config)
+      for event, hw_config in self.loaded_hw_event_configs.items()
+    ]
+    by_cgroup = self.options.perf_count_by == "cgroup"
+    self.bpf = BPF(text = self.counting_text + expand_counting(counters, by_cgroup))
+    self.counting = PerfCounting(self.bpf, counters, self.options.perf_count_drain_ms)
 
   def disable_counters(self) -> None:
     if self.group_fds is None:
@@ -147,35 +147,57 @@ class PerfBPFHook(BPFProgram):
       ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP)
 
   def poll(self):
-    self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+    if self.counting is not None:
+      self.counting.poll()
+      return
+    self.events.poll(self.bpf)
 
   def close(self):
     self.bpf.cleanup()
 
+  def lost_events(self) -> int:
+    return self.events.lost_events(self.bpf)
+
+  def poll_fds(self) -> list[int]:
+    return self.events.poll_fds(self.bpf)
+
   def data(self) -> list[CollectionTable]:
+    if self.counting is not None:
+      return self._counts_tables(self.counting.rows)
+    return self._event_tables({name: columns.frame() for name, columns in self._perf_data.items()})
+
+  def _counts_tables(self, rows: list[dict[str, Any]]) -> list[CollectionTable]:
+    if len(rows) == 0:
+      return []
+    return [
+      PerfCountsTable.from_df_id(
+        counts_frame(rows, PerfCountsTable.counter_names()),
+        collection_id=self.collection_id,
+      )
+    ]
+
+  def _event_tables(self, events: dict[str, pl.DataFrame]) -> list[CollectionTable]:
     return [
       perf_table_types[event_name].from_df_id(
-        pl.DataFrame(self._perf_data[event_name]),
+        frame.rename({
+          "count": "cumulative_count",
+          "enabled_time_us": "pmu_enabled_time_us",
+          "running_time_us": "pmu_running_time_us",
+        }),
         collection_id=self.collection_id,
       )
-      for event_name in self._perf_data.keys()
-      if event_name in perf_table_types and len(self._perf_data[event_name]) > 0
+      for event_name, frame in events.items()
+      if event_name in perf_table_types and len(frame) > 0
     ]
 
   def clear(self):
     for key in self._perf_data.keys():
       self._perf_data[key].clear()
+    if self.counting is not None:
+      self.counting.pop()
 
   def pop_data(self) -> list[CollectionTable]:
-    miss_tables = self.data()
-    self.clear()
-    return miss_tables
-
-  def _perf_handler(self, event_name: str):
-    def _perf_event_handler(cpu, perf_event_data, size):
-      event = self.bpf[event_name].event(perf_event_data)
-      try:
-          self._perf_data[event_name].append(PerfData.from_event(cpu, event))
-      except Exception as _:
-        pass
-    return _perf_event_handler
+    # poll() keeps appending on its own thread, take each buffer as it is reset
+    if self.counting is not None:
+      return self._counts_tables(self.counting.pop())
+    return self._event_tables({name: columns.pop() for name, columns in self._perf_data.items()})
@@ -0,0 +1,114 @@
+"""Event driven polling of loaded hooks.
+
+Every perf buffer and ring buffer descriptor a hook exposes through poll_fds()
+joins one epoll set, so a hook is polled as soon as one of its buffers reaches
+the wakeup watermark instead of after a fixed sleep. Hooks without descriptors,
+such as /proc readers or aggregate mode histograms, are polled every tick along
+with a flush of anything still queued below the watermark.
+
+HookPoller.split spreads the hooks over several pollers that each run on their
+own thread, optionally pinned to a CPU, so one slow hook does not delay others.
+"""
+
+import os
+import select
+import time
+from collections.abc import Sequence
+from threading import Event, Thread
+
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+
+
+class HookPoller:
+  """Waits on the buffers of a set of loaded hooks and polls the ones with data."""
+
+  def __init__(self, hooks: Sequence[BPFProgram], tick_s: float, cpu: int | None = None):
+    self.hooks = list(hooks)
+    self.tick_s = max(tick_s, 0.0)
+    self.cpu = cpu
+    self._epoll = select.epoll()
+    self._fd_hooks = dict[int, BPFProgram]()
+    for hook in self.hooks:
+      for fd in hook.poll_fds():
+        self._epoll.register(fd, select.EPOLLIN)
+        self._fd_hooks[fd] = hook
+    self._next_tick = time.monotonic() + self.tick_s
+    self._thread: Thread | None = None
+    self._stop = Event()
+
+  @classmethod
+  def split(
+    cls,
+    hooks: Sequence[BPFProgram],
+    tick_s: float,
+    threads: int,
+    cpus: Sequence[int] = (),
+  ) -> list["HookPoller"]:
+    """Round robin the hooks over up to `threads` pollers, the i-th pinned to cpus[i % len(cpus)]."""
+    threads = max(min(threads, len(hooks)), 1)
+    return [
+      cls(
+        hooks[i::threads],
+        tick_s,
+        cpu=cpus[i % len(cpus)] if cpus else None,
+      )
+      for i in range(threads)
+    ]
+
+  def poll_once(self) -> bool:
+    """Polls the hooks that became ready, returns whether the tick also came due."""
+    timeout = max(self._next_tick - time.monotonic(), 0.0)
+    ready = list[BPFProgram]()
+    try:
+      for fd, _ in self._epoll.poll(timeout):
+        hook = self._fd_hooks[fd]
+        if hook not in ready:
+          ready.append(hook)
+    except InterruptedError:
+      pass
+    for hook in ready:
+      hook.poll()
+    if time.monotonic() < self._next_tick:
+      return False
+    for hook in self.hooks:
+      if hook not in ready:
+        hook.poll()
+    self._next_tick = time.monotonic() + self.tick_s
+    return True
+
+  def flush(self):
+    """Polls every hook once more, used to drain buffers before close."""
+    for hook in self.hooks:
+      try:
+        hook.poll()
+      except Exception:
+        pass
+
+  def start(self):
+    self._thread = Thread(target=self._run, name=f"hook-poller-{self.cpu}", daemon=True)
+    self._thread.start()
+
+  def _run(self):
+    if self.cpu is not None:
+      # pid 0 pins only the calling thread
+      os.sched_setaffinity(0, {self.cpu})
+    while not self._stop.is_set():
+      try:
+        self.poll_once()
+      except Exception as e:
+        print(f"error polling {[hook.name() for hook in self.hooks]}: {e}")
+
+  def stop(self):
+    self._stop.set()
+    if self._thread is not None:
+      self._thread.join()
+      self._thread = None
+
+  def close(self):
+    self.stop()
+    self._epoll.close()
+
+
+__all__ = [
+  "HookPoller",
+]
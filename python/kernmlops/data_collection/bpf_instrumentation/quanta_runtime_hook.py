@@ -1,23 +1,24 @@
-from dataclasses import dataclass
 from pathlib import Path
 
 import polars as pl
 from bcc import BPF
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.columnar import EventColumns
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.histogram import (
+  LatencyHistogram,
+  LatencyHistogramData,
+  expand_histograms,
+  histogram_frame,
+)
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import UPTIME_TIMESTAMP, CollectionTable
+from data_schema.latency_histogram import QuantaLatencyHistogramTable
 from data_schema.quanta_runtime import QuantaQueuedTable, QuantaRuntimeTable
 
 # Note: collecting blocked time is not useful since parent processes blocking on children
 # obfuscates the meaning
 
-@dataclass(frozen=True)
-class QuantaRuntimeData:
-  cpu: int
-  pid: int
-  tgid: int
-  quanta_end_uptime_us: int
-  quanta_run_length_us: int
-
 class QuantaRuntimeBPFHook(BPFProgram):
 
   @classmethod
@@ -40,12 +41,18 @@ class QuantaRuntimeBPFHook(BPFProgram):
         bpf_text = bpf_text.replace('USE_TRACEPOINT', '1')
     else:
         bpf_text = bpf_text.replace('USE_TRACEPOINT', '0')
-    self.quanta_runtime_data = list[QuantaRuntimeData]()
-    self.quanta_queue_data = list[QuantaRuntimeData]()
+    self.quanta_runtime_columns = EventColumns()
+    self.quanta_queue_columns = EventColumns()
+    self.histogram: LatencyHistogram | None = None
+    self.histogram_data = list[LatencyHistogramData]()
 
   def load(self, collection_id: str):
     self.collection_id = collection_id
-    self.bpf = BPF(text = self.bpf_text)
+    self.events = EventTransport(self.options)
+    bpf_text = self.bpf_text.replace("AGGREGATE", "1" if self.options.aggregate else "0")
+    bpf_text = expand_histograms(expand_control(bpf_text, self.name()))
+    self.bpf = BPF(text = self.events.expand(bpf_text))
+    self.control = apply_control(self.bpf, self.name(), self.options)
     if not self.is_support_raw_tp:
       self.bpf.attach_kprobe(event=b"ttwu_do_activate", fn_name=b"trace_ttwu_do_wakeup")
       self.bpf.attach_kprobe(event=b"wake_up_new_task", fn_name=b"trace_wake_up_new_task")
@@ -53,25 +60,50 @@ class QuantaRuntimeBPFHook(BPFProgram):
         event_re=rb'^finish_task_switch$|^finish_task_switch\.isra\.\d$',
         fn_name=b"trace_run"
       )
-    self.bpf["quanta_runtimes"].open_perf_buffer(self._runtime_event_handler, page_cnt=64)
-    self.bpf["quanta_queue_times"].open_perf_buffer(self._queue_event_handler, page_cnt=64)
+    if self.options.aggregate:
+      self.histogram = LatencyHistogram(self.bpf, "quanta_latency_hist", {0: "quanta_run_length", 1: "quanta_queued_time"})
+    else:
+      self.events.open_columns(self.bpf, "quanta_runtimes", self.quanta_runtime_columns, page_cnt=64)
+      self.events.open_columns(self.bpf, "quanta_queue_times", self.quanta_queue_columns, page_cnt=64)
 
   def poll(self):
-    self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+    if self.histogram is not None:
+      self.histogram_data.extend(self.histogram.drain())
+    else:
+      self.events.poll(self.bpf)
 
   def close(self):
     self.bpf.cleanup()
 
+  def lost_events(self) -> int:
+    return self.events.lost_events(self.bpf)
+
+  def poll_fds(self) -> list[int]:
+    return self.events.poll_fds(self.bpf)
+
   def data(self) -> list[CollectionTable]:
+    return self._tables(self.histogram_data, self.quanta_runtime_columns.frame(),
+                        self.quanta_queue_columns.frame())
+
+  def _tables(
+    self, histogram_data: list[LatencyHistogramData], runtimes: pl.DataFrame, queue_times: pl.DataFrame,
+  ) -> list[CollectionTable]:
+    if self.histogram is not None:
+      return [
+        QuantaLatencyHistogramTable.from_df_id(
+          histogram_frame(histogram_data),
+          collection_id=self.collection_id,
+        ),
+      ]
     return [
       QuantaRuntimeTable.from_df_id(
-        pl.DataFrame(self.quanta_runtime_data).rename({
+        runtimes.rename({
           "quanta_end_uptime_us": UPTIME_TIMESTAMP,
         }),
         collection_id=self.collection_id,
       ),
       QuantaQueuedTable.from_df_id(
-        pl.DataFrame(self.quanta_queue_data).rename({
+        queue_times.rename({
           "quanta_end_uptime_us": UPTIME_TIMESTAMP,
           "quanta_run_length_us": "quanta_queued_time_us",
         }),
@@ -80,34 +112,12 @@ class QuantaRuntimeBPFHook(BPFProgram):
     ]
 
   def clear(self):
-    self.quanta_runtime_data.clear()
-    self.quanta_queue_data.clear()
+    self.histogram_data.clear()
+    self.quanta_runtime_columns.clear()
+    self.quanta_queue_columns.clear()
 
   def pop_data(self) -> list[CollectionTable]:
-    quanta_tables = self.data()
-    self.clear()
-    return quanta_tables
-
-  def _runtime_event_handler(self, cpu, quanta_runtime_perf_event, size):
-    event = self.bpf["quanta_runtimes"].event(quanta_runtime_perf_event)
-    self.quanta_runtime_data.append(
-      QuantaRuntimeData(
-        cpu=cpu,
-        pid=event.pid,
-        tgid=event.tgid,
-        quanta_end_uptime_us=event.quanta_end_uptime_us,
-        quanta_run_length_us=event.quanta_run_length_us,
-      )
-    )
-
-  def _queue_event_handler(self, cpu, quanta_runtime_perf_event, size):
-    event = self.bpf["quanta_queue_times"].event(quanta_runtime_perf_event)
-    self.quanta_queue_data.append(
-      QuantaRuntimeData(
-        cpu=cpu,
-        pid=event.pid,
-        tgid=event.tgid,
-        quanta_end_uptime_us=event.quanta_end_uptime_us,
-        quanta_run_length_us=event.quanta_run_length_us,
-      )
-    )
+    # poll() keeps appending on its own thread, take each buffer as it is reset
+    histogram_data, self.histogram_data = self.histogram_data, list[LatencyHistogramData]()
+    return self._tables(histogram_data, self.quanta_runtime_columns.pop(),
+                        self.quanta_queue_columns.pop())
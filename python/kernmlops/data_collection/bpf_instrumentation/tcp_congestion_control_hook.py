@@ -6,7 +6,10 @@ import struct
 import polars as pl
 from bcc import BPF
 
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.comm import TaskComms, event_comm, expand_comm
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import CollectionTable
 
 EVENT_NAMES = {
@@ -31,7 +34,8 @@ class TcpCongestionEvent:
     daddr: str
     sport: int
     dport: int
-    comm: str
+    comm: str | None
+    sample_weight: int
 
 
 class TcpCongestionControlBPFHook(BPFProgram):
@@ -43,11 +47,17 @@ class TcpCongestionControlBPFHook(BPFProgram):
     def __init__(self):
         bpf_text = open(Path(__file__).parent / "bpf/tcp_congestion_control.bpf.c", "r").read()
         self.bpf_text = bpf_text
-        self.events = list[TcpCongestionEvent]()
+        self.cc_events = list[TcpCongestionEvent]()
+        self.comms: TaskComms | None = None
 
     def load(self, collection_id: str):
         self.collection_id = collection_id
-        self.bpf = BPF(text=self.bpf_text)
+        self.events = EventTransport(self.options)
+        bpf_text = expand_comm(expand_control(self.bpf_text, self.name()), self.options.intern_comm)
+        self.bpf = BPF(text=self.events.expand(bpf_text))
+        self.control = apply_control(self.bpf, self.name(), self.options)
+        if self.options.intern_comm:
+            self.comms = TaskComms(self.bpf, self.events)
 
         # Attach core congestion control functions
         self.bpf.attach_kprobe(event=b"tcp_assign_congestion_control", fn_name=b"trace_assign_cc")
@@ -59,25 +69,29 @@ class TcpCongestionControlBPFHook(BPFProgram):
             pass
         self.bpf.attach_kprobe(event=b"tcp_cleanup_congestion_control", fn_name=b"trace_cleanup_cc")
 
-        self.bpf["cc_events"].open_perf_buffer(self._event_handler, page_cnt=64)
+        self.events.open(self.bpf, "cc_events", self._event_handler, page_cnt=64)
 
     def poll(self):
-        self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+        self.events.poll(self.bpf)
 
     def close(self):
         self.bpf.cleanup()
 
-    def _event_handler(self, cpu, data, size):
-        event = self.bpf["cc_events"].event(data)
+    def lost_events(self) -> int:
+        return self.events.lost_events(self.bpf)
 
+    def poll_fds(self) -> list[int]:
+        return self.events.poll_fds(self.bpf)
+
+    def _event_handler(self, cpu, event):
         saddr = socket.inet_ntoa(struct.pack('I', event.saddr)) if event.saddr else "0.0.0.0"
         daddr = socket.inet_ntoa(struct.pack('I', event.daddr)) if event.daddr else "0.0.0.0"
         sport = socket.ntohs(event.sport) if event.sport else 0
         dport = socket.ntohs(event.dport) if event.dport else 0
         ca_name = event.ca_name.decode('utf-8', 'replace').rstrip('\x00')
-        comm = event.comm.decode('utf-8', 'replace').rstrip('\x00')
+        comm = event_comm(event)
 
-        self.events.append(
+        self.cc_events.append(
             TcpCongestionEvent(
                 cpu=cpu,
                 pid=event.pid,
@@ -91,22 +105,27 @@ class TcpCongestionControlBPFHook(BPFProgram):
                 sport=sport,
                 dport=dport,
                 comm=comm,
+                sample_weight=event.sample_weight,
             )
         )
 
     def data(self) -> list[CollectionTable]:
         from data_schema.tcp_congestion_control import TcpCongestionControlTable
-        if len(self.events) == 0:
+        if len(self.cc_events) == 0:
             return []
-        events_df = pl.DataFrame(self.events)
+        events_df = pl.DataFrame(self.cc_events)
+        if self.comms is not None:
+            events_df = events_df.drop("comm")
         return [
             TcpCongestionControlTable.from_df_id(events_df, collection_id=self.collection_id)
         ]
 
     def clear(self):
-        self.events.clear()
+        self.cc_events.clear()
 
     def pop_data(self) -> list[CollectionTable]:
         tables = self.data()
         self.clear()
+        if self.comms is not None:
+            tables.extend(self.comms.pop(self.collection_id))
         return tables
@@ -2,10 +2,15 @@ import socket
 import struct
 from dataclasses import dataclass
 from pathlib import Path
+from threading import Lock
 
 import polars as pl
 from bcc import BPF
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.comm import TaskComms, event_comm, expand_comm
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.flow import TcpFlowData, TcpFlows, expand_flows, flow_frame
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import CollectionTable
 
 # Event type mappings
@@ -28,7 +33,7 @@ class TcpCubicEvent:
     ts_uptime_us: int
     event_type: int
     event_type_name: str
-    comm: str
+    comm: str | None
 
     # Connection info
     saddr: str
@@ -65,6 +70,7 @@ class TcpCubicEvent:
     acked: int
     in_slow_start: int
     is_tcp_friendly: int
+    sample_weight: int
 
 
 class TcpCubicBPFHook(BPFProgram):
@@ -76,12 +82,28 @@ class TcpCubicBPFHook(BPFProgram):
     def __init__(self):
         bpf_text = open(Path(__file__).parent / "bpf/tcp_cubic.bpf.c", "r").read()
         self.bpf_text = bpf_text
-        self.events = list[TcpCubicEvent]()
+        self.cubic_events = list[TcpCubicEvent]()
+        # events before _out were already popped and stay only for recent_events()
+        self._out = 0
+        # where the next recent_events() starts in cubic_events, once it was called
+        self._recent = 0
+        self._reading = False
+        # the poller appends while the collector pops
+        self._lock = Lock()
         self.cubic_functions_available = []
+        self.flows: TcpFlows | None = None
+        self.comms: TaskComms | None = None
 
     def load(self, collection_id: str):
         self.collection_id = collection_id
-        self.bpf = BPF(text=self.bpf_text)
+        self.events = EventTransport(self.options)
+        bpf_text = self.bpf_text.replace("AGGREGATE", "1" if self.options.aggregate else "0")
+        bpf_text = expand_flows(expand_control(bpf_text, self.name()), self.options.aggregate)
+        bpf_text = expand_comm(bpf_text, self.options.intern_comm)
+        self.bpf = BPF(text=self.events.expand(bpf_text))
+        self.control = apply_control(self.bpf, self.name(), self.options)
+        if self.options.intern_comm:
+            self.comms = TaskComms(self.bpf, self.events)
 
         # Try to attach to all available CUBIC functions
         cubic_functions = [
@@ -116,26 +138,35 @@ class TcpCubicBPFHook(BPFProgram):
             except Exception:
                 pass
 
-        # Open perf buffer
-        self.bpf["cubic_events"].open_perf_buffer(self._event_handler, page_cnt=64)
+        # Aggregate mode folds every callback into its flow's cwnd/RTT summaries
+        if self.options.aggregate:
+            self.flows = TcpFlows(self.bpf, self.events, self.options.flow_drain_ms)
+        else:
+            self.events.open(self.bpf, "cubic_events", self._event_handler, page_cnt=64)
 
     def poll(self):
-        self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+        self.events.poll(self.bpf)
+        if self.flows is not None:
+            self.flows.poll()
 
     def close(self):
         self.bpf.cleanup()
 
-    def _event_handler(self, cpu, data, size):
-        event = self.bpf["cubic_events"].event(data)
+    def lost_events(self) -> int:
+        return self.events.lost_events(self.bpf)
 
+    def poll_fds(self) -> list[int]:
+        return self.events.poll_fds(self.bpf)
+
+    def _event_handler(self, cpu, event):
         # Convert IP addresses
         saddr = socket.inet_ntoa(struct.pack('I', event.saddr)) if event.saddr else "0.0.0.0"
         daddr = socket.inet_ntoa(struct.pack('I', event.daddr)) if event.daddr else "0.0.0.0"
         sport = socket.ntohs(event.sport) if event.sport else 0
         dport = socket.ntohs(event.dport) if event.dport else 0
 
-        # Decode comm
-        comm = event.comm.decode('utf-8', 'replace')
+        # Decode comm, None when interned
+        comm = event_comm(event)
 
         # Get event type name
         event_type_name = EVENT_TYPES.get(event.event_type, f"UNKNOWN_{event.event_type}")
@@ -176,20 +207,32 @@ class TcpCubicBPFHook(BPFProgram):
             acked=event.acked,
             in_slow_start=event.in_slow_start,
             is_tcp_friendly=event.is_tcp_friendly,
+            sample_weight=event.sample_weight,
         )
 
-        self.events.append(cubic_event)
+        with self._lock:
+            self.cubic_events.append(cubic_event)
 
     def data(self) -> list[CollectionTable]:
+        flows = self.flows.rows if self.flows is not None else None
+        with self._lock:
+            cubic_events = self.cubic_events[self._out:]
+        return self._tables(flows, cubic_events)
+
+    def _tables(self, flows: list[TcpFlowData] | None, cubic_events: list[TcpCubicEvent]) -> list[CollectionTable]:
         # Import here to avoid circular dependency
         from data_schema.tcp_cubic import TcpCubicTable
+        from data_schema.tcp_flow import TcpCubicFlowTable
 
-        if not self.events:
+        if flows is not None:
+            return [TcpCubicFlowTable.from_df_id(flow_frame(flows), collection_id=self.collection_id)]
+
+        if not cubic_events:
             return []
 
         # Convert events to DataFrame
         df_data = []
-        for event in self.events:
+        for event in cubic_events:
             df_data.append({
                 "ts_uptime_us": event.ts_uptime_us,
                 "pid": event.pid,
@@ -225,15 +268,50 @@ class TcpCubicBPFHook(BPFProgram):
                 "acked": event.acked,
                 "in_slow_start": event.in_slow_start,
                 "is_tcp_friendly": event.is_tcp_friendly,
+                "sample_weight": event.sample_weight,
             })
 
         df = pl.DataFrame(df_data)
+        if self.comms is not None:
+            df = df.drop("comm")
         return [TcpCubicTable.from_df_id(df, collection_id=self.collection_id)]
 
+    def recent_events(self) -> dict[str, pl.DataFrame]:
+        with self._lock:
+            recent = self.cubic_events[self._recent:]
+            self._recent = len(self.cubic_events)
+            self._reading = True
+        return {
+            "cubic_events": pl.DataFrame(
+                {
+                    "ts_uptime_us": [event.ts_uptime_us for event in recent],
+                    "packets_out": [event.packets_out for event in recent],
+                    "retrans_out": [event.retrans_out for event in recent],
+                },
+                schema={"ts_uptime_us": pl.Int64(), "packets_out": pl.Int64(), "retrans_out": pl.Int64()},
+            )
+        }
+
+    def _pop_events(self) -> list[TcpCubicEvent]:
+        # events recent_events() has not read yet stay for it
+        with self._lock:
+            cubic_events = self.cubic_events[self._out:]
+            keep = self._recent if self._reading else len(self.cubic_events)
+            self.cubic_events = self.cubic_events[keep:]
+            self._out = len(self.cubic_events)
+            self._recent = 0
+        return cubic_events
+
     def clear(self):
-        self.events.clear()
+        self._pop_events()
+        if self.flows is not None:
+            self.flows.pop()
 
     def pop_data(self) -> list[CollectionTable]:
-        tables = self.data()
-        self.clear()
+        # the poller keeps appending events and drained flows, take each as it is reset
+        flows = self.flows.pop() if self.flows is not None else None
+        cubic_events = self._pop_events()
+        tables = self._tables(flows, cubic_events)
+        if self.comms is not None:
+            tables.extend(self.comms.pop(self.collection_id))
         return tables
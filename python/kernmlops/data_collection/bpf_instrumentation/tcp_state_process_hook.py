@@ -3,7 +3,11 @@ from pathlib import Path
 
 import polars as pl
 from bcc import BPF
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.comm import TaskComms, event_comm, expand_comm
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.flow import TcpFlowData, TcpFlows, expand_flows, flow_frame
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import CollectionTable
 
 # TCP state constants
@@ -54,7 +58,8 @@ class TcpStateEvent:
     event_type_name: str
     event_subtype: int
     event_subtype_name: str
-    comm: str
+    comm: str | None
+    sample_weight: int
 
 
 class TcpStateProcessBPFHook(BPFProgram):
@@ -67,6 +72,8 @@ class TcpStateProcessBPFHook(BPFProgram):
         bpf_text = open(Path(__file__).parent / "bpf/tcp_state_process.bpf.c", "r").read()
         self.bpf_text = bpf_text
         self.tcp_state_events = list[TcpStateEvent]()
+        self.flows: TcpFlows | None = None
+        self.comms: TaskComms | None = None
         self.skip_offsets = False  # Can be made configurable
 
         # Branch offsets (from the original script)
@@ -87,7 +94,14 @@ class TcpStateProcessBPFHook(BPFProgram):
 
     def load(self, collection_id: str):
         self.collection_id = collection_id
-        self.bpf = BPF(text=self.bpf_text)
+        self.events = EventTransport(self.options)
+        bpf_text = self.bpf_text.replace("AGGREGATE", "1" if self.options.aggregate else "0")
+        bpf_text = expand_flows(expand_control(bpf_text, self.name()), self.options.aggregate)
+        bpf_text = expand_comm(bpf_text, self.options.intern_comm)
+        self.bpf = BPF(text=self.events.expand(bpf_text))
+        self.control = apply_control(self.bpf, self.name(), self.options)
+        if self.options.intern_comm:
+            self.comms = TaskComms(self.bpf, self.events)
 
         # Attach main kprobe
         self.bpf.attach_kprobe(
@@ -115,20 +129,29 @@ class TcpStateProcessBPFHook(BPFProgram):
             if failed_count > 0:
                 print(f"Warning: {failed_count} offset probes failed to attach (kernel version mismatch)")
 
-        # Open perf buffer
-        self.bpf["tcp_state_events"].open_perf_buffer(
-            self._tcp_state_handler, page_cnt=64
-        )
+        # Aggregate mode counts each probe per flow instead of emitting an event per segment
+        if self.options.aggregate:
+            self.flows = TcpFlows(self.bpf, self.events, self.options.flow_drain_ms)
+        else:
+            self.events.open(
+                self.bpf, "tcp_state_events", self._tcp_state_handler, page_cnt=64
+            )
 
     def poll(self):
-        self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+        self.events.poll(self.bpf)
+        if self.flows is not None:
+            self.flows.poll()
 
     def close(self):
         self.bpf.cleanup()
 
-    def _tcp_state_handler(self, cpu, data, size):
-        event = self.bpf["tcp_state_events"].event(data)
+    def lost_events(self) -> int:
+        return self.events.lost_events(self.bpf)
 
+    def poll_fds(self) -> list[int]:
+        return self.events.poll_fds(self.bpf)
+
+    def _tcp_state_handler(self, cpu, event):
         self.tcp_state_events.append(
             TcpStateEvent(
                 cpu=cpu,
@@ -143,22 +166,39 @@ class TcpStateProcessBPFHook(BPFProgram):
                 event_type_name=EVENT_TYPES.get(event.event_type, "UNKNOWN"),
                 event_subtype=event.event_subtype,
                 event_subtype_name=EVENT_SUBTYPES.get(event.event_subtype, "UNKNOWN"),
-                comm=event.comm.decode('utf-8', 'replace')
+                comm=event_comm(event),
+                sample_weight=event.sample_weight,
             )
         )
 
     def data(self) -> list[CollectionTable]:
+        flows = self.flows.rows if self.flows is not None else None
+        return self._tables(flows, self.tcp_state_events)
+
+    def _tables(self, flows: list[TcpFlowData] | None, tcp_state_events: list[TcpStateEvent]) -> list[CollectionTable]:
+        from data_schema.tcp_flow import TcpStateProcessFlowTable
         from data_schema.tcp_state_process import TcpStateProcessTable
 
-        if len(self.tcp_state_events) == 0:
+        if flows is not None:
+            return [
+                TcpStateProcessFlowTable.from_df_id(
+                    flow_frame(flows),
+                    collection_id=self.collection_id
+                )
+            ]
+
+        if len(tcp_state_events) == 0:
             return []
 
         # Also collect aggregated statistics from the BPF maps
         stats_data = self._get_aggregated_stats()
 
+        events = pl.DataFrame(tcp_state_events)
+        if self.comms is not None:
+            events = events.drop("comm")
         tables = [
             TcpStateProcessTable.from_df_id(
-                pl.DataFrame(self.tcp_state_events),
+                events,
                 collection_id=self.collection_id
             )
         ]
@@ -177,10 +217,16 @@ class TcpStateProcessBPFHook(BPFProgram):
 
     def clear(self):
         self.tcp_state_events.clear()
+        if self.flows is not None:
+            self.flows.pop()
 
     def pop_data(self) -> list[CollectionTable]:
-        tables = self.data()
-        self.clear()
+        # the poller keeps appending events and drained flows, take each as it is reset
+        flows = self.flows.pop() if self.flows is not None else None
+        tcp_state_events, self.tcp_state_events = self.tcp_state_events, list[TcpStateEvent]()
+        tables = self._tables(flows, tcp_state_events)
+        if self.comms is not None:
+            tables.extend(self.comms.pop(self.collection_id))
         return tables
 
     def _get_aggregated_stats(self) -> dict:
@@ -7,7 +7,17 @@ from pathlib import Path
 
 import polars as pl
 from bcc import BPF
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.comm import TaskComms, event_comm, expand_comm
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.features import feature_flags
+from data_collection.bpf_instrumentation.histogram import (
+    LatencyHistogram,
+    LatencyHistogramData,
+    expand_histograms,
+    histogram_frame,
+)
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import CollectionTable
 
 # Branch type constants
@@ -99,7 +109,8 @@ class TcpConnectEvent:
     daddr: str
     sport: int
     dport: int
-    comm: str
+    comm: str | None
+    sample_weight: int
 
 
 class TcpV4ConnectBPFHook(BPFProgram):
@@ -112,6 +123,9 @@ class TcpV4ConnectBPFHook(BPFProgram):
         bpf_text = open(Path(__file__).parent / "bpf/tcp_v4_connect.bpf.c", "r").read()
         self.bpf_text = bpf_text
         self.connect_events = list[TcpConnectEvent]()
+        self.histogram: LatencyHistogram | None = None
+        self.histogram_data = list[LatencyHistogramData]()
+        self.comms: TaskComms | None = None
 
         # Branch offsets for kernel-specific tracking
         self.branch_offsets = {
@@ -135,7 +149,17 @@ class TcpV4ConnectBPFHook(BPFProgram):
 
     def load(self, collection_id: str):
         self.collection_id = collection_id
-        self.bpf = BPF(text=self.bpf_text)
+        self.events = EventTransport(self.options)
+        bpf_text = self.bpf_text.replace("AGGREGATE", "1" if self.options.aggregate else "0")
+        # the branch probes sit at instruction offsets, so these stay kprobes
+        _, task_storage = feature_flags(False, self.options.task_storage)
+        bpf_text = bpf_text.replace("USE_TASK_STORAGE", "1" if task_storage else "0")
+        bpf_text = expand_histograms(expand_control(bpf_text, self.name()))
+        bpf_text = expand_comm(bpf_text, self.options.intern_comm)
+        self.bpf = BPF(text=self.events.expand(bpf_text))
+        self.control = apply_control(self.bpf, self.name(), self.options)
+        if self.options.intern_comm:
+            self.comms = TaskComms(self.bpf, self.events)
 
         # Attach main entry and return probes
         self.bpf.attach_kprobe(event=b"tcp_v4_connect", fn_name=b"trace_tcp_v4_connect")
@@ -160,20 +184,30 @@ class TcpV4ConnectBPFHook(BPFProgram):
         if failed_count > 0:
             print(f"Warning: {failed_count} offset probes failed to attach (kernel version mismatch)")
 
-        # Open perf buffer
-        self.bpf["connect_events"].open_perf_buffer(
-            self._connect_event_handler, page_cnt=64
-        )
+        # Aggregate mode keys connect latency histograms by branch instead of emitting events
+        if self.options.aggregate:
+            self.histogram = LatencyHistogram(self.bpf, "connect_latency_hist", {0: "connect_latency"})
+        else:
+            self.events.open(
+                self.bpf, "connect_events", self._connect_event_handler, page_cnt=64
+            )
 
     def poll(self):
-        self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+        if self.histogram is not None:
+            self.histogram_data.extend(self.histogram.drain())
+        else:
+            self.events.poll(self.bpf)
 
     def close(self):
         self.bpf.cleanup()
 
-    def _connect_event_handler(self, cpu, data, size):
-        event = self.bpf["connect_events"].event(data)
+    def lost_events(self) -> int:
+        return self.events.lost_events(self.bpf)
+
+    def poll_fds(self) -> list[int]:
+        return self.events.poll_fds(self.bpf)
 
+    def _connect_event_handler(self, cpu, event):
         # Convert addresses to readable format
         saddr = socket.inet_ntoa(struct.pack('I', event.saddr)) if event.saddr else "0.0.0.0"
         daddr = socket.inet_ntoa(struct.pack('I', event.daddr)) if event.daddr else "0.0.0.0"
@@ -197,18 +231,31 @@ class TcpV4ConnectBPFHook(BPFProgram):
                 daddr=daddr,
                 sport=sport,
                 dport=dport,
-                comm=event.comm.decode('utf-8', 'ignore'),
+                comm=event_comm(event, errors="ignore"),
+                sample_weight=event.sample_weight,
             )
         )
 
     def data(self) -> list[CollectionTable]:
+        from data_schema.latency_histogram import TcpConnectLatencyHistogramTable
         from data_schema.tcp_v4_connect import TcpConnectStatsTable, TcpV4ConnectTable
 
+        if self.histogram is not None:
+            return [
+                TcpConnectLatencyHistogramTable.from_df_id(
+                    histogram_frame(self.histogram_data),
+                    collection_id=self.collection_id,
+                ),
+            ]
+
         # Main events table
         if len(self.connect_events) > 0:
             events_df = pl.DataFrame(self.connect_events)
+            if self.comms is not None:
+                events_df = events_df.drop("comm")
 
             # Calculate statistics - be robust about accessing BPF maps
+            # The stat maps are per-CPU, sum() folds every CPU's counter
             try:
                 branch_stats = self.bpf.get_table("branch_stats")
                 path_stats = self.bpf.get_table("path_stats")
@@ -218,7 +265,7 @@ class TcpV4ConnectBPFHook(BPFProgram):
                 branch_counts = {}
                 for i in range(32):
                     try:
-                        count = branch_stats[i].value if branch_stats[i] else 0
+                        count = branch_stats.sum(i).value
                         if count > 0:
                             branch_name = BRANCH_NAMES.get(i, f"unknown_{i}")
                             branch_counts[branch_name] = count
@@ -229,7 +276,7 @@ class TcpV4ConnectBPFHook(BPFProgram):
                 path_counts = {}
                 for i in range(4):
                     try:
-                        count = path_stats[i].value if path_stats[i] else 0
+                        count = path_stats.sum(i).value
                         if count > 0:
                             path_name = PATH_NAMES.get(i, f"unknown_path_{i}")
                             path_counts[path_name] = count
@@ -240,7 +287,7 @@ class TcpV4ConnectBPFHook(BPFProgram):
                 error_counts = {}
                 for i in range(8):
                     try:
-                        count = error_stats[i].value if error_stats[i] else 0
+                        count = error_stats.sum(i).value
                         if count > 0:
                             error_counts[f"error_type_{i}"] = count
                     except Exception:
@@ -273,8 +320,11 @@ class TcpV4ConnectBPFHook(BPFProgram):
 
     def clear(self):
         self.connect_events.clear()
+        self.histogram_data.clear()
 
     def pop_data(self) -> list[CollectionTable]:
         tables = self.data()
         self.clear()
+        if self.comms is not None:
+            tables.extend(self.comms.pop(self.collection_id))
         return tables
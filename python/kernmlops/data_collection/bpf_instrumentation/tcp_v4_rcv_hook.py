@@ -5,7 +5,11 @@ from pathlib import Path
 
 import polars as pl
 from bcc import BPF
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.comm import TaskComms, event_comm, expand_comm
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.flow import TcpFlowData, TcpFlows, expand_flows, flow_frame
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import CollectionTable
 
 # Branch type constants - expanded set
@@ -79,7 +83,8 @@ class TcpBranchData:
     daddr: str
     sport: int
     dport: int
-    comm: str
+    comm: str | None
+    sample_weight: int
 
 
 class TcpV4RcvBPFHook(BPFProgram):
@@ -92,6 +97,8 @@ class TcpV4RcvBPFHook(BPFProgram):
         bpf_text = open(Path(__file__).parent / "bpf/tcp_v4_rcv.bpf.c", "r").read()
         self.bpf_text = bpf_text
         self.tcp_branch_data = list[TcpBranchData]()
+        self.flows: TcpFlows | None = None
+        self.comms: TaskComms | None = None
 
         # Kernel-specific offsets for branch points
         # Original offsets
@@ -118,7 +125,14 @@ class TcpV4RcvBPFHook(BPFProgram):
 
     def load(self, collection_id: str):
         self.collection_id = collection_id
-        self.bpf = BPF(text=self.bpf_text)
+        self.events = EventTransport(self.options)
+        bpf_text = self.bpf_text.replace("AGGREGATE", "1" if self.options.aggregate else "0")
+        bpf_text = expand_flows(expand_control(bpf_text, self.name()), self.options.aggregate)
+        bpf_text = expand_comm(bpf_text, self.options.intern_comm)
+        self.bpf = BPF(text=self.events.expand(bpf_text))
+        self.control = apply_control(self.bpf, self.name(), self.options)
+        if self.options.intern_comm:
+            self.comms = TaskComms(self.bpf, self.events)
 
         # Attach main entry probe
         self.bpf.attach_kprobe(event=b"tcp_v4_rcv", fn_name=b"trace_tcp_v4_rcv")
@@ -144,24 +158,33 @@ class TcpV4RcvBPFHook(BPFProgram):
         if failed_count > 0:
             print(f"⚠ Failed to attach {failed_count} offset probes (kernel version mismatch)")
 
-        # Open perf buffer
-        self.bpf["tcp_branch_events"].open_perf_buffer(
-            self._tcp_branch_handler, page_cnt=64
-        )
+        # Aggregate mode counts branches per flow instead of emitting an event per packet
+        if self.options.aggregate:
+            self.flows = TcpFlows(self.bpf, self.events, self.options.flow_drain_ms)
+        else:
+            self.events.open(
+                self.bpf, "tcp_branch_events", self._tcp_branch_handler, page_cnt=64
+            )
 
     def poll(self):
-        self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+        self.events.poll(self.bpf)
+        if self.flows is not None:
+            self.flows.poll()
 
     def close(self):
         self.bpf.cleanup()
 
+    def lost_events(self) -> int:
+        return self.events.lost_events(self.bpf)
+
+    def poll_fds(self) -> list[int]:
+        return self.events.poll_fds(self.bpf)
+
     def _int_to_ip(self, addr):
         """Convert integer IP to string format"""
         return socket.inet_ntoa(struct.pack("!I", addr))
 
-    def _tcp_branch_handler(self, cpu, data, size):
-        event = self.bpf["tcp_branch_events"].event(data)
-
+    def _tcp_branch_handler(self, cpu, event):
         # Convert IPs and ports to proper format
         saddr = self._int_to_ip(event.saddr) if event.saddr else "0.0.0.0"
         daddr = self._int_to_ip(event.daddr) if event.daddr else "0.0.0.0"
@@ -182,27 +205,49 @@ class TcpV4RcvBPFHook(BPFProgram):
                 daddr=daddr,
                 sport=sport,
                 dport=dport,
-                comm=event.comm.decode('utf-8', 'replace')
+                comm=event_comm(event),
+                sample_weight=event.sample_weight,
             )
         )
 
     def data(self) -> list[CollectionTable]:
+        flows = self.flows.rows if self.flows is not None else None
+        return self._tables(flows, self.tcp_branch_data)
+
+    def _tables(self, flows: list[TcpFlowData] | None, tcp_branch_data: list[TcpBranchData]) -> list[CollectionTable]:
+        from data_schema.tcp_flow import TcpV4RcvFlowTable
         from data_schema.tcp_v4_rcv import TcpV4RcvTable
-        if len(self.tcp_branch_data) == 0:
+        if flows is not None:
+            return [
+                TcpV4RcvFlowTable.from_df_id(
+                    flow_frame(flows),
+                    collection_id=self.collection_id
+                )
+            ]
+        if len(tcp_branch_data) == 0:
             return []
+        events = pl.DataFrame(tcp_branch_data)
+        if self.comms is not None:
+            events = events.drop("comm")
         return [
             TcpV4RcvTable.from_df_id(
-                pl.DataFrame(self.tcp_branch_data),
+                events,
                 collection_id=self.collection_id
             )
         ]
 
     def clear(self):
         self.tcp_branch_data.clear()
+        if self.flows is not None:
+            self.flows.pop()
 
     def pop_data(self) -> list[CollectionTable]:
-        tables = self.data()
-        self.clear()
+        # the poller keeps appending events and drained flows, take each as it is reset
+        flows = self.flows.pop() if self.flows is not None else None
+        tcp_branch_data, self.tcp_branch_data = self.tcp_branch_data, list[TcpBranchData]()
+        tables = self._tables(flows, tcp_branch_data)
+        if self.comms is not None:
+            tables.extend(self.comms.pop(self.collection_id))
         return tables
 
     def get_statistics(self) -> dict:
@@ -220,7 +265,7 @@ class TcpV4RcvBPFHook(BPFProgram):
         drop_stats = drops.group_by("drop_reason_name").count() if len(drops) > 0 else None
 
         # Process statistics
-        process_stats = df.group_by("comm").count().sort("count", descending=True).head(10)
+        process_stats = df.group_by("tgid" if self.comms is not None else "comm").count().sort("count", descending=True).head(10)
 
         return {
             "total_events": len(df),
@@ -0,0 +1,250 @@
+"""Event transport shared by the BPF hooks.
+
+BPF programs emit events through textual placeholders that are expanded here
+into either per-CPU perf buffers or a single BPF ring buffer:
+
+  EVENT_OUTPUT(name, type);          declare an output carrying `type`
+  EVENT_RESERVE(name, type, var);    `type* var` zeroed in place, returns 0 when full
+  EVENT_SUBMIT(name, ctx, var);      publish a reserved `var`
+  EVENT_EMIT(name, ctx, ptr);        copy `*ptr`, e.g. a map value, into the output
+
+BCC refuses table methods inside preprocessor macros so these cannot be
+#defines. Ring buffer records carry the producing CPU in front of the event
+since, unlike perf buffers, the ring buffer does not report it.
+
+Per-CPU perf buffers can instead be drained by the NUMA node pollers in
+numa.py, each consuming only its node's CPUs through poll_cpus().
+"""
+
+import ctypes as ct
+import re
+from collections.abc import Callable
+from dataclasses import dataclass
+from enum import Enum
+from threading import Lock
+from typing import Any
+
+from bcc import BPF
+from bcc.libbcc import lib
+from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, HookOptions
+from data_collection.bpf_instrumentation.columnar import EventColumns
+
+
+class Transport(str, Enum):
+  PERF = "perf"
+  RINGBUF = "ringbuf"
+
+
+EventCallback = Callable[[int, Any], None]
+
+_PLACEHOLDER = re.compile(r"\b(EVENT_OUTPUT|EVENT_RESERVE|EVENT_SUBMIT|EVENT_EMIT)\s*\(([^;]*)\)\s*;")
+
+
+@dataclass(frozen=True)
+class _Output:
+  name: str
+  event_type: str
+
+
+class EventTransport:
+  """Expands event placeholders and opens the outputs of one BPF program."""
+
+  def __init__(self, options: HookOptions):
+    self.transport = Transport(options.transport)
+    self.ringbuf_pages = options.ringbuf_pages
+    self.wakeup_events = max(options.wakeup_events, 1)
+    self.outputs = dict[str, _Output]()
+    self.opened = list[str]()
+    self._perf_lost = 0
+    # set once node pollers own the perf buffers, poll() and poll_fds() then leave them alone
+    self.cpu_drained = False
+    self._drain_lock = Lock()
+
+  def expand(self, bpf_text: str) -> str:
+    return _PLACEHOLDER.sub(self._expand_one, bpf_text)
+
+  def _expand_one(self, match: re.Match[str]) -> str:
+    args = [arg.strip() for arg in match.group(2).split(",")]
+    kind = match.group(1)
+    if kind == "EVENT_OUTPUT":
+      name, event_type = args
+      self.outputs[name] = _Output(name=name, event_type=event_type)
+      return self._output(name, event_type)
+    if kind == "EVENT_RESERVE":
+      name, event_type, var = args
+      return self._reserve(name, event_type, var)
+    if kind == "EVENT_SUBMIT":
+      name, ctx, var = args
+      return self._submit(name, ctx, var)
+    name, ctx, ptr = args
+    return self._emit(name, ctx, ptr)
+
+  def _output(self, name: str, event_type: str) -> str:
+    if self.transport == Transport.PERF:
+      return f"BPF_PERF_OUTPUT({name});"
+    pending = f"\nBPF_PERCPU_ARRAY({name}_pending, u64, 1);" if self.wakeup_events > 1 else ""
+    return (
+      f"struct {name}_record {{ u32 cpu; u32 pad; {event_type} event; }};\n"
+      f"BPF_RINGBUF_OUTPUT({name}, {self.ringbuf_pages});\n"
+      f"BPF_PERCPU_ARRAY({name}_lost, u64, 1);"
+      f"{pending}"
+    )
+
+  def _reserve(self, name: str, event_type: str, var: str) -> str:
+    if self.transport == Transport.PERF:
+      return (
+        f"{event_type} {var}_storage; "
+        f"__builtin_memset(&{var}_storage, 0, sizeof({var}_storage)); "
+        f"{event_type}* {var} = &{var}_storage;"
+      )
+    return (
+      f"struct {name}_record* {var}_record = {name}.ringbuf_reserve(sizeof(struct {name}_record)); "
+      f"if (!{var}_record) {{ {self._count_lost(name)} return 0; }} "
+      f"{var}_record->cpu = bpf_get_smp_processor_id(); "
+      f"{event_type}* {var} = &{var}_record->event; "
+      f"__builtin_memset({var}, 0, sizeof(*{var}));"
+    )
+
+  def _submit(self, name: str, ctx: str, var: str) -> str:
+    if self.transport == Transport.PERF:
+      return f"{name}.perf_submit({ctx}, {var}, sizeof(*{var}));"
+    return f"{{ {self._wakeup_flags(name)} {name}.ringbuf_submit({var}_record, wakeup_flags); }}"
+
+  def _emit(self, name: str, ctx: str, ptr: str) -> str:
+    if self.transport == Transport.PERF:
+      return f"{name}.perf_submit({ctx}, {ptr}, sizeof(*({ptr})));"
+    return (
+      f"{{ struct {name}_record* emit_record = {name}.ringbuf_reserve(sizeof(struct {name}_record)); "
+      f"if (emit_record) {{ "
+      f"emit_record->cpu = bpf_get_smp_processor_id(); "
+      f"__builtin_memcpy(&emit_record->event, {ptr}, sizeof(emit_record->event)); "
+      f"{self._wakeup_flags(name)} {name}.ringbuf_submit(emit_record, wakeup_flags); "
+      f"}} else {{ {self._count_lost(name)} }} }}"
+    )
+
+  @staticmethod
+  def _count_lost(name: str) -> str:
+    return f"u32 lost_key = 0; u64* lost = {name}_lost.lookup(&lost_key); if (lost) (*lost)++;"
+
+  def _wakeup_flags(self, name: str) -> str:
+    # Without batching let the kernel pick, it wakes once per empty->non-empty transition
+    if self.wakeup_events <= 1:
+      return "u64 wakeup_flags = 0;"
+    # Stay quiet until this CPU has queued wakeup_events records
+    return (
+      f"u64 wakeup_flags = BPF_RB_NO_WAKEUP; u32 pending_key = 0; "
+      f"u64* pending = {name}_pending.lookup(&pending_key); "
+      f"if (!pending || ++(*pending) >= {self.wakeup_events}) {{ "
+      f"wakeup_flags = BPF_RB_FORCE_WAKEUP; if (pending) *pending = 0; }}"
+    )
+
+  def open(self, bpf: BPF, name: str, callback: EventCallback, page_cnt: int = 64):
+    """Deliver each decoded event of output `name` to callback(cpu, event)."""
+    table = bpf[name]
+    self.opened.append(name)
+    if self.transport == Transport.PERF:
+      table.open_perf_buffer(
+        lambda cpu, data, size: callback(cpu, table.event(data)),
+        page_cnt=page_cnt,
+        lost_cb=self._count_perf_lost,
+        wakeup_events=self.wakeup_events,
+      )
+      return
+
+    def _ringbuf_handler(ctx, data, size):
+      record = table.event(data)
+      callback(record.cpu, record.event)
+
+    table.open_ring_buffer(_ringbuf_handler)
+
+  def open_columns(self, bpf: BPF, name: str, columns: EventColumns, page_cnt: int = 64):
+    """Copy each raw event of output `name` into columns without decoding it."""
+    table = bpf[name]
+    self.opened.append(name)
+    if self.transport == Transport.PERF:
+
+      def _perf_handler(cpu, data, size):
+        if not columns.bound:
+          columns.bind(type(table.event(data)))
+        columns.append(cpu, data)
+
+      table.open_perf_buffer(
+        _perf_handler,
+        page_cnt=page_cnt,
+        lost_cb=self._count_perf_lost,
+        wakeup_events=self.wakeup_events,
+      )
+      return
+
+    event_offset = 0
+
+    def _ringbuf_handler(ctx, data, size):
+      nonlocal event_offset
+      if not columns.bound:
+        record = table.event(data)
+        columns.bind(type(record.event))
+        event_offset = type(record).event.offset
+      cpu = ct.cast(data, ct.POINTER(ct.c_uint32)).contents.value
+      columns.append(cpu, data + event_offset)
+
+    table.open_ring_buffer(_ringbuf_handler)
+
+  def _count_perf_lost(self, lost: int):
+    self._perf_lost += lost
+
+  def poll(self, bpf: BPF):
+    if self.transport == Transport.PERF and self.cpu_drained:
+      return
+    if self.wakeup_events > 1:
+      # Batched producers rarely wake us, drain whatever is queued
+      if self.transport == Transport.PERF:
+        bpf.perf_buffer_consume()
+      else:
+        bpf.ring_buffer_consume()
+    elif self.transport == Transport.PERF:
+      bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+    else:
+      bpf.ring_buffer_poll(timeout=POLL_TIMEOUT_MS)
+
+  def poll_fds(self, bpf: BPF) -> list[int]:
+    """Descriptors that turn readable once an opened output reaches its wakeup watermark."""
+    if self.transport == Transport.PERF:
+      if self.cpu_drained:
+        return []
+      # one perf event per CPU and output, all owned by this program
+      return [lib.perf_reader_fd(reader) for reader in bpf.perf_buffers.values()]
+    # a BPF ring buffer map is itself pollable
+    return [bpf[name].map_fd for name in self.opened]
+
+  def _cpu_readers(self, bpf: BPF, cpus: frozenset[int]) -> list[Any]:
+    # BCC keys perf buffers by (table, cpu)
+    return [reader for (_, cpu), reader in bpf.perf_buffers.items() if cpu in cpus]
+
+  def perf_cpu_fds(self, bpf: BPF, cpus: frozenset[int]) -> list[int]:
+    """Descriptors of the perf buffers of cpus, none for ring buffers."""
+    if self.transport != Transport.PERF:
+      return []
+    return [lib.perf_reader_fd(reader) for reader in self._cpu_readers(bpf, cpus)]
+
+  def poll_cpus(self, bpf: BPF, cpus: frozenset[int]):
+    """Consumes what the perf buffers of cpus hold, callers may be on different threads."""
+    readers = self._cpu_readers(bpf, cpus)
+    if not readers:
+      return
+    # every node's callbacks append to the same buffers of the hook
+    with self._drain_lock:
+      lib.perf_reader_consume(len(readers), (ct.c_void_p * len(readers))(*readers))
+
+  def lost_events(self, bpf: BPF) -> int:
+    if self.transport == Transport.PERF:
+      return self._perf_lost
+    lost = 0
+    for name in self.outputs:
+      lost += bpf[f"{name}_lost"].sum(ct.c_int(0)).value
+    return lost
+
+
+__all__ = [
+  "EventTransport",
+  "Transport",
+]
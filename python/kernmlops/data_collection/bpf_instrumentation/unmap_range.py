@@ -3,7 +3,9 @@ from pathlib import Path
 
 import polars as pl
 from bcc import BPF
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import CollectionTable
 from data_schema.generic_table import UnmapRangeDataTable
 
@@ -15,6 +17,7 @@ class UnmapRangeStat:
   start: int
   end: int
   is_huge: bool
+  sample_weight: int
 
 class UnmapRangeBPFHook(BPFProgram):
 
@@ -29,17 +32,25 @@ class UnmapRangeBPFHook(BPFProgram):
 
   def load(self, collection_id: str):
     self.collection_id = collection_id
-    self.bpf = BPF(text = self.bpf_text)
+    self.events = EventTransport(self.options)
+    self.bpf = BPF(text = self.events.expand(expand_control(self.bpf_text, self.name())))
+    self.control = apply_control(self.bpf, self.name(), self.options)
     self.bpf.attach_kprobe(event=b"unmap_page_range", fn_name=b"kprobe__unmap_page_range")
     self.bpf.attach_kprobe(event=b"__unmap_hugepage_range", fn_name=b"kprobe__unmap_hugepage_range")
-    self.bpf["unmap_range_output"].open_perf_buffer(self._unmap_range_eh, page_cnt=64)
+    self.events.open(self.bpf, "unmap_range_output", self._unmap_range_eh, page_cnt=64)
 
   def poll(self):
-    self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+    self.events.poll(self.bpf)
 
   def close(self):
     self.bpf.cleanup()
 
+  def lost_events(self) -> int:
+    return self.events.lost_events(self.bpf)
+
+  def poll_fds(self) -> list[int]:
+    return self.events.poll_fds(self.bpf)
+
   def data(self) -> list[CollectionTable]:
     return [
             UnmapRangeDataTable.from_df_id(
@@ -56,8 +67,7 @@ class UnmapRangeBPFHook(BPFProgram):
     self.clear()
     return tables
 
-  def _unmap_range_eh(self, cpu, unmap_range_struct, size):
-      event = self.bpf["unmap_range_output"].event(unmap_range_struct)
+  def _unmap_range_eh(self, cpu, event):
       self.unmap_range_stat.append(
         UnmapRangeStat(
           tgid=event.tgid,
@@ -65,5 +75,6 @@ class UnmapRangeBPFHook(BPFProgram):
           start=event.start,
           end=event.end,
           is_huge=False if event.huge == 0 else True,
+          sample_weight=event.sample_weight,
         )
       )
@@ -1,21 +1,23 @@
-from dataclasses import dataclass
 from pathlib import Path
 
 import polars as pl
 from bcc import BPF
-from data_collection.bpf_instrumentation.bpf_hook import POLL_TIMEOUT_MS, BPFProgram
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.bpf_instrumentation.columnar import EventColumns
+from data_collection.bpf_instrumentation.control import apply_control, expand_control
+from data_collection.bpf_instrumentation.features import feature_flags
+from data_collection.bpf_instrumentation.histogram import (
+  LatencyHistogram,
+  LatencyHistogramData,
+  expand_histograms,
+  histogram_frame,
+)
+from data_collection.bpf_instrumentation.transport import EventTransport
 from data_schema import CollectionTable
 from data_schema.generic_table import ZswapRuntimeDataTable
+from data_schema.latency_histogram import ZswapLatencyHistogramTable
 
 
-@dataclass(frozen=True)
-class ZswapRuntimeStat:
-  pid: int
-  tgid: int
-  start_ts: int
-  end_ts: int
-  name: str
-
 class ZswapRuntimeBPFHook(BPFProgram):
 
   @classmethod
@@ -24,75 +26,82 @@ class ZswapRuntimeBPFHook(BPFProgram):
 
   def __init__(self):
     self.bpf_text = open(Path(__file__).parent / "bpf/zswap_runtime.bpf.c", "r").read()
-    self.trace_process = list[ZswapRuntimeStat]()
+    self.zswap_columns = {
+      name: EventColumns()
+      for name in ("zswap_store", "zswap_load", "zswap_invalidate")
+    }
+    self.histogram: LatencyHistogram | None = None
+    self.histogram_data = list[LatencyHistogramData]()
 
   def load(self, collection_id: str):
     self.collection_id = collection_id
-    self.bpf = BPF(text = self.bpf_text)
+    self.events = EventTransport(self.options)
+    bpf_text = self.bpf_text.replace("AGGREGATE", "1" if self.options.aggregate else "0")
+    _, task_storage = feature_flags(False, self.options.task_storage)
+    bpf_text = bpf_text.replace("USE_TASK_STORAGE", "1" if task_storage else "0")
+    bpf_text = expand_histograms(expand_control(bpf_text, self.name()))
+    self.bpf = BPF(text = self.events.expand(bpf_text))
+    self.control = apply_control(self.bpf, self.name(), self.options)
     self.bpf.attach_kprobe(event=b"zswap_store", fn_name=b"trace_zswap_store_entry")
     self.bpf.attach_kretprobe(event=b"zswap_store", fn_name=b"trace_zswap_store_return")
     self.bpf.attach_kprobe(event=b"zswap_load", fn_name=b"trace_zswap_load_entry")
     self.bpf.attach_kretprobe(event=b"zswap_load", fn_name=b"trace_zswap_load_return")
     self.bpf.attach_kprobe(event=b"zswap_invalidate", fn_name=b"trace_zswap_invalidate_entry")
     self.bpf.attach_kretprobe(event=b"zswap_invalidate", fn_name=b"trace_zswap_invalidate_return")
-    self.bpf["zswap_store_events"].open_perf_buffer(self._zswap_store_eh, page_cnt=128)
-    self.bpf["zswap_load_events"].open_perf_buffer(self._zswap_load_eh, page_cnt=128)
-    self.bpf["zswap_invalidate_events"].open_perf_buffer(self._zswap_invalidate_eh, page_cnt=128)
+    if self.options.aggregate:
+      self.histogram = LatencyHistogram(self.bpf, "zswap_latency_hist", {0: "zswap_store", 1: "zswap_load", 2: "zswap_invalidate"})
+    else:
+      for name, columns in self.zswap_columns.items():
+        self.events.open_columns(self.bpf, f"{name}_events", columns, page_cnt=128)
 
   def poll(self):
-    self.bpf.perf_buffer_poll(timeout=POLL_TIMEOUT_MS)
+    if self.histogram is not None:
+      self.histogram_data.extend(self.histogram.drain())
+    else:
+      self.events.poll(self.bpf)
 
   def close(self):
     self.bpf.cleanup()
 
+  def lost_events(self) -> int:
+    return self.events.lost_events(self.bpf)
+
+  def poll_fds(self) -> list[int]:
+    return self.events.poll_fds(self.bpf)
+
   def data(self) -> list[CollectionTable]:
+    return self._tables(self.histogram_data, {
+      name: columns.frame() for name, columns in self.zswap_columns.items()
+    })
+
+  def _tables(self, histogram_data: list[LatencyHistogramData], events: dict[str, pl.DataFrame]) -> list[CollectionTable]:
+    if self.histogram is not None:
+      return [
+        ZswapLatencyHistogramTable.from_df_id(
+          histogram_frame(histogram_data),
+          collection_id=self.collection_id,
+        ),
+      ]
+    frames = [
+      frame.drop("cpu").with_columns(pl.lit(name).alias("name"))
+      for name, frame in events.items()
+      if len(frame) > 0
+    ]
     return [
             ZswapRuntimeDataTable.from_df_id(
-                pl.DataFrame(self.trace_process),
+                pl.concat(frames) if frames else pl.DataFrame(),
                 collection_id=self.collection_id,
             ),
         ]
 
   def clear(self):
-    self.trace_process.clear()
+    self.histogram_data.clear()
+    for columns in self.zswap_columns.values():
+      columns.clear()
 
   def pop_data(self) -> list[CollectionTable]:
-    tables = self.data()
-    self.clear()
-    return tables
-
-  def _zswap_store_eh(self, cpu, start_data, size):
-      event = self.bpf["zswap_store_events"].event(start_data)
-      self.trace_process.append(
-        ZswapRuntimeStat(
-          pid=event.pid,
-          tgid=event.tgid,
-          start_ts=event.start_ts,
-          end_ts=event.end_ts,
-          name="zswap_store"
-        )
-      )
-
-  def _zswap_load_eh(self, cpu, start_data, size):
-      event = self.bpf["zswap_load_events"].event(start_data)
-      self.trace_process.append(
-        ZswapRuntimeStat(
-          pid=event.pid,
-          tgid=event.tgid,
-          start_ts=event.start_ts,
-          end_ts=event.end_ts,
-          name="zswap_load"
-        )
-      )
-
-  def _zswap_invalidate_eh(self, cpu, start_data, size):
-      event = self.bpf["zswap_invalidate_events"].event(start_data)
-      self.trace_process.append(
-        ZswapRuntimeStat(
-          pid=event.pid,
-          tgid=event.tgid,
-          start_ts=event.start_ts,
-          end_ts=event.end_ts,
-          name="zswap_invalidate"
-        )
-      )
+    # poll() keeps appending on its own thread, take each buffer as it is reset
+    histogram_data, self.histogram_data = self.histogram_data, list[LatencyHistogramData]()
+    return self._tables(histogram_data, {
+      name: columns.pop() for name, columns in self.zswap_columns.items()
+    })
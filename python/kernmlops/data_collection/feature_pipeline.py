@@ -0,0 +1,231 @@
+"""Online features published into fstore.
+
+Every window the pipeline takes the raw events the hooks buffered since the
+previous window, see BPFProgram.recent_events, and derives:
+
+- feature_fault_rate: an EWMA of page faults per millisecond of each tgid, in
+  slot tgid % slots next to the tgid so a reader can tell the slot is its own
+- feature_system: block I/O queue depth p50/p90/p99 in 4k requests and the TCP
+  retransmit rate, segments retransmitted over segments in flight as CUBIC
+  callbacks saw them
+
+Values are signed Q16.16 from the start of the map value, the feature vector
+layout fstore_infer evaluates models over. Each map gets one LOAD_MAP per
+window, which also bumps its generation for fstore watchers.
+
+Staleness runs from an event's timestamp to when the load of its window
+returned, both on CLOCK_MONOTONIC like bpf_ktime_get_ns().
+"""
+
+import time
+from collections.abc import Sequence
+from threading import Event, Lock, Thread
+from typing import Any, Final
+
+import numpy as np
+import polars as pl
+from bcc import BPF
+from data_collection.bpf_instrumentation.bpf_hook import BPFProgram
+from data_collection.fstore import FStore
+from data_schema import UPTIME_TIMESTAMP, CollectionTable
+from data_schema.feature_staleness import FeatureStalenessTable
+
+Q16_ONE: Final[int] = 1 << 16
+
+FEATURE_MAPS: Final[str] = """
+struct feature_fault_rate {
+  s32 faults_per_ms;
+  u32 tgid;
+};
+
+struct feature_system {
+  s32 blk_queue_p50;
+  s32 blk_queue_p90;
+  s32 blk_queue_p99;
+  s32 tcp_retrans_rate;
+};
+
+BPF_ARRAY(feature_fault_rate, struct feature_fault_rate, TGID_SLOTS);
+BPF_ARRAY(feature_system, struct feature_system, 1);
+"""
+
+FAULT_RATE_DTYPE: Final[np.dtype] = np.dtype([("faults_per_ms", "<i4"), ("tgid", "<u4")])
+SYSTEM_DTYPE: Final[np.dtype] = np.dtype([
+  ("blk_queue_p50", "<i4"),
+  ("blk_queue_p90", "<i4"),
+  ("blk_queue_p99", "<i4"),
+  ("tcp_retrans_rate", "<i4"),
+])
+
+
+def q16(value: float) -> int:
+  return int(min(max(round(value * Q16_ONE), -(1 << 31)), (1 << 31) - 1))
+
+
+def _monotonic_us() -> int:
+  return time.clock_gettime_ns(time.CLOCK_MONOTONIC) // 1000
+
+
+class FeaturePipeline:
+  """Publishes windowed features of the hooks' live buffers every window_ms."""
+
+  def __init__(
+    self,
+    hooks: Sequence[BPFProgram],
+    collection_id: str,
+    window_ms: int,
+    half_life_ms: int,
+    tgid_slots: int,
+  ):
+    self.hooks = list(hooks)
+    self.collection_id = collection_id
+    self.window_s = max(window_ms, 1) / 1000
+    self.half_life_ms = max(half_life_ms, 1)
+    self.tgid_slots = max(tgid_slots, 1)
+    self.bpf = BPF(text=FEATURE_MAPS.replace("TGID_SLOTS", str(self.tgid_slots)))
+    self.fstore = FStore()
+    self.fault_rate_map = self.fstore.register(self.bpf["feature_fault_rate"].map_fd, "feature_fault_rate")
+    self.system_map = self.fstore.register(self.bpf["feature_system"].map_fd, "feature_system")
+    # faults per ms of every tgid still above Q16.16 resolution, and the tgid each slot holds
+    self.fault_rates = dict[int, float]()
+    self.slot_tgids = dict[int, int]()
+    self.rows = list[dict[str, Any]]()
+    self._rows_lock = Lock()
+    self._last_window_us = _monotonic_us()
+    self._thread: Thread | None = None
+    self._stop = Event()
+
+  def step(self):
+    events = dict[str, pl.DataFrame]()
+    for hook in self.hooks:
+      events.update(hook.recent_events())
+    now_us = _monotonic_us()
+    elapsed_ms = max(now_us - self._last_window_us, 1) / 1000
+    self._last_window_us = now_us
+
+    faults = events.get("page_fault_events")
+    keys, values = self._fault_rate_entries(faults, elapsed_ms)
+    self._publish("feature_fault_rate", self.fault_rate_map, keys, values, [faults], now_us)
+
+    queued = events.get("block_io_starts")
+    cubic = events.get("cubic_events")
+    keys, values = self._system_entries(queued, cubic)
+    self._publish("feature_system", self.system_map, keys, values, [queued, cubic], now_us)
+
+  def _fault_rate_entries(self, faults: pl.DataFrame | None, elapsed_ms: float) -> tuple[np.ndarray, np.ndarray]:
+    counts = dict[int, int]()
+    if faults is not None and len(faults) > 0:
+      per_tgid = faults.group_by("tgid").agg(pl.col("sample_weight").sum())
+      counts = dict(zip(per_tgid["tgid"].to_list(), per_tgid["sample_weight"].to_list()))
+    alpha = 1 - 0.5 ** (elapsed_ms / self.half_life_ms)
+    for tgid in set(self.fault_rates) | set(counts):
+      rate = alpha * counts.get(tgid, 0) / elapsed_ms + (1 - alpha) * self.fault_rates.get(tgid, 0.0)
+      if q16(rate) == 0 and tgid not in counts:
+        del self.fault_rates[tgid]
+      else:
+        self.fault_rates[tgid] = rate
+
+    # colliding tgids leave the slot to the one faulting most
+    slot_tgids = dict[int, int]()
+    for tgid, rate in self.fault_rates.items():
+      slot = tgid % self.tgid_slots
+      if slot not in slot_tgids or rate > self.fault_rates[slot_tgids[slot]]:
+        slot_tgids[slot] = tgid
+    # slots whose tgid went quiet are zeroed once
+    slots = sorted(set(slot_tgids) | set(self.slot_tgids))
+    self.slot_tgids = slot_tgids
+
+    values = np.zeros(len(slots), dtype=FAULT_RATE_DTYPE)
+    for i, slot in enumerate(slots):
+      tgid = slot_tgids.get(slot)
+      if tgid is not None:
+        values[i] = (q16(self.fault_rates[tgid]), tgid)
+    return np.array(slots, dtype=np.uint32), values
+
+  def _system_entries(self, queued: pl.DataFrame | None, cubic: pl.DataFrame | None) -> tuple[np.ndarray, np.ndarray]:
+    depths = [0.0, 0.0, 0.0]
+    if queued is not None and len(queued) > 0:
+      depths = np.percentile(queued["queue_length_4ks"].to_numpy(), [50, 90, 99]).tolist()
+    retrans_rate = 0.0
+    if cubic is not None and len(cubic) > 0:
+      packets_out = cubic["packets_out"].sum()
+      if packets_out > 0:
+        retrans_rate = cubic["retrans_out"].sum() / packets_out
+    values = np.zeros(1, dtype=SYSTEM_DTYPE)
+    values[0] = (*(q16(depth) for depth in depths), q16(retrans_rate))
+    return np.zeros(1, dtype=np.uint32), values
+
+  def _publish(
+    self,
+    feature_map: str,
+    map_name: int,
+    keys: np.ndarray,
+    values: np.ndarray,
+    sources: list[pl.DataFrame | None],
+    window_us: int,
+  ):
+    load_start_us = _monotonic_us()
+    entries = self.fstore.load(map_name, keys, values)
+    visible_us = _monotonic_us()
+
+    timestamps = [
+      source[UPTIME_TIMESTAMP]
+      for source in sources
+      if source is not None and len(source) > 0
+    ]
+    window_events = sum(len(ts) for ts in timestamps)
+    newest = max((ts.max() for ts in timestamps), default=None)
+    oldest = min((ts.min() for ts in timestamps), default=None)
+    with self._rows_lock:
+      self.rows.append({
+        UPTIME_TIMESTAMP: visible_us,
+        "feature_map": feature_map,
+        "window_events": window_events,
+        "entries": entries,
+        "compute_us": load_start_us - window_us,
+        "load_us": visible_us - load_start_us,
+        "newest_staleness_us": visible_us - newest if newest is not None else None,
+        "oldest_staleness_us": visible_us - oldest if oldest is not None else None,
+      })
+
+  def start(self):
+    self._thread = Thread(target=self._run, name="feature-pipeline", daemon=True)
+    self._thread.start()
+
+  def _run(self):
+    while not self._stop.wait(self.window_s):
+      try:
+        self.step()
+      except Exception as e:
+        print(f"error publishing features: {e}")
+
+  def close(self):
+    """Publishes the final window, then unregisters the feature maps."""
+    self._stop.set()
+    if self._thread is not None:
+      self._thread.join()
+      self._thread = None
+    try:
+      self.step()
+    except Exception as e:
+      print(f"error publishing features: {e}")
+    self.fstore.close()
+    self.bpf.cleanup()
+
+  def pop_data(self) -> list[CollectionTable]:
+    with self._rows_lock:
+      rows, self.rows = self.rows, list[dict[str, Any]]()
+    if len(rows) == 0:
+      return []
+    schema = FeatureStalenessTable.schema()
+    return [
+      FeatureStalenessTable.from_df_id(
+        pl.DataFrame(rows, schema={name: schema[name] for name in rows[0]}),
+        collection_id=self.collection_id,
+      )
+    ]
+
+
+__all__ = [
+  "FeaturePipeline",
+]
@@ -0,0 +1,119 @@
+"""User space side of the fstore module, see module/fstore/fstore.h.
+
+The ioctls take 64 bit map names, which fcntl.ioctl would truncate to a C
+int, so they go through libc directly.
+"""
+
+import ctypes as ct
+import os
+from typing import Final
+
+import numpy as np
+
+FSTORE_DEVICE: Final[str] = "/dev/fstore_device"
+
+# enum fstore_cmd
+UNREGISTER_MAP: Final[int] = 0x1
+REGISTER_MAP_NAMED: Final[int] = 0x2
+LOAD_MAP: Final[int] = 0x4
+
+FSTORE_NAME_LEN: Final[int] = 64
+FSTORE_NAME_HASHED: Final[int] = 1 << 63
+FSTORE_FNV_OFFSET: Final[int] = 0xcbf29ce484222325
+FSTORE_FNV_PRIME: Final[int] = 0x100000001b3
+
+_libc = ct.CDLL(None, use_errno=True)
+_libc.ioctl.argtypes = [ct.c_int, ct.c_ulong, ct.c_void_p]
+_libc.ioctl.restype = ct.c_int
+
+
+def fstore_name_hash(name: str) -> int:
+  """The u64 a map registered as name is looked up by, fstore_name_hash() in fstore.h."""
+  hash = FSTORE_FNV_OFFSET
+  for byte in name.encode():
+    hash ^= byte
+    hash = (hash * FSTORE_FNV_PRIME) & 0xffffffffffffffff
+  return hash | FSTORE_NAME_HASHED
+
+
+class _RegisterNamedInput(ct.Structure):
+  _fields_ = [
+    ("fd", ct.c_uint32),
+    ("name", ct.c_char * FSTORE_NAME_LEN),
+  ]
+
+
+class _BatchAttr(ct.Structure):
+  # the BPF_MAP_*_BATCH member of union bpf_attr
+  _fields_ = [
+    ("in_batch", ct.c_uint64),
+    ("out_batch", ct.c_uint64),
+    ("keys", ct.c_uint64),
+    ("values", ct.c_uint64),
+    ("count", ct.c_uint32),
+    ("map_fd", ct.c_uint32),
+    ("elem_flags", ct.c_uint64),
+    ("flags", ct.c_uint64),
+  ]
+
+
+class _LoadInput(ct.Structure):
+  # union bpf_attr grows with the kernel, the module copies its own size of it
+  _fields_ = [
+    ("map_name", ct.c_uint64),
+    ("batch", _BatchAttr),
+    ("_pad", ct.c_uint8 * 256),
+  ]
+
+
+class FStore:
+  """An open fstore device, the maps it registers are unregistered on close."""
+
+  def __init__(self, path: str = FSTORE_DEVICE):
+    self.fd = os.open(path, os.O_RDWR)
+    self.registered = list[int]()
+
+  def _ioctl(self, cmd: int, arg: int | None):
+    if _libc.ioctl(self.fd, cmd, arg) < 0:
+      errno = ct.get_errno()
+      raise OSError(errno, f"fstore ioctl {cmd:#x}: {os.strerror(errno)}")
+
+  def register(self, map_fd: int, name: str) -> int:
+    """Registers the map as name, returns the u64 it is looked up by."""
+    named = _RegisterNamedInput(fd=map_fd, name=name.encode())
+    self._ioctl(REGISTER_MAP_NAMED, ct.addressof(named))
+    map_name = fstore_name_hash(name)
+    self.registered.append(map_name)
+    return map_name
+
+  def unregister(self, map_name: int):
+    self._ioctl(UNREGISTER_MAP, map_name)
+    self.registered.remove(map_name)
+
+  def load(self, map_name: int, keys: np.ndarray, values: np.ndarray) -> int:
+    """Writes len(keys) entries in one LOAD_MAP, returns how many were written."""
+    keys = np.ascontiguousarray(keys)
+    values = np.ascontiguousarray(values)
+    assert len(keys) == len(values)
+    if len(keys) == 0:
+      return 0
+    load = _LoadInput(map_name=map_name)
+    load.batch.keys = keys.ctypes.data
+    load.batch.values = values.ctypes.data
+    load.batch.count = len(keys)
+    self._ioctl(LOAD_MAP, ct.addressof(load))
+    return load.batch.count
+
+  def close(self):
+    for map_name in list(self.registered):
+      try:
+        self.unregister(map_name)
+      except OSError:
+        pass
+    os.close(self.fd)
+
+
+__all__ = [
+  "fstore_name_hash",
+  "FStore",
+]
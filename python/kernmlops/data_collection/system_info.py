@@ -1,3 +1,4 @@
+import os
 import platform
 import subprocess
 import time
@@ -252,6 +253,40 @@ def machine_hardware_config() -> MachineHardwareConfiguration:
     )
 
 
+def parse_cpulist(cpulist: str) -> list[int]:
+    """CPUs of a sysfs cpulist such as "0-3,8-11"."""
+    cpus = list[int]()
+    for cpu_range in cpulist.strip().split(","):
+        if not cpu_range:
+            continue
+        first, _, last = cpu_range.partition("-")
+        cpus.extend(range(int(first), int(last or first) + 1))
+    return cpus
+
+
+def format_cpulist(cpus: list[int]) -> str:
+    ranges = list[list[int]]()
+    for cpu in sorted(set(cpus)):
+        if ranges and cpu == ranges[-1][1] + 1:
+            ranges[-1][1] = cpu
+        else:
+            ranges.append([cpu, cpu])
+    return ",".join(str(first) if first == last else f"{first}-{last}" for first, last in ranges)
+
+
+@lru_cache
+def numa_topology() -> Mapping[int, list[int]]:
+    """Online CPUs of every NUMA node, one node with every CPU without NUMA support."""
+    topology = dict[int, list[int]]()
+    for node_dir in sorted(Path("/sys/devices/system/node").glob("node[0-9]*")):
+        cpus = parse_cpulist((node_dir / "cpulist").read_text())
+        if cpus:
+            topology[int(node_dir.name.removeprefix("node"))] = cpus
+    if not topology:
+        topology[0] = list(range(os.cpu_count() or 1))
+    return topology
+
+
 def _convert_cache_size_to_bytes(raw_line: str) -> int:
     cache_size_data = raw_line.split(":", 1)[1].lstrip().rstrip().split()
     value = int(float(cache_size_data[0])) if cache_size_data else 0
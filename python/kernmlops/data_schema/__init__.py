@@ -6,9 +6,18 @@ from typing import Callable
 
 from data_schema import perf
 from data_schema.block_io import BlockIOLatencyTable, BlockIOQueueTable, BlockIOTable
+from data_schema.dataset import Dataset
+from data_schema.fault_region import FaultRegionTable
+from data_schema.feature_staleness import FeatureStalenessTable
 from data_schema.file_data import FileDataTable
 from data_schema.generic_table import ProcessMetadataTable
 from data_schema.huge_pages import CollapseHugePageDataTable
+from data_schema.latency_histogram import (
+    BlockIOLatencyHistogramTable,
+    QuantaLatencyHistogramTable,
+    TcpConnectLatencyHistogramTable,
+    ZswapLatencyHistogramTable,
+)
 from data_schema.memory_usage import MemoryUsageTable
 from data_schema.page_fault import PageFaultTable
 from data_schema.quanta_runtime import QuantaQueuedTable, QuantaRuntimeTable
@@ -22,8 +31,14 @@ from data_schema.schema import (
     collection_id_column,
     cumulative_pma_as_pdf,
 )
+from data_schema.task_comm import TaskCommTable
 from data_schema.tcp_congestion_control import TcpCongestionControlTable
 from data_schema.tcp_cubic import TcpCubicTable
+from data_schema.tcp_flow import (
+    TcpCubicFlowTable,
+    TcpStateProcessFlowTable,
+    TcpV4RcvFlowTable,
+)
 from data_schema.tcp_state_process import TcpStateProcessTable, TcpStateStatsTable
 from data_schema.tcp_v4_connect import TcpConnectStatsTable, TcpV4ConnectTable
 from data_schema.tcp_v4_rcv import TcpV4RcvTable
@@ -33,6 +48,7 @@ table_types: list[type[CollectionTable]] = [
     QuantaRuntimeTable,
     QuantaQueuedTable,
     ProcessMetadataTable,
+    TaskCommTable,
     FileDataTable,
     MemoryUsageTable,
     BlockIOLatencyTable,
@@ -40,6 +56,7 @@ table_types: list[type[CollectionTable]] = [
     BlockIOTable,
     CollapseHugePageDataTable,
     PageFaultTable,
+    FaultRegionTable,
     TcpV4RcvTable,
     TcpStateProcessTable,
     TcpStateStatsTable,
@@ -47,6 +64,15 @@ table_types: list[type[CollectionTable]] = [
     TcpConnectStatsTable,
     TcpCongestionControlTable,
     TcpCubicTable,
+    BlockIOLatencyHistogramTable,
+    ZswapLatencyHistogramTable,
+    QuantaLatencyHistogramTable,
+    TcpConnectLatencyHistogramTable,
+    TcpV4RcvFlowTable,
+    TcpStateProcessFlowTable,
+    TcpCubicFlowTable,
+    perf.PerfCountsTable,
+    FeatureStalenessTable,
 ] + list(perf.perf_table_types.values())
 
 
@@ -95,6 +121,7 @@ __all__ = [
     "CollectionTable",
     "CollectionData",
     "CollectionGraph",
+    "Dataset",
     "GraphEngine",
     "SystemInfoTable",
 ]
@@ -76,6 +76,8 @@ class BlockIOQueueTable(CollectionTable):
             "block_io_flags": pl.Int64(),
             "queue_length_segment_ios": pl.Int64(),
             "queue_length_4k_ios": pl.Int64(),
+            # requests this row stands for when the hook is sampled
+            "sample_weight": pl.Int64(),
             "collection_id": pl.String(),
         })
 
@@ -115,6 +117,7 @@ class BlockIOLatencyTable(CollectionTable):
             "block_latency_us": pl.Int64(),
             "block_io_latency_us": pl.Int64(),
             "block_io_flags": pl.Int64(),
+            "sample_weight": pl.Int64(),
             "collection_id": pl.String(),
         })
 
@@ -160,6 +163,8 @@ class BlockIOTable(CollectionTable):
             "block_io_flags_string": pl.String(),
             "queue_length_segment_ios": pl.Int64(),
             "queue_length_4k_ios": pl.Int64(),
+            # requests this row stands for when the hook is sampled
+            "sample_weight": pl.Int64(),
             "collection_id": pl.String(),
         })
 
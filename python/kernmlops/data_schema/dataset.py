@@ -0,0 +1,156 @@
+"""Hive partitioned collection output and lazy scans over it.
+
+The partitioned output sink writes the tables of a collection below its
+benchmark directory as
+
+  table=<table>/collection_id=<id>/time_bucket=<n>/part-<seq>.parquet
+
+where bucket n holds the rows with n * bucket_us <= ts_uptime_us <
+(n + 1) * bucket_us and tables without timestamps go to bucket -1. Rows in a
+file are sorted by tgid then timestamp, so row group statistics bound both.
+
+_manifest/<collection_id>.jsonl lists every file with its row count and
+min/max timestamp and tgid. Dataset prunes files with it before scanning and
+Polars pushes the same predicates down to the row groups of what is left.
+Page faults of tgid X during minute 30 of a collection:
+
+  dataset = Dataset("data/curated/<benchmark>")
+  start_us, end_us = dataset.time_range(collection_id, 30 * 60, 31 * 60)
+  dataset.scan(PageFaultTable, collection_id=collection_id,
+               start_us=start_us, end_us=end_us, tgids=[X]).collect()
+"""
+
+from pathlib import Path
+from typing import Final
+
+import polars as pl
+from data_schema.schema import UPTIME_TIMESTAMP, CollectionTable
+
+MANIFEST_DIR: Final[str] = "_manifest"
+NO_TIME_BUCKET: Final[int] = -1
+
+MANIFEST_SCHEMA: Final[pl.Schema] = pl.Schema({
+    "table": pl.String(),
+    "collection_id": pl.String(),
+    "time_bucket": pl.Int64(),
+    "path": pl.String(),
+    "rows": pl.Int64(),
+    "min_ts_uptime_us": pl.Int64(),
+    "max_ts_uptime_us": pl.Int64(),
+    "min_tgid": pl.Int64(),
+    "max_tgid": pl.Int64(),
+})
+
+
+def partition_dir(root: Path, table_name: str, collection_id: str, time_bucket: int) -> Path:
+    return root / f"table={table_name}" / f"collection_id={collection_id}" / f"time_bucket={time_bucket}"
+
+
+class Dataset:
+    """The partitioned output of every collection of one benchmark directory."""
+
+    def __init__(self, root: Path | str):
+        self.root = Path(root)
+
+    def manifest(self) -> pl.DataFrame:
+        """Every file written so far, paths relative to root."""
+        manifests = sorted((self.root / MANIFEST_DIR).glob("*.jsonl"))
+        if not manifests:
+            return pl.DataFrame(schema=MANIFEST_SCHEMA)
+        return pl.concat([
+            pl.read_ndjson(manifest, schema=MANIFEST_SCHEMA)
+            for manifest in manifests
+        ])
+
+    def collection_ids(self) -> list[str]:
+        return self.manifest()["collection_id"].unique().sort().to_list()
+
+    def time_range(self, collection_id: str, start_s: float, end_s: float) -> tuple[int, int]:
+        """Uptime range of seconds [start_s, end_s) since the first event of the collection."""
+        first_us = self.manifest().filter(
+            pl.col("collection_id") == collection_id
+        )["min_ts_uptime_us"].min()
+        if first_us is None:
+            raise ValueError(f"no timestamped rows for collection {collection_id}")
+        return (int(first_us + start_s * 1_000_000), int(first_us + end_s * 1_000_000))  # pyright: ignore [reportOperatorIssue]
+
+    def files(
+        self,
+        table_name: str,
+        *,
+        collection_id: str | None = None,
+        start_us: int | None = None,
+        end_us: int | None = None,
+        tgids: list[int] | None = None,
+    ) -> list[Path]:
+        """Files that may hold rows of table_name within [start_us, end_us) of one of tgids."""
+        manifest = self.manifest().filter(pl.col("table") == table_name)
+        if collection_id is not None:
+            manifest = manifest.filter(pl.col("collection_id") == collection_id)
+        # files without the column hold no rows a predicate on it could match
+        if start_us is not None:
+            manifest = manifest.filter(pl.col("max_ts_uptime_us") >= start_us)
+        if end_us is not None:
+            manifest = manifest.filter(pl.col("min_ts_uptime_us") < end_us)
+        if tgids is not None and not tgids:
+            return []
+        if tgids is not None:
+            manifest = manifest.filter(pl.any_horizontal(
+                pl.lit(tgid).is_between(pl.col("min_tgid"), pl.col("max_tgid"))
+                for tgid in tgids
+            ))
+        return [self.root / path for path in manifest["path"].to_list()]
+
+    def scan(
+        self,
+        table_type: type[CollectionTable],
+        *,
+        collection_id: str | None = None,
+        start_us: int | None = None,
+        end_us: int | None = None,
+        tgids: list[int] | None = None,
+    ) -> pl.LazyFrame:
+        """Lazy rows of table_type matching every predicate given."""
+        files = self.files(
+            table_type.name(),
+            collection_id=collection_id,
+            start_us=start_us,
+            end_us=end_us,
+            tgids=tgids,
+        )
+        if not files:
+            return pl.LazyFrame(schema=table_type.schema())
+        scan = pl.scan_parquet(files, hive_partitioning=False)
+        if start_us is not None:
+            scan = scan.filter(pl.col(UPTIME_TIMESTAMP) >= start_us)
+        if end_us is not None:
+            scan = scan.filter(pl.col(UPTIME_TIMESTAMP) < end_us)
+        if tgids is not None:
+            scan = scan.filter(pl.col("tgid").is_in(tgids))
+        return scan
+
+    def load(
+        self,
+        table_type: type[CollectionTable],
+        *,
+        collection_id: str | None = None,
+        start_us: int | None = None,
+        end_us: int | None = None,
+        tgids: list[int] | None = None,
+    ) -> CollectionTable:
+        return table_type.from_df(self.scan(
+            table_type,
+            collection_id=collection_id,
+            start_us=start_us,
+            end_us=end_us,
+            tgids=tgids,
+        ).collect())
+
+
+__all__ = [
+    "Dataset",
+    "MANIFEST_DIR",
+    "MANIFEST_SCHEMA",
+    "NO_TIME_BUCKET",
+    "partition_dir",
+]
@@ -0,0 +1,71 @@
+import polars as pl
+from data_schema.schema import (
+    UPTIME_TIMESTAMP,
+    CollectionGraph,
+    CollectionTable,
+)
+
+# address >> FAULT_REGION_SHIFT is a region, one 2MB huge page
+FAULT_REGION_SHIFT = 21
+
+
+class FaultRegionTable(CollectionTable):
+    """Faults per tgid and 2MB region drained from the page fault hook, see bpf_instrumentation/heatmap.py.
+
+    A row holds the faults a region gained since its previous row. access
+    has bit 0 set once the region was read, bit 1 written and bit 2 executed,
+    first_ts_us and last_ts_us are its first and latest fault.
+    """
+
+    @classmethod
+    def name(cls) -> str:
+        return "fault_region"
+
+    @classmethod
+    def schema(cls) -> pl.Schema:
+        return pl.Schema({
+            UPTIME_TIMESTAMP: pl.Int64(),
+            "tgid": pl.Int64(),
+            "region": pl.Int64(),
+            "faults": pl.Int64(),
+            "major_faults": pl.Int64(),
+            "write_faults": pl.Int64(),
+            "exec_faults": pl.Int64(),
+            "access": pl.Int64(),
+            "first_ts_us": pl.Int64(),
+            "last_ts_us": pl.Int64(),
+            "collection_id": pl.String(),
+        })
+
+    @classmethod
+    def from_df(cls, table: pl.DataFrame) -> "FaultRegionTable":
+        return FaultRegionTable(table=table.cast(cls.schema(), strict=True))  # pyright: ignore [reportArgumentType]
+
+    def __init__(self, table: pl.DataFrame):
+        self._table = table
+
+    @property
+    def table(self) -> pl.DataFrame:
+        return self._table
+
+    def filtered_table(self) -> pl.DataFrame:
+        return self.table
+
+    def graphs(self) -> list[type[CollectionGraph]]:
+        return []
+
+    def heat(self) -> pl.DataFrame:
+        """Lifetime totals of every region, hottest first."""
+        return self.table.group_by("tgid", "region").agg(
+            pl.col("faults", "major_faults", "write_faults", "exec_faults").sum(),
+            pl.col("access").max(),
+            pl.col("first_ts_us").min(),
+            pl.col("last_ts_us").max(),
+        ).sort("faults", descending=True)
+
+    def with_heat(self, events: pl.DataFrame, address_column: str = "address") -> pl.DataFrame:
+        """events, e.g. madvise or collapse decisions, with the heat of the tgid and region they address."""
+        return events.with_columns(
+            (pl.col(address_column).cast(pl.Int64()) // (1 << FAULT_REGION_SHIFT)).alias("region"),
+            pl.col("tgid").cast(pl.Int64()),
+        ).join(self.heat(), on=["tgid", "region"], how="left")
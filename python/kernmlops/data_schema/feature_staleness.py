@@ -0,0 +1,59 @@
+import polars as pl
+from data_schema.schema import (
+    UPTIME_TIMESTAMP,
+    CollectionGraph,
+    CollectionTable,
+)
+
+
+class FeatureStalenessTable(CollectionTable):
+    """One row per fstore map the feature pipeline published a window into.
+
+    Staleness runs from an event's timestamp to when the load of its window
+    returned, the newest and oldest events of the window bound it. Windows
+    without events have null staleness.
+    """
+
+    @classmethod
+    def name(cls) -> str:
+        return "feature_staleness"
+
+    @classmethod
+    def schema(cls) -> pl.Schema:
+        return pl.Schema({
+            UPTIME_TIMESTAMP: pl.Int64(),
+            "feature_map": pl.String(),
+            "window_events": pl.Int64(),
+            "entries": pl.Int64(),
+            "compute_us": pl.Int64(),
+            "load_us": pl.Int64(),
+            "newest_staleness_us": pl.Int64(),
+            "oldest_staleness_us": pl.Int64(),
+            "collection_id": pl.String(),
+        })
+
+    @classmethod
+    def from_df(cls, table: pl.DataFrame) -> "FeatureStalenessTable":
+        return FeatureStalenessTable(table=table.cast(cls.schema(), strict=True))  # pyright: ignore [reportArgumentType]
+
+    def __init__(self, table: pl.DataFrame):
+        self._table = table
+
+    @property
+    def table(self) -> pl.DataFrame:
+        return self._table
+
+    def filtered_table(self) -> pl.DataFrame:
+        return self.table
+
+    def graphs(self) -> list[type[CollectionGraph]]:
+        return []
+
+    def summary(self) -> pl.DataFrame:
+        """Staleness percentiles per feature map over the windows that had events."""
+        return self.table.drop_nulls("newest_staleness_us").group_by("feature_map").agg(
+            pl.len().alias("windows"),
+            pl.col("newest_staleness_us").quantile(0.5).alias("p50_staleness_us"),
+            pl.col("newest_staleness_us").quantile(0.99).alias("p99_staleness_us"),
+            pl.col("oldest_staleness_us").max().alias("max_staleness_us"),
+        ).sort("feature_map")
@@ -22,6 +22,8 @@ class FileDataTable(CollectionTable):
             "file_inode": pl.Int64(),
             "file_size_bytes": pl.Int64(),
             "file_name": pl.String(),
+            # opens this row stands for when the hook is sampled
+            "sample_weight": pl.Int64(),
             "collection_id": pl.String(),
         })
 
@@ -40,6 +40,7 @@ class CollapseHugePageDataTable(CollectionTable):
             "start_ts_ns",
             "end_ts_ns",
             "mm",
+            "sample_weight",
             "collection_id",
         ])
         return cls.from_df(pl.concat([collapse_df, trace_mm_df], how="horizontal"))
@@ -0,0 +1,94 @@
+import polars as pl
+from data_schema.schema import (
+    UPTIME_TIMESTAMP,
+    CollectionGraph,
+    CollectionTable,
+)
+
+
+class LatencyHistogramTable(CollectionTable):
+    """Log2 latency buckets drained from a hook running in aggregate mode.
+
+    Each row is the count added to one bucket since the previous drain, bucket b
+    holds latencies in [2^(b-1), 2^b - 1] us and bucket 0 holds zeros.
+    """
+
+    @classmethod
+    def name(cls) -> str:
+        return "latency_histogram"
+
+    @classmethod
+    def schema(cls) -> pl.Schema:
+        return pl.Schema({
+            UPTIME_TIMESTAMP: pl.Int64(),
+            "tgid": pl.Int64(),
+            "key_id": pl.Int64(),
+            "latency_kind": pl.String(),
+            "bucket": pl.Int64(),
+            "count": pl.Int64(),
+            "collection_id": pl.String(),
+        })
+
+    @classmethod
+    def from_df(cls, table: pl.DataFrame) -> "LatencyHistogramTable":
+        return cls(table=table.cast(cls.schema(), strict=True))  # pyright: ignore [reportArgumentType]
+
+    def __init__(self, table: pl.DataFrame):
+        self._table = table
+
+    @property
+    def table(self) -> pl.DataFrame:
+        return self._table
+
+    def filtered_table(self) -> pl.DataFrame:
+        return self.table
+
+    def graphs(self) -> list[type[CollectionGraph]]:
+        return []
+
+    def with_bucket_bounds(self) -> pl.DataFrame:
+        """Adds the inclusive latency range in us covered by each bucket."""
+        return self.table.with_columns([
+            pl.when(pl.col("bucket") == 0).then(0).otherwise(
+                pl.lit(1, dtype=pl.Int64()).bitwise_left_shift(pl.col("bucket") - 1)
+            ).alias("bucket_low_us"),
+            pl.when(pl.col("bucket") == 0).then(0).otherwise(
+                pl.lit(1, dtype=pl.Int64()).bitwise_left_shift(pl.col("bucket")) - 1
+            ).alias("bucket_high_us"),
+        ])
+
+    def totals(self) -> pl.DataFrame:
+        """Collapses the drains into one histogram per tgid, key and kind."""
+        return self.table.group_by(
+            ["tgid", "key_id", "latency_kind", "bucket"]
+        ).agg(
+            pl.sum("count")
+        ).sort(["tgid", "key_id", "latency_kind", "bucket"])
+
+
+class BlockIOLatencyHistogramTable(LatencyHistogramTable):
+
+    @classmethod
+    def name(cls) -> str:
+        return "block_io_latency_histogram"
+
+
+class ZswapLatencyHistogramTable(LatencyHistogramTable):
+
+    @classmethod
+    def name(cls) -> str:
+        return "zswap_latency_histogram"
+
+
+class QuantaLatencyHistogramTable(LatencyHistogramTable):
+
+    @classmethod
+    def name(cls) -> str:
+        return "quanta_latency_histogram"
+
+
+class TcpConnectLatencyHistogramTable(LatencyHistogramTable):
+
+    @classmethod
+    def name(cls) -> str:
+        return "tcp_v4_connect_latency_histogram"
@@ -25,6 +25,8 @@ class PageFaultTable(CollectionTable):
             "is_write": pl.Boolean(),
             "is_exec": pl.Boolean(),
             "comm": pl.Utf8(),
+            # faults this row stands for when the hook is sampled
+            "sample_weight": pl.Int64(),
         })
 
     @classmethod
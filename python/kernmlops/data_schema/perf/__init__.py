@@ -1,5 +1,6 @@
 from typing import Mapping
 
+from data_schema.perf.perf_counts import PerfCountsTable
 from data_schema.perf.perf_schema import (
     CustomHWEventID,
     PerfCollectionTable,
@@ -21,5 +22,6 @@ perf_table_types: Mapping[str, type[PerfCollectionTable]] = {
 __all__ = [
   "perf_table_types",
   "CustomHWEventID",
+  "PerfCountsTable",
   "PerfCollectionTable",
 ]
@@ -0,0 +1,69 @@
+import polars as pl
+from data_schema.schema import (
+  UPTIME_TIMESTAMP,
+  CollectionGraph,
+  CollectionTable,
+)
+
+# Counted in every counting mode collection, the perf tables' events come after
+BASE_COUNTER_NAMES = ["cycles", "instructions"]
+
+
+class PerfCountsTable(CollectionTable):
+    """PMU counts drained from the perf hook running in counting mode.
+
+    Each row is what one tgid and cgroup (tgid 0 when counted by cgroup) gained
+    since the previous drain, on_cpu_ns the time it was scheduled in. One column
+    per counter, null when that counter could not be opened.
+    """
+
+    @classmethod
+    def name(cls) -> str:
+        return "perf_counts"
+
+    @classmethod
+    def counter_names(cls) -> list[str]:
+        from data_schema.perf import perf_table_types
+        return BASE_COUNTER_NAMES + list(perf_table_types.keys())
+
+    @classmethod
+    def schema(cls) -> pl.Schema:
+        return pl.Schema({
+            UPTIME_TIMESTAMP: pl.Int64(),
+            "tgid": pl.Int64(),
+            "cgroup_id": pl.Int64(),
+            "on_cpu_ns": pl.Int64(),
+            **{name: pl.Int64() for name in cls.counter_names()},
+            "collection_id": pl.String(),
+        })
+
+    @classmethod
+    def from_df(cls, table: pl.DataFrame) -> "PerfCountsTable":
+        return cls(table=table.cast(cls.schema(), strict=True))  # pyright: ignore [reportArgumentType]
+
+    def __init__(self, table: pl.DataFrame):
+        self._table = table
+
+    @property
+    def table(self) -> pl.DataFrame:
+        return self._table
+
+    def filtered_table(self) -> pl.DataFrame:
+        return self.table
+
+    def graphs(self) -> list[type[CollectionGraph]]:
+        return []
+
+    def rates(self, by: str = "tgid") -> pl.DataFrame:
+        """Totals per tgid or cgroup_id with IPC and every other counter per thousand instructions."""
+        others = [name for name in self.counter_names() if name not in BASE_COUNTER_NAMES]
+        totals = self.table.group_by(by).agg(
+            pl.col("on_cpu_ns", *self.counter_names()).sum()
+        )
+        return totals.with_columns(
+            (pl.col("instructions") / pl.col("cycles")).alias("ipc"),
+            *(
+                (pl.col(name) * 1000 / pl.col("instructions")).alias(f"{name}_per_kinst")
+                for name in others
+            ),
+        ).sort("on_cpu_ns", descending=True)
@@ -25,6 +25,8 @@ class QuantaRuntimeTable(CollectionTable):
             "tgid": pl.Int64(),
             UPTIME_TIMESTAMP: pl.Int64(),
             "quanta_run_length_us": pl.Int64(),
+            # quanta this row stands for when the hook is sampled
+            "sample_weight": pl.Int64(),
             "collection_id": pl.String(),
         })
 
@@ -98,6 +100,7 @@ class QuantaQueuedTable(CollectionTable):
             "tgid": pl.Int64(),
             UPTIME_TIMESTAMP: pl.Int64(),
             "quanta_queued_time_us": pl.Int64(),
+            "sample_weight": pl.Int64(),
             "collection_id": pl.String(),
         })
 
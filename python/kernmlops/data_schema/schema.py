@@ -138,11 +138,30 @@ class SystemInfoTable(CollectionTable):
             "cores"
         ][0]
 
+    @property
+    def numa_node_cpus(self) -> list[str]:
+        """cpulist of every NUMA node, empty for collections recorded before topology was."""
+        if "numa_node_cpus" not in self.table.columns:
+            return []
+        return self.table[
+            "numa_node_cpus"
+        ][0].to_list()
+
+    @property
+    def collector_cpus(self) -> str:
+        """cpulist reserved for the collector, empty when it was not pinned."""
+        if "collector_cpus" not in self.table.columns:
+            return ""
+        return self.table[
+            "collector_cpus"
+        ][0]
+
 
 class CollectionData:
 
     def __init__(self, collection_tables: Mapping[str, CollectionTable]):
         self._tables = collection_tables
+        self._named_tables = dict[str, CollectionTable]()
         system_info = self.get(SystemInfoTable)
         # TODO(Patrick): Add proper error handling
         assert isinstance(system_info, SystemInfoTable)
@@ -151,7 +170,26 @@ class CollectionData:
 
     @property
     def tables(self) -> Mapping[str, CollectionTable]:
-        return self._tables
+        return {
+            name: self._named(name, table)
+            for name, table in self._tables.items()
+        }
+
+    def _named(self, name: str, table: CollectionTable) -> CollectionTable:
+        """Tables collected with interned comms get theirs joined back on first use."""
+        from data_schema.task_comm import TaskCommTable
+
+        if name in self._named_tables:
+            return self._named_tables[name]
+        comms = self._tables.get(TaskCommTable.name(), None)
+        if (
+            isinstance(comms, TaskCommTable)
+            and "comm" in type(table).schema()
+            and "comm" not in table.table.columns
+        ):
+            table = type(table).from_df(comms.name_events(table.table))
+        self._named_tables[name] = table
+        return table
 
     @property
     def system_info(self) -> SystemInfoTable:
@@ -182,9 +220,9 @@ class CollectionData:
         return self.system_info.cpus
 
     def get[T: CollectionTable](self, table_type: type[T]) -> T | None:
-        table = self.tables.get(table_type.name(), None)
+        table = self._tables.get(table_type.name(), None)
         if table:
-            return cast(T, table)
+            return cast(T, self._named(table_type.name(), table))
         return None
 
     def graph(self, out_dir: Path | None = None, *, use_matplot: bool = False, no_trends: bool = False) -> None:
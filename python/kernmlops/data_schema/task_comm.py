@@ -0,0 +1,72 @@
+import polars as pl
+from data_schema.schema import (
+    UPTIME_TIMESTAMP,
+    CollectionGraph,
+    CollectionTable,
+)
+
+
+class TaskCommTable(CollectionTable):
+    """Names of the tasks seen by hooks that intern comms, see bpf_instrumentation/comm.py.
+
+    A task has a row from its first event on and a new one after every rename,
+    so the name of an event is that of the latest row of its pid before it.
+    """
+
+    @classmethod
+    def name(cls) -> str:
+        return "task_comm"
+
+    @classmethod
+    def schema(cls) -> pl.Schema:
+        return pl.Schema({
+            UPTIME_TIMESTAMP: pl.Int64(),
+            "pid": pl.Int64(),
+            "tgid": pl.Int64(),
+            "comm": pl.String(),
+            "collection_id": pl.String(),
+        })
+
+    @classmethod
+    def from_df(cls, table: pl.DataFrame) -> "TaskCommTable":
+        return TaskCommTable(table=table)
+
+    def __init__(self, table: pl.DataFrame):
+        self._table = table
+
+    @property
+    def table(self) -> pl.DataFrame:
+        return self._table
+
+    def filtered_table(self) -> pl.DataFrame:
+        return self.table
+
+    def graphs(self) -> list[type[CollectionGraph]]:
+        return []
+
+    def name_events(self, events: pl.DataFrame) -> pl.DataFrame:
+        """events with the comm of their pid at their timestamp, in timestamp order."""
+        comms = self.table.select(
+            UPTIME_TIMESTAMP,
+            pl.col("pid").cast(pl.Int64()),
+            "comm",
+        ).unique().sort(UPTIME_TIMESTAMP)
+        events = events.with_columns(
+            pl.col("pid").cast(pl.Int64()).alias("_comm_pid"),
+        ).sort(UPTIME_TIMESTAMP)
+        named = events.join_asof(
+            comms.rename({"pid": "_comm_pid"}),
+            on=UPTIME_TIMESTAMP,
+            by="_comm_pid",
+            strategy="backward",
+        )
+        # A task is named when its event is emitted, which can be after the event's timestamp
+        first = events.join_asof(
+            comms.rename({"pid": "_comm_pid", "comm": "_comm_next"}),
+            on=UPTIME_TIMESTAMP,
+            by="_comm_pid",
+            strategy="forward",
+        )
+        return named.with_columns(
+            pl.col("comm").fill_null(first["_comm_next"]),
+        ).drop("_comm_pid")
@@ -27,6 +27,8 @@ class TcpCongestionControlTable(CollectionTable):
             "sport": pl.Int32(),
             "dport": pl.Int32(),
             "comm": pl.Utf8(),
+            # events this row stands for when the hook is sampled
+            "sample_weight": pl.Int64(),
         })
 
     @classmethod
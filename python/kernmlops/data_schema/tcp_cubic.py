@@ -58,6 +58,8 @@ class TcpCubicTable(CollectionTable):
             "acked": pl.Int32(),
             "in_slow_start": pl.Int8(),
             "is_tcp_friendly": pl.Int8(),
+            # callbacks this row stands for when the hook is sampled
+            "sample_weight": pl.Int64(),
         })
 
     @classmethod
@@ -0,0 +1,111 @@
+import polars as pl
+from data_schema.schema import (
+    UPTIME_TIMESTAMP,
+    CollectionGraph,
+    CollectionTable,
+)
+
+
+class TcpFlowTable(CollectionTable):
+    """Per-connection counters drained from a TCP hook running in aggregate mode.
+
+    Each row holds what one flow gained since its previous row: branch_counts[i]
+    counts the hook's branch or event type i and drop_counts[i] the i-th drop
+    reason of TCP_FLOW_DROP_REASONS. cwnd and RTT sums and sample counts are
+    per row too, their min, max and last values cover the flow so far. `closed`
+    marks the final row of a flow that reached TCP_CLOSE.
+    """
+
+    @classmethod
+    def name(cls) -> str:
+        return "tcp_flow"
+
+    @classmethod
+    def schema(cls) -> pl.Schema:
+        return pl.Schema({
+            UPTIME_TIMESTAMP: pl.Int64(),
+            "laddr": pl.String(),
+            "raddr": pl.String(),
+            "lport": pl.Int32(),
+            "rport": pl.Int32(),
+            "closed": pl.Boolean(),
+            "first_ts_us": pl.Int64(),
+            "last_ts_us": pl.Int64(),
+            "branch_counts": pl.List(pl.Int64()),
+            "drop_counts": pl.List(pl.Int64()),
+            "cwnd_min": pl.Int64(),
+            "cwnd_max": pl.Int64(),
+            "cwnd_last": pl.Int64(),
+            "cwnd_sum": pl.Int64(),
+            "cwnd_samples": pl.Int64(),
+            "srtt_min_us": pl.Int64(),
+            "srtt_max_us": pl.Int64(),
+            "srtt_last_us": pl.Int64(),
+            "srtt_sum_us": pl.Int64(),
+            "rtt_samples": pl.Int64(),
+            "collection_id": pl.String(),
+        })
+
+    @classmethod
+    def from_df(cls, table: pl.DataFrame) -> "TcpFlowTable":
+        return cls(table=table.cast(cls.schema(), strict=True))  # pyright: ignore [reportArgumentType]
+
+    def __init__(self, table: pl.DataFrame):
+        self._table = table
+
+    @property
+    def table(self) -> pl.DataFrame:
+        return self._table
+
+    def filtered_table(self) -> pl.DataFrame:
+        return self.table
+
+    def graphs(self) -> list[type[CollectionGraph]]:
+        return []
+
+    def totals(self) -> pl.DataFrame:
+        """Collapses the drains into one row per flow with its mean cwnd and smoothed RTT."""
+        flow = ["laddr", "raddr", "lport", "rport"]
+        return self.table.group_by(flow).agg([
+            pl.min("first_ts_us"),
+            pl.max("last_ts_us"),
+            pl.col("closed").any(),
+            pl.col("branch_counts").list.sum().sum().alias("events"),
+            pl.col("drop_counts").list.sum().sum().alias("drops"),
+            pl.min("cwnd_min"),
+            pl.max("cwnd_max"),
+            (pl.sum("cwnd_sum") / pl.sum("cwnd_samples")).alias("cwnd_mean"),
+            pl.min("srtt_min_us"),
+            pl.max("srtt_max_us"),
+            (pl.sum("srtt_sum_us") / pl.sum("rtt_samples")).alias("srtt_mean_us"),
+        ]).sort(flow)
+
+    def branch_totals(self) -> pl.DataFrame:
+        """Sums each branch over every flow, `branch` indexes branch_counts."""
+        return self.table.select([
+            pl.int_ranges(0, pl.col("branch_counts").list.len()).alias("branch"),
+            pl.col("branch_counts").alias("count"),
+        ]).explode(["branch", "count"]).group_by("branch").agg(
+            pl.sum("count")
+        ).sort("branch")
+
+
+class TcpV4RcvFlowTable(TcpFlowTable):
+
+    @classmethod
+    def name(cls) -> str:
+        return "tcp_v4_rcv_flow"
+
+
+class TcpStateProcessFlowTable(TcpFlowTable):
+
+    @classmethod
+    def name(cls) -> str:
+        return "tcp_state_process_flow"
+
+
+class TcpCubicFlowTable(TcpFlowTable):
+
+    @classmethod
+    def name(cls) -> str:
+        return "tcp_cubic_flow"
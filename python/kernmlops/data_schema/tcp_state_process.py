@@ -29,6 +29,8 @@ class TcpStateProcessTable(CollectionTable):
             "event_subtype": pl.Int8(),
             "event_subtype_name": pl.Utf8(),
             "comm": pl.Utf8(),
+            # segments this row stands for when the hook is sampled
+            "sample_weight": pl.Int64(),
         })
 
     @classmethod
@@ -34,6 +34,8 @@ class TcpV4ConnectTable(CollectionTable):
             "sport": pl.Int32(),
             "dport": pl.Int32(),
             "comm": pl.Utf8(),
+            # connects this row stands for when the hook is sampled
+            "sample_weight": pl.Int64(),
         })
 
     @classmethod
@@ -28,6 +28,8 @@ class TcpV4RcvTable(CollectionTable):
             "sport": pl.Int32(),
             "dport": pl.Int32(),
             "comm": pl.Utf8(),
+            # 1 unless packets are sampled, then the packets this row represents
+            "sample_weight": pl.Int64(),
         })
 
     @classmethod